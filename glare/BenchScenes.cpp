@@ -0,0 +1,203 @@
+#include "BenchScenes.h"
+#include "Philox.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+// light sources of the scenes
+#define BENCH_POINT_LIGHTS 32
+#define BENCH_AREA_LIGHTS 8
+#define BENCH_NOISE_LIGHTS 8
+#define BENCH_NOISE_OCTAVES 4
+
+static const char* sceneNames[BENCH_SCENES] = { "points", "area", "noise" };
+
+const char* benchSceneName(int scene)
+{
+    return scene >= 0 && scene < BENCH_SCENES ? sceneNames[scene] : "";
+}
+
+bool benchSceneFromName(const std::string& name, BenchScene& scene)
+{
+    for (int i = 0; i < BENCH_SCENES; ++i)
+        if (name == sceneNames[i])
+        {
+            scene = (BenchScene)i;
+            return true;
+        }
+    return false;
+}
+
+// Four uniform numbers in [0, 1) for draw index of the scene
+static void sceneRandom(unsigned int seed, BenchScene scene, uint32_t index, float out[4])
+{
+    uint32_t counter[4] = { index, (uint32_t)scene, BENCH_SCENE_STREAM, 0 };
+    uint32_t key[2] = { seed, 0 };
+    uint32_t bits[4];
+    philox4x32(counter, key, bits);
+    for (int i = 0; i < 4; ++i)
+        out[i] = philoxToFloat(bits[i]);
+}
+
+// Luminance of a light, log uniform between min and max
+static float logUniform(float u, float min, float max)
+{
+    return min * std::pow(max / min, u);
+}
+
+// A small Gaussian spot, most of its energy inside a pixel or two
+static void addPoint(float* const* planes, int width, int height, float x, float y,
+                     float luminance, const float tint[3])
+{
+    const float sigma = 0.7f;
+    int x0 = std::max(0, (int)x - 2), x1 = std::min(width - 1, (int)x + 2);
+    int y0 = std::max(0, (int)y - 2), y1 = std::min(height - 1, (int)y + 2);
+    for (int py = y0; py <= y1; ++py)
+        for (int px = x0; px <= x1; ++px)
+        {
+            float dx = px + 0.5f - x, dy = py + 0.5f - y;
+            float weight = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+            for (int c = 0; c < 3; ++c)
+                planes[c][(size_t)py * width + px] += luminance * tint[c] * weight;
+        }
+}
+
+// Warm to cool white, like lamps of different kinds
+static void lightTint(float u, float tint[3])
+{
+    tint[0] = 1.0f + 0.2f * (u - 0.5f);
+    tint[1] = 1.0f;
+    tint[2] = 1.0f - 0.3f * (u - 0.5f);
+}
+
+// Bilinear lattice noise summed over octaves in [0, 1), the lattices are
+// drawn once so the image costs a few lookups per pixel
+static void noiseBackground(float* const* planes, int width, int height, unsigned int seed)
+{
+    struct Lattice
+    {
+        int cells;
+        std::vector<float> values;
+    };
+    std::vector<Lattice> octaves(BENCH_NOISE_OCTAVES);
+    uint32_t index = 1u << 20;
+    for (int o = 0; o < BENCH_NOISE_OCTAVES; ++o)
+    {
+        Lattice& lattice = octaves[o];
+        lattice.cells = 8 << o;
+        lattice.values.resize((size_t)(lattice.cells + 1) * (lattice.cells + 1));
+        for (size_t i = 0; i < lattice.values.size(); i += 4)
+        {
+            float u[4];
+            sceneRandom(seed, BENCH_SCENE_NOISE, index++, u);
+            for (size_t k = 0; k < 4 && i + k < lattice.values.size(); ++k)
+                lattice.values[i + k] = u[k];
+        }
+    }
+
+    const int side = std::max(width, height);
+    ThreadPool::global().parallelFor(0, height, 16, [&](size_t y0, size_t y1) {
+        for (size_t py = y0; py < y1; ++py)
+            for (int px = 0; px < width; ++px)
+            {
+                float sum = 0.0f, amplitude = 0.5f, norm = 0.0f;
+                for (const Lattice& lattice : octaves)
+                {
+                    float fx = (px + 0.5f) / side * lattice.cells;
+                    float fy = (py + 0.5f) / side * lattice.cells;
+                    int ix = std::min((int)fx, lattice.cells - 1), iy = std::min((int)fy, lattice.cells - 1);
+                    float tx = fx - ix, ty = fy - iy;
+                    const float* row0 = lattice.values.data() + (size_t)iy * (lattice.cells + 1);
+                    const float* row1 = row0 + lattice.cells + 1;
+                    float top = row0[ix] + (row0[ix + 1] - row0[ix]) * tx;
+                    float bottom = row1[ix] + (row1[ix + 1] - row1[ix]) * tx;
+                    sum += amplitude * (top + (bottom - top) * ty);
+                    norm += amplitude;
+                    amplitude *= 0.5f;
+                }
+
+                // log-normal around 0.2 cd/m^2, a little warmer in the brights
+                float n = sum / norm;
+                float luminance = 0.2f * std::exp(4.0f * (n - 0.5f));
+                size_t i = py * width + px;
+                planes[0][i] = luminance * (0.9f + 0.2f * n);
+                planes[1][i] = luminance;
+                planes[2][i] = luminance * (1.1f - 0.2f * n);
+            }
+    });
+}
+
+void makeBenchScene(BenchScene scene, int width, int height, unsigned int seed,
+                    std::vector<float>& red, std::vector<float>& green, std::vector<float>& blue)
+{
+    size_t pixels = (size_t)width * height;
+    red.assign(pixels, 0.0f);
+    green.assign(pixels, 0.0f);
+    blue.assign(pixels, 0.0f);
+    float* rgb[3] = { red.data(), green.data(), blue.data() };
+
+    const float side = (float)std::min(width, height);
+    uint32_t index = 0;
+    float u[4], v[4], tint[3];
+
+    switch (scene)
+    {
+    case BENCH_SCENE_POINTS:
+        for (float* plane : rgb)
+            std::fill(plane, plane + pixels, 0.02f);
+        for (int i = 0; i < BENCH_POINT_LIGHTS; ++i)
+        {
+            sceneRandom(seed, scene, index++, u);
+            lightTint(u[3], tint);
+            addPoint(rgb, width, height, u[0] * width, u[1] * height, logUniform(u[2], 1e2f, 1e5f), tint);
+        }
+        break;
+
+    case BENCH_SCENE_AREA:
+        // sky, brighter towards the top
+        for (int y = 0; y < height; ++y)
+        {
+            float t = (float)y / height;
+            for (int c = 0; c < 3; ++c)
+                std::fill(rgb[c] + (size_t)y * width, rgb[c] + (size_t)(y + 1) * width,
+                          (0.5f - 0.45f * t) * (c == 2 ? 1.2f : 1.0f));
+        }
+        for (int i = 0; i < BENCH_AREA_LIGHTS; ++i)
+        {
+            sceneRandom(seed, scene, index++, u);
+            sceneRandom(seed, scene, index++, v);
+            lightTint(v[2], tint);
+
+            float cx = u[0] * width, cy = u[1] * height;
+            float halfWidth = (0.01f + 0.03f * u[2]) * side;
+            float halfHeight = (0.01f + 0.03f * u[3]) * side;
+            float luminance = logUniform(v[0], 50.0f, 2000.0f);
+            bool disc = v[1] < 0.5f;
+
+            int x0 = std::max(0, (int)(cx - halfWidth)), x1 = std::min(width - 1, (int)(cx + halfWidth));
+            int y0 = std::max(0, (int)(cy - halfHeight)), y1 = std::min(height - 1, (int)(cy + halfHeight));
+            for (int y = y0; y <= y1; ++y)
+                for (int x = x0; x <= x1; ++x)
+                {
+                    float dx = (x + 0.5f - cx) / halfWidth, dy = (y + 0.5f - cy) / halfHeight;
+                    if (disc && dx * dx + dy * dy > 1.0f)
+                        continue;
+                    for (int c = 0; c < 3; ++c)
+                        rgb[c][(size_t)y * width + x] = luminance * tint[c];
+                }
+        }
+        break;
+
+    case BENCH_SCENE_NOISE:
+    default:
+        noiseBackground(rgb, width, height, seed);
+        for (int i = 0; i < BENCH_NOISE_LIGHTS; ++i)
+        {
+            sceneRandom(seed, BENCH_SCENE_NOISE, index++, u);
+            lightTint(u[3], tint);
+            addPoint(rgb, width, height, u[0] * width, u[1] * height, logUniform(u[2], 1e2f, 1e4f), tint);
+        }
+        break;
+    }
+}
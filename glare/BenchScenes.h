@@ -0,0 +1,30 @@
+#ifndef BENCHSCENES_H
+#define BENCHSCENES_H
+
+#include <string>
+#include <vector>
+
+// Synthetic HDR scenes for glare-bench, built in memory so a benchmark
+// does not depend on image files. The same seed and size always give the
+// same pixels, they are drawn from the Philox generator on their own
+// stream
+
+// Philox stream of the scenes, apart from the renderer's RandomStream
+#define BENCH_SCENE_STREAM 16
+
+enum BenchScene
+{
+    BENCH_SCENE_POINTS = 0,     // street lights at night: bright points on a dark background
+    BENCH_SCENE_AREA   = 1,     // windows and lamps: lit rectangles and discs over a sky gradient
+    BENCH_SCENE_NOISE  = 2,     // a textured, log-normal background with a few lights
+    BENCH_SCENES
+};
+
+const char* benchSceneName(int scene);
+bool benchSceneFromName(const std::string& name, BenchScene& scene);
+
+// Linear red, green and blue planes of width x height in cd/m^2
+void makeBenchScene(BenchScene scene, int width, int height, unsigned int seed,
+                    std::vector<float>& red, std::vector<float>& green, std::vector<float>& blue);
+
+#endif // BENCHSCENES_H
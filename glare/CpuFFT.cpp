@@ -0,0 +1,533 @@
+#include "CpuFFT.h"
+#include "CpuFFTKernels.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_FFT_X86_DISPATCH
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Stockham passes of one axis, the twiddles of all passes in one array
+struct CpuFFT::Axis
+{
+    int length;
+    std::vector<CpuFFTStage> stages;
+    std::vector<float> twiddles;
+};
+
+struct CpuFFTKernelChoice
+{
+    CpuFFTKernel run;
+    int lanes;          // transforms per block, two vectors wide
+    const char* name;
+};
+
+static CpuFFTKernelChoice chooseKernel()
+{
+    CpuFFTKernelChoice choice = {runStages<VecScalar>, 8, "scalar"};
+#ifdef CPU_FFT_X86_DISPATCH
+    if (__builtin_cpu_supports("avx512f") && cpuFFTKernelAVX512())
+    {
+        choice.run = cpuFFTKernelAVX512();
+        choice.lanes = 16;
+        choice.name = "avx512";
+    }
+    else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && cpuFFTKernelAVX2())
+    {
+        choice.run = cpuFFTKernelAVX2();
+        choice.name = "avx2";
+    }
+#endif
+    return choice;
+}
+
+static const CpuFFTKernelChoice& kernel()
+{
+    static const CpuFFTKernelChoice choice = chooseKernel();
+    return choice;
+}
+
+// Radix 4 passes first, then the remaining prime factors
+static bool factorize(int length, std::vector<int>& radices)
+{
+    static const int primes[] = {2, 3, 5, 7, 11, 13};
+
+    radices.clear();
+    if (length < 1)
+        return false;
+
+    while (length % 4 == 0)
+    {
+        radices.push_back(4);
+        length /= 4;
+    }
+    for (int p : primes)
+    {
+        while (length % p == 0)
+        {
+            radices.push_back(p);
+            length /= p;
+        }
+    }
+    return length == 1;
+}
+
+std::unique_ptr<CpuFFT::Axis> CpuFFT::makeAxis(int length)
+{
+    std::unique_ptr<Axis> axis(new Axis());
+    axis->length = length;
+
+    std::vector<int> radices;
+    factorize(length, radices);
+
+    size_t nTwiddles = 0;
+    int remaining = length;
+    for (int r : radices)
+    {
+        nTwiddles += 2 * (size_t)(r - 1) * (remaining / r);
+        remaining /= r;
+    }
+    axis->twiddles.resize(nTwiddles);
+
+    // twiddles in double, rounded once
+    size_t offset = 0;
+    int stride = 1;
+    remaining = length;
+    for (int r : radices)
+    {
+        CpuFFTStage stage;
+        stage.radix = r;
+        stage.length = remaining;
+        stage.stride = stride;
+        stage.twiddles = axis->twiddles.data() + offset;
+        for (int k = 0; k < CPU_FFT_MAX_PRIME; ++k)
+        {
+            stage.cosines[k] = k < r ? (float)std::cos(2.0 * M_PI * k / r) : 0.f;
+            stage.sines[k] = k < r ? (float)std::sin(2.0 * M_PI * k / r) : 0.f;
+        }
+
+        int m = remaining / r;
+        for (int p = 0; p < m; ++p)
+        {
+            for (int j = 1; j < r; ++j)
+            {
+                double angle = -2.0 * M_PI * j * p / remaining;
+                axis->twiddles[offset++] = (float)std::cos(angle);
+                axis->twiddles[offset++] = (float)std::sin(angle);
+            }
+        }
+
+        axis->stages.push_back(stage);
+        remaining = m;
+        stride *= r;
+    }
+    return axis;
+}
+
+// Per thread ping-pong buffers of a block
+static float* scratch(size_t floats)
+{
+    static thread_local std::vector<float> buffer;
+    if (buffer.size() < floats)
+        buffer.resize(floats);
+    return buffer.data();
+}
+
+// Rows [row0, row0 + rows) of n complex values, pitch complex values
+// apart, into elements of lanes values. Goes through the rows in tiles so
+// the strided writes stay in L1, missing rows are zero
+static void gatherRows(const float* src, size_t pitch, int row0, int rows, int n, int lanes, float* x)
+{
+    for (int e0 = 0; e0 < n; e0 += CPU_FFT_TRANSPOSE_BLOCK)
+    {
+        int e1 = std::min(n, e0 + CPU_FFT_TRANSPOSE_BLOCK);
+        for (int l = 0; l < lanes; ++l)
+        {
+            float* lane = x + 2 * l;
+            if (l >= rows)
+            {
+                for (int e = e0; e < e1; ++e)
+                    lane[2 * (size_t)e * lanes] = lane[2 * (size_t)e * lanes + 1] = 0.f;
+                continue;
+            }
+
+            const float* row = src + 2 * (size_t)(row0 + l) * pitch;
+            for (int e = e0; e < e1; ++e)
+            {
+                lane[2 * (size_t)e * lanes] = row[2 * e];
+                lane[2 * (size_t)e * lanes + 1] = row[2 * e + 1];
+            }
+        }
+    }
+}
+
+// Real rows of n values as complex values with zero imaginary parts
+static void gatherRealRows(const float* src, size_t pitch, int row0, int rows, int n, int lanes, float* x)
+{
+    for (int e0 = 0; e0 < n; e0 += CPU_FFT_TRANSPOSE_BLOCK)
+    {
+        int e1 = std::min(n, e0 + CPU_FFT_TRANSPOSE_BLOCK);
+        for (int l = 0; l < lanes; ++l)
+        {
+            float* lane = x + 2 * l;
+            const float* row = l < rows ? src + (size_t)(row0 + l) * pitch : nullptr;
+            for (int e = e0; e < e1; ++e)
+            {
+                lane[2 * (size_t)e * lanes] = row ? row[e] : 0.f;
+                lane[2 * (size_t)e * lanes + 1] = 0.f;
+            }
+        }
+    }
+}
+
+static void scatterRows(const float* x, float* dst, size_t pitch, int row0, int rows, int n, int lanes, float scale)
+{
+    for (int e0 = 0; e0 < n; e0 += CPU_FFT_TRANSPOSE_BLOCK)
+    {
+        int e1 = std::min(n, e0 + CPU_FFT_TRANSPOSE_BLOCK);
+        for (int l = 0; l < rows; ++l)
+        {
+            const float* lane = x + 2 * l;
+            float* row = dst + 2 * (size_t)(row0 + l) * pitch;
+            for (int e = e0; e < e1; ++e)
+            {
+                row[2 * e] = lane[2 * (size_t)e * lanes] * scale;
+                row[2 * e + 1] = lane[2 * (size_t)e * lanes + 1] * scale;
+            }
+        }
+    }
+}
+
+
+CpuFFT::CpuFFT(int width, int height, CpuFFTLayout layout, int batch, ThreadPool* pool)
+    : m_width(width)
+    , m_height(height)
+    , m_layout(layout)
+    , m_batch(std::max(batch, 1))
+    , m_pool(pool != nullptr ? pool : &ThreadPool::global())
+{
+    bool packed = layout == CPU_FFT_REAL && width % 2 == 0;
+    int half = width / 2;
+
+    if (layout == CPU_FFT_REAL)
+    {
+        m_spatialDistance = (size_t)width * height;
+        m_spectralDistance = 2 * (size_t)(half + 1) * height;
+    }
+    else
+    {
+        m_spatialDistance = m_spectralDistance = 2 * (size_t)width * height;
+    }
+
+    if (!supportsLength(width) || !supportsLength(height))
+    {
+        std::cerr << "Error: CpuFFT does not support " << width << "x" << height << " transforms" << std::endl;
+        return;
+    }
+
+    // even real rows are transformed as width/2 complex values
+    m_rows = makeAxis(packed ? half : width);
+    m_columns = makeAxis(height);
+
+    if (layout == CPU_FFT_REAL)
+    {
+        m_realTwiddles.resize(2 * (size_t)(half + 1));
+        for (int k = 0; k <= half; ++k)
+        {
+            double angle = -2.0 * M_PI * k / width;
+            m_realTwiddles[2 * k] = (float)std::cos(angle);
+            m_realTwiddles[2 * k + 1] = (float)std::sin(angle);
+        }
+    }
+}
+
+CpuFFT::~CpuFFT()
+{
+}
+
+void CpuFFT::setDistances(size_t spatialDistance, size_t spectralDistance)
+{
+    m_spatialDistance = spatialDistance;
+    m_spectralDistance = spectralDistance;
+}
+
+bool CpuFFT::supportsLength(int length)
+{
+    std::vector<int> radices;
+    return factorize(length, radices);
+}
+
+const char* CpuFFT::getInstructionSet()
+{
+    return kernel().name;
+}
+
+void CpuFFT::forward(const float* in, float* out)
+{
+    if (!m_rows)
+        return;
+
+    for (int b = 0; b < m_batch; ++b)
+    {
+        const float* src = in + b * m_spatialDistance;
+        float* dst = out + b * m_spectralDistance;
+
+        if (m_layout == CPU_FFT_REAL)
+        {
+            realRowsForward(src, dst);
+            transformColumns(dst, dst, m_width/2 + 1, false, 1.f);
+        }
+        else
+        {
+            transformRows(src, dst, false, 1.f);
+            transformColumns(dst, dst, m_width, false, 1.f);
+        }
+    }
+}
+
+void CpuFFT::backward(const float* in, float* out)
+{
+    if (!m_rows)
+        return;
+
+    for (int b = 0; b < m_batch; ++b)
+    {
+        const float* src = in + b * m_spectralDistance;
+        float* dst = out + b * m_spatialDistance;
+
+        if (m_layout == CPU_FFT_REAL)
+        {
+            // the columns go through a scratch plane, the input is kept
+            int columns = m_width/2 + 1;
+            m_spectrum.resize(2 * (size_t)columns * m_height);
+            transformColumns(src, m_spectrum.data(), columns, true, 1.f);
+            realRowsBackward(m_spectrum.data(), dst, 1.f / ((float)m_rows->length * m_height));
+        }
+        else
+        {
+            transformRows(src, dst, true, 1.f);
+            transformColumns(dst, dst, m_width, true, 1.f / ((float)m_width * m_height));
+        }
+    }
+}
+
+// STEP: ROWS, transposed into blocks of lanes rows
+void CpuFFT::transformRows(const float* src, float* dst, bool inverse, float scale)
+{
+    const CpuFFTKernelChoice& k = kernel();
+    const Axis& axis = *m_rows;
+    const int lanes = k.lanes;
+    const int n = axis.length;
+    size_t nBlocks = (m_height + lanes - 1) / lanes;
+
+    m_pool->parallelFor(0, nBlocks, 1, [&](size_t begin, size_t end) {
+        size_t elements = 2 * (size_t)n * lanes;
+        float* x = scratch(2 * elements);
+        float* y = x + elements;
+
+        for (size_t block = begin; block < end; ++block)
+        {
+            int row0 = (int)block * lanes;
+            int rows = std::min(lanes, m_height - row0);
+
+            gatherRows(src, n, row0, rows, n, lanes, x);
+            float* result = k.run(axis.stages.data(), (int)axis.stages.size(), x, y, lanes, inverse);
+            scatterRows(result, dst, n, row0, rows, n, lanes, scale);
+        }
+    });
+}
+
+// STEP: COLUMNS, blocks of lanes neighbouring columns are already in the
+// element layout, a row of a block is a single contiguous read
+void CpuFFT::transformColumns(const float* src, float* dst, int columns, bool inverse, float scale)
+{
+    const CpuFFTKernelChoice& k = kernel();
+    const Axis& axis = *m_columns;
+    const int lanes = k.lanes;
+    const int n = axis.length;
+    size_t nBlocks = (columns + lanes - 1) / lanes;
+
+    m_pool->parallelFor(0, nBlocks, 1, [&](size_t begin, size_t end) {
+        size_t elements = 2 * (size_t)n * lanes;
+        float* x = scratch(2 * elements);
+        float* y = x + elements;
+
+        for (size_t block = begin; block < end; ++block)
+        {
+            int column0 = (int)block * lanes;
+            int count = std::min(lanes, columns - column0);
+
+            for (int e = 0; e < n; ++e)
+            {
+                float* element = x + 2 * (size_t)e * lanes;
+                std::memcpy(element, src + 2 * ((size_t)e * columns + column0), 2 * count * sizeof(float));
+                std::fill(element + 2 * count, element + 2 * lanes, 0.f);
+            }
+
+            float* result = k.run(axis.stages.data(), (int)axis.stages.size(), x, y, lanes, inverse);
+
+            for (int e = 0; e < n; ++e)
+            {
+                const float* element = result + 2 * (size_t)e * lanes;
+                float* out = dst + 2 * ((size_t)e * columns + column0);
+                for (int i = 0; i < 2 * count; ++i)
+                    out[i] = element[i] * scale;
+            }
+        }
+    });
+}
+
+// STEP: REAL ROWS. Even rows are packed as x[2n] + i x[2n + 1], transformed
+// at half the length and split into the even and odd parts afterwards
+void CpuFFT::realRowsForward(const float* src, float* dst)
+{
+    const CpuFFTKernelChoice& k = kernel();
+    const Axis& axis = *m_rows;
+    const int lanes = k.lanes;
+    const int n = axis.length;
+    const int half = m_width / 2;
+    const bool packed = m_width % 2 == 0;
+    const float* w = m_realTwiddles.data();
+    size_t nBlocks = (m_height + lanes - 1) / lanes;
+
+    m_pool->parallelFor(0, nBlocks, 1, [&](size_t begin, size_t end) {
+        size_t elements = 2 * (size_t)n * lanes;
+        float* x = scratch(2 * elements);
+        float* y = x + elements;
+
+        for (size_t block = begin; block < end; ++block)
+        {
+            int row0 = (int)block * lanes;
+            int rows = std::min(lanes, m_height - row0);
+
+            if (packed)
+                gatherRows(src, half, row0, rows, half, lanes, x);
+            else
+                gatherRealRows(src, m_width, row0, rows, m_width, lanes, x);
+
+            float* result = k.run(axis.stages.data(), (int)axis.stages.size(), x, y, lanes, false);
+
+            for (int l = 0; l < rows; ++l)
+            {
+                const float* z = result + 2 * l;
+                float* out = dst + 2 * (size_t)(row0 + l) * (half + 1);
+
+                if (!packed)
+                {
+                    for (int i = 0; i <= half; ++i)
+                    {
+                        out[2 * i] = z[2 * (size_t)i * lanes];
+                        out[2 * i + 1] = z[2 * (size_t)i * lanes + 1];
+                    }
+                    continue;
+                }
+
+                // X[i] = (Z[i] + Z*[n - i]) / 2 - i w^i (Z[i] - Z*[n - i]) / 2
+                for (int i = 0; i <= half; ++i)
+                {
+                    const float* a = z + 2 * (size_t)(i % half) * lanes;
+                    const float* b = z + 2 * (size_t)((half - i) % half) * lanes;
+                    float evenRe = 0.5f * (a[0] + b[0]);
+                    float evenIm = 0.5f * (a[1] - b[1]);
+                    float oddRe = 0.5f * (a[1] + b[1]);
+                    float oddIm = -0.5f * (a[0] - b[0]);
+                    out[2 * i] = evenRe + w[2 * i] * oddRe - w[2 * i + 1] * oddIm;
+                    out[2 * i + 1] = evenIm + w[2 * i] * oddIm + w[2 * i + 1] * oddRe;
+                }
+            }
+        }
+    });
+}
+
+// The inverse of realRowsForward, the hermitian half is recombined into
+// the packed spectrum or, for odd widths, mirrored into the full one
+void CpuFFT::realRowsBackward(const float* src, float* dst, float scale)
+{
+    const CpuFFTKernelChoice& k = kernel();
+    const Axis& axis = *m_rows;
+    const int lanes = k.lanes;
+    const int n = axis.length;
+    const int half = m_width / 2;
+    const bool packed = m_width % 2 == 0;
+    const float* w = m_realTwiddles.data();
+    size_t nBlocks = (m_height + lanes - 1) / lanes;
+
+    m_pool->parallelFor(0, nBlocks, 1, [&](size_t begin, size_t end) {
+        size_t elements = 2 * (size_t)n * lanes;
+        float* x = scratch(2 * elements);
+        float* y = x + elements;
+
+        for (size_t block = begin; block < end; ++block)
+        {
+            int row0 = (int)block * lanes;
+            int rows = std::min(lanes, m_height - row0);
+
+            for (int l = 0; l < lanes; ++l)
+            {
+                float* z = x + 2 * l;
+                if (l >= rows)
+                {
+                    for (int i = 0; i < n; ++i)
+                        z[2 * (size_t)i * lanes] = z[2 * (size_t)i * lanes + 1] = 0.f;
+                    continue;
+                }
+
+                const float* in = src + 2 * (size_t)(row0 + l) * (half + 1);
+                if (!packed)
+                {
+                    for (int i = 0; i <= half; ++i)
+                    {
+                        z[2 * (size_t)i * lanes] = in[2 * i];
+                        z[2 * (size_t)i * lanes + 1] = in[2 * i + 1];
+                    }
+                    for (int i = half + 1; i < n; ++i)
+                    {
+                        z[2 * (size_t)i * lanes] = in[2 * (n - i)];
+                        z[2 * (size_t)i * lanes + 1] = -in[2 * (n - i) + 1];
+                    }
+                    continue;
+                }
+
+                // Z[i] = E[i] + i O[i], E = (X[i] + X*[n - i]) / 2,
+                // O = w^-i (X[i] - X*[n - i]) / 2
+                for (int i = 0; i < half; ++i)
+                {
+                    const float* a = in + 2 * i;
+                    const float* b = in + 2 * (half - i);
+                    float evenRe = 0.5f * (a[0] + b[0]);
+                    float evenIm = 0.5f * (a[1] - b[1]);
+                    float diffRe = 0.5f * (a[0] - b[0]);
+                    float diffIm = 0.5f * (a[1] + b[1]);
+                    float oddRe = diffRe * w[2 * i] + diffIm * w[2 * i + 1];
+                    float oddIm = diffIm * w[2 * i] - diffRe * w[2 * i + 1];
+                    z[2 * (size_t)i * lanes] = evenRe - oddIm;
+                    z[2 * (size_t)i * lanes + 1] = evenIm + oddRe;
+                }
+            }
+
+            float* result = k.run(axis.stages.data(), (int)axis.stages.size(), x, y, lanes, true);
+
+            if (packed)
+            {
+                scatterRows(result, dst, half, row0, rows, half, lanes, scale);
+                continue;
+            }
+
+            for (int l = 0; l < rows; ++l)
+            {
+                const float* z = result + 2 * l;
+                float* out = dst + (size_t)(row0 + l) * m_width;
+                for (int i = 0; i < m_width; ++i)
+                    out[i] = z[2 * (size_t)i * lanes] * scale;
+            }
+        }
+    });
+}
@@ -0,0 +1,79 @@
+#ifndef CPUFFT_H
+#define CPUFFT_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Elements per tile of the row transposes
+#define CPU_FFT_TRANSPOSE_BLOCK 64
+
+class ThreadPool;
+
+enum CpuFFTLayout
+{
+    CPU_FFT_COMPLEX,    // interleaved complex in both domains
+    CPU_FFT_REAL        // real planes, width/2 + 1 hermitian values per spectrum row
+};
+
+// 2D single precision FFT on the host for when the OpenCL device is the
+// CPU itself. Same conventions as the renderer's clFFT plans: row major
+// planes, hermitian rows of width/2 + 1 values, forward unscaled and
+// backward scaled by 1 / (width * height). Lengths may have the prime
+// factors 2, 3, 5, 7, 11 and 13.
+//
+// Rows and columns are transformed in blocks of neighbouring transforms
+// so every butterfly is a vector operation, AVX-512, AVX2 or scalar as
+// the CPU allows, and the blocks are spread over a ThreadPool, the global
+// one unless the plan is given its own. A plan may be used by one thread
+// at a time.
+class CpuFFT
+{
+public:
+    CpuFFT(int width, int height, CpuFFTLayout layout, int batch = 1, ThreadPool* pool = nullptr);
+    ~CpuFFT();
+
+    CpuFFT(const CpuFFT&) = delete;
+    CpuFFT& operator=(const CpuFFT&) = delete;
+
+    // Floats between the planes of a batch, tight by default
+    void setDistances(size_t spatialDistance, size_t spectralDistance);
+
+    // Out of place for real planes, in or out of place for complex ones.
+    // The input is left untouched
+    void forward(const float* in, float* out);
+    void backward(const float* in, float* out);
+
+    int getWidth() const { return m_width; }
+    int getHeight() const { return m_height; }
+    CpuFFTLayout getLayout() const { return m_layout; }
+    int getBatch() const { return m_batch; }
+
+    static bool supportsLength(int length);
+    // "avx512", "avx2" or "scalar"
+    static const char* getInstructionSet();
+
+private:
+    struct Axis;
+    static std::unique_ptr<Axis> makeAxis(int length);
+
+    void transformRows(const float* src, float* dst, bool inverse, float scale);
+    void transformColumns(const float* src, float* dst, int columns, bool inverse, float scale);
+    void realRowsForward(const float* src, float* dst);
+    void realRowsBackward(const float* src, float* dst, float scale);
+
+    int m_width;
+    int m_height;
+    CpuFFTLayout m_layout;
+    int m_batch;
+    ThreadPool* m_pool;
+    size_t m_spatialDistance;
+    size_t m_spectralDistance;
+
+    std::unique_ptr<Axis> m_rows;       // width, or width/2 for even real planes
+    std::unique_ptr<Axis> m_columns;
+    std::vector<float> m_realTwiddles;  // exp(-2 pi i k / width), k <= width/2
+    std::vector<float> m_spectrum;      // column pass of a backward real transform
+};
+
+#endif // CPUFFT_H
@@ -0,0 +1,52 @@
+// CpuFFT butterflies on four complex values per vector. Built with -mavx2
+// -mfma, only called when the CPU reports both.
+#include "CpuFFTKernels.h"
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+namespace {
+
+struct VecAVX2
+{
+    typedef __m256 Type;
+    static const int width = 4;
+
+    static inline Type load(const float* p) { return _mm256_loadu_ps(p); }
+    static inline void store(float* p, Type a) { _mm256_storeu_ps(p, a); }
+    static inline Type add(Type a, Type b) { return _mm256_add_ps(a, b); }
+    static inline Type sub(Type a, Type b) { return _mm256_sub_ps(a, b); }
+    static inline Type scale(Type a, float f) { return _mm256_mul_ps(a, _mm256_set1_ps(f)); }
+    // (re, im) -> (-im, re)
+    static inline Type mulI(Type a)
+    {
+        return _mm256_addsub_ps(_mm256_setzero_ps(), _mm256_permute_ps(a, 0xB1));
+    }
+    static inline Type mul(Type a, float c, float s)
+    {
+        Type swapped = _mm256_mul_ps(_mm256_permute_ps(a, 0xB1), _mm256_set1_ps(s));
+        return _mm256_fmaddsub_ps(a, _mm256_set1_ps(c), swapped);
+    }
+    static inline Type mulConj(Type a, float c, float s)
+    {
+        Type swapped = _mm256_mul_ps(_mm256_permute_ps(a, 0xB1), _mm256_set1_ps(s));
+        return _mm256_fmsubadd_ps(a, _mm256_set1_ps(c), swapped);
+    }
+};
+
+} // namespace
+
+CpuFFTKernel cpuFFTKernelAVX2()
+{
+    return runStages<VecAVX2>;
+}
+
+#else
+
+CpuFFTKernel cpuFFTKernelAVX2()
+{
+    return nullptr;
+}
+
+#endif // __AVX2__
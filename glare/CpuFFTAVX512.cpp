@@ -0,0 +1,53 @@
+// CpuFFT butterflies on eight complex values per vector. Built with
+// -mavx512f, only called when the CPU reports it.
+#include "CpuFFTKernels.h"
+
+#if defined(__AVX512F__)
+
+#include <immintrin.h>
+
+namespace {
+
+struct VecAVX512
+{
+    typedef __m512 Type;
+    static const int width = 8;
+
+    static inline Type load(const float* p) { return _mm512_loadu_ps(p); }
+    static inline void store(float* p, Type a) { _mm512_storeu_ps(p, a); }
+    static inline Type add(Type a, Type b) { return _mm512_add_ps(a, b); }
+    static inline Type sub(Type a, Type b) { return _mm512_sub_ps(a, b); }
+    static inline Type scale(Type a, float f) { return _mm512_mul_ps(a, _mm512_set1_ps(f)); }
+    // (re, im) -> (-im, re), the real lanes are negated through a mask
+    static inline Type mulI(Type a)
+    {
+        Type swapped = _mm512_permute_ps(a, 0xB1);
+        return _mm512_mask_sub_ps(swapped, 0x5555, _mm512_setzero_ps(), swapped);
+    }
+    static inline Type mul(Type a, float c, float s)
+    {
+        Type swapped = _mm512_mul_ps(_mm512_permute_ps(a, 0xB1), _mm512_set1_ps(s));
+        return _mm512_fmaddsub_ps(a, _mm512_set1_ps(c), swapped);
+    }
+    static inline Type mulConj(Type a, float c, float s)
+    {
+        Type swapped = _mm512_mul_ps(_mm512_permute_ps(a, 0xB1), _mm512_set1_ps(s));
+        return _mm512_fmsubadd_ps(a, _mm512_set1_ps(c), swapped);
+    }
+};
+
+} // namespace
+
+CpuFFTKernel cpuFFTKernelAVX512()
+{
+    return runStages<VecAVX512>;
+}
+
+#else
+
+CpuFFTKernel cpuFFTKernelAVX512()
+{
+    return nullptr;
+}
+
+#endif // __AVX512F__
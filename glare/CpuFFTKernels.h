@@ -0,0 +1,221 @@
+#ifndef CPUFFTKERNELS_H
+#define CPUFFTKERNELS_H
+
+// Butterflies of CpuFFT, included by one translation unit per instruction
+// set. Everything here has internal linkage and nothing from the standard
+// library is pulled in, so the copies built with AVX flags can never be
+// picked by the linker for code running on older CPUs.
+
+#include <cstddef>
+
+// Largest prime factor a transform length may have, like clFFT
+#define CPU_FFT_MAX_PRIME 13
+
+// One Stockham pass. The data is a sequence of elements, each one a block
+// of lanes complex values from as many independent transforms
+struct CpuFFTStage
+{
+    int radix;
+    int length;                 // length still to transform when the pass runs
+    int stride;                 // product of the radices of the passes before
+    const float* twiddles;      // (radix - 1) complex values per butterfly
+    float cosines[CPU_FFT_MAX_PRIME];   // cos(2 pi k / radix)
+    float sines[CPU_FFT_MAX_PRIME];     // sin(2 pi k / radix)
+};
+
+// Runs all passes ping-ponging between x and y, returns the buffer that
+// holds the result. lanes is a multiple of the vector width
+typedef float* (*CpuFFTKernel)(const CpuFFTStage* stages, int nStages, float* x, float* y,
+                               int lanes, bool inverse);
+
+// nullptr when the translation unit was built without the instruction set
+CpuFFTKernel cpuFFTKernelAVX2();
+CpuFFTKernel cpuFFTKernelAVX512();
+
+namespace {
+
+// One complex value per vector
+struct VecScalar
+{
+    struct Type { float re, im; };
+    static const int width = 1;
+
+    static inline Type load(const float* p) { Type a = {p[0], p[1]}; return a; }
+    static inline void store(float* p, Type a) { p[0] = a.re; p[1] = a.im; }
+    static inline Type add(Type a, Type b) { Type c = {a.re + b.re, a.im + b.im}; return c; }
+    static inline Type sub(Type a, Type b) { Type c = {a.re - b.re, a.im - b.im}; return c; }
+    static inline Type scale(Type a, float f) { Type c = {a.re * f, a.im * f}; return c; }
+    // a * i
+    static inline Type mulI(Type a) { Type c = {-a.im, a.re}; return c; }
+    // a * (c + i s) and a * (c - i s)
+    static inline Type mul(Type a, float c, float s)
+    {
+        Type r = {a.re * c - a.im * s, a.re * s + a.im * c};
+        return r;
+    }
+    static inline Type mulConj(Type a, float c, float s)
+    {
+        Type r = {a.re * c + a.im * s, a.im * c - a.re * s};
+        return r;
+    }
+};
+
+// DFT of R values in place, odd prime R. The pairs a[k] +- a[R - k]
+// share the cosine and sine terms
+template <class V, bool Inverse, int R>
+struct Butterfly
+{
+    typedef typename V::Type T;
+
+    static inline void run(T* a, const float* cosines, const float* sines)
+    {
+        const int H = R / 2;
+        T sum[H], diff[H], lower[H], upper[H];
+        T b0 = a[0];
+        for (int k = 1; k <= H; ++k)
+        {
+            sum[k - 1] = V::add(a[k], a[R - k]);
+            diff[k - 1] = V::sub(a[k], a[R - k]);
+            b0 = V::add(b0, sum[k - 1]);
+        }
+
+        for (int j = 1; j <= H; ++j)
+        {
+            T re = a[0];
+            T im = V::scale(diff[0], sines[j % R]);
+            re = V::add(re, V::scale(sum[0], cosines[j % R]));
+            for (int k = 2; k <= H; ++k)
+            {
+                re = V::add(re, V::scale(sum[k - 1], cosines[(j * k) % R]));
+                im = V::add(im, V::scale(diff[k - 1], sines[(j * k) % R]));
+            }
+            // forward: b[j] = re - i im, b[R - j] = re + i im
+            T iim = V::mulI(im);
+            lower[j - 1] = Inverse ? V::add(re, iim) : V::sub(re, iim);
+            upper[j - 1] = Inverse ? V::sub(re, iim) : V::add(re, iim);
+        }
+
+        a[0] = b0;
+        for (int j = 1; j <= H; ++j)
+        {
+            a[j] = lower[j - 1];
+            a[R - j] = upper[j - 1];
+        }
+    }
+};
+
+template <class V, bool Inverse>
+struct Butterfly<V, Inverse, 2>
+{
+    typedef typename V::Type T;
+
+    static inline void run(T* a, const float*, const float*)
+    {
+        T t = a[0];
+        a[0] = V::add(t, a[1]);
+        a[1] = V::sub(t, a[1]);
+    }
+};
+
+template <class V, bool Inverse>
+struct Butterfly<V, Inverse, 4>
+{
+    typedef typename V::Type T;
+
+    static inline void run(T* a, const float*, const float*)
+    {
+        T t0 = V::add(a[0], a[2]);
+        T t1 = V::sub(a[0], a[2]);
+        T t2 = V::add(a[1], a[3]);
+        T t3 = V::mulI(V::sub(a[1], a[3]));
+        a[0] = V::add(t0, t2);
+        a[2] = V::sub(t0, t2);
+        a[1] = Inverse ? V::add(t1, t3) : V::sub(t1, t3);
+        a[3] = Inverse ? V::sub(t1, t3) : V::add(t1, t3);
+    }
+};
+
+// x[q + s (p + k m)] -> y[q + s (R p + j)] with the twiddle w^(j p)
+template <class V, bool Inverse, int R>
+static void radixPass(const CpuFFTStage& stage, const float* x, float* y, int lanes)
+{
+    typedef typename V::Type T;
+
+    const int m = stage.length / R;
+    const int s = stage.stride;
+    const size_t block = 2 * (size_t)lanes;
+    const size_t inStep = (size_t)s * m * block;
+    const size_t outStep = (size_t)s * block;
+
+    for (int p = 0; p < m; ++p)
+    {
+        const float* w = stage.twiddles + 2 * (size_t)(R - 1) * p;
+        for (int q = 0; q < s; ++q)
+        {
+            const float* in = x + (q + (size_t)s * p) * block;
+            float* out = y + (q + (size_t)s * R * p) * block;
+
+            for (int v = 0; v < lanes; v += V::width)
+            {
+                T a[R];
+                for (int k = 0; k < R; ++k)
+                    a[k] = V::load(in + k * inStep + 2 * v);
+
+                Butterfly<V, Inverse, R>::run(a, stage.cosines, stage.sines);
+
+                V::store(out + 2 * v, a[0]);
+                if (p == 0)
+                {
+                    for (int j = 1; j < R; ++j)
+                        V::store(out + j * outStep + 2 * v, a[j]);
+                }
+                else
+                {
+                    for (int j = 1; j < R; ++j)
+                    {
+                        float c = w[2 * (j - 1)];
+                        float sn = w[2 * (j - 1) + 1];
+                        T b = Inverse ? V::mulConj(a[j], c, sn) : V::mul(a[j], c, sn);
+                        V::store(out + j * outStep + 2 * v, b);
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <class V, bool Inverse>
+static void runPass(const CpuFFTStage& stage, const float* x, float* y, int lanes)
+{
+    switch (stage.radix)
+    {
+    case 2:  radixPass<V, Inverse, 2>(stage, x, y, lanes); break;
+    case 3:  radixPass<V, Inverse, 3>(stage, x, y, lanes); break;
+    case 4:  radixPass<V, Inverse, 4>(stage, x, y, lanes); break;
+    case 5:  radixPass<V, Inverse, 5>(stage, x, y, lanes); break;
+    case 7:  radixPass<V, Inverse, 7>(stage, x, y, lanes); break;
+    case 11: radixPass<V, Inverse, 11>(stage, x, y, lanes); break;
+    case 13: radixPass<V, Inverse, 13>(stage, x, y, lanes); break;
+    }
+}
+
+template <class V>
+static float* runStages(const CpuFFTStage* stages, int nStages, float* x, float* y, int lanes, bool inverse)
+{
+    for (int i = 0; i < nStages; ++i)
+    {
+        if (inverse)
+            runPass<V, true>(stages[i], x, y, lanes);
+        else
+            runPass<V, false>(stages[i], x, y, lanes);
+
+        float* t = x;
+        x = y;
+        y = t;
+    }
+    return x;
+}
+
+} // namespace
+
+#endif // CPUFFTKERNELS_H
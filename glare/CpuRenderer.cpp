@@ -0,0 +1,729 @@
+#include "CpuRenderer.h"
+#include "GlareConstants.h"
+#include "LensParticles.h"
+#include "ToneMapping.h"
+#include "Trace.h"
+#include "image.h"
+#include "spectrumMap.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+
+// same constants as the kernels
+static const float PI = 3.14159265f;
+static const float TM_LOCAL_ALPHA1 = 0.35355339f;
+static const float TM_LOCAL_RATIO = 1.6f;
+static const float TM_HIST_DELTA = 1e-4f;
+static const float TM_HIST_TOLERANCE = 0.025f;
+static const int TM_HIST_ITERATIONS = 32;
+
+// Allocates nPlanes planes of width x height values and clears each one
+// on the pool in bands of tile rows. The threads that clear a band are
+// the ones the tiled stages start on, so on NUMA machines its pages are
+// first touched on the node that works on them
+template <class T>
+static void allocatePlanes(ThreadPool& pool, std::unique_ptr<T[]>& planes, int nPlanes, int width, int height)
+{
+    size_t planeSize = (size_t)width * height;
+    planes.reset(new T[nPlanes * planeSize]);
+
+    for (int c = 0; c < nPlanes; ++c)
+    {
+        T* plane = planes.get() + c * planeSize;
+        pool.parallelFor(0, planeSize, (size_t)width * CPU_RENDER_TILE, [plane](size_t begin, size_t end) {
+            std::fill(plane + begin, plane + end, T());
+        });
+    }
+}
+
+// NaN goes to 0 like the clamp of the kernels
+static inline float clamp01(float v)
+{
+    return v > 0.0f ? (v < 1.0f ? v : 1.0f) : 0.0f;
+}
+
+static inline float getLuminance(float r, float g, float b)
+{
+    return 0.212671f * r + 0.71516f * g + 0.072169f * b;
+}
+
+// Clamped, gamma corrected colour as a UNORM8 0xAARRGGBB word, rounded
+// like write_imagef
+static inline unsigned int packPixel(float r, float g, float b, float invGamma)
+{
+    unsigned int R = (unsigned int)std::lrint(std::pow(clamp01(r), invGamma) * 255.0f);
+    unsigned int G = (unsigned int)std::lrint(std::pow(clamp01(g), invGamma) * 255.0f);
+    unsigned int B = (unsigned int)std::lrint(std::pow(clamp01(b), invGamma) * 255.0f);
+    return 0xff000000u | (R << 16) | (G << 8) | B;
+}
+
+// compute_magnitude_kernel shifts both axes by half the width. As a
+// gather, the source that lands on dest or -1, the larger one when two
+// sources land on the same pixel
+static inline int shiftSource(int dest, int half, int size)
+{
+    if (dest + half < size)
+        return dest + half;
+    if (dest - half >= 0 && dest - half < half)
+        return dest - half;
+    return -1;
+}
+
+CpuRenderer::CpuRenderer(unsigned int nThreads, bool pinThreads) :
+    m_pool(nThreads, pinThreads), m_width(0), m_height(0),
+    m_exponentialLambda(0), m_exponentialDistance(0), m_exponentialMaxPupil(0), m_normFactor(1.0f)
+{
+}
+
+CpuRenderer::~CpuRenderer()
+{
+}
+
+void CpuRenderer::setImage(const Image& image)
+{
+    int width = image.getWidth();
+    int height = image.getHeight();
+    size_t planeSize = (size_t)width * height;
+    int specWidth = width / 2 + 1;
+
+    if (width != m_width || height != m_height)
+    {
+        m_width = width;
+        m_height = height;
+
+        m_complexPlan.reset(new CpuFFT(width, height, CPU_FFT_COMPLEX, 1, &m_pool));
+        m_realPlan.reset(new CpuFFT(width, height, CPU_FFT_REAL, 3, &m_pool));
+        m_scalesPlan.reset();
+
+        std::vector<float>().swap(m_complexExponential);
+        allocatePlanes(m_pool, m_field, 2, width, height);
+        allocatePlanes(m_pool, m_fresnel, 1, width, height);
+        allocatePlanes(m_pool, m_psf, 3, width, height);
+        allocatePlanes(m_pool, m_hdr, 3, width, height);
+        allocatePlanes(m_pool, m_frame, 1, width, height);
+        allocatePlanes(m_pool, m_imageSpectra, 6, specWidth, height);
+        allocatePlanes(m_pool, m_spectra, 6, specWidth, height);
+        m_scaleSpectra.reset();
+        m_blurred.reset();
+    }
+
+    // the PSF planes are rewritten every frame, the image passes through
+    for (int c = 0; c < 3; ++c)
+        image.copyChannel(c, m_psf.get() + c * planeSize);
+    m_realPlan->forward(m_psf.get(), m_imageSpectra.get());
+}
+
+void CpuRenderer::render(const CpuFrameParams& params)
+{
+    if (!m_realPlan)
+        return;
+
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    Clock::time_point last = start;
+    auto mark = [&last](float& stage) {
+        Clock::time_point now = Clock::now();
+        stage = std::chrono::duration<float, std::milli>(now - last).count();
+        last = now;
+    };
+
+    updateComplexExponential(params);
+
+    // STEP: APERTURE times the Fresnel term
+    renderAperture(params);
+
+    // STEP: FFT OF THE APERTURE, magnitude of the field centred
+    {
+        TRACE_SCOPE("psf fft", "cpu");
+        m_complexPlan->forward(m_field.get(), m_field.get());
+    }
+    computeMagnitude(params);
+    mark(m_timings.aperture);
+
+    // STEP: SPECTRAL BLUR into the red, green and blue PSF
+    spectralBlur(params);
+    mark(m_timings.spectral);
+
+    // STEP: CONVOLUTION with the image spectra
+    convolve();
+    mark(m_timings.convolution);
+
+    // STEP: TONE MAPPING
+    if (params.toneMapOperator == TM_REINHARD_LOCAL)
+        toneMapLocal(params);
+    else if (params.toneMapOperator == TM_HISTOGRAM_ADJUSTMENT)
+        toneMapHistogram(params);
+    else
+        toneMapExtended(params);
+    mark(m_timings.toneMap);
+
+    m_timings.total = std::chrono::duration<float, std::milli>(last - start).count();
+}
+
+// generate_complex_exp, recomputed only when its parameters change
+void CpuRenderer::updateComplexExponential(const CpuFrameParams& params)
+{
+    if (!m_complexExponential.empty() && params.lambda == m_exponentialLambda &&
+        params.distance == m_exponentialDistance && params.maxPupilSize == m_exponentialMaxPupil)
+        return;
+
+    m_exponentialLambda = params.lambda;
+    m_exponentialDistance = params.distance;
+    m_exponentialMaxPupil = params.maxPupilSize;
+    m_complexExponential.resize(2 * (size_t)m_width * m_height);
+
+    const int width = m_width;
+    const int height = m_height;
+    const float lambda = params.lambda;
+    const float d = params.distance;
+    const float resolution = (float)height / params.maxPupilSize;   // px / mm
+    float* output = m_complexExponential.data();
+
+    m_pool.parallelForTiles(width, height, CPU_RENDER_TILE, CPU_RENDER_TILE, [=](int x0, int y0, int x1, int y1) {
+        for (int yi = y0; yi < y1; ++yi)
+        {
+            float yp = ((float)yi / height - 0.5f) / resolution / d / lambda;
+            for (int xi = x0; xi < x1; ++xi)
+            {
+                float xp = ((float)xi / width - 0.5f) / resolution / d / lambda;
+                float value = PI / (d * lambda) * (xp * xp + yp * yp);
+
+                size_t index = 2 * ((size_t)yi * width + xi);
+                output[index] = std::cos(value);
+                output[index + 1] = std::sin(value);
+            }
+        }
+    });
+}
+
+// glr_count_lens_points, glr_scan_lens_tiles and glr_bin_lens_points as
+// one counting sort over the CPU_RENDER_TILE tiles of renderAperture
+void CpuRenderer::binLensPoints(const CpuFrameParams& params, int tilesX, int tilesY)
+{
+    const int nTiles = tilesX * tilesY;
+    const int nPoints = params.nPoints;
+
+    m_pointScreen.resize(2 * (size_t)nPoints);
+    m_tileOffsets.assign(nTiles + 1, 0);
+    float* screen = m_pointScreen.data();
+
+    m_pool.parallelFor(0, nPoints, LENS_PARTICLES_PER_TASK, [&](size_t begin, size_t end) {
+        for (size_t n = begin; n < end; ++n)
+            lensScreenPosition(params.points + 4 * n, params.distort, m_width, m_height,
+                               screen[2 * n], screen[2 * n + 1]);
+    });
+
+    int tiles[4];
+    for (int n = 0; n < nPoints; ++n)
+        if (lensPointTiles(screen[2 * n], screen[2 * n + 1], m_width, m_height, CPU_RENDER_TILE, tilesX, tilesY, tiles))
+            for (int ty = tiles[1]; ty <= tiles[3]; ++ty)
+                for (int tx = tiles[0]; tx <= tiles[2]; ++tx)
+                    ++m_tileOffsets[ty * tilesX + tx + 1];
+
+    for (int t = 0; t < nTiles; ++t)
+        m_tileOffsets[t + 1] += m_tileOffsets[t];
+
+    std::vector<unsigned int> cursors(m_tileOffsets.begin(), m_tileOffsets.end() - 1);
+    m_tileEntries.resize(m_tileOffsets[nTiles]);
+    for (int n = 0; n < nPoints; ++n)
+        if (lensPointTiles(screen[2 * n], screen[2 * n + 1], m_width, m_height, CPU_RENDER_TILE, tilesX, tilesY, tiles))
+            for (int ty = tiles[1]; ty <= tiles[3]; ++ty)
+                for (int tx = tiles[0]; tx <= tiles[2]; ++tx)
+                    m_tileEntries[cursors[ty * tilesX + tx]++] = n;
+}
+
+// glr_render_pupil, glr_render_gratings, glr_rasterise_lens_points and
+// glr_merge_images, multiplied with the Fresnel term in the same pass
+void CpuRenderer::renderAperture(const CpuFrameParams& params)
+{
+    TRACE_SCOPE("aperture", "cpu");
+    const int width = m_width;
+    const int height = m_height;
+    const int tilesX = (width + CPU_RENDER_TILE - 1) / CPU_RENDER_TILE;
+
+    binLensPoints(params, tilesX, (height + CPU_RENDER_TILE - 1) / CPU_RENDER_TILE);
+
+    const float pupil2 = params.pupilRadius * params.pupilRadius;
+    const float slid2 = params.slidRadius * params.slidRadius;
+    const float extent = LENS_PARTICLE_RADIUS + 0.5f;
+    const float* screen = m_pointScreen.data();
+    const unsigned int* offsets = m_tileOffsets.data();
+    const unsigned int* entries = m_tileEntries.data();
+    const float* exponential = m_complexExponential.data();
+    float* field = m_field.get();
+
+    m_pool.parallelForTiles(width, height, CPU_RENDER_TILE, CPU_RENDER_TILE, [&](int x0, int y0, int x1, int y1) {
+        // optical depth of the particles over the tile
+        unsigned int depth[CPU_RENDER_TILE * CPU_RENDER_TILE] = {};
+        int tile = (y0 / CPU_RENDER_TILE) * tilesX + x0 / CPU_RENDER_TILE;
+        for (unsigned int e = offsets[tile]; e < offsets[tile + 1]; ++e)
+        {
+            const float* pos = screen + 2 * (size_t)entries[e];
+            int px0 = std::max((int)std::floor(pos[0] - extent), x0);
+            int px1 = std::min((int)std::ceil(pos[0] + extent), x1);
+            int py0 = std::max((int)std::floor(pos[1] - extent), y0);
+            int py1 = std::min((int)std::ceil(pos[1] + extent), y1);
+
+            for (int y = py0; y < py1; ++y)
+                for (int x = px0; x < px1; ++x)
+                {
+                    float dx = x + 0.5f - pos[0];
+                    float dy = y + 0.5f - pos[1];
+                    depth[(y - y0) * CPU_RENDER_TILE + (x - x0)] += lensPointDepth(std::sqrt(dx * dx + dy * dy));
+                }
+        }
+
+        for (int y = y0; y < y1; ++y)
+        {
+            float dy = params.pupilCenterY - y;
+            for (int x = x0; x < x1; ++x)
+            {
+                size_t i = (size_t)y * width + x;
+                float dx = params.pupilCenterX - x;
+                float d2 = dx * dx + dy * dy;
+
+                // gratings around the clear centre attenuated by the
+                // particles, black outside the pupil
+                float value = d2 > slid2 ? params.gratings[i] : 255.0f;
+                value = std::rint(value * lensTransmission(depth[(y - y0) * CPU_RENDER_TILE + (x - x0)]));
+                if (d2 > pupil2)
+                    value = 0.0f;
+
+                float p = value / 255.0f;
+                field[2 * i] = exponential[2 * i] * p;
+                field[2 * i + 1] = exponential[2 * i + 1] * p;
+            }
+        }
+    });
+}
+
+// compute_magnitude_kernel: Fresnel and FFT normalisation, then the shift
+void CpuRenderer::computeMagnitude(const CpuFrameParams& params)
+{
+    TRACE_SCOPE("magnitude", "cpu");
+    const int width = m_width;
+    const int height = m_height;
+    const int half = width / 2;
+    const float K = params.lambda * params.lambda * params.distance * params.distance;
+    const float* field = m_field.get();
+    float* fresnel = m_fresnel.get();
+
+    m_pool.parallelForTiles(width, height, CPU_RENDER_TILE, CPU_RENDER_TILE, [=](int x0, int y0, int x1, int y1) {
+        for (int y = y0; y < y1; ++y)
+        {
+            int sy = shiftSource(y, half, height);
+            for (int x = x0; x < x1; ++x)
+            {
+                int sx = shiftSource(x, half, width);
+                float color = 0.0f;
+                if (sx >= 0 && sy >= 0)
+                {
+                    size_t index = 2 * ((size_t)sy * width + sx);
+                    color = std::sqrt(field[index] * field[index] + field[index + 1] * field[index + 1]);
+                    color = color / K;
+                    color = color / width / height;
+                }
+                fresnel[(size_t)y * width + x] = color;
+            }
+        }
+    });
+
+    // the energy of the PSF, a row at a time so the sum is the same for
+    // any number of threads
+    std::vector<double> rowEnergy(height);
+    m_pool.parallelFor(0, height, CPU_RENDER_TILE, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y)
+        {
+            double energy = 0.0;
+            for (int x = 0; x < width; ++x)
+                energy += fresnel[y * width + x];
+            rowEnergy[y] = energy;
+        }
+    });
+    double energy = 0.0;
+    for (int y = 0; y < height; ++y)
+        energy += rowEnergy[y];
+    m_normFactor = energy > 0.0 ? (float)(energy / PSF_ENERGY) : 1.0f;
+}
+
+// spectral_blur: the centred PSF scaled to every wavelength, bilinear
+// with a zero border like the normalised image sampler, weighted with
+// the colour matching functions and taken to sRGB
+void CpuRenderer::spectralBlur(const CpuFrameParams& params)
+{
+    TRACE_SCOPE("spectral blur", "cpu");
+    const int width = m_width;
+    const int height = m_height;
+    const int samples = std::max(1, std::min(params.spectralSamples, CPU_RENDER_SPECTRAL_SAMPLES));
+    const float lambda = params.lambda * 1000 * 1000;   // nm
+    const float* fresnel = m_fresnel.get();
+    const float normFactor = m_normFactor;
+    const size_t planeSize = (size_t)width * height;
+    float* red = m_psf.get();
+    float* green = red + planeSize;
+    float* blue = green + planeSize;
+
+    // per wavelength colour weights, interpolated exactly like the kernel
+    float wavelengths[CPU_RENDER_SPECTRAL_SAMPLES];
+    float xyz[CPU_RENDER_SPECTRAL_SAMPLES][3];
+    for (int i = 0; i < samples; ++i)
+    {
+        float wavelength = (float)i / (float)samples;
+        wavelength = 390 + wavelength * 400;
+        wavelengths[i] = wavelength;
+
+        float fidx = wavelength - 390;
+        int idx = (int)fidx;
+        for (int k = 0; k < 3; ++k)
+        {
+            float v1 = spectrum[idx * 3 + k];
+            float v2 = spectrum[(idx + 1) * 3 + k];
+            xyz[i][k] = (v2 - v1) * (fidx - (idx + 1)) + v1;
+        }
+    }
+
+    // bilinear taps of one axis, taps outside the plane read texel 0 with
+    // a zero weight instead of the border colour
+    struct Taps
+    {
+        int first, second;
+        float firstWeight, secondWeight;
+    };
+    auto taps = [](float coordinate, int size) {
+        float t = coordinate * size - 0.5f;
+        float t0 = std::floor(t);
+        float weight = t - t0;
+        int i0 = (int)t0;
+        bool valid0 = i0 >= 0 && i0 < size;
+        bool valid1 = i0 + 1 >= 0 && i0 + 1 < size;
+        Taps result = {valid0 ? i0 : 0, valid1 ? i0 + 1 : 0,
+                       valid0 ? 1 - weight : 0.0f, valid1 ? weight : 0.0f};
+        return result;
+    };
+
+    m_pool.parallelForTiles(width, height, CPU_RENDER_TILE, CPU_RENDER_TILE, [&](int x0, int y0, int x1, int y1) {
+        // the column taps of the tile only depend on the wavelength
+        Taps columns[CPU_RENDER_SPECTRAL_SAMPLES][CPU_RENDER_TILE];
+        for (int i = 0; i < samples; ++i)
+            for (int px = x0; px < x1; ++px)
+            {
+                float x = (float)px / width - 0.5f;
+                columns[i][px - x0] = taps(x * lambda / wavelengths[i] + 0.5f, width);
+            }
+
+        float X[CPU_RENDER_TILE], Y[CPU_RENDER_TILE], Z[CPU_RENDER_TILE];
+        for (int py = y0; py < y1; ++py)
+        {
+            std::fill(X, X + CPU_RENDER_TILE, 0.0f);
+            std::fill(Y, Y + CPU_RENDER_TILE, 0.0f);
+            std::fill(Z, Z + CPU_RENDER_TILE, 0.0f);
+
+            float y = (float)py / height - 0.5f;
+            for (int i = 0; i < samples; ++i)
+            {
+                Taps rows = taps(y * lambda / wavelengths[i] + 0.5f, height);
+                const float* row0 = fresnel + (size_t)rows.first * width;
+                const float* row1 = fresnel + (size_t)rows.second * width;
+                const Taps* column = columns[i];
+
+                for (int k = 0; k < x1 - x0; ++k)
+                {
+                    const Taps& c = column[k];
+                    float intensity = rows.firstWeight * (c.firstWeight * row0[c.first] + c.secondWeight * row0[c.second]) +
+                                      rows.secondWeight * (c.firstWeight * row1[c.first] + c.secondWeight * row1[c.second]);
+                    X[k] += xyz[i][0] * intensity;
+                    Y[k] += xyz[i][1] * intensity;
+                    Z[k] += xyz[i][2] * intensity;
+                }
+            }
+
+            for (int k = 0; k < x1 - x0; ++k)
+            {
+                float cx = X[k] / samples / 21 / normFactor;
+                float cy = Y[k] / samples / 21 / normFactor;
+                float cz = Z[k] / samples / 21 / normFactor;
+
+                size_t index = (size_t)py * width + x0 + k;
+                red[index] = std::min(3.2404542f * cx - 1.5371385f * cy - 0.4985314f * cz, 1.0f);
+                green[index] = std::min(-0.9692660f * cx + 1.8760108f * cy + 0.0415560f * cz, 1.0f);
+                blue[index] = std::min(0.0556434f * cx - 0.2040259f * cy + 1.0572252f * cz, 1.0f);
+            }
+        }
+    });
+}
+
+// Forward transforms of the PSF planes, conv_of_ffts over the hermitian
+// halves and the inverse into the hdr planes. The products stay in
+// m_spectra for the local operator
+void CpuRenderer::convolve()
+{
+    TRACE_SCOPE("convolution", "cpu");
+    m_realPlan->forward(m_psf.get(), m_spectra.get());
+
+    size_t nValues = 3 * (size_t)(m_width / 2 + 1) * m_height;
+    float* psf = m_spectra.get();
+    const float* img = m_imageSpectra.get();
+
+    m_pool.parallelFor(0, nValues, (size_t)(m_width / 2 + 1) * CPU_RENDER_TILE, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            float x2 = psf[2 * i], y2 = psf[2 * i + 1];
+            float x3 = img[2 * i], y3 = img[2 * i + 1];
+            psf[2 * i] = x2 * x3 - y2 * y3;
+            psf[2 * i + 1] = x2 * y3 + y2 * x3;
+        }
+    });
+
+    m_realPlan->backward(m_spectra.get(), m_hdr.get());
+}
+
+// tm_reinhard_extended
+void CpuRenderer::toneMapExtended(const CpuFrameParams& params)
+{
+    TRACE_SCOPE("tone map", "cpu");
+    const int width = m_width;
+    const size_t planeSize = (size_t)m_width * m_height;
+    const float* red = m_hdr.get();
+    const float* green = red + planeSize;
+    const float* blue = green + planeSize;
+    unsigned int* frame = m_frame.get();
+    const float exposure = params.exposure;
+    const float Lwhite = params.Lwhite;
+    const float invGamma = 1.f / params.gamma;
+
+    m_pool.parallelForTiles(m_width, m_height, CPU_RENDER_TILE, CPU_RENDER_TILE, [=](int x0, int y0, int x1, int y1) {
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x)
+            {
+                size_t i = (size_t)y * width + x;
+                float r = red[i], g = green[i], b = blue[i];
+
+                float L = exposure * getLuminance(r, g, b);
+                float Ld = (L * (1.0f + L / (Lwhite * Lwhite))) / (1.0f + L);
+                frame[i] = packPixel(Ld * r / Lwhite, Ld * g / Lwhite, Ld * b / Lwhite, invGamma);
+            }
+    });
+}
+
+// tm_local_scale_spectra, the batched inverse and tm_reinhard_local
+void CpuRenderer::toneMapLocal(const CpuFrameParams& params)
+{
+    TRACE_SCOPE("tone map", "cpu");
+    const int width = m_width;
+    const int height = m_height;
+    const int specWidth = width / 2 + 1;
+    const size_t specSize = (size_t)specWidth * height;
+    const size_t planeSize = (size_t)width * height;
+    const int nScales = TM_LOCAL_SCALES;
+
+    if (!m_scalesPlan)
+    {
+        m_scalesPlan.reset(new CpuFFT(width, height, CPU_FFT_REAL, nScales + 1, &m_pool));
+        allocatePlanes(m_pool, m_scaleSpectra, 2 * (nScales + 1), specWidth, height);
+        allocatePlanes(m_pool, m_blurred, nScales + 1, width, height);
+    }
+
+    // STEP: luminance spectrum blurred at every scale
+    const float* redSpectrum = m_spectra.get();
+    const float* greenSpectrum = redSpectrum + 2 * specSize;
+    const float* blueSpectrum = greenSpectrum + 2 * specSize;
+    float* scaleSpectra = m_scaleSpectra.get();
+
+    m_pool.parallelFor(0, height, CPU_RENDER_TILE, [=](size_t rowBegin, size_t rowEnd) {
+        for (int yp = (int)rowBegin; yp < (int)rowEnd; ++yp)
+        {
+            float fy = (float)(yp <= height / 2 ? yp : yp - height) / height;
+            for (int xp = 0; xp < specWidth; ++xp)
+            {
+                size_t index = 2 * ((size_t)xp + (size_t)yp * specWidth);
+                float re = getLuminance(redSpectrum[index], greenSpectrum[index], blueSpectrum[index]);
+                float im = getLuminance(redSpectrum[index + 1], greenSpectrum[index + 1], blueSpectrum[index + 1]);
+
+                float fx = (float)xp / width;
+                float f2 = fx * fx + fy * fy;
+
+                float s = 1.0f;
+                for (int i = 0; i <= nScales; ++i)
+                {
+                    float as = TM_LOCAL_ALPHA1 * s;
+                    float g = std::exp(-PI * PI * as * as * f2);
+                    scaleSpectra[i * 2 * specSize + index] = re * g;
+                    scaleSpectra[i * 2 * specSize + index + 1] = im * g;
+                    s *= TM_LOCAL_RATIO;
+                }
+            }
+        }
+    });
+
+    m_scalesPlan->backward(m_scaleSpectra.get(), m_blurred.get());
+
+    // STEP: per pixel scale selection
+    const float* red = m_hdr.get();
+    const float* green = red + planeSize;
+    const float* blue = green + planeSize;
+    const float* blurred = m_blurred.get();
+    unsigned int* frame = m_frame.get();
+    const float exposure = params.exposure;
+    const float epsilon = params.epsilon;
+    const float sharpening = std::pow(2.0f, params.phi) * params.key;
+    const float invGamma = 1.f / params.gamma;
+
+    m_pool.parallelForTiles(width, height, CPU_RENDER_TILE, CPU_RENDER_TILE, [=](int x0, int y0, int x1, int y1) {
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x)
+            {
+                size_t index = (size_t)y * width + x;
+                float r = red[index], g = green[index], b = blue[index];
+
+                float Lw = getLuminance(r, g, b);
+                float L = exposure * Lw;
+
+                float adaptation = exposure * blurred[index];
+                float s = 1.0f;
+                for (int i = 0; i < nScales; ++i)
+                {
+                    float v1 = exposure * blurred[i * planeSize + index];
+                    float v2 = exposure * blurred[(i + 1) * planeSize + index];
+                    float v = (v1 - v2) / (sharpening / (s * s) + v1);
+
+                    if (std::fabs(v) >= epsilon)
+                        break;
+
+                    adaptation = v1;
+                    s *= TM_LOCAL_RATIO;
+                }
+
+                float Ld = L / (1.0f + adaptation);
+                float scale = Lw > 0.0f ? Ld / Lw : 0.0f;
+                frame[index] = packPixel(r * scale, g * scale, b * scale, invGamma);
+            }
+    });
+}
+
+// tm_log_luminance_range, tm_log_histogram, tm_histogram_cdf and
+// tm_histogram_adjustment. Chunks reduce privately and merge once
+void CpuRenderer::toneMapHistogram(const CpuFrameParams& params)
+{
+    TRACE_SCOPE("tone map", "cpu");
+    const int width = m_width;
+    const size_t nPixels = (size_t)m_width * m_height;
+    const float* red = m_hdr.get();
+    const float* green = red + nPixels;
+    const float* blue = green + nPixels;
+    const size_t grain = (size_t)width * CPU_RENDER_TILE;
+
+    auto logLuminance = [=](size_t i) {
+        return std::log(TM_HIST_DELTA + std::max(getLuminance(red[i], green[i], blue[i]), 0.0f));
+    };
+
+    // STEP: log luminance range
+    std::mutex mutex;
+    float logMin = HUGE_VALF;
+    float logMax = -HUGE_VALF;
+    m_pool.parallelFor(0, nPixels, grain, [&](size_t begin, size_t end) {
+        float lmin = HUGE_VALF;
+        float lmax = -HUGE_VALF;
+        for (size_t i = begin; i < end; ++i)
+        {
+            float l = logLuminance(i);
+            lmin = std::min(lmin, l);
+            lmax = std::max(lmax, l);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        logMin = std::min(logMin, lmin);
+        logMax = std::max(logMax, lmax);
+    });
+
+    // STEP: histogram
+    unsigned int histogram[TM_HIST_BINS] = {};
+    float scale = TM_HIST_BINS / std::max(logMax - logMin, 1e-6f);
+    m_pool.parallelFor(0, nPixels, grain, [&](size_t begin, size_t end) {
+        unsigned int localHist[TM_HIST_BINS] = {};
+        for (size_t i = begin; i < end; ++i)
+        {
+            int bin = (int)((logLuminance(i) - logMin) * scale);
+            localHist[std::min(std::max(bin, 0), TM_HIST_BINS - 1)]++;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int bin = 0; bin < TM_HIST_BINS; ++bin)
+            histogram[bin] += localHist[bin];
+    });
+
+    // STEP: ceiling clamped cdf
+    float logDisplayMin = std::log(params.displayMinLuminance);
+    float logDisplayMax = std::log(params.displayMaxLuminance);
+    float binWidth = (logMax - logMin) / TM_HIST_BINS;
+    float displayRange = logDisplayMax - logDisplayMin;
+
+    float counts[TM_HIST_BINS];
+    for (int bin = 0; bin < TM_HIST_BINS; ++bin)
+        counts[bin] = (float)histogram[bin];
+
+    for (int iteration = 0; iteration < TM_HIST_ITERATIONS; ++iteration)
+    {
+        float total = 0.0f;
+        for (int bin = 0; bin < TM_HIST_BINS; ++bin)
+            total += counts[bin];
+
+        float ceiling = total * binWidth / displayRange;
+        float trimmings = 0.0f;
+        for (int bin = 0; bin < TM_HIST_BINS; ++bin)
+            trimmings += std::max(counts[bin] - ceiling, 0.0f);
+
+        if (trimmings <= TM_HIST_TOLERANCE * total)
+            break;
+
+        for (int bin = 0; bin < TM_HIST_BINS; ++bin)
+            counts[bin] -= std::max(counts[bin] - ceiling, 0.0f);
+    }
+
+    float cdf[TM_HIST_BINS];
+    float sum = 0.0f;
+    for (int bin = 0; bin < TM_HIST_BINS; ++bin)
+    {
+        sum += counts[bin];
+        cdf[bin] = sum;
+    }
+    for (int bin = 0; bin < TM_HIST_BINS; ++bin)
+        cdf[bin] = sum > 0.0f ? cdf[bin] / sum : (float)(bin + 1) / TM_HIST_BINS;
+
+    // STEP: tone mapping
+    unsigned int* frame = m_frame.get();
+    const float logWorldRange = std::max(logMax - logMin, 1e-6f);
+    const float invGamma = 1.f / params.gamma;
+
+    m_pool.parallelForTiles(m_width, m_height, CPU_RENDER_TILE, CPU_RENDER_TILE, [&](int x0, int y0, int x1, int y1) {
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x)
+            {
+                size_t index = (size_t)y * width + x;
+                float r = red[index], g = green[index], b = blue[index];
+                float Lw = getLuminance(r, g, b);
+                float l = std::log(TM_HIST_DELTA + std::max(Lw, 0.0f));
+                float Bde;
+
+                if (logWorldRange <= displayRange)
+                {
+                    // the scene fits on the display, a linear operator is enough
+                    Bde = logDisplayMax - (logMax - l);
+                }
+                else
+                {
+                    float t = std::min(std::max((l - logMin) / logWorldRange * TM_HIST_BINS, 0.0f), (float)TM_HIST_BINS);
+                    int bin = std::min((int)t, TM_HIST_BINS - 1);
+                    float lower = bin > 0 ? cdf[bin - 1] : 0.0f;
+                    float P = lower + (cdf[bin] - lower) * (t - bin);
+
+                    Bde = logDisplayMin + displayRange * P;
+                }
+
+                float Ld = std::exp(Bde - logDisplayMax);
+                float colorScale = Lw > 0.0f ? Ld / Lw : 0.0f;
+                frame[index] = packPixel(r * colorScale, g * colorScale, b * colorScale, invGamma);
+            }
+    });
+}
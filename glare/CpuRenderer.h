@@ -0,0 +1,125 @@
+#ifndef CPURENDERER_H
+#define CPURENDERER_H
+
+#include "CpuFFT.h"
+#include "FrameTimings.h"
+#include "ThreadPool.h"
+
+#include <memory>
+#include <vector>
+
+class Image;
+
+// Side of the square tiles the per pixel stages are scheduled in. A tile
+// of every plane a stage touches stays in L2
+#define CPU_RENDER_TILE 64
+
+// Most wavelengths the spectral blur integrates over, like spectral_blur
+#define CPU_RENDER_SPECTRAL_SAMPLES 32
+
+// Everything a frame depends on besides the image
+struct CpuFrameParams
+{
+    // aperture, in PSF pixels
+    float pupilRadius;
+    float pupilCenterX;
+    float pupilCenterY;
+    float slidRadius;               // deformed radius of the clear lens centre
+    const unsigned char* gratings;  // grey gratings texture, frame sized
+    const float* points;            // lens particles, x, dx, y, dy each
+    int nPoints;
+    float distort;
+
+    // Fresnel propagation
+    float lambda;                   // mm
+    float distance;                 // mm
+    float maxPupilSize;             // mm covered by the frame height
+    int spectralSamples;            // up to CPU_RENDER_SPECTRAL_SAMPLES
+
+    // tone mapping, see the kernels of the same operators
+    int toneMapOperator;
+    float exposure;
+    float key;                      // local operator
+    float gamma;
+    float Lwhite;
+    float phi;
+    float epsilon;
+    float displayMinLuminance;
+    float displayMaxLuminance;
+};
+
+// The whole glare pipeline on the host, for machines without a usable
+// OpenCL device: aperture, Fresnel term, PSF transform, spectral blur,
+// convolution and tone mapping. Follows the OpenCL kernels step by step,
+// the transforms are CpuFFT plans and the per pixel stages run in
+// CPU_RENDER_TILE tiles, all of it on the renderer's own ThreadPool.
+// The PSF is generated at the frame size.
+class CpuRenderer
+{
+public:
+    // nThreads = 0 uses every hardware thread, see ThreadPool for pinning
+    explicit CpuRenderer(unsigned int nThreads = 0, bool pinThreads = false);
+    ~CpuRenderer();
+
+    CpuRenderer(const CpuRenderer&) = delete;
+    CpuRenderer& operator=(const CpuRenderer&) = delete;
+
+    // Transforms the channels of the image, which must have its host
+    // pixels. The frame size follows the image
+    void setImage(const Image& image);
+    void render(const CpuFrameParams& params);
+
+    int getWidth() const { return m_width; }
+    int getHeight() const { return m_height; }
+    unsigned int getThreadCount() const { return m_pool.size(); }
+    // Stage timings of the last render
+    const FrameTimings& getTimings() const { return m_timings; }
+
+    // Tone mapped frame as native endian 0xAARRGGBB words
+    unsigned char* getFrame() { return (unsigned char*)m_frame.get(); }
+    // Linear red, green and blue planes of the frame
+    const float* getHdr(int c) const { return m_hdr.get() + (size_t)c * m_width * m_height; }
+
+private:
+    void updateComplexExponential(const CpuFrameParams& params);
+    void binLensPoints(const CpuFrameParams& params, int tilesX, int tilesY);
+    void renderAperture(const CpuFrameParams& params);
+    void computeMagnitude(const CpuFrameParams& params);
+    void spectralBlur(const CpuFrameParams& params);
+    void convolve();
+    void toneMapExtended(const CpuFrameParams& params);
+    void toneMapLocal(const CpuFrameParams& params);
+    void toneMapHistogram(const CpuFrameParams& params);
+
+    ThreadPool m_pool;
+    FrameTimings m_timings;
+
+    int m_width;
+    int m_height;
+
+    std::unique_ptr<CpuFFT> m_complexPlan;  // aperture to field
+    std::unique_ptr<CpuFFT> m_realPlan;     // three planes at once
+    std::unique_ptr<CpuFFT> m_scalesPlan;   // luminance pyramid, made on first use
+
+    // Fresnel term and the parameters it was computed for
+    std::vector<float> m_complexExponential;
+    float m_exponentialLambda;
+    float m_exponentialDistance;
+    float m_exponentialMaxPupil;
+
+    std::unique_ptr<float[]> m_imageSpectra;        // three hermitian planes
+    std::vector<float> m_pointScreen;               // aperture position of each particle
+    std::vector<unsigned int> m_tileOffsets;        // first entry of each tile, then the total
+    std::vector<unsigned int> m_tileEntries;        // particles by tile
+    std::unique_ptr<float[]> m_field;               // aperture, then its transform
+    std::unique_ptr<float[]> m_fresnel;             // centred PSF magnitude
+    float m_normFactor;                             // its sum over PSF_ENERGY, see GlareConstants.h
+    std::unique_ptr<float[]> m_psf;                 // red, green and blue PSF
+    std::unique_ptr<float[]> m_spectra;             // PSF spectra, then the products
+    std::unique_ptr<float[]> m_scaleSpectra;
+    std::unique_ptr<float[]> m_blurred;
+    std::unique_ptr<float[]> m_hdr;
+    std::unique_ptr<unsigned int[]> m_frame;
+};
+
+#endif // CPURENDERER_H
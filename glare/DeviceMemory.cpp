@@ -0,0 +1,205 @@
+#include "DeviceMemory.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+
+static const char* stageNames[MEMORY_STAGES] = {
+    "image", "staging", "aperture", "psf", "convolution", "tone_map", "tiles"
+};
+
+const char* memoryStageName(int stage)
+{
+    return stage >= 0 && stage < MEMORY_STAGES ? stageNames[stage] : "";
+}
+
+// Bytes of a pixel of the formats the renderer uses
+static size_t pixelBytes(const cl::ImageFormat& format)
+{
+    size_t channels = format.image_channel_order == CL_R || format.image_channel_order == CL_A ? 1 :
+                      format.image_channel_order == CL_RG ? 2 : 4;
+    switch (format.image_channel_data_type)
+    {
+    case CL_FLOAT:
+    case CL_UNSIGNED_INT32:
+    case CL_SIGNED_INT32:
+        return channels * 4;
+    case CL_HALF_FLOAT:
+    case CL_UNSIGNED_INT16:
+    case CL_UNORM_INT16:
+        return channels * 2;
+    default:
+        return channels;
+    }
+}
+
+static double megabytes(unsigned long long bytes)
+{
+    return bytes / (1024.0 * 1024.0);
+}
+
+void printMemoryUsage(std::ostream& out, const MemoryUsage& usage)
+{
+    std::streamsize precision = out.precision(1);
+    std::ios::fmtflags flags = out.setf(std::ios::fixed, std::ios::floatfield);
+
+    for (int stage = 0; stage < MEMORY_STAGES; ++stage)
+        if (usage.peak[stage] > 0)
+            out << "  " << memoryStageName(stage) << ": " << megabytes(usage.current[stage]) << " MB, peak "
+                << megabytes(usage.peak[stage]) << " MB\n";
+    out << "  total: " << megabytes(usage.total) << " MB in " << usage.allocations << " allocations, peak "
+        << megabytes(usage.peakTotal) << " MB";
+    if (usage.budget > 0)
+        out << " of a " << megabytes(usage.budget) << " MB budget";
+    out << "\n";
+
+    out.precision(precision);
+    out.flags(flags);
+}
+
+struct DeviceMemory::Counters
+{
+    std::mutex mutex;
+    MemoryUsage usage;
+    bool overBudget;        // reported until the total is back under
+};
+
+// user data of a destructor callback
+struct DeviceMemory::Allocation
+{
+    std::shared_ptr<Counters> counters;
+    MemoryStage stage;
+    size_t size;
+};
+
+DeviceMemory::DeviceMemory() :
+    m_counters(new Counters)
+{
+    m_counters->usage = MemoryUsage();
+    m_counters->overBudget = false;
+}
+
+cl::Buffer DeviceMemory::buffer(MemoryStage stage, const cl::Context& context, cl_mem_flags flags, size_t size,
+                                void* host)
+{
+    try {
+        cl::Buffer buffer(context, flags, size, host);
+        track(stage, buffer);
+        return buffer;
+    } catch(cl::Error err) {
+        failed(stage, size, err);
+        throw;
+    }
+}
+
+cl::Image2D DeviceMemory::image(MemoryStage stage, const cl::Context& context, cl_mem_flags flags,
+                                const cl::ImageFormat& format, size_t width, size_t height, void* host)
+{
+    try {
+        // the format is made in place, the implicit copy of cl::ImageFormat is deprecated
+        cl::Image2D image(context, flags, cl::ImageFormat(format.image_channel_order, format.image_channel_data_type),
+                          width, height, 0, host);
+        track(stage, image);
+        return image;
+    } catch(cl::Error err) {
+        failed(stage, width * height * pixelBytes(format), err);
+        throw;
+    }
+}
+
+void DeviceMemory::setBudget(unsigned long long bytes)
+{
+    std::lock_guard<std::mutex> lock(m_counters->mutex);
+    m_counters->usage.budget = bytes;
+    m_counters->overBudget = false;
+}
+
+unsigned long long DeviceMemory::getBudget() const
+{
+    std::lock_guard<std::mutex> lock(m_counters->mutex);
+    return m_counters->usage.budget;
+}
+
+MemoryUsage DeviceMemory::getUsage() const
+{
+    std::lock_guard<std::mutex> lock(m_counters->mutex);
+    return m_counters->usage;
+}
+
+void DeviceMemory::resetPeak()
+{
+    std::lock_guard<std::mutex> lock(m_counters->mutex);
+    MemoryUsage& usage = m_counters->usage;
+    for (int stage = 0; stage < MEMORY_STAGES; ++stage)
+        usage.peak[stage] = usage.current[stage];
+    usage.peakTotal = usage.total;
+}
+
+void DeviceMemory::track(MemoryStage stage, const cl::Memory& memory)
+{
+    size_t size = memory.getInfo<CL_MEM_SIZE>();
+    MemoryUsage usage;
+    bool report = false;
+    double totalMb;
+    {
+        std::lock_guard<std::mutex> lock(m_counters->mutex);
+        MemoryUsage& counted = m_counters->usage;
+        counted.current[stage] += size;
+        counted.peak[stage] = std::max(counted.peak[stage], counted.current[stage]);
+        counted.total += size;
+        counted.peakTotal = std::max(counted.peakTotal, counted.total);
+        ++counted.allocations;
+        totalMb = megabytes(counted.total);
+
+        if (counted.budget > 0 && counted.total > counted.budget && !m_counters->overBudget)
+        {
+            m_counters->overBudget = true;
+            report = true;
+            usage = counted;
+        }
+    }
+
+    TRACE_COUNTER("device memory MB", totalMb);
+    (void)totalMb;
+
+    Allocation* allocation = new Allocation{ m_counters, stage, size };
+    if (clSetMemObjectDestructorCallback(memory(), released, allocation) != CL_SUCCESS)
+    {
+        // without the callback the bytes could never be taken off again
+        released(memory(), allocation);
+    }
+
+    if (report)
+    {
+        std::cout << "Warning: device memory over the budget with " << (size >> 20) << " MB for "
+                  << memoryStageName(stage) << "\n";
+        printMemoryUsage(std::cout, usage);
+    }
+}
+
+void DeviceMemory::failed(MemoryStage stage, size_t size, const cl::Error& err) const
+{
+    std::cout << "ERROR: could not allocate " << (size >> 20) << " MB of device memory for "
+              << memoryStageName(stage) << ": " << err.what() << " (" << err.err() << ")\n";
+    printMemoryUsage(std::cout, getUsage());
+}
+
+void CL_CALLBACK DeviceMemory::released(cl_mem, void* data)
+{
+    Allocation* allocation = (Allocation*)data;
+    double totalMb;
+    {
+        std::lock_guard<std::mutex> lock(allocation->counters->mutex);
+        MemoryUsage& usage = allocation->counters->usage;
+        usage.current[allocation->stage] -= allocation->size;
+        usage.total -= allocation->size;
+        --usage.allocations;
+        if (usage.total <= usage.budget)
+            allocation->counters->overBudget = false;
+        totalMb = megabytes(usage.total);
+    }
+    TRACE_COUNTER("device memory MB", totalMb);
+    (void)totalMb;
+    delete allocation;
+}
@@ -0,0 +1,73 @@
+#ifndef DEVICEMEMORY_H
+#define DEVICEMEMORY_H
+
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include <memory>
+#include <ostream>
+
+// What a device allocation is for
+enum MemoryStage
+{
+    MEMORY_IMAGE = 0,       // image spectra and the tone mapped frame
+    MEMORY_STAGING,         // pinned upload and readback planes
+    MEMORY_APERTURE,        // pupil, gratings, lens particles and the complex aperture
+    MEMORY_PSF,             // PSF transform, magnitude and spectral blur
+    MEMORY_CONVOLUTION,     // PSF spectra, products and the linear result
+    MEMORY_TONE_MAP,
+    MEMORY_TILES,           // slots and spectra of the tiled convolution
+    MEMORY_STAGES
+};
+
+const char* memoryStageName(int stage);
+
+struct MemoryUsage
+{
+    unsigned long long current[MEMORY_STAGES];
+    unsigned long long peak[MEMORY_STAGES];
+    unsigned long long total;
+    unsigned long long peakTotal;
+    unsigned long long budget;      // 0 without one
+    int allocations;                // alive
+};
+
+// One line per stage with current and peak MB, then the totals
+void printMemoryUsage(std::ostream& out, const MemoryUsage& usage);
+
+// Accounting allocator of the renderer's device memory. Buffers and images
+// are made here with the stage they belong to, and their bytes count
+// until the driver deletes them: a destructor callback takes them off, so
+// the wrappers can be copied and dropped as usual. An allocation that
+// fails is reported with what is resident before the error goes on. The
+// budget is only checked, the renderer plans its buffers to stay under it
+class DeviceMemory
+{
+public:
+    DeviceMemory();
+
+    cl::Buffer buffer(MemoryStage stage, const cl::Context& context, cl_mem_flags flags, size_t size,
+                      void* host = NULL);
+    cl::Image2D image(MemoryStage stage, const cl::Context& context, cl_mem_flags flags,
+                      const cl::ImageFormat& format, size_t width, size_t height, void* host = NULL);
+
+    void setBudget(unsigned long long bytes);
+    unsigned long long getBudget() const;
+
+    MemoryUsage getUsage() const;
+    // peaks start again from what is allocated now
+    void resetPeak();
+
+private:
+    struct Counters;
+    struct Allocation;
+
+    void track(MemoryStage stage, const cl::Memory& memory);
+    void failed(MemoryStage stage, size_t size, const cl::Error& err) const;
+    static void CL_CALLBACK released(cl_mem memory, void* data);
+
+    // shared with the callbacks, which may come after the renderer is gone
+    std::shared_ptr<Counters> m_counters;
+};
+
+#endif // DEVICEMEMORY_H
@@ -0,0 +1,276 @@
+#include "ExrSequence.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <glob.h>
+#endif
+
+static bool fileExists(const std::string& path)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    return file.good();
+}
+
+static std::vector<std::string> globFiles(const std::string& pattern)
+{
+    std::vector<std::string> paths;
+#if defined(_WIN32)
+    std::string directory;
+    size_t slash = pattern.find_last_of("/\\");
+    if (slash != std::string::npos)
+        directory = pattern.substr(0, slash + 1);
+
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern.c_str(), &data);
+    if (find != INVALID_HANDLE_VALUE)
+    {
+        do {
+            if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+                paths.push_back(directory + data.cFileName);
+        } while (FindNextFileA(find, &data));
+        FindClose(find);
+    }
+#else
+    glob_t result;
+    if (glob(pattern.c_str(), 0, NULL, &result) == 0)
+    {
+        for (size_t i = 0; i < result.gl_pathc; ++i)
+            paths.push_back(result.gl_pathv[i]);
+    }
+    globfree(&result);
+#endif
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+// Splits "shot.%04d.exr" into prefix, width and suffix. Only a single %d
+// conversion is accepted, the pattern is never used as a format string
+static bool parseFramePattern(const std::string& pattern, std::string& prefix, int& width, std::string& suffix)
+{
+    size_t percent = pattern.find('%');
+    if (percent == std::string::npos)
+        return false;
+
+    size_t i = percent + 1;
+    width = 0;
+    while (i < pattern.size() && pattern[i] >= '0' && pattern[i] <= '9')
+        width = width * 10 + (pattern[i++] - '0');
+
+    if (i >= pattern.size() || pattern[i] != 'd' || width > 16)
+        return false;
+
+    prefix = pattern.substr(0, percent);
+    suffix = pattern.substr(i + 1);
+    return suffix.find('%') == std::string::npos;
+}
+
+static std::string framePath(const std::string& prefix, int width, const std::string& suffix, int frame)
+{
+    std::string number = std::to_string(frame);
+    if ((int)number.size() < width)
+        number.insert(0, width - number.size(), '0');
+    return prefix + number + suffix;
+}
+
+std::vector<std::string> ExrSequence::expandPattern(const std::string& pattern)
+{
+    if (pattern.find_first_of("*?[") != std::string::npos)
+        return globFiles(pattern);
+
+    std::string prefix, suffix;
+    int width;
+    if (!parseFramePattern(pattern, prefix, width, suffix))
+        return fileExists(pattern) ? std::vector<std::string>(1, pattern) : std::vector<std::string>();
+
+    // frames run from the first existing number up to the first gap
+    int first = 0;
+    while (first <= EXR_SEQUENCE_MAX_START && !fileExists(framePath(prefix, width, suffix, first)))
+        ++first;
+
+    std::vector<std::string> paths;
+    if (first > EXR_SEQUENCE_MAX_START)
+        return paths;
+
+    for (int frame = first; ; ++frame)
+    {
+        std::string path = framePath(prefix, width, suffix, frame);
+        if (!fileExists(path))
+            break;
+        paths.push_back(path);
+    }
+    return paths;
+}
+
+std::string ExrSequence::formatPattern(const std::string& pattern, int frame)
+{
+    std::string prefix, suffix;
+    int width;
+    if (!parseFramePattern(pattern, prefix, width, suffix))
+        return pattern;
+    return framePath(prefix, width, suffix, frame);
+}
+
+
+ExrSequence::ExrSequence(const std::string& pattern, int prefetch, int nDecoders, PixelPrecision precision)
+    : m_paths(expandPattern(pattern))
+    , m_precision(precision)
+{
+    if (m_paths.empty())
+        std::cerr << "Error: No EXR frames match " << pattern << std::endl;
+    start(prefetch, nDecoders);
+}
+
+ExrSequence::ExrSequence(const std::vector<std::string>& paths, int prefetch, int nDecoders, PixelPrecision precision)
+    : m_paths(paths)
+    , m_precision(precision)
+{
+    start(prefetch, nDecoders);
+}
+
+ExrSequence::~ExrSequence()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_spaceAvailable.notify_all();
+    m_frameReady.notify_all();
+
+    for (std::thread& decoder : m_decoders)
+        decoder.join();
+}
+
+int ExrSequence::defaultDecoders()
+{
+    int threads = (int)std::thread::hardware_concurrency();
+    return std::max(1, std::min(threads - 1, (int)EXR_SEQUENCE_MAX_DECODERS));
+}
+
+void ExrSequence::start(int prefetch, int nDecoders)
+{
+    if (nDecoders <= 0)
+        nDecoders = defaultDecoders();
+    // a decoder claims its slot before it starts, two more slots keep
+    // frames ready while all of them are busy
+    prefetch = std::max(prefetch, nDecoders + 2);
+
+    m_slots.resize(prefetch);
+    m_slotFrame.assign(prefetch, (size_t)-1);
+    m_nextDecode = 0;
+    m_nextConsume = 0;
+    m_stop = false;
+
+    m_startTime = std::chrono::steady_clock::now();
+    m_decodedFrames = 0;
+    m_decodeSeconds = 0.0;
+
+    if (m_paths.empty())
+        return;
+
+    for (int i = 0; i < nDecoders; ++i)
+        m_decoders.push_back(std::thread(&ExrSequence::decoderLoop, this));
+}
+
+void ExrSequence::decoderLoop()
+{
+    TRACE_THREAD_NAME("exr decoder");
+    for (;;)
+    {
+        size_t frame;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_spaceAvailable.wait(lock, [this] {
+                return m_stop || m_nextDecode < m_nextConsume + m_slots.size();
+            });
+            if (m_stop)
+                return;
+            frame = m_nextDecode++;
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        std::unique_ptr<Image> image;
+        {
+            TRACE_SCOPE("decode", "io");
+            image.reset(new Image(getPath(frame), PIXEL_LAYOUT_PLANAR, m_precision));
+        }
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - begin;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            size_t slot = frame % m_slots.size();
+            m_slots[slot] = std::move(image);
+            m_slotFrame[slot] = frame;
+            ++m_decodedFrames;
+            m_decodeSeconds += seconds.count();
+        }
+        m_frameReady.notify_all();
+    }
+}
+
+// called with m_mutex held once the next frame is in its slot
+std::unique_ptr<Image> ExrSequence::takeFrame()
+{
+    size_t slot = m_nextConsume % m_slots.size();
+    std::unique_ptr<Image> image = std::move(m_slots[slot]);
+    m_slotFrame[slot] = (size_t)-1;
+    ++m_nextConsume;
+
+    m_spaceAvailable.notify_all();
+    return image;
+}
+
+std::unique_ptr<Image> ExrSequence::nextFrame()
+{
+    if (m_paths.empty())
+        return nullptr;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_frameReady.wait(lock, [this] {
+        return m_stop || m_slotFrame[m_nextConsume % m_slots.size()] == m_nextConsume;
+    });
+    if (m_stop)
+        return nullptr;
+    return takeFrame();
+}
+
+std::unique_ptr<Image> ExrSequence::tryNextFrame()
+{
+    if (m_paths.empty())
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_slotFrame[m_nextConsume % m_slots.size()] != m_nextConsume)
+        return nullptr;
+    return takeFrame();
+}
+
+size_t ExrSequence::getNextFrameIndex() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_paths.empty() ? 0 : m_nextConsume % m_paths.size();
+}
+
+double ExrSequence::getDecodeFps() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - m_startTime;
+    return seconds.count() > 0.0 ? m_decodedFrames / seconds.count() : 0.0;
+}
+
+double ExrSequence::getAverageDecodeMs() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_decodedFrames > 0 ? 1000.0 * m_decodeSeconds / m_decodedFrames : 0.0;
+}
+
+size_t ExrSequence::getDecodedFrames() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_decodedFrames;
+}
@@ -0,0 +1,102 @@
+#ifndef EXRSEQUENCE_H
+#define EXRSEQUENCE_H
+
+#include "image.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Frames decoded ahead of the one being shown, raised to two more than
+// there are decoders
+#define EXR_SEQUENCE_PREFETCH 4
+// Decoders are one per hardware thread but the caller's, up to this many:
+// every one of them holds a frame in the ring. A 1920x1080 ZIP frame
+// takes about 110 ms on one core, 9 fps per decoder, so 24 fps needs
+// three decoders on cores of their own
+#define EXR_SEQUENCE_MAX_DECODERS 8
+
+// Highest first frame number a printf pattern is probed for
+#define EXR_SEQUENCE_MAX_START 10000
+
+// EXR frames decoded on background threads into a bounded ring. Decoders
+// stop once the ring is full and resume as frames are taken, so a slow
+// consumer never makes the sequence grow in memory. The sequence loops.
+class ExrSequence
+{
+public:
+    // pattern is printf style ("shot.%04d.exr") or a glob ("shot/*.exr").
+    // nDecoders <= 0 uses defaultDecoders()
+    explicit ExrSequence(const std::string& pattern,
+                         int prefetch = EXR_SEQUENCE_PREFETCH,
+                         int nDecoders = 0,
+                         PixelPrecision precision = PIXEL_PRECISION_FLOAT);
+    // explicit list of frames, shown in the given order
+    explicit ExrSequence(const std::vector<std::string>& paths,
+                         int prefetch = EXR_SEQUENCE_PREFETCH,
+                         int nDecoders = 0,
+                         PixelPrecision precision = PIXEL_PRECISION_FLOAT);
+    ~ExrSequence();
+
+    ExrSequence(const ExrSequence&) = delete;
+    ExrSequence& operator=(const ExrSequence&) = delete;
+
+    size_t size() const { return m_paths.size(); }
+    bool empty() const { return m_paths.empty(); }
+    const std::string& getPath(size_t frame) const { return m_paths[frame % m_paths.size()]; }
+
+    // Next frame in order, waits for it to be decoded
+    std::unique_ptr<Image> nextFrame();
+    // Next frame in order if it is already decoded, nullptr otherwise
+    std::unique_ptr<Image> tryNextFrame();
+
+    // Index in the sequence of the frame nextFrame returns
+    size_t getNextFrameIndex() const;
+
+    // Decoded frames per second since the sequence was opened, and the
+    // average time one decoder spends on a frame
+    double getDecodeFps() const;
+    double getAverageDecodeMs() const;
+    size_t getDecodedFrames() const;
+    int getDecoderCount() const { return (int)m_decoders.size(); }
+
+    // One decoder per hardware thread but one, at least one and at most
+    // EXR_SEQUENCE_MAX_DECODERS
+    static int defaultDecoders();
+
+    static std::vector<std::string> expandPattern(const std::string& pattern);
+    // Path of frame number frame in a printf style pattern, other
+    // patterns are returned as they are
+    static std::string formatPattern(const std::string& pattern, int frame);
+
+private:
+    void start(int prefetch, int nDecoders);
+    void decoderLoop();
+    std::unique_ptr<Image> takeFrame();
+
+    std::vector<std::string> m_paths;
+    PixelPrecision m_precision;
+
+    // slot n % prefetch holds frame n once m_slotFrame says so
+    std::vector<std::unique_ptr<Image> > m_slots;
+    std::vector<size_t> m_slotFrame;
+    size_t m_nextDecode;
+    size_t m_nextConsume;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_spaceAvailable;
+    std::condition_variable m_frameReady;
+    bool m_stop;
+
+    std::vector<std::thread> m_decoders;
+
+    std::chrono::steady_clock::time_point m_startTime;
+    size_t m_decodedFrames;
+    double m_decodeSeconds;
+};
+
+#endif // EXRSEQUENCE_H
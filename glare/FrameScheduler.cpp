@@ -0,0 +1,171 @@
+#include "FrameScheduler.h"
+
+#include <algorithm>
+
+// best first, each level a little cheaper than the one before
+static const RenderQuality qualityLevels[] = {
+    {1.0f,   32},
+    {1.0f,   16},
+    {0.75f,  16},
+    {0.5f,   16},
+    {0.5f,   8},
+    {0.375f, 8},
+    {0.25f,  8}
+};
+static const int nQualityLevels = sizeof(qualityLevels) / sizeof(qualityLevels[0]);
+
+FrameScheduler::FrameScheduler(double targetFps) :
+    m_targetFps(FRAME_SCHEDULER_FPS), m_adaptive(true), m_started(false), m_accumulator(0.0),
+    m_level(0), m_overBudget(0), m_underBudget(0), m_settle(0), m_averageMs(0.0)
+{
+    setTargetFps(targetFps);
+}
+
+void FrameScheduler::setTargetFps(double fps)
+{
+    m_targetFps = fps > 0.0 ? fps : FRAME_SCHEDULER_FPS;
+    m_overBudget = 0;
+    m_underBudget = 0;
+}
+
+double FrameScheduler::getBudgetMs() const
+{
+    return 1000.0 / m_targetFps * FRAME_SCHEDULER_HEADROOM;
+}
+
+void FrameScheduler::setAdaptive(bool adaptive)
+{
+    m_adaptive = adaptive;
+    if (!adaptive)
+        m_level = 0;
+    m_overBudget = 0;
+    m_underBudget = 0;
+}
+
+float FrameScheduler::beginFrame()
+{
+    Clock::time_point now = Clock::now();
+    Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / m_targetFps));
+
+    if (!m_started)
+    {
+        m_started = true;
+        m_lastBegin = now;
+        m_nextDeadline = now + period;
+        return 0.0f;
+    }
+
+    m_accumulator += std::chrono::duration<double>(now - m_lastBegin).count();
+    m_lastBegin = now;
+
+    // whole steps only, a long stall is not caught up on
+    double step = 1.0 / m_targetFps;
+    int steps = (int)(m_accumulator / step);
+    if (steps > FRAME_SCHEDULER_MAX_STEPS)
+    {
+        steps = FRAME_SCHEDULER_MAX_STEPS;
+        m_accumulator = 0.0;
+    }
+    else
+    {
+        m_accumulator -= steps * step;
+    }
+
+    // a frame more than a period late starts a new schedule
+    m_nextDeadline += period;
+    if (m_nextDeadline < now)
+        m_nextDeadline = now + period;
+
+    return (float)(steps * step);
+}
+
+void FrameScheduler::endFrame(const FrameTimings& timings)
+{
+    double ms = timings.total;
+    m_averageMs = m_averageMs <= 0.0 ? ms : 0.8 * m_averageMs + 0.2 * ms;
+
+    if (!m_adaptive)
+        return;
+    if (m_settle > 0)
+    {
+        --m_settle;
+        return;
+    }
+
+    double budget = getBudgetMs();
+    int level = m_level;
+
+    if (ms > budget)
+    {
+        m_underBudget = 0;
+        if (++m_overBudget >= FRAME_SCHEDULER_DOWN_FRAMES && m_level + 1 < nQualityLevels)
+        {
+            // straight to the best level expected to fit
+            level = m_level + 1;
+            while (level + 1 < nQualityLevels && estimateMs(timings, level) > budget)
+                ++level;
+        }
+    }
+    else
+    {
+        m_overBudget = 0;
+        if (m_level > 0 && estimateMs(timings, m_level - 1) < budget * 0.8)
+        {
+            if (++m_underBudget >= FRAME_SCHEDULER_UP_FRAMES)
+                level = m_level - 1;
+        }
+        else
+        {
+            m_underBudget = 0;
+        }
+    }
+
+    if (level != m_level)
+    {
+        m_level = level;
+        m_overBudget = 0;
+        m_underBudget = 0;
+        m_settle = FRAME_SCHEDULER_SETTLE_FRAMES;
+    }
+}
+
+int FrameScheduler::msUntilNextFrame() const
+{
+    if (!m_started)
+        return 0;
+
+    double ms = std::chrono::duration<double, std::milli>(m_nextDeadline - Clock::now()).count();
+    return std::max(0, (int)ms);
+}
+
+const RenderQuality& FrameScheduler::getQuality() const
+{
+    return qualityLevels[m_level];
+}
+
+int FrameScheduler::getQualityLevels()
+{
+    return nQualityLevels;
+}
+
+const RenderQuality& FrameScheduler::getQuality(int level)
+{
+    return qualityLevels[std::max(0, std::min(level, nQualityLevels - 1))];
+}
+
+// Cost of a frame at level from the stages measured at the current one.
+// The per pixel stages scale with the pixel count, the spectral blur also
+// with the sample count, the rest stays
+double FrameScheduler::estimateMs(const FrameTimings& timings, int level) const
+{
+    const RenderQuality& from = qualityLevels[m_level];
+    const RenderQuality& to = qualityLevels[level];
+
+    double area = (double)(to.scale * to.scale) / (from.scale * from.scale);
+    double samples = (double)to.spectralSamples / from.spectralSamples;
+    double stages = timings.aperture + timings.spectral + timings.convolution + timings.toneMap;
+    double rest = std::max(0.0, (double)timings.total - stages);
+
+    return rest + (timings.aperture + timings.convolution + timings.toneMap) * area +
+           timings.spectral * area * samples;
+}
@@ -0,0 +1,88 @@
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include "FrameTimings.h"
+
+#include <chrono>
+
+// Interactive frame rate the viewer aims for
+#define FRAME_SCHEDULER_FPS 60.0
+// Share of the frame period the renderer may use, the rest is left for
+// the display and the event loop
+#define FRAME_SCHEDULER_HEADROOM 0.85
+// Simulation steps one frame may catch up on before time is dropped
+#define FRAME_SCHEDULER_MAX_STEPS 4
+// Frames over budget before the quality is lowered, frames with room for
+// the next level before it is raised, and frames ignored after a change
+// while plans and buffers are rebuilt
+#define FRAME_SCHEDULER_DOWN_FRAMES 3
+#define FRAME_SCHEDULER_UP_FRAMES 30
+#define FRAME_SCHEDULER_SETTLE_FRAMES 3
+
+// Internal resolution of the glare pipeline. scale applies to both image
+// axes, so the PSF and the convolution shrink with its square
+struct RenderQuality
+{
+    float scale;
+    int spectralSamples;
+};
+
+// Paces frames at a target rate and keeps the renderer inside the frame
+// budget. Simulation time advances in fixed steps of one frame period, so
+// particles and the pupil move the same at any rendering speed. After
+// each frame the stage timings go to a controller that moves between
+// quality levels: it estimates what each level would cost from how the
+// stages scale with the pixel and spectral sample counts, drops a level
+// as soon as frames run over budget and climbs back only after the better
+// level has fitted for a while.
+class FrameScheduler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit FrameScheduler(double targetFps = FRAME_SCHEDULER_FPS);
+
+    void setTargetFps(double fps);
+    double getTargetFps() const { return m_targetFps; }
+    double getBudgetMs() const;
+
+    // Dynamic resolution on or off, off renders at the best level
+    void setAdaptive(bool adaptive);
+    bool isAdaptive() const { return m_adaptive; }
+
+    // Starts a frame, returns the simulation time it advances: whole
+    // fixed steps, the remainder carries over to the next frame
+    float beginFrame();
+    // Ends the frame with its stage timings, may change getQuality
+    void endFrame(const FrameTimings& timings);
+    // Milliseconds until the next frame is due, deadlines follow each
+    // other by one period so frames do not drift
+    int msUntilNextFrame() const;
+
+    const RenderQuality& getQuality() const;
+    int getQualityLevel() const { return m_level; }
+    static int getQualityLevels();
+    static const RenderQuality& getQuality(int level);
+
+    // Exponential average of the frame cost in ms
+    double getAverageFrameMs() const { return m_averageMs; }
+
+private:
+    double estimateMs(const FrameTimings& timings, int level) const;
+
+    double m_targetFps;
+    bool m_adaptive;
+
+    bool m_started;
+    Clock::time_point m_lastBegin;
+    Clock::time_point m_nextDeadline;
+    double m_accumulator;       // s of real time not simulated yet
+
+    int m_level;
+    int m_overBudget;           // consecutive frames over budget
+    int m_underBudget;          // consecutive frames with room for the next level
+    int m_settle;               // frames left to ignore after a change
+    double m_averageMs;
+};
+
+#endif // FRAMESCHEDULER_H
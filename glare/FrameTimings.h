@@ -0,0 +1,75 @@
+#ifndef FRAMETIMINGS_H
+#define FRAMETIMINGS_H
+
+// Milliseconds a frame spent in each stage of the pipeline, measured on
+// the host after the stage's work has finished
+struct FrameTimings
+{
+    float aperture;         // pupil, gratings, particles, Fresnel term and PSF transform
+    float spectral;         // spectral blur into the red, green and blue PSF
+    float convolution;      // PSF spectra, products and inverse transforms
+    float toneMap;
+    float total;            // the whole frame, including what is not a stage
+
+    FrameTimings() : aperture(0), spectral(0), convolution(0), toneMap(0), total(0) {}
+};
+
+// Frames whose device profile is kept
+#define FRAME_PROFILE_RING 64
+
+// Stages of a frame on the OpenCL device, in pipeline order
+enum ProfileStage
+{
+    PROFILE_APERTURE,       // pupil, gratings, lens particles and their merge
+    PROFILE_FRESNEL,        // Fresnel term and its product with the aperture
+    PROFILE_PSF_FFT,        // transform of the aperture
+    PROFILE_MAGNITUDE,      // centred magnitude of the field
+    PROFILE_SPECTRAL_BLUR,
+    PROFILE_PSF_FORWARD_FFT,    // spectra of the red, green and blue PSF
+    PROFILE_MULTIPLY,       // products with the image spectra
+    PROFILE_INVERSE_FFT,
+    PROFILE_TONE_MAP,
+    PROFILE_READBACK,       // frames and tiles read to the host
+    PROFILE_STAGES
+};
+
+inline const char* profileStageName(int stage)
+{
+    static const char* names[PROFILE_STAGES] = {
+        "aperture", "fresnel", "psf fft", "magnitude", "spectral blur",
+        "psf forward fft", "multiply", "inverse fft", "tone map", "readback"
+    };
+    return stage >= 0 && stage < PROFILE_STAGES ? names[stage] : "";
+}
+
+// Profiling times of the commands of one stage in ns of the device
+// clock, FrameProfile::base is the frame's first queued command. queued,
+// submit and start are the earliest of the stage, end the latest; busy
+// sums how long each command ran. clFFT reports the last kernel of a transform,
+// so busy misses the earlier passes of multi pass plans
+struct StageProfile
+{
+    unsigned long long queued;
+    unsigned long long submit;
+    unsigned long long start;
+    unsigned long long end;
+    unsigned long long busy;
+    int commands;
+
+    StageProfile() : queued(0), submit(0), start(0), end(0), busy(0), commands(0) {}
+    double busyMs() const { return busy * 1e-6; }
+};
+
+// Device profile of one frame, from the OpenCL profiling events
+struct FrameProfile
+{
+    unsigned int frame;
+    unsigned long long base;    // device time of the first queued command
+    unsigned long long end;     // device time the last command ended
+    StageProfile stages[PROFILE_STAGES];
+
+    FrameProfile() : frame(0), base(0), end(0) {}
+    double spanMs() const { return end > base ? (end - base) * 1e-6 : 0.0; }
+};
+
+#endif // FRAMETIMINGS_H
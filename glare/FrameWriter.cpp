@@ -0,0 +1,153 @@
+#include "FrameWriter.h"
+#include "image.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+FrameWriter::FrameWriter(int nThreads, int maxQueued)
+    : m_maxQueued((size_t)std::max(maxQueued, 1))
+    , m_nextSequence(0)
+    , m_nextWrite(0)
+    , m_written(0)
+    , m_failed(0)
+    , m_stop(false)
+{
+    nThreads = std::max(nThreads, 1);
+    for (int i = 0; i < nThreads; ++i)
+        m_workers.push_back(std::thread(&FrameWriter::workerLoop, this));
+}
+
+FrameWriter::~FrameWriter()
+{
+    flush();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_jobAvailable.notify_all();
+
+    for (std::thread& worker : m_workers)
+        worker.join();
+}
+
+void FrameWriter::writePng(const std::string& filename, int width, int height, std::vector<unsigned char>&& bgra)
+{
+    Job job;
+    job.filename = filename;
+    job.exr = false;
+    job.width = width;
+    job.height = height;
+    job.bgra = std::move(bgra);
+    submit(std::move(job));
+}
+
+void FrameWriter::writeExr(const std::string& filename, int width, int height,
+                           std::vector<float>&& red, std::vector<float>&& green, std::vector<float>&& blue)
+{
+    Job job;
+    job.filename = filename;
+    job.exr = true;
+    job.width = width;
+    job.height = height;
+    job.red = std::move(red);
+    job.green = std::move(green);
+    job.blue = std::move(blue);
+    submit(std::move(job));
+}
+
+// blocks while the queue is full, so a slow disk holds the render loop
+// back instead of piling up frames in memory
+void FrameWriter::submit(Job&& job)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_spaceAvailable.wait(lock, [this] { return m_queue.size() < m_maxQueued; });
+
+    job.sequence = m_nextSequence++;
+    m_queue.push_back(std::move(job));
+    lock.unlock();
+
+    m_jobAvailable.notify_one();
+}
+
+void FrameWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_writeTurn.wait(lock, [this] { return m_nextWrite == m_nextSequence; });
+}
+
+void FrameWriter::workerLoop()
+{
+    std::vector<unsigned char> rgba;
+    std::vector<unsigned char> encoded;
+    TRACE_THREAD_NAME("frame writer");
+
+    for (;;)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_jobAvailable.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+            if (m_queue.empty())
+                return;
+
+            job = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        m_spaceAvailable.notify_one();
+
+        // compression in parallel with the other workers
+        bool encodedOk;
+        {
+            TRACE_SCOPE("encode", "io");
+            if (job.exr)
+            {
+                encodedOk = Image::encodeExr(encoded, job.red.data(), job.green.data(), job.blue.data(),
+                                             job.width, job.height);
+            }
+            else
+            {
+                size_t pixels = (size_t)job.width * job.height;
+                rgba.resize(pixels * 4);
+                const unsigned int* argb = (const unsigned int*)job.bgra.data();
+                for (size_t i = 0; i < pixels; ++i)
+                {
+                    rgba[4*i]   = (argb[i] >> 16) & 0xff;
+                    rgba[4*i+1] = (argb[i] >> 8) & 0xff;
+                    rgba[4*i+2] = argb[i] & 0xff;
+                    rgba[4*i+3] = (argb[i] >> 24) & 0xff;
+                }
+                encodedOk = Image::encodePng(encoded, rgba.data(), job.width, job.height);
+            }
+        }
+
+        // files hit the disk in submission order
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_writeTurn.wait(lock, [this, &job] { return m_nextWrite == job.sequence; });
+        lock.unlock();
+
+        bool ok;
+        {
+            TRACE_SCOPE("write", "io");
+            ok = encodedOk && Image::writeFile(job.filename, encoded);
+        }
+
+        lock.lock();
+        ++(ok ? m_written : m_failed);
+        ++m_nextWrite;
+        lock.unlock();
+        m_writeTurn.notify_all();
+    }
+}
+
+size_t FrameWriter::getWrittenFrames() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_written;
+}
+
+size_t FrameWriter::getFailedFrames() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_failed;
+}
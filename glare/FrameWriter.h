@@ -0,0 +1,72 @@
+#ifndef FRAMEWRITER_H
+#define FRAMEWRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Frames waiting to be encoded before submitting blocks
+#define FRAME_WRITER_QUEUE 8
+#define FRAME_WRITER_THREADS 2
+
+// Encodes and writes frames on background threads. PNG and EXR
+// compression runs in parallel, the files are written in submission order
+// so a sequence on disk never has a later frame without the earlier ones.
+class FrameWriter
+{
+public:
+    explicit FrameWriter(int nThreads = FRAME_WRITER_THREADS, int maxQueued = FRAME_WRITER_QUEUE);
+    ~FrameWriter();
+
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter& operator=(const FrameWriter&) = delete;
+
+    // Tone mapped frame as read by TemporalGlareRenderer::readFrame,
+    // native endian 0xAARRGGBB words. The buffer is taken over
+    void writePng(const std::string& filename, int width, int height, std::vector<unsigned char>&& bgra);
+
+    // Linear planes, stored as half floats. The buffers are taken over
+    void writeExr(const std::string& filename, int width, int height,
+                  std::vector<float>&& red, std::vector<float>&& green, std::vector<float>&& blue);
+
+    // Waits until everything submitted so far is on disk
+    void flush();
+
+    size_t getWrittenFrames() const;
+    size_t getFailedFrames() const;
+
+private:
+    struct Job
+    {
+        size_t sequence;
+        std::string filename;
+        bool exr;
+        int width;
+        int height;
+        std::vector<unsigned char> bgra;
+        std::vector<float> red, green, blue;
+    };
+
+    void submit(Job&& job);
+    void workerLoop();
+
+    std::vector<std::thread> m_workers;
+    std::deque<Job> m_queue;
+    size_t m_maxQueued;
+
+    size_t m_nextSequence;      // given to the next submitted frame
+    size_t m_nextWrite;         // frame allowed to hit the disk next
+    size_t m_written;
+    size_t m_failed;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_jobAvailable;
+    std::condition_variable m_spaceAvailable;
+    std::condition_variable m_writeTurn;
+    bool m_stop;
+};
+
+#endif // FRAMEWRITER_H
@@ -0,0 +1,18 @@
+#ifndef GLARECONSTANTS_H
+#define GLARECONSTANTS_H
+
+// Constants every backend has to agree on, the OpenCL pipeline, the CPU
+// backend and the reference renderer alike
+
+// Sum of the monochrome PSF every backend normalises to before the
+// spectral blur (fresnel.cl's normFactor is the PSF's own sum over it), so
+// the glare keeps its brightness at any render scale or tiled PSF size.
+// The PSF was not normalised before. Its sum on the first frame of a
+// 512x512 image at render scale 1 was 6.9e5 on the area bench scene,
+// 8.7e5 on noise, 9.0e5 on hdr_imgs/example.exr and 1.15e6 on points,
+// the pupil following each scene's luminance. 8e5 is a round value in
+// that range: a scale 1 frame is PSF_ENERGY / its old sum as bright as
+// it used to be, 1.16 for area, 0.89 for example.exr and 0.70 for points
+#define PSF_ENERGY 8.0e5f
+
+#endif // GLARECONSTANTS_H
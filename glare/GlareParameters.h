@@ -0,0 +1,42 @@
+#ifndef GLAREPARAMETERS_H
+#define GLAREPARAMETERS_H
+
+#include "ToneMapping.h"
+
+// Everything a client can set between frames, for embedding the renderer
+// without reaching into its members. Defaults are the renderer's own
+struct GlareParameters
+{
+    // eye model
+    float focus;
+    float apertureSize;
+    float fieldLuminance;           // adaptation luminance the pupil follows (cd/m^2)
+    bool autoFieldLuminance;        // measure it over the foveal window of the image instead
+    float luminanceScale;           // cd/m^2 per image unit for the measurement
+
+    // tone mapping
+    int toneMapOperator;            // ToneMapOperator
+    float gamma;
+    float Lwhite;
+    float exposure;                 // used when autoExposure is off
+    bool autoExposure;
+
+    // local operator
+    float phi;
+    float epsilon;
+
+    // histogram adjustment display range (cd/m^2)
+    float displayMinLuminance;
+    float displayMaxLuminance;
+
+    GlareParameters()
+        : focus(500.0f), apertureSize(8.0f), fieldLuminance(0.5f),
+          autoFieldLuminance(true), luminanceScale(1.0f),
+          toneMapOperator(TM_REINHARD_EXTENDED), gamma(5.0f), Lwhite(5.0f), exposure(1.0f),
+          autoExposure(true), phi(8.0f), epsilon(0.05f),
+          displayMinLuminance(1.0f), displayMaxLuminance(100.0f)
+    {
+    }
+};
+
+#endif // GLAREPARAMETERS_H
@@ -0,0 +1,71 @@
+#ifndef GRATINGS_H
+#define GRATINGS_H
+
+#include "Philox.h"
+
+#include <cmath>
+
+// Procedural lens gratings: the radial fibres of the crystalline lens,
+// dark lines running out from the frame centre. Fibre i sits at its share
+// of the circle moved by up to jitter of the spacing, bends by up to
+// jitter of it towards the frame edge and has its own width and darkness,
+// all drawn from block i of the RANDOM_STREAM_GRATINGS sequence of the
+// seed. Widths scale with the frame height, so the gratings look the same
+// at any PSF size. glr_bake_gratings in render.cl is the same model
+
+// Fibres around the lens and their jitter at start, 0 fibres is a clear lens
+#define GRATINGS_FIBRES_DEFAULT 180
+#define GRATINGS_FIBRES_MAX 4096
+#define GRATINGS_JITTER_DEFAULT 0.5f
+// Mean fibre width as a fraction of the frame height and the mean share
+// of light a fibre takes
+#define GRATINGS_WIDTH 0.0025f
+#define GRATINGS_CONTRAST 0.55f
+// Fibres looked at either side of a pixel's own slot. Jitter and bend
+// move a fibre by at most 1.5 slots, so fewer fibres than 2 * REACH + 1
+// would be counted twice
+#define GRATINGS_REACH 2
+#define GRATINGS_FIBRES_MIN (2 * GRATINGS_REACH + 1)
+
+// Angle at the centre, bend at a radius of the frame height, half width
+// as a fraction of the frame height and darkness of a fibre
+inline void gratingsFibre(uint32_t seed, int fibre, int fibres, float jitter, float out[4])
+{
+    const float spacing = 6.28318531f / fibres;
+    float u[4];
+    philoxUniform4(seed, 0, RANDOM_STREAM_GRATINGS, fibre, u);
+
+    out[0] = -3.14159265f + (fibre + 0.5f + jitter * (u[0] - 0.5f)) * spacing;
+    out[1] = jitter * (u[1] - 0.5f) * spacing;
+    out[2] = 0.5f * GRATINGS_WIDTH * (0.5f + u[2]);
+    out[3] = GRATINGS_CONTRAST * (0.75f + 0.5f * u[3]);
+}
+
+// Grey level of pixel (x, y) of a width x height gratings texture, table
+// holds the gratingsFibre values of every fibre
+inline unsigned char gratingsValue(int x, int y, int width, int height, int fibres, const float* table)
+{
+    if (fibres <= 0)
+        return 255;
+
+    const float twoPi = 6.28318531f;
+    float dx = x + 0.5f - width / 2.0f;
+    float dy = y + 0.5f - height / 2.0f;
+    float r = std::sqrt(dx * dx + dy * dy);
+    float theta = std::atan2(dy, dx);
+    int slot = (int)std::floor((theta + 3.14159265f) / twoPi * fibres);
+
+    float transmission = 1.0f;
+    for (int k = slot - GRATINGS_REACH; k <= slot + GRATINGS_REACH; ++k)
+    {
+        const float* fibre = table + 4 * (((k % fibres) + fibres) % fibres);
+        float angle = fibre[0] + fibre[1] * r / height;
+        float d = r * std::fabs(std::remainder(theta - angle, twoPi));
+        float coverage = fibre[2] * height + 0.5f - d;
+        coverage = coverage > 0.0f ? (coverage < 1.0f ? coverage : 1.0f) : 0.0f;
+        transmission *= 1.0f - fibre[3] * coverage;
+    }
+    return (unsigned char)(transmission * 255.0f + 0.5f);
+}
+
+#endif // GRATINGS_H
@@ -0,0 +1,297 @@
+#include "KernelBench.h"
+#include "PupilModel.h"
+#include "spectrumMap.h"
+
+#include <algorithm>
+#include <iostream>
+
+// Candidate local sizes, 0 x 0 leaves it to the driver
+static const WorkGroupSize candidates[] = {
+    {0, 0},
+    {8, 8}, {16, 16}, {32, 32},
+    {16, 8}, {8, 16}, {32, 8}, {8, 32},
+    {32, 4}, {64, 4}, {64, 1}, {128, 1}, {256, 1}
+};
+
+// Parameters of the launches, what the renderer passes by default
+#define BENCH_LAMBDA (575.0f / 1000.0f / 1000.0f)
+#define BENCH_DISTANCE 20.0f
+
+KernelBench::KernelBench(cl_context context, cl_device_id device, cl_program program, int spectralSamples) :
+    m_spectralSamples(std::max(1, spectralSamples))
+{
+    // the wrappers take ownership of what they are given
+    clRetainContext(context);
+    clRetainDevice(device);
+    clRetainProgram(program);
+    m_context = cl::Context(context);
+    m_device = cl::Device(device);
+    m_program = cl::Program(program);
+    m_queue = cl::CommandQueue(m_context, m_device, CL_QUEUE_PROFILING_ENABLE);
+}
+
+const std::vector<std::string>& KernelBench::kernelNames()
+{
+    static const std::vector<std::string> names = {
+        "glr_render_pupil", "glr_render_gratings", "glr_merge_images", "multiply_with_complex_exp",
+        "compute_magnitude_kernel", "spectral_blur", "conv_of_ffts", "tm_reinhard_extended"
+    };
+    return names;
+}
+
+// Bytes a work item has to read and write at least, cached rereads not
+// counted, and its arithmetic as written in the kernel source
+void KernelBench::cost(const std::string& name, double& bytes, double& flops) const
+{
+    bytes = 0.0;
+    flops = 0.0;
+    if (name == "glr_render_pupil")                 // one RGBA8 write
+    {
+        bytes = 4;
+        flops = 6;
+    }
+    else if (name == "glr_render_gratings")         // RGBA8 in and out
+    {
+        bytes = 8;
+        flops = 6;
+    }
+    else if (name == "glr_merge_images")            // two RGBA8 and the occlusion in, RGBA8 out
+    {
+        bytes = 16;
+        flops = 4;
+    }
+    else if (name == "multiply_with_complex_exp")   // RGBA8 and a complex in, a complex out
+    {
+        bytes = 20;
+        flops = 3;
+    }
+    else if (name == "compute_magnitude_kernel")    // a complex in, a float and an RGBA float out
+    {
+        bytes = 28;
+        flops = 10;
+    }
+    else if (name == "spectral_blur")               // an RGBA float in, three floats out
+    {
+        bytes = 28;
+        flops = 26.0 * m_spectralSamples + 21;
+    }
+    else if (name == "conv_of_ffts")                // two complex in, one out
+    {
+        bytes = 24;
+        flops = 6;
+    }
+    else if (name == "tm_reinhard_extended")        // three floats in, RGBA8 out
+    {
+        bytes = 16;
+        flops = 24;
+    }
+}
+
+// The shape the renderer launches a kernel over for a width x height
+// frame, conv_of_ffts runs over the hermitian half of the spectra. It
+// checks its bounds, so its launches are rounded up to whole groups
+void KernelBench::launchShape(const std::string& name, int width, int height,
+                              int& launchWidth, int& launchHeight, bool& rounded)
+{
+    rounded = name == "conv_of_ffts";
+    launchWidth = rounded ? width / 2 + 1 : width;
+    launchHeight = height;
+}
+
+// The kernel with its arguments set on width x height inputs, which are
+// kept alive in inputs
+cl::Kernel KernelBench::makeLaunch(const std::string& name, int width, int height, std::vector<cl::Memory>& inputs)
+{
+    size_t pixels = (size_t)width * height;
+    cl_float2 centre = {{ width / 2.0f, height / 2.0f }};
+    float radius = std::min(width, height) / 4.0f;
+
+    // an aperture like the renderer's: a disc of ones, the rest zeros
+    std::vector<cl_uchar> aperture(pixels * 4);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            float dx = x - centre.s[0], dy = y - centre.s[1];
+            cl_uchar value = dx * dx + dy * dy > radius * radius ? 0 : 255;
+            std::fill(&aperture[((size_t)y * width + x) * 4], &aperture[((size_t)y * width + x) * 4] + 3, value);
+            aperture[((size_t)y * width + x) * 4 + 3] = 255;
+        }
+    std::vector<float> ones(pixels * 4, 1.0f);
+
+    // RGBA images of a channel type, the format is made in place as the
+    // implicit copy of cl::ImageFormat is deprecated
+    const cl_channel_type rgba8 = CL_UNSIGNED_INT8;
+    const cl_channel_type rgbaFloat = CL_FLOAT;
+    auto image = [&](cl_channel_type type, void* data) {
+        cl::Image2D memory(m_context, CL_MEM_READ_WRITE | (data ? CL_MEM_COPY_HOST_PTR : 0),
+                           cl::ImageFormat(CL_RGBA, type), width, height, 0, data);
+        inputs.push_back(memory);
+        return memory;
+    };
+    auto buffer = [&](size_t floats) {
+        cl::Buffer memory(m_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(float) * floats,
+                          ones.data());
+        inputs.push_back(memory);
+        return memory;
+    };
+
+    cl::Kernel kernel(m_program, name.c_str());
+    if (name == "glr_render_pupil")
+    {
+        PupilState state = {};
+        state.radiusPx = radius;
+        cl::Buffer pupil(m_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(PupilState), &state);
+        inputs.push_back(pupil);
+        kernel.setArg(0, image(rgba8, NULL));
+        kernel.setArg(1, pupil);
+        kernel.setArg(2, width);
+        kernel.setArg(3, height);
+        kernel.setArg(4, centre);
+    }
+    else if (name == "glr_render_gratings")
+    {
+        kernel.setArg(0, image(rgba8, aperture.data()));
+        kernel.setArg(1, image(rgba8, NULL));
+        kernel.setArg(2, radius / 2);
+        kernel.setArg(3, width);
+        kernel.setArg(4, height);
+        kernel.setArg(5, centre);
+    }
+    else if (name == "glr_merge_images")
+    {
+        kernel.setArg(0, image(rgba8, aperture.data()));
+        kernel.setArg(1, image(rgba8, aperture.data()));
+        kernel.setArg(2, buffer(pixels));
+        kernel.setArg(3, image(rgba8, NULL));
+        kernel.setArg(4, width);
+    }
+    else if (name == "multiply_with_complex_exp")
+    {
+        kernel.setArg(0, image(rgba8, aperture.data()));
+        kernel.setArg(1, buffer(pixels * 2));
+        kernel.setArg(2, buffer(pixels * 2));
+        kernel.setArg(3, width);
+    }
+    else if (name == "compute_magnitude_kernel")
+    {
+        kernel.setArg(0, buffer(pixels * 2));
+        kernel.setArg(1, image(rgbaFloat, NULL));
+        kernel.setArg(2, buffer(pixels));
+        kernel.setArg(3, width);
+        kernel.setArg(4, height);
+        kernel.setArg(5, BENCH_LAMBDA);
+        kernel.setArg(6, BENCH_DISTANCE);
+    }
+    else if (name == "spectral_blur")
+    {
+        cl::Buffer spectrumMapping(m_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                   sizeof(float) * SPECTRUM_RESOLUTION * 3, spectrum);
+        inputs.push_back(spectrumMapping);
+        kernel.setArg(0, image(rgbaFloat, ones.data()));
+        kernel.setArg(1, buffer(pixels));
+        kernel.setArg(2, buffer(pixels));
+        kernel.setArg(3, buffer(pixels));
+        kernel.setArg(4, spectrumMapping);
+        kernel.setArg(5, width);
+        kernel.setArg(6, height);
+        kernel.setArg(7, BENCH_LAMBDA * 1000 * 1000);
+        kernel.setArg(8, BENCH_DISTANCE);
+        kernel.setArg(9, 1.0f);
+        kernel.setArg(10, m_spectralSamples);
+    }
+    else if (name == "conv_of_ffts")
+    {
+        kernel.setArg(0, buffer(pixels * 2));
+        kernel.setArg(1, buffer(pixels * 2));
+        kernel.setArg(2, buffer(pixels * 2));
+        kernel.setArg(3, width);
+        kernel.setArg(4, height);
+    }
+    else if (name == "tm_reinhard_extended")
+    {
+        // like the frame image, normalised bytes
+        cl::Image2D frame(m_context, CL_MEM_WRITE_ONLY, cl::ImageFormat(CL_RGBA, CL_UNORM_INT8), width, height);
+        inputs.push_back(frame);
+        kernel.setArg(0, buffer(pixels));
+        kernel.setArg(1, buffer(pixels));
+        kernel.setArg(2, buffer(pixels));
+        kernel.setArg(3, frame);
+        kernel.setArg(4, 1.0f);
+        kernel.setArg(5, 2.2f);
+        kernel.setArg(6, 1.0f);
+        kernel.setArg(7, width);
+    }
+    return kernel;
+}
+
+std::vector<KernelTiming> KernelBench::run(const std::string& kernelName, int frameWidth, int frameHeight,
+                                           int repetitions)
+{
+    int width, height;
+    bool rounded;
+    launchShape(kernelName, frameWidth, frameHeight, width, height, rounded);
+
+    std::vector<KernelTiming> timings;
+    std::vector<cl::Memory> inputs;
+    cl::Kernel kernel = makeLaunch(kernelName, width, height, inputs);
+
+    size_t maxGroup = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(m_device);
+    std::vector<size_t> maxItems = m_device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+    double bytes, flops;
+    cost(kernelName, bytes, flops);
+    double items = (double)width * height;
+
+    for (const WorkGroupSize& local : candidates)
+    {
+        cl::NDRange localRange = cl::NullRange;
+        cl::NDRange globalRange(width, height, 1);
+        if (local.x > 0)
+        {
+            if ((size_t)local.x * local.y > maxGroup || maxItems.size() < 2 ||
+                (size_t)local.x > maxItems[0] || (size_t)local.y > maxItems[1] ||
+                (!rounded && (width % local.x != 0 || height % local.y != 0)))
+                continue;
+            localRange = cl::NDRange(local.x, local.y, 1);
+            globalRange = cl::NDRange((width + local.x - 1) / local.x * local.x,
+                                      (height + local.y - 1) / local.y * local.y, 1);
+        }
+
+        // a local size the kernel can't run with on this device is skipped
+        std::vector<double> ms;
+        try {
+            for (int i = 0; i < KERNEL_BENCH_WARMUP; ++i)
+                m_queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalRange, localRange);
+            m_queue.finish();
+
+            std::vector<cl::Event> events(std::max(1, repetitions));
+            for (cl::Event& event : events)
+                m_queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalRange, localRange, NULL, &event);
+            m_queue.finish();
+
+            for (cl::Event& event : events)
+            {
+                cl_ulong start = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+                cl_ulong end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+                ms.push_back(end > start ? (end - start) / 1e6 : 0.0);
+            }
+        } catch (cl::Error err) {
+            std::cout << kernelName << " " << local.x << "x" << local.y << ": " << err.what()
+                      << " (" << err.err() << ")\n";
+            m_queue.finish();
+            continue;
+        }
+
+        std::sort(ms.begin(), ms.end());
+        KernelTiming timing;
+        timing.kernel = kernelName;
+        timing.width = width;
+        timing.height = height;
+        timing.local = local;
+        timing.medianMs = ms[(ms.size() - 1) / 2];
+        double seconds = timing.medianMs / 1000.0;
+        timing.gbPerS = seconds > 0.0 ? bytes * items / seconds / 1e9 : 0.0;
+        timing.gflopPerS = seconds > 0.0 ? flops * items / seconds / 1e9 : 0.0;
+        timings.push_back(timing);
+    }
+    return timings;
+}
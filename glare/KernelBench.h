@@ -0,0 +1,62 @@
+#ifndef KERNELBENCH_H
+#define KERNELBENCH_H
+
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include "KernelTuning.h"
+
+#include <string>
+#include <vector>
+
+// Launches timed per local size, after the warm up ones
+#define KERNEL_BENCH_WARMUP 2
+
+// One kernel at one problem size and local size
+struct KernelTiming
+{
+    std::string kernel;
+    int width;
+    int height;
+    WorkGroupSize local;    // 0 x 0 for the driver's choice
+    double medianMs;        // device time of a launch
+    double gbPerS;
+    double gflopPerS;
+};
+
+// Micro-benchmarks of the 2D kernels of the pipeline for glare-bench
+// --kernels. Each kernel runs alone on inputs like the renderer's, with
+// every candidate local size the device accepts, and is timed with
+// profiling events on a queue of its own. Bandwidth and FLOP rate come
+// from rough per work item counts of the bytes a kernel has to move and
+// the arithmetic in its source, good for comparing local sizes and
+// spotting kernels far from the device's limits, not as exact figures
+class KernelBench
+{
+public:
+    // takes references of its own to the renderer's objects
+    KernelBench(cl_context context, cl_device_id device, cl_program program, int spectralSamples);
+
+    // the kernels the renderer launches with tunedRange
+    static const std::vector<std::string>& kernelNames();
+
+    // One timing per local size that fits the kernel on the device and
+    // divides its launch for a width x height frame, the driver's choice
+    // first. The timings carry the launch shape, which sizes the tuning
+    // entry like tunedRange does
+    std::vector<KernelTiming> run(const std::string& kernel, int width, int height, int repetitions);
+
+private:
+    static void launchShape(const std::string& name, int width, int height,
+                            int& launchWidth, int& launchHeight, bool& rounded);
+    cl::Kernel makeLaunch(const std::string& name, int width, int height, std::vector<cl::Memory>& inputs);
+    void cost(const std::string& name, double& bytes, double& flops) const;
+
+    cl::Context m_context;
+    cl::Device m_device;
+    cl::Program m_program;
+    cl::CommandQueue m_queue;
+    int m_spectralSamples;
+};
+
+#endif // KERNELBENCH_H
@@ -0,0 +1,95 @@
+#include "KernelTuning.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+std::string KernelTuning::defaultPath()
+{
+    const char* path = std::getenv("GLARE_TUNING_FILE");
+    return path && *path ? path : KERNEL_TUNING_FILE;
+}
+
+int KernelTuning::sizeClass(size_t width, size_t height)
+{
+    size_t side = width > height ? width : height;
+    int size = KERNEL_TUNING_MIN_CLASS;
+    while ((size_t)size < side)
+        size *= 2;
+    return size;
+}
+
+bool KernelTuning::load(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        // device names have spaces in them, the fields are split at tabs
+        std::vector<std::string> fields;
+        std::stringstream stream(line);
+        std::string field;
+        while (std::getline(stream, field, '\t'))
+            fields.push_back(field);
+        if (fields.size() != 5 || fields[0].empty() || fields[1].empty())
+            continue;
+
+        char* end;
+        long values[3];
+        bool valid = true;
+        for (int i = 0; i < 3; ++i)
+        {
+            values[i] = std::strtol(fields[i + 2].c_str(), &end, 10);
+            valid = valid && *end == '\0' && end != fields[i + 2].c_str() && values[i] >= 0;
+        }
+        if (!valid || values[0] < KERNEL_TUNING_MIN_CLASS || (values[1] == 0) != (values[2] == 0))
+            continue;
+
+        WorkGroupSize local = { (int)values[1], (int)values[2] };
+        set(fields[0], fields[1], (int)values[0], local);
+    }
+    return true;
+}
+
+bool KernelTuning::save(const std::string& path) const
+{
+    std::ofstream file(path);
+    file << "# Work-group sizes measured by glare-bench --kernels\n";
+    file << "# device\tkernel\tsize class\tlocal x\tlocal y, 0 0 for the driver's choice\n";
+    for (const auto& entry : m_entries)
+        file << std::get<0>(entry.first) << "\t" << std::get<1>(entry.first) << "\t" << std::get<2>(entry.first)
+             << "\t" << entry.second.x << "\t" << entry.second.y << "\n";
+    return (bool)file;
+}
+
+void KernelTuning::set(const std::string& device, const std::string& kernel, int sizeClass, WorkGroupSize local)
+{
+    m_entries[std::make_tuple(device, kernel, sizeClass)] = local;
+}
+
+bool KernelTuning::find(const std::string& device, const std::string& kernel, int sizeClass, WorkGroupSize& local) const
+{
+    auto entry = m_entries.find(std::make_tuple(device, kernel, sizeClass));
+    if (entry == m_entries.end())
+        return false;
+    local = entry->second;
+    return true;
+}
+
+int KernelTuning::count(const std::string& device) const
+{
+    int n = 0;
+    for (const auto& entry : m_entries)
+        if (std::get<0>(entry.first) == device)
+            ++n;
+    return n;
+}
@@ -0,0 +1,52 @@
+#ifndef KERNELTUNING_H
+#define KERNELTUNING_H
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <tuple>
+
+// Work-group sizes of the 2D kernels, measured by glare-bench --kernels
+// and kept per device, kernel and size class in a text file the renderer
+// reads at startup. One entry per line, tab separated:
+//
+//     device  kernel  size class  local x  local y
+//
+// Lines starting with # are comments. A local size of 0 x 0 records that
+// the driver's own choice measured best.
+
+// Tuning file in the working directory, next to the kernel sources, when
+// GLARE_TUNING_FILE is not set
+#define KERNEL_TUNING_FILE "glare-tuning.txt"
+
+// Launches are grouped by the power of two at or above their longer side,
+// never below this
+#define KERNEL_TUNING_MIN_CLASS 64
+
+struct WorkGroupSize
+{
+    int x;
+    int y;
+};
+
+class KernelTuning
+{
+public:
+    static std::string defaultPath();
+    static int sizeClass(size_t width, size_t height);
+
+    // Malformed lines are skipped. False when the file can't be read,
+    // the table is left as it was
+    bool load(const std::string& path);
+    bool save(const std::string& path) const;
+
+    void set(const std::string& device, const std::string& kernel, int sizeClass, WorkGroupSize local);
+    bool find(const std::string& device, const std::string& kernel, int sizeClass, WorkGroupSize& local) const;
+    // entries of a device
+    int count(const std::string& device) const;
+
+private:
+    std::map<std::tuple<std::string, std::string, int>, WorkGroupSize> m_entries;
+};
+
+#endif // KERNELTUNING_H
@@ -0,0 +1,84 @@
+#ifndef LENSPARTICLES_H
+#define LENSPARTICLES_H
+
+#include <cmath>
+
+// Lens particles and their rasteriser, shared by the OpenCL and the host
+// renderers. The kernels in render.cl repeat the rasteriser constants
+
+// Lens particles at start and the most setParticleCount allows
+#define LENS_PARTICLES_DEFAULT 2000
+#define LENS_PARTICLES_MAX (1 << 20)
+// Particles per task when the CPU backend moves them
+#define LENS_PARTICLES_PER_TASK 4096
+
+// Default particle motion, in lens units (half the frame) and seconds:
+// a slow downward drift of the tear film, how fast velocities relax to
+// it and the strength of the Brownian kicks
+#define LENS_PARTICLE_DRIFT_X 0.0f
+#define LENS_PARTICLE_DRIFT_Y 0.02f
+#define LENS_PARTICLE_DAMPING 2.0f
+#define LENS_PARTICLE_DIFFUSION 0.05f
+
+// Particles are discs of this radius in aperture pixels
+#define LENS_PARTICLE_RADIUS 1.5f
+
+// Side of the screen tiles particles are binned into on the device, also
+// the work-group size of the rasteriser. A disc touches at most
+// LENS_TILES_PER_POINT tiles as long as it is smaller than a tile
+#define LENS_TILE 16
+#define LENS_TILES_PER_POINT 4
+// Work-group size of the single group prefix sum over the tile counts
+#define LENS_SCAN_GROUP 256
+
+// Coverage is accumulated as integer optical depth, so the order the
+// particles of a pixel are summed in does not change the mask. A fully
+// covered pixel adds LENS_DEPTH_OPAQUE
+#define LENS_DEPTH_SCALE 4096.0f
+#define LENS_DEPTH_OPAQUE 49152u
+
+// Aperture pixel the particle is drawn at, distorted with the lens
+inline void lensScreenPosition(const float* p, float distort, int width, int height, float& x, float& y)
+{
+    x = (p[0] + distort * p[1]) * width / 2.0f + width / 2.0f;
+    y = (p[2] + distort * p[3]) * height / 2.0f + height / 2.0f;
+}
+
+// Range of tileSize tiles the disc at (x, y) overlaps, false when it is
+// off the aperture. Same as lens_point_tiles
+inline bool lensPointTiles(float x, float y, int width, int height, int tileSize, int tilesX, int tilesY, int tiles[4])
+{
+    float extent = LENS_PARTICLE_RADIUS + 0.5f;
+    if (x + extent < 0.0f || y + extent < 0.0f || x - extent >= width || y - extent >= height)
+        return false;
+
+    int bounds[4] = { (int)std::floor((x - extent) / tileSize), (int)std::floor((y - extent) / tileSize),
+                      (int)std::floor((x + extent) / tileSize), (int)std::floor((y + extent) / tileSize) };
+    for (int i = 0; i < 4; ++i)
+    {
+        int last = (i % 2 == 0 ? tilesX : tilesY) - 1;
+        tiles[i] = bounds[i] < 0 ? 0 : (bounds[i] > last ? last : bounds[i]);
+    }
+    return true;
+}
+
+// Optical depth a disc adds to a pixel whose centre is d away from the
+// disc's, the coverage of the pixel is approximated by a one pixel ramp
+// across the edge
+inline unsigned int lensPointDepth(float d)
+{
+    float coverage = LENS_PARTICLE_RADIUS + 0.5f - d;
+    if (coverage <= 0.0f)
+        return 0;
+    if (coverage >= 1.0f)
+        return LENS_DEPTH_OPAQUE;
+    return (unsigned int)(-std::log(1.0f - coverage) * LENS_DEPTH_SCALE + 0.5f);
+}
+
+// Fraction of light a pixel lets through
+inline float lensTransmission(unsigned int depth)
+{
+    return std::exp(-(float)depth / LENS_DEPTH_SCALE);
+}
+
+#endif // LENSPARTICLES_H
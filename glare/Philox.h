@@ -0,0 +1,73 @@
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <cstdint>
+
+// Philox4x32-10 counter based generator (Salmon et al., "Parallel Random
+// Numbers: As Easy as 1, 2, 3"). A block of four words is a pure function
+// of its counter and key, so any value can be regenerated on its own and
+// in any order. kernels/philox.cl is the same generator on the device,
+// both have to stay in sync.
+//
+// The renderer keys blocks by (seed, frame, stream, index): the counter
+// is (index, frame, stream, 0) and the key (seed, 0)
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+// Independent sequences of one frame, same values in philox.cl
+enum RandomStream
+{
+    RANDOM_STREAM_PUPIL       = 0,
+    RANDOM_STREAM_DEFORMATION = 1,
+    RANDOM_STREAM_PARTICLES   = 2,
+    RANDOM_STREAM_PARTICLE_MOTION = 3,
+    RANDOM_STREAM_GRATINGS    = 4
+};
+
+inline void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4])
+{
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+
+    for (int round = 0; round < PHILOX_ROUNDS; ++round)
+    {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+
+        uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)p1;
+        c3 = (uint32_t)p0;
+        c0 = n0;
+        c2 = n2;
+
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+// 24 random bits to a float in [0, 1)
+inline float philoxToFloat(uint32_t bits)
+{
+    return (float)(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+// Block index of the (seed, frame, stream) sequence as four floats in [0, 1)
+inline void philoxUniform4(uint32_t seed, uint32_t frame, uint32_t stream, uint32_t index, float out[4])
+{
+    uint32_t counter[4] = {index, frame, stream, 0};
+    uint32_t key[2] = {seed, 0};
+    uint32_t bits[4];
+    philox4x32(counter, key, bits);
+
+    for (int i = 0; i < 4; ++i)
+        out[i] = philoxToFloat(bits[i]);
+}
+
+#endif // PHILOX_H
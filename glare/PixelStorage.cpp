@@ -0,0 +1,328 @@
+#include "PixelStorage.h"
+#include "ThreadPool.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PIXEL_X86_DISPATCH
+#endif
+
+// Rows handed to a thread at a time by loadChannel
+#define PIXEL_ROWS_PER_CHUNK 16
+
+void* alignedAlloc(size_t bytes)
+{
+    void* p = nullptr;
+#if defined(_WIN32)
+    p = _aligned_malloc(bytes, PIXEL_STORAGE_ALIGNMENT);
+#else
+    if (posix_memalign(&p, PIXEL_STORAGE_ALIGNMENT, bytes) != 0)
+        p = nullptr;
+#endif
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void alignedFree(void* p)
+{
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+// IEEE 754 half to float, including denormals, infinities and NaNs.
+// NaNs come back quiet like _mm256_cvtph_ps
+static inline float halfToFloatScalar(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    uint32_t bits;
+
+    if (exponent == 0x1f)          // inf / NaN
+        bits = sign | 0x7f800000 | (mantissa << 13) | (mantissa != 0 ? 0x400000 : 0);
+    else if (exponent != 0)        // normal
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    else if (mantissa == 0)        // zero
+        bits = sign;
+    else                           // denormal, renormalise
+    {
+        exponent = 113;
+        while ((mantissa & 0x400) == 0)
+        {
+            mantissa <<= 1;
+            --exponent;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// float to half, round to nearest even like _mm256_cvtps_ph. Values
+// beyond the half range saturate to +-65504 instead of becoming
+// infinities: a bright light stored as inf would spread NaNs over the
+// whole frame through the convolution
+static inline uint16_t floatToHalfScalar(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t absBits = bits & 0x7fffffff;
+
+    if (absBits > 0x7f800000)      // NaN, keep it quiet
+        return (uint16_t)(sign | 0x7e00 | ((absBits >> 13) & 0x3ff));
+    if (absBits >= 0x477ff000)     // inf or rounds past 65504
+        return (uint16_t)(sign | HALF_MAX_BITS);
+
+    uint32_t h, remainder, halfway;
+    if (absBits < 0x38800000)      // half denormal or zero
+    {
+        if (absBits < 0x33000000)
+            return (uint16_t)sign;
+        uint32_t shift = 126 - (absBits >> 23);
+        uint32_t mantissa = (absBits & 0x7fffff) | 0x800000;
+        h = mantissa >> shift;
+        remainder = mantissa & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+    }
+    else                           // normal, rebias the exponent
+    {
+        h = (absBits - 0x38000000) >> 13;
+        remainder = absBits & 0x1fff;
+        halfway = 0x1000;
+    }
+
+    if (remainder > halfway || (remainder == halfway && (h & 1)))
+        ++h;
+    return (uint16_t)(sign | h);
+}
+
+#ifdef PIXEL_X86_DISPATCH
+
+__attribute__((target("avx,f16c")))
+static void halfToFloatF16C(const uint16_t* src, float* dst, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i h = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+    }
+    for (; i < n; ++i)
+        dst[i] = halfToFloatScalar(src[i]);
+}
+
+__attribute__((target("avx,f16c")))
+static void floatToHalfF16C(const float* src, uint16_t* dst, size_t n)
+{
+    size_t i = 0;
+    // min and max return their second operand for NaNs, so those pass through
+    const __m256 upper = _mm256_set1_ps(HALF_MAX);
+    const __m256 lower = _mm256_set1_ps(-HALF_MAX);
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 f = _mm256_max_ps(lower, _mm256_min_ps(upper, _mm256_loadu_ps(src + i)));
+        __m128i h = _mm256_cvtps_ph(f, _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(dst + i), h);
+    }
+    for (; i < n; ++i)
+        dst[i] = floatToHalfScalar(src[i]);
+}
+
+static const bool hasF16C = __builtin_cpu_supports("f16c");
+
+#endif // PIXEL_X86_DISPATCH
+
+void halfToFloat(const uint16_t* src, float* dst, size_t n)
+{
+#ifdef PIXEL_X86_DISPATCH
+    if (hasF16C)
+    {
+        halfToFloatF16C(src, dst, n);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = halfToFloatScalar(src[i]);
+}
+
+void floatToHalf(const float* src, uint16_t* dst, size_t n)
+{
+#ifdef PIXEL_X86_DISPATCH
+    if (hasF16C)
+    {
+        floatToHalfF16C(src, dst, n);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = floatToHalfScalar(src[i]);
+}
+
+// interleaved rows go through a float row of the full pixel width
+static float* scratchRow(size_t n)
+{
+    static thread_local std::vector<float> scratch;
+    if (scratch.size() < n)
+        scratch.resize(n);
+    return scratch.data();
+}
+
+
+PixelStorage::PixelStorage()
+    : m_data(nullptr)
+    , m_bytes(0)
+    , m_planeBytes(0)
+    , m_width(0)
+    , m_height(0)
+    , m_layout(PIXEL_LAYOUT_PLANAR)
+    , m_precision(PIXEL_PRECISION_FLOAT)
+{
+}
+
+PixelStorage::~PixelStorage()
+{
+    release();
+}
+
+void PixelStorage::allocate(int width, int height, PixelLayout layout, PixelPrecision precision)
+{
+    release();
+
+    m_width = width;
+    m_height = height;
+    m_layout = layout;
+    m_precision = precision;
+
+    size_t pixels = (size_t)width * height;
+    if (m_layout == PIXEL_LAYOUT_PLANAR)
+    {
+        m_planeBytes = pixels * elementSize();
+        m_planeBytes = (m_planeBytes + PIXEL_STORAGE_ALIGNMENT - 1) / PIXEL_STORAGE_ALIGNMENT * PIXEL_STORAGE_ALIGNMENT;
+        m_bytes = 3 * m_planeBytes;
+    }
+    else
+    {
+        m_planeBytes = 0;
+        m_bytes = 4 * pixels * elementSize();
+    }
+
+    m_data = (unsigned char*)alignedAlloc(m_bytes);
+}
+
+void PixelStorage::release()
+{
+    if (m_data != nullptr)
+        alignedFree(m_data);
+    m_data = nullptr;
+    m_bytes = 0;
+}
+
+size_t PixelStorage::elementSize() const
+{
+    return m_precision == PIXEL_PRECISION_HALF ? sizeof(uint16_t) : sizeof(float);
+}
+
+// planar: start of row y of channel c, interleaved: start of row y
+unsigned char* PixelStorage::rowAddress(int c, int y) const
+{
+    size_t rowOffset = (size_t)y * m_width * elementSize();
+    if (m_layout == PIXEL_LAYOUT_PLANAR)
+        return m_data + c * m_planeBytes + rowOffset;
+    return m_data + 4 * rowOffset;
+}
+
+void PixelStorage::storeRow(int y, const float* red, const float* green, const float* blue)
+{
+    if (m_layout == PIXEL_LAYOUT_PLANAR)
+    {
+        const float* channels[3] = {red, green, blue};
+        for (int c = 0; c < 3; ++c)
+        {
+            if (m_precision == PIXEL_PRECISION_HALF)
+                floatToHalf(channels[c], (uint16_t*)rowAddress(c, y), m_width);
+            else
+                memcpy(rowAddress(c, y), channels[c], sizeof(float) * m_width);
+        }
+        return;
+    }
+
+    float* rgba = m_precision == PIXEL_PRECISION_HALF ? scratchRow(4 * (size_t)m_width)
+                                                      : (float*)rowAddress(0, y);
+    for (int x = 0; x < m_width; ++x)
+    {
+        rgba[4*x]   = red[x];
+        rgba[4*x+1] = green[x];
+        rgba[4*x+2] = blue[x];
+        rgba[4*x+3] = 1.0f;
+    }
+
+    if (m_precision == PIXEL_PRECISION_HALF)
+        floatToHalf(rgba, (uint16_t*)rowAddress(0, y), 4 * (size_t)m_width);
+}
+
+void PixelStorage::loadRow(int c, int y, float* dest) const
+{
+    loadSpan(c, y, 0, m_width, dest);
+}
+
+void PixelStorage::loadSpan(int c, int y, int x, int n, float* dest) const
+{
+    if (m_layout == PIXEL_LAYOUT_PLANAR)
+    {
+        const unsigned char* row = rowAddress(c, y);
+        if (m_precision == PIXEL_PRECISION_HALF)
+            halfToFloat((const uint16_t*)row + x, dest, n);
+        else
+            memcpy(dest, (const float*)row + x, sizeof(float) * n);
+        return;
+    }
+
+    const float* rgba = (const float*)rowAddress(0, y) + 4 * (size_t)x;
+    if (m_precision == PIXEL_PRECISION_HALF)
+    {
+        float* span = scratchRow(4 * (size_t)n);
+        halfToFloat((const uint16_t*)rowAddress(0, y) + 4 * (size_t)x, span, 4 * (size_t)n);
+        rgba = span;
+    }
+
+    for (int i = 0; i < n; ++i)
+        dest[i] = rgba[4*i + c];
+}
+
+void PixelStorage::loadChannel(int c, float* dest) const
+{
+    const float* plane = getPlane(c);
+    if (plane != nullptr)
+    {
+        memcpy(dest, plane, sizeof(float) * m_width * m_height);
+        return;
+    }
+
+    ThreadPool::global().parallelFor(0, m_height, PIXEL_ROWS_PER_CHUNK, [&](size_t rowBegin, size_t rowEnd) {
+        for (size_t y = rowBegin; y < rowEnd; ++y)
+            loadRow(c, (int)y, dest + y * m_width);
+    });
+}
+
+const float* PixelStorage::getPlane(int c) const
+{
+    if (m_data == nullptr || m_layout != PIXEL_LAYOUT_PLANAR || m_precision != PIXEL_PRECISION_FLOAT)
+        return nullptr;
+    return (const float*)(m_data + c * m_planeBytes);
+}
@@ -0,0 +1,84 @@
+#ifndef PIXELSTORAGE_H
+#define PIXELSTORAGE_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Alignment of every plane, a cache line and a full AVX-512 register
+#define PIXEL_STORAGE_ALIGNMENT 64
+
+enum PixelLayout
+{
+    PIXEL_LAYOUT_PLANAR = 0,     // one plane per channel
+    PIXEL_LAYOUT_RGBA   = 1      // interleaved, alpha is 1
+};
+
+enum PixelPrecision
+{
+    PIXEL_PRECISION_FLOAT = 0,
+    PIXEL_PRECISION_HALF  = 1    // half the footprint, widened on access
+};
+
+void* alignedAlloc(size_t bytes);
+void alignedFree(void* p);
+
+// Largest finite half and its bits
+#define HALF_MAX 65504.0f
+#define HALF_MAX_BITS 0x7bff
+
+// half <-> float for a run of values, F16C when the CPU has it. Rounding
+// is to nearest even either way and both give the same bits. floatToHalf
+// saturates to +-HALF_MAX, NaNs stay NaNs
+void halfToFloat(const uint16_t* src, float* dst, size_t n);
+void floatToHalf(const float* src, uint16_t* dst, size_t n);
+
+// RGB pixels in one 64 byte aligned allocation. Rows are accessed as
+// float whatever the layout and precision are.
+class PixelStorage
+{
+public:
+    PixelStorage();
+    ~PixelStorage();
+
+    PixelStorage(const PixelStorage&) = delete;
+    PixelStorage& operator=(const PixelStorage&) = delete;
+
+    void allocate(int width, int height, PixelLayout layout, PixelPrecision precision);
+    void release();
+
+    bool empty() const { return m_data == nullptr; }
+    int getWidth() const { return m_width; }
+    int getHeight() const { return m_height; }
+    PixelLayout getLayout() const { return m_layout; }
+    PixelPrecision getPrecision() const { return m_precision; }
+    size_t getBytes() const { return m_bytes; }
+
+    // Row y of the three channels, converted to the storage precision
+    void storeRow(int y, const float* red, const float* green, const float* blue);
+
+    // Row y of channel c (0 red, 1 green, 2 blue) widened to float
+    void loadRow(int c, int y, float* dest) const;
+    // n pixels of it starting at column x
+    void loadSpan(int c, int y, int x, int n, float* dest) const;
+
+    // Channel c as a tightly packed width x height float plane
+    void loadChannel(int c, float* dest) const;
+
+    // Channel c in place for planar float storage, nullptr otherwise
+    const float* getPlane(int c) const;
+
+private:
+    size_t elementSize() const;
+    unsigned char* rowAddress(int c, int y) const;
+
+    unsigned char* m_data;
+    size_t m_bytes;
+    size_t m_planeBytes;    // planar only, rounded up to the alignment
+
+    int m_width;
+    int m_height;
+    PixelLayout m_layout;
+    PixelPrecision m_precision;
+};
+
+#endif // PIXELSTORAGE_H
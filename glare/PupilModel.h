@@ -0,0 +1,102 @@
+#ifndef PUPILMODEL_H
+#define PUPILMODEL_H
+
+#include <algorithm>
+#include <cmath>
+
+// Pupil dynamics. The diameter follows the luminance of a foveal window
+// of the scene after a latency, constricting faster than it dilates, and
+// hippus, the slow unrest of the pupil, is added on top. The state is
+// advanced once a frame by the elapsed time, by glr_update_pupil on the
+// device and by pupilStep on the host for the CPU backend.
+// kernels/pupil.cl repeats the constants and PupilState
+
+// Side of the square window around the image centre the adaptation
+// luminance is averaged over, as a fraction of the image height
+#define PUPIL_FOVEA 0.125f
+// Seconds before the pupil reacts to a change of luminance, and the time
+// constants of constriction and dilation
+#define PUPIL_LATENCY 0.25f
+#define PUPIL_TAU_CONSTRICT 0.15f
+#define PUPIL_TAU_DILATE 1.5f
+// Correlation time (s) and scale of the hippus, the scale as the frame
+// noise of the pupil had before
+#define PUPIL_HIPPUS_TAU 1.0f
+#define PUPIL_HIPPUS_SIGMA 0.05f
+#define PUPIL_MIN_DIAMETER 1.5f
+// Luminance samples kept to look back over the latency, enough for
+// frames at up to 250 fps
+#define PUPIL_HISTORY 64
+// Work-group size of the foveal reduction
+#define PUPIL_GROUP 256
+
+// Plain 32 bit fields only, the device sees the same layout. All zero is
+// the reset state, the first step starts adapted to its luminance
+struct PupilState
+{
+    float time;                 // s since the reset
+    float diameter;             // mm, the adaptation diameter
+    float hippus;               // unit variance hippus noise
+    float aperture;             // mm, with hippus, what the frame renders
+    float radiusPx;             // aperture radius in PSF pixels
+    float luminance;            // cd/m^2 of the last frame
+    unsigned int count;         // luminance samples so far
+    unsigned int pad;
+    float sampleTime[PUPIL_HISTORY];
+    float sampleLuminance[PUPIL_HISTORY];
+};
+
+// Steady state diameter in mm for an adaptation luminance in cd/m^2
+// (Moon and Spencer)
+inline float pupilSteadyDiameter(float luminance)
+{
+    return 4.9f - 3.0f * std::tanh(0.4f * (std::log(std::max(luminance, 1e-6f)) + 1.0f));
+}
+
+// Advances the pupil by dt seconds. luminance is the adaptation luminance
+// of the frame and gauss a standard normal draw for the hippus
+inline void pupilStep(PupilState& state, float luminance, float dt, float gauss,
+                      float maxDiameter, int psfHeight)
+{
+    if (state.count == 0)
+    {
+        state.time = 0.0f;
+        state.diameter = pupilSteadyDiameter(luminance);
+        state.hippus = 0.0f;
+    }
+    else
+    {
+        state.time += dt;
+    }
+
+    state.sampleTime[state.count % PUPIL_HISTORY] = state.time;
+    state.sampleLuminance[state.count % PUPIL_HISTORY] = luminance;
+    state.count++;
+
+    // the newest sample at least the latency old, or the oldest one kept
+    unsigned int kept = std::min(state.count, (unsigned int)PUPIL_HISTORY);
+    float delayed = luminance;
+    for (unsigned int k = 0; k < kept; ++k)
+    {
+        unsigned int slot = (state.count - 1 - k) % PUPIL_HISTORY;
+        delayed = state.sampleLuminance[slot];
+        if (state.time - state.sampleTime[slot] >= PUPIL_LATENCY)
+            break;
+    }
+
+    float target = pupilSteadyDiameter(delayed);
+    float tau = target < state.diameter ? PUPIL_TAU_CONSTRICT : PUPIL_TAU_DILATE;
+    state.diameter += (target - state.diameter) * (1.0f - std::exp(-dt / tau));
+
+    float decay = std::exp(-dt / PUPIL_HIPPUS_TAU);
+    state.hippus = state.hippus * decay + std::sqrt(1.0f - decay * decay) * gauss;
+
+    // hippus grows with the room the pupil has, as in Pamplona et al.
+    float p = std::min(state.diameter, maxDiameter);
+    float aperture = p + PUPIL_HIPPUS_SIGMA * state.hippus * maxDiameter / p * std::sqrt(1.0f - p / maxDiameter);
+    state.aperture = std::max(PUPIL_MIN_DIAMETER, std::min(aperture, maxDiameter));
+    state.radiusPx = (float)psfHeight / maxDiameter * state.aperture / 2.0f;
+    state.luminance = luminance;
+}
+
+#endif // PUPILMODEL_H
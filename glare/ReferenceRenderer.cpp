@@ -0,0 +1,337 @@
+#include "ReferenceRenderer.h"
+#include "GlareConstants.h"
+#include "LensParticles.h"
+#include "spectrumMap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+typedef std::complex<double> Complex;
+
+static const double PI = 3.14159265358979323846;
+
+// Unscaled complex transform of one length, radix 2 for powers of two
+// and Bluestein's chirp z-transform over a power of two otherwise
+class ReferenceFFT
+{
+public:
+    explicit ReferenceFFT(int n) : m_n(n), m_size(1)
+    {
+        bool power = (n & (n - 1)) == 0;
+        while (m_size < (power ? n : 2 * n - 1))
+            m_size *= 2;
+
+        m_twiddles.resize(m_size / 2);
+        for (int k = 0; k < m_size / 2; ++k)
+            m_twiddles[k] = std::polar(1.0, -2.0 * PI * k / m_size);
+        if (power)
+            return;
+
+        // exp(-i pi k^2 / n), k^2 modulo 2n keeps the phase exact
+        m_chirp.resize(n);
+        for (int k = 0; k < n; ++k)
+            m_chirp[k] = std::polar(1.0, -PI * (double)(((long long)k * k) % (2LL * n)) / n);
+        m_filter.assign(m_size, Complex());
+        for (int k = 0; k < n; ++k)
+        {
+            m_filter[k] = std::conj(m_chirp[k]);
+            if (k > 0)
+                m_filter[m_size - k] = std::conj(m_chirp[k]);
+        }
+        radix2(m_filter.data(), false);
+    }
+
+    // In place, n values
+    void transform(Complex* data, bool inverse) const
+    {
+        if (m_chirp.empty())
+        {
+            radix2(data, inverse);
+            return;
+        }
+
+        // the inverse is the conjugate of the forward transform of the conjugate
+        std::vector<Complex> work(m_size);
+        for (int k = 0; k < m_n; ++k)
+            work[k] = (inverse ? std::conj(data[k]) : data[k]) * m_chirp[k];
+        radix2(work.data(), false);
+        for (int k = 0; k < m_size; ++k)
+            work[k] *= m_filter[k];
+        radix2(work.data(), true);
+        for (int k = 0; k < m_n; ++k)
+        {
+            Complex value = work[k] * m_chirp[k] / (double)m_size;
+            data[k] = inverse ? std::conj(value) : value;
+        }
+    }
+
+private:
+    void radix2(Complex* data, bool inverse) const
+    {
+        for (int i = 1, j = 0; i < m_size; ++i)
+        {
+            int bit = m_size >> 1;
+            for (; j & bit; bit >>= 1)
+                j ^= bit;
+            j ^= bit;
+            if (i < j)
+                std::swap(data[i], data[j]);
+        }
+
+        for (int length = 2; length <= m_size; length *= 2)
+        {
+            int half = length / 2;
+            int step = m_size / length;
+            for (int start = 0; start < m_size; start += length)
+                for (int k = 0; k < half; ++k)
+                {
+                    Complex w = inverse ? std::conj(m_twiddles[k * step]) : m_twiddles[k * step];
+                    Complex a = data[start + k];
+                    Complex b = data[start + k + half] * w;
+                    data[start + k] = a + b;
+                    data[start + k + half] = a - b;
+                }
+        }
+    }
+
+    int m_n;
+    int m_size;                         // of the radix 2 transform
+    std::vector<Complex> m_twiddles;
+    std::vector<Complex> m_chirp;       // Bluestein only
+    std::vector<Complex> m_filter;      // transform of the conjugate chirp
+};
+
+// Unscaled transform of a width x height plane, rows then columns
+static void transform2D(ThreadPool& pool, const ReferenceFFT& rows, const ReferenceFFT& columns,
+                        Complex* plane, int width, int height, bool inverse)
+{
+    pool.parallelFor(0, height, 1, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y)
+            rows.transform(plane + y * width, inverse);
+    });
+    pool.parallelFor(0, width, 16, [&](size_t begin, size_t end) {
+        std::vector<Complex> column(height);
+        for (size_t x = begin; x < end; ++x)
+        {
+            for (int y = 0; y < height; ++y)
+                column[y] = plane[(size_t)y * width + x];
+            columns.transform(column.data(), inverse);
+            for (int y = 0; y < height; ++y)
+                plane[(size_t)y * width + x] = column[y];
+        }
+    });
+}
+
+// the shift of compute_magnitude_kernel, see CpuRenderer
+static inline int shiftSource(int dest, int half, int size)
+{
+    if (dest + half < size)
+        return dest + half;
+    if (dest - half >= 0 && dest - half < half)
+        return dest - half;
+    return -1;
+}
+
+// Bilinear taps of one axis with a zero border
+struct ReferenceTaps
+{
+    int first, second;
+    double firstWeight, secondWeight;
+};
+
+static ReferenceTaps taps(double coordinate, int size)
+{
+    double t = coordinate * size - 0.5;
+    double t0 = std::floor(t);
+    double weight = t - t0;
+    int i0 = (int)t0;
+    bool valid0 = i0 >= 0 && i0 < size;
+    bool valid1 = i0 + 1 >= 0 && i0 + 1 < size;
+    ReferenceTaps result = {valid0 ? i0 : 0, valid1 ? i0 + 1 : 0,
+                            valid0 ? 1 - weight : 0.0, valid1 ? weight : 0.0};
+    return result;
+}
+
+ReferenceRenderer::ReferenceRenderer(unsigned int nThreads) :
+    m_pool(nThreads), m_width(0), m_height(0)
+{
+}
+
+void ReferenceRenderer::render(const float* red, const float* green, const float* blue, int width, int height,
+                               const CpuFrameParams& params)
+{
+    m_width = width;
+    m_height = height;
+    const size_t planeSize = (size_t)width * height;
+    ReferenceFFT rows(width), columns(height);
+
+    // STEP: APERTURE, the optical depth of the lens particles first
+    std::vector<unsigned int> depth(planeSize, 0);
+    const float extent = LENS_PARTICLE_RADIUS + 0.5f;
+    for (int n = 0; n < params.nPoints; ++n)
+    {
+        float px, py;
+        lensScreenPosition(params.points + 4 * (size_t)n, params.distort, width, height, px, py);
+        int x0 = std::max((int)std::floor(px - extent), 0);
+        int x1 = std::min((int)std::ceil(px + extent), width);
+        int y0 = std::max((int)std::floor(py - extent), 0);
+        int y1 = std::min((int)std::ceil(py + extent), height);
+
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x)
+            {
+                float dx = x + 0.5f - px;
+                float dy = y + 0.5f - py;
+                depth[(size_t)y * width + x] += lensPointDepth(std::sqrt(dx * dx + dy * dy));
+            }
+    }
+
+    // pupil, gratings and particles times the Fresnel term
+    const double lambda = params.lambda;
+    const double d = params.distance;
+    const double resolution = (double)height / params.maxPupilSize;     // px / mm
+    const double pupil2 = (double)params.pupilRadius * params.pupilRadius;
+    const double slid2 = (double)params.slidRadius * params.slidRadius;
+    std::vector<Complex> field(planeSize);
+
+    m_pool.parallelFor(0, height, 1, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y)
+        {
+            double yp = ((double)y / height - 0.5) / resolution / d / lambda;
+            double dy = params.pupilCenterY - (double)y;
+            for (int x = 0; x < width; ++x)
+            {
+                size_t i = y * width + x;
+                double xp = ((double)x / width - 0.5) / resolution / d / lambda;
+                double dx = params.pupilCenterX - (double)x;
+                double d2 = dx * dx + dy * dy;
+
+                double value = d2 > slid2 ? params.gratings[i] : 255.0;
+                value *= std::exp(-(double)depth[i] / LENS_DEPTH_SCALE);
+                if (d2 > pupil2)
+                    value = 0.0;
+                field[i] = std::polar(value / 255.0, PI / (d * lambda) * (xp * xp + yp * yp));
+            }
+        }
+    });
+
+    // STEP: FFT OF THE APERTURE, magnitude of the field centred
+    transform2D(m_pool, rows, columns, field.data(), width, height, false);
+
+    const int half = width / 2;
+    const double K = lambda * lambda * d * d;
+    std::vector<double> fresnel(planeSize);
+    for (int y = 0; y < height; ++y)
+    {
+        int sy = shiftSource(y, half, height);
+        for (int x = 0; x < width; ++x)
+        {
+            int sx = shiftSource(x, half, width);
+            fresnel[(size_t)y * width + x] = sx >= 0 && sy >= 0 ?
+                std::abs(field[(size_t)sy * width + sx]) / K / width / height : 0.0;
+        }
+    }
+
+    // taken to PSF_ENERGY like the pipelines
+    double energy = 0.0;
+    for (size_t i = 0; i < planeSize; ++i)
+        energy += fresnel[i];
+    if (energy > 0.0)
+        for (size_t i = 0; i < planeSize; ++i)
+            fresnel[i] *= PSF_ENERGY / energy;
+    std::vector<Complex>().swap(field);
+
+    // STEP: SPECTRAL BLUR, the colour matching functions interpolated
+    // linearly and zero past the end of the table
+    const int samples = REFERENCE_SPECTRAL_SAMPLES;
+    const double lambdaNm = lambda * 1000 * 1000;
+    std::vector<double> wavelengths(samples);
+    std::vector<double> xyz(3 * (size_t)samples);
+    for (int i = 0; i < samples; ++i)
+    {
+        wavelengths[i] = 390 + 400.0 * i / samples;
+        double position = wavelengths[i] - 390;
+        int idx = (int)std::floor(position);
+        double weight = position - idx;
+        for (int k = 0; k < 3; ++k)
+        {
+            double v1 = idx < SPECTRUM_RESOLUTION ? spectrum[idx * 3 + k] : 0.0;
+            double v2 = idx + 1 < SPECTRUM_RESOLUTION ? spectrum[(idx + 1) * 3 + k] : 0.0;
+            xyz[3 * i + k] = v1 + (v2 - v1) * weight;
+        }
+    }
+
+    std::vector<ReferenceTaps> columnTaps((size_t)samples * width);
+    for (int i = 0; i < samples; ++i)
+        for (int x = 0; x < width; ++x)
+            columnTaps[(size_t)i * width + x] = taps(((double)x / width - 0.5) * lambdaNm / wavelengths[i] + 0.5, width);
+
+    std::vector<double> psf[3];
+    for (int c = 0; c < 3; ++c)
+        psf[c].resize(planeSize);
+
+    m_pool.parallelFor(0, height, 1, [&](size_t begin, size_t end) {
+        std::vector<double> X(width), Y(width), Z(width);
+        for (size_t py = begin; py < end; ++py)
+        {
+            std::fill(X.begin(), X.end(), 0.0);
+            std::fill(Y.begin(), Y.end(), 0.0);
+            std::fill(Z.begin(), Z.end(), 0.0);
+
+            double y = (double)py / height - 0.5;
+            for (int i = 0; i < samples; ++i)
+            {
+                ReferenceTaps rowTaps = taps(y * lambdaNm / wavelengths[i] + 0.5, height);
+                const double* row0 = fresnel.data() + (size_t)rowTaps.first * width;
+                const double* row1 = fresnel.data() + (size_t)rowTaps.second * width;
+                const ReferenceTaps* column = columnTaps.data() + (size_t)i * width;
+
+                for (int x = 0; x < width; ++x)
+                {
+                    const ReferenceTaps& t = column[x];
+                    double intensity = rowTaps.firstWeight * (t.firstWeight * row0[t.first] + t.secondWeight * row0[t.second]) +
+                                       rowTaps.secondWeight * (t.firstWeight * row1[t.first] + t.secondWeight * row1[t.second]);
+                    X[x] += xyz[3 * i] * intensity;
+                    Y[x] += xyz[3 * i + 1] * intensity;
+                    Z[x] += xyz[3 * i + 2] * intensity;
+                }
+            }
+
+            for (int x = 0; x < width; ++x)
+            {
+                double cx = X[x] / samples / 21;
+                double cy = Y[x] / samples / 21;
+                double cz = Z[x] / samples / 21;
+
+                size_t index = py * width + x;
+                psf[0][index] = std::min(3.2404542 * cx - 1.5371385 * cy - 0.4985314 * cz, 1.0);
+                psf[1][index] = std::min(-0.9692660 * cx + 1.8760108 * cy + 0.0415560 * cz, 1.0);
+                psf[2][index] = std::min(0.0556434 * cx - 0.2040259 * cy + 1.0572252 * cz, 1.0);
+            }
+        }
+    });
+
+    // STEP: CONVOLUTION, circular like the transforms of the pipelines
+    const float* image[3] = {red, green, blue};
+    std::vector<Complex> psfSpectrum(planeSize), imageSpectrum(planeSize);
+    for (int c = 0; c < 3; ++c)
+    {
+        for (size_t i = 0; i < planeSize; ++i)
+        {
+            psfSpectrum[i] = psf[c][i];
+            imageSpectrum[i] = image[c][i];
+        }
+        std::vector<double>().swap(psf[c]);
+
+        transform2D(m_pool, rows, columns, psfSpectrum.data(), width, height, false);
+        transform2D(m_pool, rows, columns, imageSpectrum.data(), width, height, false);
+        for (size_t i = 0; i < planeSize; ++i)
+            psfSpectrum[i] *= imageSpectrum[i];
+        transform2D(m_pool, rows, columns, psfSpectrum.data(), width, height, true);
+
+        m_hdr[c].resize(planeSize);
+        for (size_t i = 0; i < planeSize; ++i)
+            m_hdr[c][i] = psfSpectrum[i].real() / planeSize;
+    }
+}
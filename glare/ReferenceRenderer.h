@@ -0,0 +1,46 @@
+#ifndef REFERENCERENDERER_H
+#define REFERENCERENDERER_H
+
+#include "CpuRenderer.h"
+#include "ThreadPool.h"
+
+#include <vector>
+
+// Wavelengths of the reference's spectral integral, one per nm over the
+// 390 to 790 nm the spectral blur covers
+#define REFERENCE_SPECTRAL_SAMPLES 400
+
+// The linear glare image of one frame in double precision, the yardstick
+// the optimised pipelines are measured against. Same aperture model as
+// render.cl and fresnel.cl: pupil, gratings and lens particles times the
+// Fresnel term, the magnitude of its transform spread over the spectrum
+// and convolved with the image. Where the pipelines approximate, it does
+// not: the aperture is not stored as bytes, the colour matching functions
+// are interpolated at REFERENCE_SPECTRAL_SAMPLES wavelengths and every
+// transform is a double precision FFT of the full frame. Slow, a frame at
+// a time, for glare-bench --accuracy.
+class ReferenceRenderer
+{
+public:
+    // nThreads = 0 uses every hardware thread
+    explicit ReferenceRenderer(unsigned int nThreads = 0);
+
+    // Renders width x height linear planes with the aperture of params,
+    // whose PSF pixels must be image pixels: a frame of the CPU backend
+    // at render scale 1
+    void render(const float* red, const float* green, const float* blue, int width, int height,
+                const CpuFrameParams& params);
+
+    int getWidth() const { return m_width; }
+    int getHeight() const { return m_height; }
+    // Linear red, green and blue planes
+    const double* getHdr(int c) const { return m_hdr[c].data(); }
+
+private:
+    ThreadPool m_pool;
+    int m_width;
+    int m_height;
+    std::vector<double> m_hdr[3];
+};
+
+#endif // REFERENCERENDERER_H
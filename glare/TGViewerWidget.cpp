@@ -3,19 +3,41 @@
 #include <algorithm>
 
 #include <QPainter>
+#include <QImage>
 #include <QTimer>
 #include <QTime>
+#include <iostream>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif !defined(__APPLE__)
+#include <GL/glx.h>
+#endif
 
 TGViewerWidget::TGViewerWidget(TemporalGlareRenderer *renderer, QWidget *parent)
-    : QOpenGLWidget(parent), glRenderer(renderer)
+    : QOpenGLWidget(parent), glRenderer(renderer), glSharing(false), pboSupported(false),
+      displayTexture(0), pboIndex(0), textureWidth(0), textureHeight(0)
 {
-    elapsed = 0;
+    pbo[0] = pbo[1] = 0;
+    glRenderer->setDynamicResolution(scheduler.isAdaptive());
 		setMinimumSize(512, 512);
     setAutoFillBackground(false);
 		setFocusPolicy(Qt::StrongFocus);
 
-		connect(&timer, SIGNAL(timeout()), this, SLOT(update()));
-		timer.start(1000);
+		timer.setSingleShot(true);
+		timer.setTimerType(Qt::PreciseTimer);
+		connect(&timer, SIGNAL(timeout()), this, SLOT(animate()));
+		timer.start(0);
+}
+
+TGViewerWidget::~TGViewerWidget()
+{
+	makeCurrent();
+	if (displayTexture != 0)
+		glDeleteTextures(1, &displayTexture);
+	if (pboSupported)
+		glDeleteBuffers(2, pbo);
+	doneCurrent();
 }
 
 QSize TGViewerWidget::sizeHint() const
@@ -25,7 +47,41 @@ QSize TGViewerWidget::sizeHint() const
 
 void TGViewerWidget::animate()
 {
-    elapsed = (elapsed + qobject_cast<QTimer*>(sender())->interval()) % 1000;
+	update();
+}
+
+void TGViewerWidget::setFrameRate(double fps)
+{
+	scheduler.setTargetFps(fps);
+}
+
+void TGViewerWidget::setDynamicResolution(bool enabled)
+{
+	scheduler.setAdaptive(enabled);
+	glRenderer->setDynamicResolution(enabled);
+	update();
+}
+
+// Advances the renderer by the scheduler's fixed steps at the quality it
+// picked for this frame
+bool TGViewerWidget::renderFrame()
+{
+	float dt = scheduler.beginFrame();
+	glRenderer->setRenderQuality(scheduler.getQuality());
+	return glRenderer->stepFrame(dt);
+}
+
+// Hands the frame's timings to the scheduler and arms the timer for the
+// next deadline, or polls at the target rate while there is nothing to show
+void TGViewerWidget::scheduleFrame(bool rendered)
+{
+	if (rendered)
+	{
+		scheduler.endFrame(glRenderer->getFrameTimings());
+		timer.start(scheduler.msUntilNextFrame());
+	}
+	else
+		timer.start(std::max(1, (int)(1000.0 / scheduler.getTargetFps())));
 }
 
 void TGViewerWidget::setKpos(QVector3D newK_pos)
@@ -93,6 +149,24 @@ void TGViewerWidget::setExposureMode(int newMode)
 	emit ExposureModeChanged(newMode);
 }
 
+void TGViewerWidget::setToneMapOperator(int newOperator)
+{
+	switch(newOperator)
+	{
+		case 1:
+			glRenderer->m_toneMapOperator = TM_REINHARD_LOCAL;
+			break;
+		case 2:
+			glRenderer->m_toneMapOperator = TM_HISTOGRAM_ADJUSTMENT;
+			break;
+		default:
+			glRenderer->m_toneMapOperator = TM_REINHARD_EXTENDED;
+	}
+
+	update();
+	emit ToneMapOperatorChanged(newOperator);
+}
+
 void TGViewerWidget::refresh()
 {
 
@@ -112,16 +186,176 @@ void TGViewerWidget::setFov(double newFov)
 	emit fovChanged(newFov);
 }
 
-void TGViewerWidget::paintEvent(QPaintEvent *event)
+void TGViewerWidget::initializeGL()
 {
-    QTime time;
-    time.start();
-    QPainter painter;
-    painter.begin(this);
-    painter.setRenderHint(QPainter::Antialiasing);
-    glRenderer->paint(&painter, event, elapsed, size());
-    painter.end();
+	glewExperimental = GL_TRUE;
+	if (glewInit() != GLEW_OK)
+		std::cout << "GLEW could not be initialised, frames are drawn with QPainter\n";
+	else
+	{
+		// uploadFrame maps the PBOs with glMapBufferRange
+		pboSupported = GLEW_VERSION_3_0 || GLEW_ARB_map_buffer_range;
+		if (!pboSupported)
+			std::cout << "glMapBufferRange not supported, frames are drawn with QPainter\n";
+	}
+
+	// the current context for OpenCL to share with, none on macOS
+#if defined(_WIN32)
+	cl_context_properties glProperties[] = {
+		CL_GL_CONTEXT_KHR,   (cl_context_properties)wglGetCurrentContext(),
+		CL_WGL_HDC_KHR,      (cl_context_properties)wglGetCurrentDC(),
+		0
+	};
+	glSharing = glRenderer->initGLSharing(glProperties);
+#elif defined(__APPLE__)
+	glSharing = glRenderer->initGLSharing(NULL);
+#else
+	cl_context_properties glProperties[] = {
+		CL_GL_CONTEXT_KHR,   (cl_context_properties)glXGetCurrentContext(),
+		CL_GLX_DISPLAY_KHR,  (cl_context_properties)glXGetCurrentDisplay(),
+		0
+	};
+	glSharing = glRenderer->initGLSharing(glProperties);
+#endif
+	glGenTextures(1, &displayTexture);
+
+	if (pboSupported)
+		glGenBuffers(2, pbo);
+}
+
+void TGViewerWidget::paintGL()
+{
+	QTime time;
+	time.start();
+
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	if (glRenderer->getWidth() == 0 || glRenderer->getHeight() == 0)
+	{
+		scheduleFrame(false);
+		return;
+	}
+
+	if (!pboSupported)
+	{
+		// tiled frames and size mismatches would need uploadFrame even
+		// with GL sharing, let QPainter upload every frame instead
+		bool rendered = renderFrame();
+		if (rendered)
+		{
+			try {
+				// the frame is already in Qt's native format, wrap it without a copy
+				QImage img(glRenderer->stageFrame(), glRenderer->getWidth(), glRenderer->getHeight(),
+				           QImage::Format_ARGB32_Premultiplied);
+				QPainter painter;
+				painter.begin(this);
+				painter.setRenderHint(QPainter::SmoothPixmapTransform);
+				painter.drawImage(QRect(0, 0, glRenderer->getSourceWidth(), glRenderer->getSourceHeight()), img);
+				painter.end();
+			} catch(cl::Error err) {
+				std::cerr << "ERROR: " << err.what() << "(" << err.err() << ")" << std::endl;
+			}
+		}
+		scheduleFrame(rendered);
 		emit renderTimeUpdated( time.elapsed() );
+		return;
+	}
+
+	// GL must be done with the texture before OpenCL acquires it
+	if (glSharing)
+		glFinish();
+
+	// the quality, and so the frame size, is settled before the texture
+	bool rendered = renderFrame();
+	scheduleFrame(rendered);
+	if (!rendered)
+		return;
+
+	int width  = glRenderer->getWidth();
+	int height = glRenderer->getHeight();
+	updateDisplayTexture(width, height);
+
+	// tiled frames and size mismatches, such as the first frame after the
+	// quality changed, do not go through the texture
+	if (!glRenderer->isFrameInDisplay())
+		uploadFrame(width, height);
+
+	drawFrame(glRenderer->getSourceWidth(), glRenderer->getSourceHeight());
+	emit renderTimeUpdated( time.elapsed() );
+}
+
+// (Re)allocates the texture storage when the image size changes
+void TGViewerWidget::updateDisplayTexture(int width, int height)
+{
+	if (width == textureWidth && height == textureHeight)
+		return;
+
+	glBindTexture(GL_TEXTURE_2D, displayTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	textureWidth = width;
+	textureHeight = height;
+
+	if (glSharing)
+		glRenderer->setDisplayTexture(displayTexture, width, height);
+}
+
+// Reads the frame into the next PBO of the ring and lets the driver copy
+// it into the texture asynchronously
+void TGViewerWidget::uploadFrame(int width, int height)
+{
+	GLsizeiptr size = (GLsizeiptr)width * height * 4;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[pboIndex]);
+
+	// orphan the old storage so mapping does not wait for its transfer
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	void* ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (ptr != NULL)
+	{
+		glRenderer->readFrame((unsigned char*)ptr);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+		// sourced from the bound PBO, returns without waiting for the copy.
+		// Frames are 0xAARRGGBB words, the layout GL calls BGRA_REV
+		glBindTexture(GL_TEXTURE_2D, displayTexture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	pboIndex = (pboIndex + 1) % 2;
+}
+
+// Textured quad at the image's native size, top-left aligned. Frames
+// rendered below scale 1 are stretched back to it
+void TGViewerWidget::drawFrame(int width, int height)
+{
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrtho(0, this->width(), this->height(), 0, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+
+	glEnable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, displayTexture);
+	glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+
+	glBegin(GL_QUADS);
+	glTexCoord2f(0.0f, 0.0f); glVertex2f(0.0f, 0.0f);
+	glTexCoord2f(1.0f, 0.0f); glVertex2f(width, 0.0f);
+	glTexCoord2f(1.0f, 1.0f); glVertex2f(width, height);
+	glTexCoord2f(0.0f, 1.0f); glVertex2f(0.0f, height);
+	glEnd();
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glDisable(GL_TEXTURE_2D);
 }
 
 void TGViewerWidget::keyPressEvent(QKeyEvent *event)
@@ -265,4 +499,9 @@ int TGViewerWidget::getExposureMode()
 	if(glRenderer->m_autoExposure) 
 		return 0; 
 	return 1;
+}
+
+int TGViewerWidget::getToneMapOperator()
+{
+	return glRenderer->m_toneMapOperator;
 }
\ No newline at end of file
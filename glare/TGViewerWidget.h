@@ -4,7 +4,9 @@
 #include <GL/glew.h>
 #include <QOpenGLWidget>
 #include <QKeyEvent>
+#include <QVector3D>
 #include "TemporalGlareRenderer.h"
+#include "FrameScheduler.h"
 #include <QLabel>
 #include <QTimer>
 
@@ -14,6 +16,7 @@ class TGViewerWidget : public QOpenGLWidget
 
 public:
     TGViewerWidget(TemporalGlareRenderer *glRenderer, QWidget *parent);
+    ~TGViewerWidget();
 	QVector3D getKpos();
 	float getFocal();
 	float getAperture();
@@ -23,10 +26,13 @@ public:
 	float getExposure();
 	float getAlpha();
 	int getExposureMode();
+	int getToneMapOperator();
 
 public slots:
     void animate();
 	void refresh();
+	void setFrameRate(double fps);	// how often the view is re-rendered
+	void setDynamicResolution(bool enabled);	// lower the render scale to keep the frame rate
 	
 	void setKpos(QVector3D newK_pos);  // Set a new position of the virtual camera
 	void setFocal(double newFocus);  // Set a new focus distance for the virtual camera
@@ -38,6 +44,7 @@ public slots:
 	void setExposure(double newAlpha);
 	void setAlpha(double newAlpha);
 	void setExposureMode(int newMode); 	// true for Auto false for Manual
+	void setToneMapOperator(int newOperator);
 
 signals:
 	void KposChanged(QVector3D newK_pos);
@@ -59,9 +66,12 @@ signals:
 	void ExposureChanged(double exposure);
 signals:
 	void ExposureModeChanged(int mode);
+signals:
+	void ToneMapOperatorChanged(int tmOperator);
 
 protected:
-    void paintEvent(QPaintEvent *event) override;
+    void initializeGL() override;
+    void paintGL() override;
     void keyPressEvent(QKeyEvent *event);
 
 	void mousePressEvent(QMouseEvent *event) override;
@@ -71,12 +81,29 @@ protected:
 
 private:
     TemporalGlareRenderer *glRenderer;
-    int elapsed;
 	QPoint mouseDragStart;
 	Qt::MouseButton mouseDragButton;
 	double mouseDragFocal;
 
+	// frames are paced by the scheduler, the timer fires once per frame
+	FrameScheduler scheduler;
 	QTimer timer;
+
+	bool renderFrame();
+	void scheduleFrame(bool rendered);
+
+	// Display texture, written by OpenCL through GL sharing or uploaded
+	// from a ring of pixel buffer objects
+	void updateDisplayTexture(int width, int height);
+	void uploadFrame(int width, int height);
+	void drawFrame(int width, int height);
+
+	bool glSharing;
+	bool pboSupported;
+	GLuint displayTexture;
+	GLuint pbo[2];
+	int pboIndex;
+	int textureWidth, textureHeight;
 };
 
 #endif // GLWIDGET_H
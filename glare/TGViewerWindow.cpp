@@ -1,6 +1,7 @@
 #include <QGridLayout>
 #include <QTimer>
 #include <QShortcut>
+#include <QFontDatabase>
 
 
 #define _USE_MATH_DEFINES
@@ -10,6 +11,7 @@
 
 
 TGViewerWindow::TGViewerWindow()
+	: sequenceDecoders(0)
 {
 	setWindowTitle(tr("Temporal Glare Renderer"));
 	tgViewerWidget = new TGViewerWidget(&tgRenderer, this);
@@ -27,7 +29,9 @@ TGViewerWindow::TGViewerWindow()
 	image_io_layout->addWidget(imageLoadLabel);
 	QPushButton *load_exr_button = new QPushButton("Load .exr image", this);
 	image_io_layout->addWidget(load_exr_button);
-	QPushButton *save_png_button = new QPushButton("Save .png image", this);
+	QPushButton *load_sequence_button = new QPushButton("Load .exr sequence", this);
+	image_io_layout->addWidget(load_sequence_button);
+	QPushButton *save_png_button = new QPushButton("Save image", this);
 	image_io_layout->addWidget(save_png_button);
 	controls_layout->addLayout(image_io_layout);
 
@@ -59,9 +63,10 @@ TGViewerWindow::TGViewerWindow()
 	tonemapLabel->setAlignment(Qt::AlignLeft);
 	tonemap_layout->addWidget(tonemapLabel);
 
-	QLabel *tonemapOperatorLabel = new QLabel(tr("Reinhard Extended"));
-	tonemapOperatorLabel->setAlignment(Qt::AlignRight);
-	tonemap_layout->addWidget(tonemapOperatorLabel);
+	QStringList operators = {"Reinhard Extended", "Reinhard Local", "Histogram Adjustment"};
+	QComboBox *tonemap_combo = new QComboBox(this);
+	tonemap_combo->addItems(operators);
+	tonemap_layout->addWidget(tonemap_combo);
 
 	// 1st control
 	QHBoxLayout *tonemap_control1_layout = new QHBoxLayout;
@@ -118,9 +123,18 @@ TGViewerWindow::TGViewerWindow()
 
 
 	controls_layout->addWidget( controlsHelpLabel );
+	stageOverlayCB = new QCheckBox(tr("Stage timings"));
+	controls_layout->addWidget( stageOverlayCB );
 	renderTimeLabel = new QLabel(this);
 	controls_layout->addWidget( renderTimeLabel );
 
+	// drawn over the top left corner of the view
+	stageOverlay = new QLabel(tgViewerWidget);
+	stageOverlay->setStyleSheet("QLabel { background-color: rgba(0, 0, 0, 160); color: white; padding: 4px; }");
+	stageOverlay->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+	stageOverlay->move(8, 8);
+	stageOverlay->hide();
+
 	QWidget *central_widget = new QWidget( this );
 	central_widget->setLayout(main_layout);
 	setCentralWidget(central_widget);
@@ -146,9 +160,13 @@ TGViewerWindow::TGViewerWindow()
 	connect(control1SB, static_cast<void (QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged), tgViewerWidget, &TGViewerWidget::setGamma);
 	connect(control2SB, static_cast<void (QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged), tgViewerWidget, &TGViewerWidget::setLWhite);
 	connect(exposure_combo, static_cast<void(QComboBox::*)(int)>(&QComboBox::currentIndexChanged), tgViewerWidget, &TGViewerWidget::setExposureMode);
+	connect(tonemap_combo, static_cast<void(QComboBox::*)(int)>(&QComboBox::currentIndexChanged), tgViewerWidget, &TGViewerWidget::setToneMapOperator);
 
 	// connect I/O pushbuttons
 	connect(load_exr_button, SIGNAL (released()), this, SLOT (loadExrFile()));
+	connect(load_sequence_button, SIGNAL (released()), this, SLOT (loadExrSequence()));
+	connect(save_png_button, SIGNAL (released()), this, SLOT (saveImage()));
+	connect(stageOverlayCB, &QCheckBox::toggled, stageOverlay, &QLabel::setVisible);
 
 	// Update labels
 	// tgViewerWidget->setKpos(tgViewerWidget->getKpos());
@@ -159,6 +177,7 @@ TGViewerWindow::TGViewerWindow()
 	tgViewerWidget->setLWhite(tgViewerWidget->getLwhite());
 	tgViewerWidget->setAlpha(tgViewerWidget->getAlpha());
 	tgViewerWidget->setExposureMode(tgViewerWidget->getExposureMode());
+	tgViewerWidget->setToneMapOperator(tgViewerWidget->getToneMapOperator());
 
 
 
@@ -169,6 +188,45 @@ void TGViewerWindow::renderTimeUpdated(int renderTime)
 {
 	QString label = QString("Rendering time %1 ms - %2 fps").arg(QString::number(renderTime), QString::number(1000/(renderTime+0.1)));
 	renderTimeLabel->setText(label);
+	updateStageOverlay();
+}
+
+// Device profile of the OpenCL backend, the last frame and the average
+// over the profiles kept, or the host timings of the CPU backend
+void TGViewerWindow::updateStageOverlay()
+{
+	if (!stageOverlay->isVisible())
+		return;
+
+	QString text;
+	std::vector<FrameProfile> profiles = tgRenderer.getFrameProfiles();
+	if (!profiles.empty())
+	{
+		const FrameProfile& last = profiles.back();
+		text += QString("%1 %2 %3\n").arg("stage", -16).arg("ms", 7).arg("avg", 7);
+		for (int stage = 0; stage < PROFILE_STAGES; ++stage)
+		{
+			double sum = 0.0;
+			for (const FrameProfile& profile : profiles)
+				sum += profile.stages[stage].busyMs();
+			text += QString("%1 %2 %3\n").arg(profileStageName(stage), -16)
+			                             .arg(last.stages[stage].busyMs(), 7, 'f', 2)
+			                             .arg(sum / profiles.size(), 7, 'f', 2);
+		}
+		text += QString("%1 %2").arg("device span", -16).arg(last.spanMs(), 7, 'f', 2);
+	}
+	else
+	{
+		const FrameTimings& timings = tgRenderer.getFrameTimings();
+		text += QString("%1 %2\n").arg("aperture", -16).arg(timings.aperture, 7, 'f', 2);
+		text += QString("%1 %2\n").arg("spectral blur", -16).arg(timings.spectral, 7, 'f', 2);
+		text += QString("%1 %2\n").arg("convolution", -16).arg(timings.convolution, 7, 'f', 2);
+		text += QString("%1 %2\n").arg("tone map", -16).arg(timings.toneMap, 7, 'f', 2);
+		text += QString("%1 %2").arg("total", -16).arg(timings.total, 7, 'f', 2);
+	}
+
+	stageOverlay->setText(text);
+	stageOverlay->adjustSize();
 }
 
 void TGViewerWindow::loadExrFile()
@@ -181,7 +239,60 @@ void TGViewerWindow::loadExrFile()
         return;
 	else
 	{
-		tgRenderer.readExrFile(fileName);
-		tgViewerWidget->resize(tgRenderer.getWidth(), tgRenderer.getHeight());
+		tgRenderer.readExrFile(fileName.toStdString());
+		tgViewerWidget->resize(tgRenderer.getSourceWidth(), tgRenderer.getSourceHeight());
 	}
-}
\ No newline at end of file
+}
+
+void TGViewerWindow::loadExrSequence()
+{
+	QStringList fileNames = QFileDialog::getOpenFileNames(this,
+        tr("Open EXR Sequence"), "",
+        tr("Exr File (*.exr);;All Files (*)"));
+
+	if (fileNames.isEmpty())
+        return;
+
+	// frames play in file name order
+	fileNames.sort();
+	std::vector<std::string> paths;
+	for (const QString& fileName : fileNames)
+		paths.push_back(fileName.toStdString());
+
+	// frames keep their own cadence, the view is still paced by the scheduler
+	if (tgRenderer.openExrSequence(paths, 24.0f, sequenceDecoders))
+		tgViewerWidget->resize(tgRenderer.getSourceWidth(), tgRenderer.getSourceHeight());
+}
+
+void TGViewerWindow::saveImage()
+{
+	QString fileName = QFileDialog::getSaveFileName(this,
+        tr("Save Image"), "",
+        tr("PNG Image (*.png);;Linear EXR (*.exr)"));
+
+	if (fileName.isEmpty())
+        return;
+
+	int width = tgRenderer.getWidth();
+	int height = tgRenderer.getHeight();
+	size_t pixels = (size_t)width * height;
+
+	// the frame may live in the GL texture, its context has to be current.
+	// Only the read back happens here, encoding runs on the writer threads
+	tgViewerWidget->makeCurrent();
+	if (fileName.endsWith(".exr", Qt::CaseInsensitive))
+	{
+		std::vector<float> red(pixels), green(pixels), blue(pixels);
+		tgRenderer.readHdrFrame(red.data(), green.data(), blue.data());
+		frameWriter.writeExr(fileName.toStdString(), width, height, std::move(red), std::move(green), std::move(blue));
+	}
+	else
+	{
+		if (!fileName.endsWith(".png", Qt::CaseInsensitive))
+			fileName += ".png";
+		std::vector<unsigned char> bgra(pixels * 4);
+		tgRenderer.readFrame(bgra.data());
+		frameWriter.writePng(fileName.toStdString(), width, height, std::move(bgra));
+	}
+	tgViewerWidget->doneCurrent();
+}
@@ -10,8 +10,10 @@
 #include <QPushButton>
 #include <QFileDialog>
 #include <QComboBox>
+#include <QCheckBox>
 #include <QTimer>
 #include "TGViewerWidget.h"
+#include "FrameWriter.h"
 
 class TGViewerWindow : public QMainWindow
 {
@@ -20,16 +22,28 @@ class TGViewerWindow : public QMainWindow
 public:
     TGViewerWindow();
 
+    const TemporalGlareRenderer& getRenderer() const { return tgRenderer; }
+    // Threads decoding loaded sequences, 0 for ExrSequence::defaultDecoders
+    void setSequenceDecoders(int decoders) { sequenceDecoders = decoders; }
+
 public slots:
 	void renderTimeUpdated(int renderTime);
 	void loadExrFile();
+	void loadExrSequence();
+	void saveImage();
 
 private:
+	void updateStageOverlay();
+
 	TGViewerWidget* tgViewerWidget;
     TemporalGlareRenderer tgRenderer;
+	FrameWriter frameWriter;
+	int sequenceDecoders;
 	QLabel *cameraPosLabel;
 	QDoubleSpinBox *apertureSB, *focalSB, *fovSB, *control1SB, *control2SB, *alphaSB;
     QLabel *renderTimeLabel;
+	QLabel *stageOverlay;	// per stage timings over the view
+	QCheckBox *stageOverlayCB;
 	QLabel *focalLengthLabel;
 };
 
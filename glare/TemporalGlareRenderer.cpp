@@ -1,58 +1,240 @@
-#include <QPainter>
-#include <QPaintEvent>
-#include <QWidget>
-#include <QImage>
 #include <iostream>
 #include <fstream>
-#include <QtWidgets>
 #include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
 #include <assert.h>
 
 #include "TemporalGlareRenderer.h"
+#include "GlareConstants.h"
+#include "Philox.h"
+#include "ThreadPool.h"
+#include "Trace.h"
 
 #include "ocl_utils.hpp"
 #include "spectrumMap.h"
 
+// texture target of the shared display image, libglare itself neither
+// includes nor links GL
+#ifndef GL_TEXTURE_2D
+#define GL_TEXTURE_2D 0x0DE1
+#endif
+
 
 // Auto adjust exposure with a key value proposed in
 // "Perceptual Effects in Real-time Tone Mapping" by Krawczyk et al.
 
-TemporalGlareRenderer::TemporalGlareRenderer() :
-	m_imgWidth(0), m_imgHeight(0), m_maxPupilSize(9.0f), ncols(0), nrows(0), 
-    m_pupilRadiusPx(0), m_fieldLuminance(0.5), m_nPoints(2000), 
-    m_lambda(575.0f/1000.0f/1000.0f), m_distance(20), m_gamma(5.0f), m_alpha(1.0f),
-    m_Lwhite(5.0f), m_autoExposure(true), m_autoExposureValue(1.0f), m_distort(0.0f),
-    m_slidRadiusDeformedPx(0), m_slidRadiusPx(0)
+// Real <-> hermitian transforms store width/2 + 1 complex values per row,
+// set the strides explicitly so the kernels can rely on that layout
+static void setRealTransformStrides(clfftPlanHandle plan, int width, int height, bool forward)
+{
+    size_t realStrides[2] = {1, (size_t)width};
+    size_t hermitianStrides[2] = {1, (size_t)(width/2 + 1)};
+    size_t realDistance = (size_t)width * height;
+    size_t hermitianDistance = (size_t)(width/2 + 1) * height;
+
+    if (forward)
+    {
+        clfftSetPlanInStride(plan, CLFFT_2D, realStrides);
+        clfftSetPlanOutStride(plan, CLFFT_2D, hermitianStrides);
+        clfftSetPlanDistance(plan, realDistance, hermitianDistance);
+    }
+    else
+    {
+        clfftSetPlanInStride(plan, CLFFT_2D, hermitianStrides);
+        clfftSetPlanOutStride(plan, CLFFT_2D, realStrides);
+        clfftSetPlanDistance(plan, hermitianDistance, realDistance);
+    }
+}
+
+// Tone mapped frames are stored in this channel order, so that every
+// pixel is a native endian 0xAARRGGBB word like Qt's ARGB32
+static cl_channel_order frameChannelOrder()
+{
+    const uint32_t word = 1;
+    unsigned char firstByte;
+    memcpy(&firstByte, &word, 1);
+    return firstByte == 1 ? CL_BGRA : CL_ARGB;
+}
+
+// Device memory the tiled path needs for one tile size: the PSF spectra,
+// the spectrum and product scratch, the input, output and frame planes
+// of every slot, about two planes of clFFT scratch and the PSF pipeline,
+// in place with its occlusion mask
+static cl_ulong tileDeviceBytes(int tileSize, int psfSize)
 {
+    cl_ulong plane = sizeof(float) * (cl_ulong)tileSize * tileSize;
+    cl_ulong spectrum = 2 * sizeof(float) * (cl_ulong)(tileSize/2 + 1) * tileSize;
+    cl_ulong psfPipeline = (cl_ulong)psfSize * psfSize * (FRAME_BYTES_PSF_IN_PLACE + sizeof(float));
+    return 5 * spectrum + TILE_SLOTS * 7 * plane + 2 * plane + psfPipeline;
+}
+
+TemporalGlareRenderer::TemporalGlareRenderer(RenderBackend backend, unsigned int cpuThreads, bool pinThreads) :
+    m_gamma(5.0f), m_Lwhite(5.0f), m_alpha(1.0f), m_autoExposureValue(1.0f), m_autoExposure(true),
+    m_toneMapOperator(TM_REINHARD_EXTENDED), m_phi(8.0f), m_epsilon(0.05f),
+    m_displayMinLuminance(1.0f), m_displayMaxLuminance(100.0f), m_keepHostImage(false),
+    m_halfPrecisionImages(false), m_autoFieldLuminance(true), m_luminanceScale(1.0f),
+    m_particleDriftX(LENS_PARTICLE_DRIFT_X), m_particleDriftY(LENS_PARTICLE_DRIFT_Y),
+    m_particleDamping(LENS_PARTICLE_DAMPING), m_particleDiffusion(LENS_PARTICLE_DIFFUSION),
+    m_forceTiling(false), m_memoryBudget(0), m_memoryMode(MEMORY_MODE_FULL), m_glSharing(false),
+    m_displayWidth(0), m_displayHeight(0), m_frameInDisplay(false), m_stagingIndex(0), m_imgWidth(0),
+    m_imgHeight(0), nrows(0), ncols(0), m_renderScale(1.0f),
+    m_spectralSamples(CPU_RENDER_SPECTRAL_SAMPLES), m_dynamicResolution(false),
+    m_profiles(FRAME_PROFILE_RING), m_profileHead(0), m_profileCount(0),
+    m_profileStage(PROFILE_STAGES), m_traceAnchor(-1), m_traceAnchorHost(0), m_pupilRadiusPx(0),
+    m_maxPupilSize(9.0f), m_fieldLuminance(0.5), m_hostPupil(), m_imageFieldLuminance(0.5f),
+    m_gratingsFibres(GRATINGS_FIBRES_DEFAULT), m_gratingsJitter(GRATINGS_JITTER_DEFAULT),
+    m_gratingsBaked(false), m_slidRadiusPx(0), m_slidRadiusDeformedPx(0), m_distort(0.0f),
+    m_nPoints(LENS_PARTICLES_DEFAULT), m_lastElapsed(-1), m_binTilesX(0), m_binTilesY(0),
+    m_binCapacity(0), m_seed((unsigned int)time(NULL)), m_frameIndex(0),
+    m_lambda(575.0f/1000.0f/1000.0f), m_distance(20), m_psfPlanInPlace(false), m_psfPlanReady(false),
+    m_convolutionPlansReady(false), m_localScalesPlanReady(false), m_sequenceFps(24.0f),
+    m_sequenceFramesShown(0), m_sequenceStalls(0), m_psfWidth(0), m_psfHeight(0),
+    m_tiledPsfSize(TILED_PSF_SIZE), m_tiled(false), m_tileSize(0), m_tileStep(0),
+    m_tilePlansReady(false), m_hostFFT(false), m_cpuFrameParams(), m_hasCpuFrameParams(false)
+{
+    for (int i = 0; i < FRAME_STAGING_BUFFERS; ++i)
+        m_stagingPtrs[i] = nullptr;
+
     m_apertureTexture = nullptr;
-    m_slidTexture = nullptr;
+    m_complexExponential = nullptr;
+    m_complexAperture = nullptr;
+
+    for (int i = 0; i < TILE_SLOTS; ++i)
+        m_tileStagingPtrs[i] = nullptr;
 
     m_imageChanged = false;
 
     float tmp = (m_alpha - 0.5f) * 20.f;
     m_exposure = std::pow(2.f, tmp);
 
-    initOpenCL();
-    
-    srand (time(NULL));
+    if (backend == RENDER_BACKEND_CPU)
+    {
+        m_cpuRenderer.reset(new CpuRenderer(cpuThreads, pinThreads));
+        std::cout << "Using CPU backend: " << m_cpuRenderer->getThreadCount() << " threads, "
+                  << CpuFFT::getInstructionSet() << " FFT\n";
+    }
+    else
+    {
+        initOpenCL();
+    }
+}
+
+RenderBackend TemporalGlareRenderer::defaultBackend()
+{
+    const char* backend = getenv("GLARE_BACKEND");
+    if (backend != nullptr && std::string(backend) == "cpu")
+        return RENDER_BACKEND_CPU;
+    return RENDER_BACKEND_OPENCL;
+}
+
+RenderBackend TemporalGlareRenderer::getBackend() const
+{
+    return m_cpuRenderer ? RENDER_BACKEND_CPU : RENDER_BACKEND_OPENCL;
+}
+
+bool TemporalGlareRenderer::isValid() const
+{
+    return m_error.empty();
+}
+
+const std::string& TemporalGlareRenderer::getError() const
+{
+    return m_error;
+}
+
+// Advances the pupil dynamics by dt seconds. With the OpenCL backend the
+// foveal luminance is reduced and the state advanced on the device, the
+// pupil kernel later in the queue reads the radius from there, so nothing
+// comes back to the host
+void TemporalGlareRenderer::updatePupilDiameter(unsigned int frame, float dt)
+{
+    m_slidRadiusPx  = (float)m_psfHeight / m_maxPupilSize * 3.7f / 2.0f ;
+
+    float luminance = m_autoFieldLuminance ? -1.0f : m_fieldLuminance;
+
+    if (m_cpuRenderer)
+    {
+        float u[4];
+        philoxUniform4(m_seed, frame, RANDOM_STREAM_PUPIL, 0, u);
+        float gauss = std::sqrt(-2.0f * std::log(1.0f - u[0])) * std::cos(2.0f * 3.14159265f * u[1]);
+
+        pupilStep(m_hostPupil, luminance < 0.0f ? m_imageFieldLuminance : luminance, dt, gauss,
+                  m_maxPupilSize, m_psfHeight);
+        m_apperture = m_hostPupil.aperture;
+        m_pupilRadiusPx = m_hostPupil.radiusPx;
+        return;
+    }
+
+    // the tiled path has no image planes on the device, the kernel only
+    // reads them for a window, which is empty then
+    int x0 = 0, y0 = 0, width = 0, height = 0;
+    if (m_tiled && luminance < 0.0f)
+        luminance = m_imageFieldLuminance;
+    else if (luminance < 0.0f)
+        fovealWindow(x0, y0, width, height);
+
+    pupilUpdateKernel.setArg(0, m_tiled ? m_pupilState : m_uploadChannels[0]);
+    pupilUpdateKernel.setArg(1, m_tiled ? m_pupilState : m_uploadChannels[1]);
+    pupilUpdateKernel.setArg(2, m_tiled ? m_pupilState : m_uploadChannels[2]);
+    pupilUpdateKernel.setArg(3, m_imgWidth);
+    pupilUpdateKernel.setArg(4, x0);
+    pupilUpdateKernel.setArg(5, y0);
+    pupilUpdateKernel.setArg(6, width);
+    pupilUpdateKernel.setArg(7, height);
+    pupilUpdateKernel.setArg(8, luminance);
+    pupilUpdateKernel.setArg(9, m_luminanceScale);
+    pupilUpdateKernel.setArg(10, m_pupilState);
+    pupilUpdateKernel.setArg(11, dt);
+    pupilUpdateKernel.setArg(12, m_seed);
+    pupilUpdateKernel.setArg(13, frame);
+    pupilUpdateKernel.setArg(14, m_maxPupilSize);
+    pupilUpdateKernel.setArg(15, m_psfHeight);
+
+    queue.enqueueNDRangeKernel(
+        pupilUpdateKernel,
+        cl::NullRange,
+        cl::NDRange(PUPIL_GROUP),
+        cl::NDRange(PUPIL_GROUP), NULL, profileEvent()
+    );
+}
+
+// Square window of side PUPIL_FOVEA * height around the image centre
+void TemporalGlareRenderer::fovealWindow(int& x0, int& y0, int& width, int& height)
+{
+    int side = std::max(1, (int)(PUPIL_FOVEA * m_imgHeight));
+    width = std::min(side, m_imgWidth);
+    height = std::min(side, m_imgHeight);
+    x0 = (m_imgWidth - width) / 2;
+    y0 = (m_imgHeight - height) / 2;
 }
 
-void TemporalGlareRenderer::updatePupilDiameter()
+// Mean luminance of the foveal window in cd/m^2 from the host pixels, for
+// the backends that do not keep the whole image on the device
+float TemporalGlareRenderer::measureFieldLuminance()
 {
-    // TODO: limit variation based on time 
-    // TODO: auto link m_fieldLuminance with the LWhite from the HDR image
-    float p = 4.9 - 3*tanh(0.4 * (log(m_fieldLuminance) + 1));
-    m_apperture = p + noise() * m_maxPupilSize / p * sqrt( 1 - p / m_maxPupilSize);
-    m_pupilRadiusPx = (float)m_imgHeight / m_maxPupilSize * m_apperture / 2.0f;
-    // m_pupilRadiusPx = (float)m_imgHeight / 2.0f * m_apperture / m_maxPupilSize;
-    m_slidRadiusPx  = (float)m_imgHeight / m_maxPupilSize * 3.7f / 2.0f ;
+    int x0, y0, width, height;
+    fovealWindow(x0, y0, width, height);
+
+    size_t n = (size_t)width * height;
+    std::vector<float> window(3 * n);
+    for (int c = 0; c < 3; ++c)
+        image->copyTile(c, x0, y0, width, height, window.data() + c * n);
+
+    double sum = 0.0;
+    for (size_t i = 0; i < n; ++i)
+        sum += std::max(0.212671f * window[i] + 0.71516f * window[n + i] + 0.072169f * window[2 * n + i], 0.0f);
+    return (float)(sum / n) * m_luminanceScale;
 }
 
-void TemporalGlareRenderer::updateLensDeformation()
+void TemporalGlareRenderer::updateLensDeformation(unsigned int frame)
 {
     // TODO: Smooth out the noise function 
-    m_distort = noise() * 100;
-    m_slidRadiusDeformedPx = m_slidRadiusPx + m_distort * deformationCoeff(2*m_slidRadiusPx/m_imgHeight);
+    m_distort = noise(frame, RANDOM_STREAM_DEFORMATION) * 100;
+    m_slidRadiusDeformedPx = m_slidRadiusPx + m_distort * deformationCoeff(2*m_slidRadiusPx/m_psfHeight);
 }
 
 void TemporalGlareRenderer::updateApertureTexture()
@@ -63,404 +245,532 @@ void TemporalGlareRenderer::updateApertureTexture()
         if (m_apertureTexture != nullptr)
             delete [] m_apertureTexture;
 
-        m_apertureTexture = new float [m_imgHeight * m_imgWidth];
-        m_pupilCenter = { m_imgWidth/2.0f, m_imgHeight/2.0f};
+        m_apertureTexture = new float [m_psfHeight * m_psfWidth];
+        m_pupilCenter = { m_psfWidth/2.0f, m_psfHeight/2.0f};
         m_apperture = m_maxPupilSize;
 
         m_imageChanged = false;
 
+        // the CPU backend keeps its own Fresnel term
+        if (m_cpuRenderer)
+            return;
+
         // generate the complex exponential
-        int test_size = m_imgWidth * m_imgHeight * 2;
+        int test_size = m_psfWidth * m_psfHeight * 2;
+        delete [] m_complexExponential;
+        delete [] m_complexAperture;
         m_complexExponential = new float[test_size];
         m_complexAperture = new float[test_size];
 
         // We compute E for a specific m_lambda
-        cl::Buffer buffer_complex(context, CL_MEM_READ_WRITE, sizeof(float) * test_size);
+        cl::Buffer buffer_complex = m_deviceMemory.buffer(MEMORY_APERTURE, context, CL_MEM_READ_WRITE, sizeof(float) * test_size);
 
         compExpKernel.setArg(0, buffer_complex);
         compExpKernel.setArg(1, m_lambda);                              // mm
         compExpKernel.setArg(2, m_distance);                            // mm
-        compExpKernel.setArg(3, m_imgWidth);                            // px
-        compExpKernel.setArg(4, m_imgHeight);
-        compExpKernel.setArg(5, (float)m_imgHeight / m_maxPupilSize);   // px / mm
+        compExpKernel.setArg(3, m_psfWidth);                            // px
+        compExpKernel.setArg(4, m_psfHeight);
+        compExpKernel.setArg(5, (float)m_psfHeight / m_maxPupilSize);   // px / mm
 
         queue.enqueueNDRangeKernel(
             compExpKernel, 
             cl::NullRange, 
-            cl::NDRange(m_imgWidth, m_imgHeight, 1), 
-            cl::NullRange
+            cl::NDRange(m_psfWidth, m_psfHeight, 1), 
+            cl::NullRange, NULL, profileEvent()
         );
         queue.finish();
 
-		queue.enqueueReadBuffer(buffer_complex, CL_TRUE, 0, sizeof(float) * test_size, m_complexExponential);
+		queue.enqueueReadBuffer(buffer_complex, CL_TRUE, 0, sizeof(float) * test_size, m_complexExponential, NULL, profileEvent());
 		queue.finish();
 
     }
    
 }
 
-
-void TemporalGlareRenderer::paint(QPainter *painter, QPaintEvent *event, int elapsed, const QSize &destSize)
+// Bakes the procedural gratings at the PSF size, once for each size, seed
+// and fibre setting. On the device with the OpenCL backend, nothing is
+// read from disk or uploaded
+void TemporalGlareRenderer::bakeGratings()
 {
-    if( image == nullptr ) // No HDR image available
+    if (m_gratingsBaked)
         return;
+    m_gratingsBaked = true;
 
-    unsigned char* data = NULL;
-    float* raw = NULL;
-    float* magnitude = NULL; 
-    float* r = NULL;
-    float* g = NULL;
-    float* b = NULL;
+    if (m_cpuRenderer)
+    {
+        std::vector<float> table(4 * (size_t)m_gratingsFibres);
+        for (int i = 0; i < m_gratingsFibres; ++i)
+            gratingsFibre(m_seed, i, m_gratingsFibres, m_gratingsJitter, &table[4 * i]);
+
+        const int width = m_psfWidth;
+        const int height = m_psfHeight;
+        const int fibres = m_gratingsFibres;
+        m_gratingsTexture.resize((size_t)width * height);
+        unsigned char* texture = m_gratingsTexture.data();
+
+        ThreadPool::global().parallelForTiles(width, height, CPU_RENDER_TILE, CPU_RENDER_TILE,
+                                              [&](int x0, int y0, int x1, int y1) {
+            for (int y = y0; y < y1; ++y)
+                for (int x = x0; x < x1; ++x)
+                    texture[(size_t)y * width + x] = gratingsValue(x, y, width, height, fibres, table.data());
+        });
+        return;
+    }
 
-    float normFactor = 1.0f;
-    try {
-        
-        // TODO Remove all additional buffers
-        // TODO Check the spectral blur 
-        // TODO Fix PSF
-        // TODO Smooth particle random movement
-        magnitude = new float[m_imgWidth * m_imgHeight];
-        raw  = new float[m_imgWidth*m_imgHeight*4];
-        data = new unsigned char[m_imgWidth*m_imgHeight*4];
-        memset(data, 255, m_imgWidth * m_imgHeight * 4);
-
-        cl::size_t<3> origin;
-        origin[0] = 0; origin[1] = 0, origin[2] = 0;
-        cl::size_t<3> region;
-        region[0] = m_imgWidth; region[1] = m_imgHeight; region[2] = 1;
+    m_gratingsImage = m_deviceMemory.image(MEMORY_APERTURE, context,
+                CL_MEM_READ_WRITE,
+                cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8),
+                m_psfWidth,
+                m_psfHeight,
+                NULL);
+
+    gratingsBakeKernel.setArg(0, m_gratingsImage);
+    gratingsBakeKernel.setArg(1, m_psfWidth);
+    gratingsBakeKernel.setArg(2, m_psfHeight);
+    gratingsBakeKernel.setArg(3, m_gratingsFibres);
+    gratingsBakeKernel.setArg(4, m_gratingsJitter);
+    gratingsBakeKernel.setArg(5, m_seed);
+
+    queue.enqueueNDRangeKernel(
+        gratingsBakeKernel,
+        cl::NullRange,
+        cl::NDRange(m_psfWidth, m_psfHeight, 1),
+        cl::NullRange, NULL, profileEvent()
+    );
+}
 
 
-        std::cout<<"Frame Updated\n";
+// Reads the last frame into the next pinned staging buffer. The pointer
+// stays valid for FRAME_STAGING_BUFFERS - 1 further frames
+unsigned char* TemporalGlareRenderer::stageFrame()
+{
+    TRACE_SCOPE("readback", "render");
+    // tiled and CPU frames are on the host already
+    if (m_tiled)
+        return m_tiledFrame.data();
+    if (m_cpuRenderer)
+        return m_cpuRenderer->getFrame();
+
+    unsigned char* frame = m_stagingPtrs[m_stagingIndex];
+    m_stagingIndex = (m_stagingIndex + 1) % FRAME_STAGING_BUFFERS;
+
+    readFrame(frame);
+    return frame;
+}
 
-        // make the neccessary updates 
-        updateApertureTexture();
-        updatePupilDiameter(); 
-        updateLensDeformation();
+// Copies the last tone mapped frame to host memory, as 32 bit ARGB words
+// (alpha is always 1, so also premultiplied)
+void TemporalGlareRenderer::readFrame(unsigned char* dest)
+{
+    TRACE_SCOPE("read frame", "render");
+    if (m_tiled)
+    {
+        memcpy(dest, m_tiledFrame.data(), m_tiledFrame.size());
+        return;
+    }
+    if (m_cpuRenderer)
+    {
+        memcpy(dest, m_cpuRenderer->getFrame(), sizeof(unsigned int) * m_imgWidth * m_imgHeight);
+        return;
+    }
 
-        //STEP: GENERATING THE PUPIL
-        cl::Image2D pupilBuffer(context, 
-                    CL_MEM_READ_WRITE, 
-                    cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8),
-                    m_imgWidth,
-                    m_imgHeight,
-                    0,
-                    NULL);
+    cl::size_t<3> origin;
+    origin[0] = 0; origin[1] = 0, origin[2] = 0;
+    cl::size_t<3> region;
+    region[0] = m_imgWidth; region[1] = m_imgHeight; region[2] = 1;
 
-        
-        pupilKernel = cl::Kernel(program, "glr_render_pupil");
-        pupilKernel.setArg(0, pupilBuffer);
-        pupilKernel.setArg(1, m_pupilRadiusPx);
-        pupilKernel.setArg(2, m_imgWidth);
-        pupilKernel.setArg(3, m_imgHeight);
-        pupilKernel.setArg(4, m_pupilCenter);
+    m_profileStage = PROFILE_READBACK;
 
-        queue.enqueueNDRangeKernel(
-            pupilKernel, 
-            cl::NullRange, 
-            cl::NDRange(m_imgWidth, m_imgHeight, 1), 
-            cl::NullRange
-        );
+    // with GL sharing the last frame went to the display texture, the GL
+    // context has to be current. The texture is RGBA8, repacked into words
+    if (m_frameInDisplay)
+    {
+        std::vector<cl::Memory> glObjects(1, m_displayImage);
+        queue.enqueueAcquireGLObjects(&glObjects);
+        queue.enqueueReadImage(m_displayImage, CL_TRUE, origin, region, 0, 0, dest, NULL, profileEvent());
+        queue.enqueueReleaseGLObjects(&glObjects);
         queue.finish();
 
-        // queue.enqueueReadImage(pupilBuffer, CL_TRUE, origin, region, 0, 0 , data,  NULL, NULL);
-        // queue.finish();
-
-        //STEP: GRATINGS RENDERING 
-        cl::Image2D slidBufferIn(context, 
-                    CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
-                    cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8),
-                    m_slidWidth,
-                    m_slidHeight,
-                    0,
-                    m_slidTexture);
-
-        cl::Image2D slidBufferOut(context, 
-                    CL_MEM_READ_WRITE, 
-                    cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8),
-                    m_slidWidth,
-                    m_slidHeight,
-                    0,
-                    NULL);
-
-        gratingsKernel = cl::Kernel(program, "glr_render_gratings");
-        gratingsKernel.setArg(0, slidBufferIn);
-        gratingsKernel.setArg(1, slidBufferOut);
-        gratingsKernel.setArg(2, m_slidRadiusDeformedPx);
-        gratingsKernel.setArg(3, m_imgWidth);
-        gratingsKernel.setArg(4, m_imgHeight);
-        gratingsKernel.setArg(5, m_pupilCenter);
+        unsigned int* argb = (unsigned int*)dest;
+        for (size_t i = 0; i < (size_t)m_imgWidth * m_imgHeight; ++i)
+        {
+            const unsigned char* rgba = dest + 4 * i;
+            argb[i] = ((unsigned int)rgba[3] << 24) | ((unsigned int)rgba[0] << 16) |
+                      ((unsigned int)rgba[1] << 8) | rgba[2];
+        }
+        return;
+    }
 
-        queue.enqueueNDRangeKernel(
-            gratingsKernel, 
-            cl::NullRange, 
-            cl::NDRange(m_imgWidth, m_imgHeight, 1), 
-            cl::NullRange
-        );
-        queue.finish();
-        
-        //STEP: GENERATE LENS POINTS  
-        cl::Buffer coordinatesBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * m_nPoints * 4);
-        queue.enqueueWriteBuffer(coordinatesBuffer, CL_TRUE, 0, sizeof(float) * m_nPoints * 4, m_pointCoordinates);
-        
-        cl::Buffer pointsBuffer(context, CL_MEM_READ_WRITE, sizeof(unsigned char) * m_imgWidth * m_imgHeight * 4);
-        queue.enqueueWriteBuffer(pointsBuffer, CL_TRUE, 0, sizeof(unsigned char) * m_imgWidth * m_imgHeight * 4, data);
+    queue.enqueueReadImage(m_frameImage, CL_TRUE, origin, region, 0, 0, dest, NULL, profileEvent());
+}
 
-        queue.finish();
+void TemporalGlareRenderer::readHdrFrame(float* red, float* green, float* blue)
+{
+    TRACE_SCOPE("read hdr frame", "render");
+    if (m_tiled)
+    {
+        memcpy(red, m_tiledHdr[0].data(), sizeof(float) * m_tiledHdr[0].size());
+        memcpy(green, m_tiledHdr[1].data(), sizeof(float) * m_tiledHdr[1].size());
+        memcpy(blue, m_tiledHdr[2].data(), sizeof(float) * m_tiledHdr[2].size());
+        return;
+    }
 
-        lensDotsKernel = cl::Kernel(program, "glr_render_lens_points");
+    size_t planeSize = sizeof(float) * m_imgWidth * m_imgHeight;
+    if (m_cpuRenderer)
+    {
+        memcpy(red, m_cpuRenderer->getHdr(0), planeSize);
+        memcpy(green, m_cpuRenderer->getHdr(1), planeSize);
+        memcpy(blue, m_cpuRenderer->getHdr(2), planeSize);
+        return;
+    }
 
-        lensDotsKernel.setArg(0,coordinatesBuffer);
-        lensDotsKernel.setArg(1,pointsBuffer);
-        lensDotsKernel.setArg(2,m_imgWidth);
-        lensDotsKernel.setArg(3,m_imgHeight);
-        lensDotsKernel.setArg(4,m_distort); // distort coefficient -> how the lens is deformed (pixels)
+    m_profileStage = PROFILE_READBACK;
+    queue.enqueueReadBuffer(m_hdrChannels[0], CL_FALSE, 0, planeSize, red, NULL, profileEvent());
+    queue.enqueueReadBuffer(m_hdrChannels[1], CL_FALSE, 0, planeSize, green, NULL, profileEvent());
+    queue.enqueueReadBuffer(m_hdrChannels[2], CL_TRUE, 0, planeSize, blue, NULL, profileEvent());
+}
 
-        queue.finish();
+// The lens particles are regenerated straight away when an image is set
+void TemporalGlareRenderer::setSeed(unsigned int seed)
+{
+    m_seed = seed;
+    m_gratingsBaked = false;
+    if (image != nullptr)
+        resizeLensPoints(m_nPoints, 0);
+}
 
-        // we take each point, skew it based on the lens distort
-        // and we draw it
-        queue.enqueueNDRangeKernel(
-            lensDotsKernel, 
-            cl::NullRange, 
-            cl::NDRange(m_nPoints, 1, 1), 
-            cl::NullRange
-        );
-        queue.finish();
+// Existing particles keep moving where they are, added ones start at
+// rest. Nothing goes through the host with the OpenCL backend
+void TemporalGlareRenderer::setParticleCount(int count)
+{
+    count = std::max(0, std::min(count, LENS_PARTICLES_MAX));
+    if (count == m_nPoints)
+        return;
 
-        // put the poins back in the data buffer
-        queue.enqueueReadBuffer(pointsBuffer, CL_TRUE, 0, sizeof(unsigned char) * m_imgWidth * m_imgHeight * 4, data);
-        queue.finish();
+    // the particles are made with the textures
+    if (image == nullptr)
+    {
+        m_nPoints = count;
+        return;
+    }
 
-        //STEP: MERGE PUPIL-RELATED IMAGES 
-        cl::Image2D mergeBufferOut(context, 
-                    CL_MEM_READ_WRITE, 
-                    cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8),
-                    m_slidWidth,
-                    m_slidHeight,
-                    0,
-                    NULL);
+    try {
+        resizeLensPoints(count, std::min(count, m_nPoints));
+    } catch(cl::Error err) {
+        std::cerr << "ERROR: " << err.what() << "(" << getOCLErrorString(err.err()) << ")" << std::endl;
+    }
+}
 
-        cl::Image2D pointsBufferOut(context, 
-                    CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
-                    cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8),
-                    m_imgWidth,
-                    m_imgHeight,
-                    0,
-                    data);
-        
-        // first slid, second pupil, third particles
-        mergeKernel = cl::Kernel(program, "glr_merge_images");
-        mergeKernel.setArg(0, slidBufferOut);
-        mergeKernel.setArg(1, pupilBuffer);
-        mergeKernel.setArg(2, pointsBufferOut);
-        mergeKernel.setArg(3, mergeBufferOut);
+int TemporalGlareRenderer::getParticleCount() const
+{
+    return m_nPoints;
+}
 
-        queue.enqueueNDRangeKernel(
-            mergeKernel, 
-            cl::NullRange, 
-            cl::NDRange(m_imgWidth, m_imgHeight, 1), 
-            cl::NullRange
-        );
-        queue.finish();
+void TemporalGlareRenderer::setGratings(int fibres, float jitter)
+{
+    if (fibres > 0)
+        fibres = std::max(GRATINGS_FIBRES_MIN, std::min(fibres, GRATINGS_FIBRES_MAX));
+    else
+        fibres = 0;
+
+    m_gratingsFibres = fibres;
+    m_gratingsJitter = std::max(0.0f, std::min(jitter, 1.0f));
+    m_gratingsBaked = false;
+}
 
-        queue.enqueueReadImage(mergeBufferOut, CL_TRUE, origin, region, 0, 0 , data,  NULL, NULL);
-        queue.finish();
+int TemporalGlareRenderer::getGratingsFibres() const
+{
+    return m_gratingsFibres;
+}
 
-        // STEP: multiply with complex exponential (fresnel term)
-        // takes only the first channel from the buffer, which contains the monochrome texture
+float TemporalGlareRenderer::getGratingsJitter() const
+{
+    return m_gratingsJitter;
+}
 
-        cl::Buffer complexApertureBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight * 2);
-        cl::Buffer complexExponentialBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight * 2);
+unsigned int TemporalGlareRenderer::getSeed() const
+{
+    return m_seed;
+}
 
-        queue.enqueueWriteBuffer(complexExponentialBuffer, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight * 2, m_complexExponential);
+void TemporalGlareRenderer::setFrameIndex(unsigned int frame)
+{
+    m_frameIndex = frame;
+}
 
-        compExpMultKernel.setArg(0, mergeBufferOut);
-        compExpMultKernel.setArg(1, complexExponentialBuffer);
-        compExpMultKernel.setArg(2, complexApertureBuffer);
-        compExpMultKernel.setArg(3, m_imgWidth);
+unsigned int TemporalGlareRenderer::getFrameIndex() const
+{
+    return m_frameIndex;
+}
 
-        queue.enqueueNDRangeKernel(
-            compExpMultKernel, 
-            cl::NullRange, 
-            cl::NDRange(m_imgWidth, m_imgHeight, 1), 
-            cl::NullRange
-        );
+void TemporalGlareRenderer::setFieldLuminance(float luminance)
+{
+    m_fieldLuminance = luminance;
+    m_autoFieldLuminance = false;
+}
 
-        queue.finish();
+bool TemporalGlareRenderer::renderFrame(int elapsed)
+{
+    float dt = m_lastElapsed < 0 ? 0.0f : (((elapsed - m_lastElapsed) % 1000 + 1000) % 1000) / 1000.0f;
+    m_lastElapsed = elapsed;
+    return stepFrame(dt);
+}
 
-        // debug 
-        // queue.enqueueReadBuffer(complexApertureBuffer, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight * 2, m_complexAperture);
-        // queue.finish();
+// Runs the whole glare pipeline. The tone mapped result stays on the
+// device, either in the shared display texture or in m_frameImage
+bool TemporalGlareRenderer::stepFrame(float dt)
+{
+    TRACE_SCOPE("frame", "render");
+    advanceSequence();
 
-        // cl::Buffer complexApertureBufferMagnitude(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight);
+    if( image == nullptr ) // No HDR image available
+        return false;
 
-        // for (int i = 0; i < m_imgHeight*m_imgWidth; i++)
-        // {
-        //     float x = m_complexAperture[2*i];
-        //     float y = m_complexAperture[2*i + 1];
-        //     magnitude[i] = std::sqrt(x*x + y*y);
-        // }
-        
+    // the random state of a frame only depends on the seed and its index
+    unsigned int frame = m_frameIndex++;
 
-        // queue.enqueueWriteBuffer(complexApertureBufferMagnitude, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight, magnitude);
-        // queue.finish();
-        
+    m_timings = FrameTimings();
+    m_frameStart = m_stageStart = std::chrono::steady_clock::now();
 
-        //STEP: APPLY THE FFT TO GET THE PSF
+    bool rendered;
+    if (m_cpuRenderer)
+    {
+        stepLensPoints(frame, dt);
+        rendered = renderFrameOnHost(frame, dt);
+    }
+    else
+    {
+        beginFrameProfile(frame);
+        rendered = renderFrameOnDevice(frame, dt);
+        resolveProfileEvents();
+        m_profileStage = PROFILE_STAGES;
+    }
 
-        cl::Buffer psfBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight * 2);
+    m_timings.total = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - m_frameStart).count();
+    return rendered;
+}
 
-        size_t clLengths[2] = {m_imgWidth, m_imgHeight};
-        clfftCreateDefaultPlan(&planHandle, context(), CLFFT_2D, clLengths);
-        clfftSetPlanPrecision(planHandle, CLFFT_SINGLE);
-        clfftSetLayout(planHandle, CLFFT_COMPLEX_INTERLEAVED, CLFFT_COMPLEX_INTERLEAVED);
-        clfftSetResultLocation(planHandle, CLFFT_OUTOFPLACE);
+// Adds the time since the last mark to stage
+void TemporalGlareRenderer::markStage(float& stage)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    stage += std::chrono::duration<float, std::milli>(now - m_stageStart).count();
+    m_stageStart = now;
+}
 
-        clfftBakePlan(planHandle, 1, &queue(), NULL, NULL);
-        clfftEnqueueTransform(planHandle, CLFFT_FORWARD, 1, &queue(), 0, NULL, NULL, &complexApertureBuffer(), &psfBuffer(), NULL);
-        clFinish(queue());
+// NULL outside the stages of a frame, PROFILE_STAGES
+cl::Event* TemporalGlareRenderer::profileEvent()
+{
+    if (m_profileStage == PROFILE_STAGES)
+        return NULL;
+#ifdef GLARE_TRACING
+    // the host time of an enqueue, its queued time maps the device clock
+    if (m_traceAnchor < 0 && traceActive())
+    {
+        m_traceAnchor = (int)m_profileEvents.size();
+        m_traceAnchorHost = traceNow();
+    }
+#endif
+    m_profileEvents.push_back(std::make_pair(m_profileStage, cl::Event()));
+    return &m_profileEvents.back().second;
+}
 
-        queue.enqueueReadBuffer(psfBuffer, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight * 2, raw);
-        queue.finish();
-        
-        //STEP: SPECTRAL BLUR
-        cl::Buffer monochromePSF(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight);
+void TemporalGlareRenderer::recordProfileEvent(ProfileStage stage, const cl::Event& event)
+{
+    m_profileEvents.push_back(std::make_pair(stage, event));
+}
 
-        // From psfBuffer to monochromePSF
+// Closes the record of the frame before, with whatever of it is still
+// pending, and starts an empty one
+void TemporalGlareRenderer::beginFrameProfile(unsigned int frame)
+{
+    resolveProfileEvents();
 
-        cl::Image2D fresnelPSF(context, 
-                    CL_MEM_READ_WRITE, 
-                    cl::ImageFormat(CL_RGBA, CL_FLOAT),
-                    m_imgWidth,
-                    m_imgHeight,
-                    0,
-                    NULL);
+    if (m_profileCount > 0)
+        m_profileHead = (m_profileHead + 1) % FRAME_PROFILE_RING;
+    m_profileCount = std::min(m_profileCount + 1, FRAME_PROFILE_RING);
 
-        computeMagnitudeKernel.setArg(0, psfBuffer);
-        computeMagnitudeKernel.setArg(1, fresnelPSF);
-        computeMagnitudeKernel.setArg(2, monochromePSF); // debug 
-        computeMagnitudeKernel.setArg(3, m_imgWidth);
-        computeMagnitudeKernel.setArg(4, m_imgHeight);
-        computeMagnitudeKernel.setArg(5, m_lambda);
-        computeMagnitudeKernel.setArg(6, m_distance);
+    m_profiles[m_profileHead] = FrameProfile();
+    m_profiles[m_profileHead].frame = frame;
+    m_profileStage = PROFILE_APERTURE;
+}
 
-        queue.enqueueNDRangeKernel(
-            computeMagnitudeKernel, 
-            cl::NullRange, 
-            cl::NDRange(m_imgWidth, m_imgHeight, 1), 
-            cl::NullRange
-        );
+// Adds the finished commands to the frame being recorded. Every command
+// is done by the time a frame returns or a readback has its pixels, so
+// the waits here do not block
+void TemporalGlareRenderer::resolveProfileEvents()
+{
+    if (m_profileCount == 0)
+    {
+        m_profileEvents.clear();
+        m_traceAnchor = -1;
+        return;
+    }
 
-        queue.finish();
+#ifdef GLARE_TRACING
+    // device ns to host ns, from the anchor's enqueue
+    long long traceOffset = 0;
+    bool traced = false;
+    if (m_traceAnchor >= 0 && m_traceAnchor < (int)m_profileEvents.size())
+    {
+        try {
+            cl::Event& anchor = m_profileEvents[m_traceAnchor].second;
+            anchor.wait();
+            traceOffset = (long long)m_traceAnchorHost -
+                          (long long)anchor.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+            traced = true;
+        } catch(cl::Error err) {
+        }
+    }
+#endif
 
-        queue.enqueueReadBuffer(monochromePSF, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight, magnitude);
-        queue.finish();
+    FrameProfile& profile = m_profiles[m_profileHead];
+    for (std::pair<ProfileStage, cl::Event>& entry : m_profileEvents)
+    {
+        cl::Event& event = entry.second;
+        if (event() == NULL)
+            continue;
+
+        cl_ulong queued, submit, start, end;
+        try {
+            event.wait();
+            queued = event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+            submit = event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>();
+            start = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+            end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+        } catch(cl::Error err) {
+            // not a profiled queue, or a command without times such as a marker
+            continue;
+        }
 
-        // TODO: Implement LOG norm 
-        for (int i = 0; i < m_imgHeight*m_imgWidth; i++)
+        StageProfile& stage = profile.stages[entry.first];
+        if (stage.commands == 0 || queued < stage.queued)
+            stage.queued = queued;
+        if (stage.commands == 0 || submit < stage.submit)
+            stage.submit = submit;
+        if (stage.commands == 0 || start < stage.start)
+            stage.start = start;
+        stage.end = std::max<unsigned long long>(stage.end, end);
+        stage.busy += end > start ? end - start : 0;
+        ++stage.commands;
+
+        if (profile.base == 0 || queued < profile.base)
+            profile.base = queued;
+        profile.end = std::max<unsigned long long>(profile.end, end);
+
+#ifdef GLARE_TRACING
+        if (traced)
         {
-            if(magnitude[i] > normFactor)
-                normFactor = magnitude[i];
+            cl_command_queue commandQueue = NULL;
+            clGetEventInfo(event(), CL_EVENT_COMMAND_QUEUE, sizeof(commandQueue), &commandQueue, NULL);
+            traceDeviceSpan(profileStageName(entry.first), commandQueue == m_transferQueue() ? 2 : 1,
+                            queued + traceOffset, start + traceOffset, end + traceOffset);
         }
+#endif
+    }
+    m_profileEvents.clear();
+    m_traceAnchor = -1;
+}
 
+std::vector<FrameProfile> TemporalGlareRenderer::getFrameProfiles()
+{
+    resolveProfileEvents();
 
-        queue.enqueueReadImage(fresnelPSF, CL_TRUE, origin, region, 0, 0 , raw,  NULL, NULL);
-        queue.finish();
+    std::vector<FrameProfile> profiles;
+    for (int i = m_profileCount - 1; i >= 0; --i)
+        profiles.push_back(m_profiles[(m_profileHead - i + FRAME_PROFILE_RING) % FRAME_PROFILE_RING]);
+    return profiles;
+}
 
-        
-        // the channels resulting from the spectral blur  
-        cl::Buffer redChannelPSF(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight);
-        cl::Buffer greenChannelPSF(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight);
-        cl::Buffer blueChannelPSF(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight);
-
-        // TODO: adapt it to the spectrum mapping vector
-        cl::Buffer spectrumMapping(context, CL_MEM_READ_WRITE, sizeof(float) * SPECTRUM_RESOLUTION * 3);
-        queue.enqueueWriteBuffer(spectrumMapping, CL_TRUE, 0, sizeof(float) * SPECTRUM_RESOLUTION * 3, spectrum);
-
-        cl::Image2D fresnelPSF2(context, 
-                    CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, 
-                    cl::ImageFormat(CL_RGBA, CL_FLOAT),
-                    m_imgWidth,
-                    m_imgHeight,
-                    0,
-                    raw);
-
-        spectralBlurKernel.setArg(0, fresnelPSF2);
-        spectralBlurKernel.setArg(1, redChannelPSF);
-        spectralBlurKernel.setArg(2, greenChannelPSF);
-        spectralBlurKernel.setArg(3, blueChannelPSF);
-        spectralBlurKernel.setArg(4, spectrumMapping); // lambda to RGB mapping -> TBD
-        spectralBlurKernel.setArg(5, m_imgWidth);
-        spectralBlurKernel.setArg(6, m_imgHeight);
-        spectralBlurKernel.setArg(7, m_lambda*1000*1000);
-        spectralBlurKernel.setArg(8, m_distance);
-        spectralBlurKernel.setArg(9, normFactor);
+bool TemporalGlareRenderer::getLastFrameProfile(FrameProfile& profile)
+{
+    resolveProfileEvents();
 
-        queue.enqueueNDRangeKernel(
-            spectralBlurKernel, 
-            cl::NullRange, 
-            cl::NDRange(m_imgWidth, m_imgHeight, 1), 
-            cl::NullRange
-        );
+    if (m_profileCount == 0)
+        return false;
+    profile = m_profiles[m_profileHead];
+    return true;
+}
 
-        queue.finish();
+bool TemporalGlareRenderer::renderFrameOnDevice(unsigned int frame, float dt)
+{
+    bool rendered = false;
+    try {
+        // the last frame's linear result is not worth its memory any more
+        if(m_memoryMode >= MEMORY_MODE_NO_CACHES && !m_tiled)
+        {
+            for (int c = 0; c < 3; ++c)
+                m_hdrChannels[c] = cl::Buffer();
+        }
 
-        r = new float[m_imgWidth*m_imgHeight];
-        g = new float[m_imgWidth*m_imgHeight];
-        b = new float[m_imgWidth*m_imgHeight];
+        stepLensPoints(frame, dt);
 
-        queue.enqueueReadBuffer(redChannelPSF, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight, r);
-        queue.finish();
+        cl::Buffer psfChannels[3];
+        generatePSF(psfChannels, frame, dt);
 
-        queue.enqueueReadBuffer(greenChannelPSF, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight, g);
-        queue.finish();
+        // STEP: TILED CONVOLUTION, the image is streamed through the
+        // device tile by tile and the results come back to the host
+        if(m_tiled)
+        {
+            renderTiles(psfChannels);
+            markStage(m_timings.convolution);
+            return true;
+        }
 
-        queue.enqueueReadBuffer(blueChannelPSF, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight, b);
-        queue.finish();
+        cl::Buffer& redChannelPSF = psfChannels[0];
+        cl::Buffer& greenChannelPSF = psfChannels[1];
+        cl::Buffer& blueChannelPSF = psfChannels[2];
 
 
         // STEP: COMPUTE FFT OF THE SPECTRAL PSF
+        m_profileStage = PROFILE_PSF_FORWARD_FFT;
 
-        // The FFT buffers of the spectral PSF
-        cl::Buffer redChannelPSFFFT(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight*2);
-        cl::Buffer greenChannelPSFFFT(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight*2);
-        cl::Buffer blueChannelPSFFFT(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight*2);
-
-        clfftSetLayout(planHandle, CLFFT_REAL, CLFFT_COMPLEX_INTERLEAVED);
-        clfftBakePlan(planHandle, 1, &queue(), NULL, NULL);
+        // The FFT buffers of the spectral PSF, half spectra of the real PSF
+        bool inPlace = m_memoryMode >= MEMORY_MODE_IN_PLACE;
+        int spectrumWidth = m_imgWidth/2 + 1;
+        size_t spectrumSize = sizeof(float) * 2 * spectrumWidth * m_imgHeight;
+        size_t planeSize = sizeof(float) * m_imgWidth * m_imgHeight;
+        cl::Buffer redChannelPSFFFT = m_deviceMemory.buffer(MEMORY_CONVOLUTION, context, CL_MEM_READ_WRITE, spectrumSize);
+        cl::Buffer greenChannelPSFFFT = m_deviceMemory.buffer(MEMORY_CONVOLUTION, context, CL_MEM_READ_WRITE, spectrumSize);
+        cl::Buffer blueChannelPSFFFT = m_deviceMemory.buffer(MEMORY_CONVOLUTION, context, CL_MEM_READ_WRITE, spectrumSize);
 
         queue.finish();
 
         // FFT red
-        clfftEnqueueTransform(planHandle, CLFFT_FORWARD, 1, &queue(), 0, NULL, NULL, &redChannelPSF(), &redChannelPSFFFT(), NULL);
+        enqueueTransform(m_forwardPlan, CLFFT_FORWARD, redChannelPSF, redChannelPSFFFT);
         clFinish(queue());
 
         // FFT green
-        clfftEnqueueTransform(planHandle, CLFFT_FORWARD, 1, &queue(), 0, NULL, NULL, &greenChannelPSF(), &greenChannelPSFFFT(), NULL);
+        enqueueTransform(m_forwardPlan, CLFFT_FORWARD, greenChannelPSF, greenChannelPSFFFT);
         clFinish(queue());
 
         // FFT blue
-        clfftEnqueueTransform(planHandle, CLFFT_FORWARD, 1, &queue(), 0, NULL, NULL, &blueChannelPSF(), &blueChannelPSFFFT(), NULL);
+        enqueueTransform(m_forwardPlan, CLFFT_FORWARD, blueChannelPSF, blueChannelPSFFFT);
         clFinish(queue());
 
+        if(inPlace)
+        {
+            for (int c = 0; c < 3; ++c)
+                psfChannels[c] = cl::Buffer();
+        }
         
 
-        // STEP: multiply  with original m_ImgRedFFT / m_ImgGreenFFT / m_ImgBlueFFT
+        // STEP: multiply  with original m_imgRedFFT / m_imgGreenFFT / m_imgBlueFFT
+        m_profileStage = PROFILE_MULTIPLY;
 
         
-        // The FFT buffers of the original image
-        cl::Buffer redChannelFFT(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight*2);
-        cl::Buffer greenChannelFFT(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight*2);
-        cl::Buffer blueChannelFFT(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight*2);
-
-        queue.enqueueWriteBuffer(redChannelFFT, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight*2, m_ImgRedFFT);
-        queue.enqueueWriteBuffer(greenChannelFFT, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight*2,m_ImgGreenFFT);
-        queue.enqueueWriteBuffer(blueChannelFFT, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight*2, m_ImgBlueFFT);
-
-        // the FFT buffers of the results of the convolution
-        cl::Buffer redChannelMult(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight*2);
-        cl::Buffer greenChannelMult(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight*2);
-        cl::Buffer blueChannelMult(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight*2);
+        // The FFT buffers of the original image stay on the device
+        // the FFT buffers of the results of the convolution, the products
+        // overwrite the PSF spectra when memory is short
+        cl::Buffer redChannelMult = redChannelPSFFFT;
+        cl::Buffer greenChannelMult = greenChannelPSFFFT;
+        cl::Buffer blueChannelMult = blueChannelPSFFFT;
+        if(!inPlace)
+        {
+            redChannelMult = m_deviceMemory.buffer(MEMORY_CONVOLUTION, context, CL_MEM_READ_WRITE, spectrumSize);
+            greenChannelMult = m_deviceMemory.buffer(MEMORY_CONVOLUTION, context, CL_MEM_READ_WRITE, spectrumSize);
+            blueChannelMult = m_deviceMemory.buffer(MEMORY_CONVOLUTION, context, CL_MEM_READ_WRITE, spectrumSize);
+        }
 
         queue.finish();
 
@@ -468,114 +778,278 @@ void TemporalGlareRenderer::paint(QPainter *painter, QPaintEvent *event, int ela
 
         // red channels conv
         convOfFFTsKernel.setArg(0, redChannelPSFFFT);
-        convOfFFTsKernel.setArg(1, redChannelFFT);
+        convOfFFTsKernel.setArg(1, m_imgRedFFT);
         convOfFFTsKernel.setArg(2, redChannelMult);
-        convOfFFTsKernel.setArg(3, m_imgWidth);
+        convOfFFTsKernel.setArg(3, spectrumWidth);
+        convOfFFTsKernel.setArg(4, m_imgHeight);
         
         queue.enqueueNDRangeKernel(
             convOfFFTsKernel, 
             cl::NullRange, 
-            cl::NDRange(m_imgWidth, m_imgHeight, 1), 
-            cl::NullRange
+            roundedRange("conv_of_ffts", spectrumWidth, m_imgHeight), 
+            tunedRange("conv_of_ffts", spectrumWidth, m_imgHeight, true), NULL, profileEvent()
         );
         queue.finish();
 
         // green channels conv
         convOfFFTsKernel.setArg(0, greenChannelPSFFFT);
-        convOfFFTsKernel.setArg(1, greenChannelFFT);
+        convOfFFTsKernel.setArg(1, m_imgGreenFFT);
         convOfFFTsKernel.setArg(2, greenChannelMult);
-        convOfFFTsKernel.setArg(3, m_imgWidth);
+        convOfFFTsKernel.setArg(3, spectrumWidth);
+        convOfFFTsKernel.setArg(4, m_imgHeight);
         
         queue.enqueueNDRangeKernel(
             convOfFFTsKernel, 
             cl::NullRange, 
-            cl::NDRange(m_imgWidth, m_imgHeight, 1), 
-            cl::NullRange
+            roundedRange("conv_of_ffts", spectrumWidth, m_imgHeight), 
+            tunedRange("conv_of_ffts", spectrumWidth, m_imgHeight, true), NULL, profileEvent()
         );
         queue.finish();
 
         // blue channels conv
         convOfFFTsKernel.setArg(0, blueChannelPSFFFT);
-        convOfFFTsKernel.setArg(1, blueChannelFFT);
+        convOfFFTsKernel.setArg(1, m_imgBlueFFT);
         convOfFFTsKernel.setArg(2, blueChannelMult);
-        convOfFFTsKernel.setArg(3, m_imgWidth);
+        convOfFFTsKernel.setArg(3, spectrumWidth);
+        convOfFFTsKernel.setArg(4, m_imgHeight);
         
         queue.enqueueNDRangeKernel(
             convOfFFTsKernel, 
             cl::NullRange, 
-            cl::NDRange(m_imgWidth, m_imgHeight, 1), 
-            cl::NullRange
+            roundedRange("conv_of_ffts", spectrumWidth, m_imgHeight), 
+            tunedRange("conv_of_ffts", spectrumWidth, m_imgHeight, true), NULL, profileEvent()
         );
         queue.finish();
 
 
-        // STEP: Computing the iFFT of the multiplication (as in convolution result)
+        // STEP: Gaussian pyramid of the luminance in the frequency domain,
+        // taken from the products before the inverse transforms reuse them
+        cl::Buffer scaleSpectra;
 
-        clfftSetLayout(planHandle, CLFFT_COMPLEX_INTERLEAVED, CLFFT_REAL);
-        clfftBakePlan(planHandle, 1, &queue(), NULL, NULL);
+        if(m_toneMapOperator == TM_REINHARD_LOCAL)
+        {
+            m_profileStage = PROFILE_TONE_MAP;
+            int specSize = (m_imgWidth/2 + 1) * m_imgHeight;
+            scaleSpectra = m_deviceMemory.buffer(MEMORY_TONE_MAP, context, CL_MEM_READ_WRITE, sizeof(float) * specSize * 2 * (TM_LOCAL_SCALES + 1));
+
+            localScaleSpectraKernel.setArg(0, redChannelMult);
+            localScaleSpectraKernel.setArg(1, greenChannelMult);
+            localScaleSpectraKernel.setArg(2, blueChannelMult);
+            localScaleSpectraKernel.setArg(3, scaleSpectra);
+            localScaleSpectraKernel.setArg(4, m_imgWidth);
+            localScaleSpectraKernel.setArg(5, m_imgHeight);
+            localScaleSpectraKernel.setArg(6, TM_LOCAL_SCALES);
+
+            queue.enqueueNDRangeKernel(
+                localScaleSpectraKernel, 
+                cl::NullRange, 
+                cl::NDRange(m_imgWidth/2 + 1, m_imgHeight, 1), 
+                cl::NullRange, NULL, profileEvent()
+            );
+            queue.finish();
+        }
+
+        // STEP: Computing the iFFT of the multiplication (as in convolution result)
+        m_profileStage = PROFILE_INVERSE_FFT;
 
-        cl::Buffer redChanneliFFT(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight*2);
-        cl::Buffer greenChanneliFFT(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight*2);
-        cl::Buffer blueChanneliFFT(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight*2);
+        cl::Buffer redChanneliFFT = m_deviceMemory.buffer(MEMORY_CONVOLUTION, context, CL_MEM_READ_WRITE, planeSize);
+        cl::Buffer greenChanneliFFT = m_deviceMemory.buffer(MEMORY_CONVOLUTION, context, CL_MEM_READ_WRITE, planeSize);
+        cl::Buffer blueChanneliFFT = m_deviceMemory.buffer(MEMORY_CONVOLUTION, context, CL_MEM_READ_WRITE, planeSize);
         queue.finish();
 
         // TODO: replace redCannelFFT with the result of fft multiplication
 
         // red channel iFFT
-        // clfftEnqueueTransform(planHandle, CLFFT_BACKWARD, 1, &queue(), 0, NULL, NULL, &redChannelFFT(), &redChanneliFFT(), NULL);
-        clfftEnqueueTransform(planHandle, CLFFT_BACKWARD, 1, &queue(), 0, NULL, NULL, &redChannelMult(), &redChanneliFFT(), NULL);
+        // clfftEnqueueTransform(m_inversePlan, CLFFT_BACKWARD, 1, &queue(), 0, NULL, NULL, &redChannelFFT(), &redChanneliFFT(), NULL);
+        enqueueTransform(m_inversePlan, CLFFT_BACKWARD, redChannelMult, redChanneliFFT);
         clFinish(queue());
         // queue.enqueueReadBuffer(redChanneliFFT, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight * 2, raw);
         // queue.finish();
 
         // green channel iFFT
-        // clfftEnqueueTransform(planHandle, CLFFT_BACKWARD, 1, &queue(), 0, NULL, NULL, &greenChannelFFT(), &greenChanneliFFT(), NULL);
-        clfftEnqueueTransform(planHandle, CLFFT_BACKWARD, 1, &queue(), 0, NULL, NULL, &greenChannelMult(), &greenChanneliFFT(), NULL);
+        // clfftEnqueueTransform(m_inversePlan, CLFFT_BACKWARD, 1, &queue(), 0, NULL, NULL, &greenChannelFFT(), &greenChanneliFFT(), NULL);
+        enqueueTransform(m_inversePlan, CLFFT_BACKWARD, greenChannelMult, greenChanneliFFT);
         clFinish(queue());
         // queue.enqueueReadBuffer(greenChanneliFFT, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight, m_ImgGreeniFFT);
         // queue.finish();
 
         // blue channel iFFT
-        // clfftEnqueueTransform(planHandle, CLFFT_BACKWARD, 1, &queue(), 0, NULL, NULL, &blueChannelFFT(), &blueChanneliFFT(), NULL);
-        clfftEnqueueTransform(planHandle, CLFFT_BACKWARD, 1, &queue(), 0, NULL, NULL, &blueChannelMult(), &blueChanneliFFT(), NULL);
+        // clfftEnqueueTransform(m_inversePlan, CLFFT_BACKWARD, 1, &queue(), 0, NULL, NULL, &blueChannelFFT(), &blueChanneliFFT(), NULL);
+        enqueueTransform(m_inversePlan, CLFFT_BACKWARD, blueChannelMult, blueChanneliFFT);
         clFinish(queue());
         // queue.enqueueReadBuffer(blueChanneliFFT, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight*2, raw);
         // queue.finish();
+        markStage(m_timings.convolution);
 
-        // tone mapping
-        cl::Image2D toneMappedBuffer(context, 
-                    CL_MEM_READ_WRITE, 
-                    cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8),
-                    m_imgWidth,
-                    m_imgHeight,
-                    0,
-                    NULL);
+        // keep the linear result for readHdrFrame
+        m_hdrChannels[0] = redChanneliFFT;
+        m_hdrChannels[1] = greenChanneliFFT;
+        m_hdrChannels[2] = blueChanneliFFT;
 
-        toneMapperKernel.setArg(0, redChanneliFFT);
-        toneMapperKernel.setArg(1, greenChanneliFFT);
-        toneMapperKernel.setArg(2, blueChanneliFFT);
-        toneMapperKernel.setArg(3, toneMappedBuffer);
+        // tone mapping, straight into the shared GL texture when there is one
+        m_profileStage = PROFILE_TONE_MAP;
+        bool toDisplayTexture = m_glSharing && m_displayImage() != NULL &&
+                                m_displayWidth == m_imgWidth && m_displayHeight == m_imgHeight;
+        m_frameInDisplay = toDisplayTexture;
 
-        // switch between auto-exposure and custom-exposure for tone mapping
-        if(m_autoExposure)
-            toneMapperKernel.setArg(4, m_autoExposureValue);
+        cl::Memory toneMappedBuffer;
+        std::vector<cl::Memory> glObjects;
+
+        if(toDisplayTexture)
+        {
+            toneMappedBuffer = m_displayImage;
+            glObjects.push_back(m_displayImage);
+            queue.enqueueAcquireGLObjects(&glObjects);
+        }
         else
-            toneMapperKernel.setArg(4, m_exposure);
+        {
+            toneMappedBuffer = m_frameImage;
+        }
 
-        toneMapperKernel.setArg(5, m_gamma);
-        toneMapperKernel.setArg(6, m_Lwhite);
-        toneMapperKernel.setArg(7, m_imgWidth);
+        // switch between auto-exposure and custom-exposure for tone mapping
+        float exposure = m_autoExposure ? m_autoExposureValue : m_exposure;
 
-        queue.enqueueNDRangeKernel(
-            toneMapperKernel, 
-            cl::NullRange, 
-            cl::NDRange(m_imgWidth, m_imgHeight, 1), 
-            cl::NullRange
-        );
-        queue.finish();
+        if(m_toneMapOperator == TM_REINHARD_LOCAL)
+        {
+            // all scales in a single batched inverse transform
+            cl::Buffer blurredLuminance = m_deviceMemory.buffer(MEMORY_TONE_MAP, context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight * (TM_LOCAL_SCALES + 1));
+            enqueueTransform(m_localScalesPlan, CLFFT_BACKWARD, scaleSpectra, blurredLuminance);
+
+            // the key value is the one the exposure was derived from
+            float key = exposure * image->getLogAverageLuminance();
+
+            localToneMapperKernel.setArg(0, redChanneliFFT);
+            localToneMapperKernel.setArg(1, greenChanneliFFT);
+            localToneMapperKernel.setArg(2, blueChanneliFFT);
+            localToneMapperKernel.setArg(3, blurredLuminance);
+            localToneMapperKernel.setArg(4, toneMappedBuffer);
+            localToneMapperKernel.setArg(5, exposure);
+            localToneMapperKernel.setArg(6, key);
+            localToneMapperKernel.setArg(7, m_phi);
+            localToneMapperKernel.setArg(8, m_epsilon);
+            localToneMapperKernel.setArg(9, m_gamma);
+            localToneMapperKernel.setArg(10, m_imgWidth);
+            localToneMapperKernel.setArg(11, m_imgHeight);
+            localToneMapperKernel.setArg(12, TM_LOCAL_SCALES);
+
+            queue.enqueueNDRangeKernel(
+                localToneMapperKernel, 
+                cl::NullRange, 
+                cl::NDRange(m_imgWidth, m_imgHeight, 1), 
+                cl::NullRange, NULL, profileEvent()
+            );
+            queue.finish();
+        }
+        else if(m_toneMapOperator == TM_HISTOGRAM_ADJUSTMENT)
+        {
+            // STEP: log luminance histogram, its clamped CDF and the lookup,
+            // enqueued back to back without any host synchronisation
+            int nPixels = m_imgWidth * m_imgHeight;
+            int nGroups = std::min((nPixels + TM_HIST_BINS - 1) / TM_HIST_BINS, TM_HIST_MAX_GROUPS);
+
+            cl::Buffer histogram = m_deviceMemory.buffer(MEMORY_TONE_MAP, context, CL_MEM_READ_WRITE, sizeof(cl_uint) * TM_HIST_BINS);
+            cl::Buffer logRange = m_deviceMemory.buffer(MEMORY_TONE_MAP, context, CL_MEM_READ_WRITE, sizeof(cl_uint) * 2);
+            cl::Buffer cdf = m_deviceMemory.buffer(MEMORY_TONE_MAP, context, CL_MEM_READ_WRITE, sizeof(float) * TM_HIST_BINS);
+
+            histogramClearKernel.setArg(0, histogram);
+            histogramClearKernel.setArg(1, logRange);
+
+            queue.enqueueNDRangeKernel(
+                histogramClearKernel, 
+                cl::NullRange, 
+                cl::NDRange(TM_HIST_BINS), 
+                cl::NullRange, NULL, profileEvent()
+            );
+
+            histogramRangeKernel.setArg(0, redChanneliFFT);
+            histogramRangeKernel.setArg(1, greenChanneliFFT);
+            histogramRangeKernel.setArg(2, blueChanneliFFT);
+            histogramRangeKernel.setArg(3, logRange);
+            histogramRangeKernel.setArg(4, nPixels);
+
+            queue.enqueueNDRangeKernel(
+                histogramRangeKernel, 
+                cl::NullRange, 
+                cl::NDRange(nGroups * TM_HIST_BINS), 
+                cl::NDRange(TM_HIST_BINS), NULL, profileEvent()
+            );
+
+            histogramKernel.setArg(0, redChanneliFFT);
+            histogramKernel.setArg(1, greenChanneliFFT);
+            histogramKernel.setArg(2, blueChanneliFFT);
+            histogramKernel.setArg(3, logRange);
+            histogramKernel.setArg(4, histogram);
+            histogramKernel.setArg(5, nPixels);
+
+            queue.enqueueNDRangeKernel(
+                histogramKernel, 
+                cl::NullRange, 
+                cl::NDRange(nGroups * TM_HIST_BINS), 
+                cl::NDRange(TM_HIST_BINS), NULL, profileEvent()
+            );
+
+            float logDisplayMin = std::log(m_displayMinLuminance);
+            float logDisplayMax = std::log(m_displayMaxLuminance);
+
+            histogramCdfKernel.setArg(0, histogram);
+            histogramCdfKernel.setArg(1, logRange);
+            histogramCdfKernel.setArg(2, cdf);
+            histogramCdfKernel.setArg(3, logDisplayMin);
+            histogramCdfKernel.setArg(4, logDisplayMax);
+
+            queue.enqueueNDRangeKernel(
+                histogramCdfKernel, 
+                cl::NullRange, 
+                cl::NDRange(TM_HIST_BINS), 
+                cl::NDRange(TM_HIST_BINS), NULL, profileEvent()
+            );
+
+            histogramToneMapperKernel.setArg(0, redChanneliFFT);
+            histogramToneMapperKernel.setArg(1, greenChanneliFFT);
+            histogramToneMapperKernel.setArg(2, blueChanneliFFT);
+            histogramToneMapperKernel.setArg(3, logRange);
+            histogramToneMapperKernel.setArg(4, cdf);
+            histogramToneMapperKernel.setArg(5, toneMappedBuffer);
+            histogramToneMapperKernel.setArg(6, logDisplayMin);
+            histogramToneMapperKernel.setArg(7, logDisplayMax);
+            histogramToneMapperKernel.setArg(8, m_gamma);
+            histogramToneMapperKernel.setArg(9, m_imgWidth);
+
+            queue.enqueueNDRangeKernel(
+                histogramToneMapperKernel, 
+                cl::NullRange, 
+                cl::NDRange(m_imgWidth, m_imgHeight, 1), 
+                cl::NullRange, NULL, profileEvent()
+            );
+            queue.finish();
+        }
+        else
+        {
+            toneMapperKernel.setArg(0, redChanneliFFT);
+            toneMapperKernel.setArg(1, greenChanneliFFT);
+            toneMapperKernel.setArg(2, blueChanneliFFT);
+            toneMapperKernel.setArg(3, toneMappedBuffer);
+            toneMapperKernel.setArg(4, exposure);
+            toneMapperKernel.setArg(5, m_gamma);
+            toneMapperKernel.setArg(6, m_Lwhite);
+            toneMapperKernel.setArg(7, m_imgWidth);
+
+            queue.enqueueNDRangeKernel(
+                toneMapperKernel, 
+                cl::NullRange, 
+                cl::NDRange(m_imgWidth, m_imgHeight, 1), 
+                tunedRange("tm_reinhard_extended", m_imgWidth, m_imgHeight), NULL, profileEvent()
+            );
+            queue.finish();
+        }
 
-        queue.enqueueReadImage(toneMappedBuffer, CL_TRUE, origin, region, 0, 0 , data,  NULL, NULL);
+        // hand the texture back to GL, finished before GL samples it
+        if(toDisplayTexture)
+            queue.enqueueReleaseGLObjects(&glObjects);
         queue.finish();
+        markStage(m_timings.toneMap);
+
+        rendered = true;
 
         // DEBUG SECTION
         // NORM
@@ -612,48 +1086,1320 @@ void TemporalGlareRenderer::paint(QPainter *painter, QPaintEvent *event, int ela
         //     data[i*4 + 2] = (unsigned char)(255 * b[i]);
         //     data[i*4 + 3] = 255;
         // }
-
-        QImage img(data, m_imgWidth, m_imgHeight, QImage::Format_RGBA8888);
-        painter->drawImage(0, 0, img);        
     } catch(cl::Error err) {
          std::cerr << "ERROR: " << err.what() << "(" << getOCLErrorString(err.err()) << ")" << std::endl;
-    }
-    delete[] data;
-    delete[] raw;
-    delete[] magnitude;
-    delete[] r;
-    delete[] g;
-    delete[] b;
-    
-}
+
+        // the frame is lost, the next one is planned for less memory
+        if(err.err() == CL_MEM_OBJECT_ALLOCATION_FAILURE || err.err() == CL_OUT_OF_RESOURCES ||
+           err.err() == CL_OUT_OF_HOST_MEMORY)
+        {
+            try {
+                queue.finish();
+                reduceMemoryBudget();
+            } catch(cl::Error retryErr) {
+                std::cerr << "ERROR: " << retryErr.what() << "(" << getOCLErrorString(retryErr.err()) << ")" << std::endl;
+            }
+        }
+    }
+
+    return rendered;
+}
+
+// renderFrame of the CPU backend, the same animation state drives the
+// whole pipeline in CpuRenderer
+bool TemporalGlareRenderer::renderFrameOnHost(unsigned int frame, float dt)
+{
+    updateApertureTexture();
+    updatePupilDiameter(frame, dt);
+    updateLensDeformation(frame);
+    bakeGratings();
+
+    float exposure = m_autoExposure ? m_autoExposureValue : m_exposure;
+
+    CpuFrameParams params;
+    params.pupilRadius = m_pupilRadiusPx;
+    params.pupilCenterX = m_pupilCenter.s[0];
+    params.pupilCenterY = m_pupilCenter.s[1];
+    params.slidRadius = m_slidRadiusDeformedPx;
+    params.gratings = m_gratingsTexture.data();
+    params.points = m_pointCoordinates.data();
+    params.nPoints = m_nPoints;
+    params.distort = m_distort;
+    params.lambda = m_lambda;
+    params.distance = m_distance;
+    params.maxPupilSize = m_maxPupilSize;
+    params.spectralSamples = m_spectralSamples;
+    params.toneMapOperator = m_toneMapOperator;
+    params.exposure = exposure;
+    params.key = exposure * image->getLogAverageLuminance();
+    params.gamma = m_gamma;
+    params.Lwhite = m_Lwhite;
+    params.phi = m_phi;
+    params.epsilon = m_epsilon;
+    params.displayMinLuminance = m_displayMinLuminance;
+    params.displayMaxLuminance = m_displayMaxLuminance;
+
+    // lens, pupil and gratings updates count to the aperture
+    markStage(m_timings.aperture);
+    m_cpuRenderer->render(params);
+    m_cpuFrameParams = params;
+    m_hasCpuFrameParams = true;
+    const FrameTimings& timings = m_cpuRenderer->getTimings();
+    m_timings.aperture += timings.aperture;
+    m_timings.spectral += timings.spectral;
+    m_timings.convolution += timings.convolution;
+    m_timings.toneMap += timings.toneMap;
+    m_stageStart = std::chrono::steady_clock::now();
+    m_frameInDisplay = false;
+    return true;
+}
+
+// Renders the pupil, gratings and lens particles, propagates them with
+// the Fresnel term and spreads the result over the visible spectrum. The
+// red, green and blue PSF planes are m_psfWidth x m_psfHeight, centred
+void TemporalGlareRenderer::generatePSF(cl::Buffer* psfChannels, unsigned int frame, float dt)
+{
+    TRACE_SCOPE("psf", "render");
+    std::vector<float> magnitudePlane((size_t)m_psfWidth * m_psfHeight);
+    std::vector<float> rawPlane((size_t)m_psfWidth * m_psfHeight * 4);
+    float* magnitude = magnitudePlane.data();
+    float* raw = rawPlane.data();
+
+    float normFactor = 1.0f;
+
+    cl::size_t<3> origin;
+    origin[0] = 0; origin[1] = 0, origin[2] = 0;
+    cl::size_t<3> region;
+    region[0] = m_psfWidth; region[1] = m_psfHeight; region[2] = 1;
+
+    // make the neccessary updates 
+    m_profileStage = PROFILE_FRESNEL;
+    updateApertureTexture();
+    m_profileStage = PROFILE_APERTURE;
+    updatePupilDiameter(frame, dt);
+    updateLensDeformation(frame);
+
+    //STEP: GENERATING THE PUPIL
+    cl::Image2D pupilBuffer = m_deviceMemory.image(MEMORY_APERTURE, context,
+                CL_MEM_READ_WRITE, 
+                cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8),
+                m_psfWidth,
+                m_psfHeight,
+                NULL);
+
+    
+    pupilKernel.setArg(0, pupilBuffer);
+    pupilKernel.setArg(1, m_pupilState);
+    pupilKernel.setArg(2, m_psfWidth);
+    pupilKernel.setArg(3, m_psfHeight);
+    pupilKernel.setArg(4, m_pupilCenter);
+
+    queue.enqueueNDRangeKernel(
+        pupilKernel, 
+        cl::NullRange, 
+        cl::NDRange(m_psfWidth, m_psfHeight, 1), 
+        tunedRange("glr_render_pupil", m_psfWidth, m_psfHeight), NULL, profileEvent()
+    );
+    queue.finish();
+
+    // queue.enqueueReadImage(pupilBuffer, CL_TRUE, origin, region, 0, 0 , data,  NULL, NULL);
+    // queue.finish();
+
+    //STEP: GRATINGS RENDERING, the baked gratings with the clear centre
+    bakeGratings();
+
+    cl::Image2D slidBufferOut = m_deviceMemory.image(MEMORY_APERTURE, context,
+                CL_MEM_READ_WRITE, 
+                cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8),
+                m_psfWidth,
+                m_psfHeight,
+                NULL);
+
+    gratingsKernel.setArg(0, m_gratingsImage);
+    gratingsKernel.setArg(1, slidBufferOut);
+    gratingsKernel.setArg(2, m_slidRadiusDeformedPx);
+    gratingsKernel.setArg(3, m_psfWidth);
+    gratingsKernel.setArg(4, m_psfHeight);
+    gratingsKernel.setArg(5, m_pupilCenter);
+
+    queue.enqueueNDRangeKernel(
+        gratingsKernel, 
+        cl::NullRange, 
+        cl::NDRange(m_psfWidth, m_psfHeight, 1), 
+        tunedRange("glr_render_gratings", m_psfWidth, m_psfHeight), NULL, profileEvent()
+    );
+    queue.finish();
+    
+    //STEP: RASTERISE LENS POINTS into the occlusion mask, on the device
+    rasteriseLensPoints();
+
+    //STEP: MERGE PUPIL-RELATED IMAGES 
+    cl::Image2D mergeBufferOut = m_deviceMemory.image(MEMORY_APERTURE, context,
+                CL_MEM_READ_WRITE, 
+                cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8),
+                m_psfWidth,
+                m_psfHeight,
+                NULL);
+
+    // first slid, second pupil, third particles
+    mergeKernel = cl::Kernel(program, "glr_merge_images");
+    mergeKernel.setArg(0, slidBufferOut);
+    mergeKernel.setArg(1, pupilBuffer);
+    mergeKernel.setArg(2, m_occlusionMask);
+    mergeKernel.setArg(3, mergeBufferOut);
+    mergeKernel.setArg(4, m_psfWidth);
+
+    queue.enqueueNDRangeKernel(
+        mergeKernel, 
+        cl::NullRange, 
+        cl::NDRange(m_psfWidth, m_psfHeight, 1), 
+        tunedRange("glr_merge_images", m_psfWidth, m_psfHeight), NULL, profileEvent()
+    );
+    queue.finish();
+
+    // STEP: multiply with complex exponential (fresnel term)
+    m_profileStage = PROFILE_FRESNEL;
+    // takes only the first channel from the buffer, which contains the monochrome texture
+
+    cl::Buffer complexApertureBuffer = m_deviceMemory.buffer(MEMORY_APERTURE, context, CL_MEM_READ_WRITE, sizeof(float) * m_psfWidth * m_psfHeight * 2);
+    cl::Buffer complexExponentialBuffer = m_deviceMemory.buffer(MEMORY_APERTURE, context, CL_MEM_READ_WRITE, sizeof(float) * m_psfWidth * m_psfHeight * 2);
+
+    queue.enqueueWriteBuffer(complexExponentialBuffer, CL_TRUE, 0, sizeof(float) * m_psfWidth * m_psfHeight * 2, m_complexExponential, NULL, profileEvent());
+
+    compExpMultKernel.setArg(0, mergeBufferOut);
+    compExpMultKernel.setArg(1, complexExponentialBuffer);
+    compExpMultKernel.setArg(2, complexApertureBuffer);
+    compExpMultKernel.setArg(3, m_psfWidth);
+
+    queue.enqueueNDRangeKernel(
+        compExpMultKernel, 
+        cl::NullRange, 
+        cl::NDRange(m_psfWidth, m_psfHeight, 1), 
+        tunedRange("multiply_with_complex_exp", m_psfWidth, m_psfHeight), NULL, profileEvent()
+    );
+
+    queue.finish();
+
+    // short of memory the PSF scratch goes as soon as it is used up
+    bool inPlace = m_memoryMode >= MEMORY_MODE_IN_PLACE;
+    if(inPlace)
+    {
+        complexExponentialBuffer = cl::Buffer();
+        pupilBuffer = cl::Image2D();
+        slidBufferOut = cl::Image2D();
+        mergeBufferOut = cl::Image2D();
+    }
+
+    // debug 
+    // queue.enqueueReadBuffer(complexApertureBuffer, CL_TRUE, 0, sizeof(float) * m_psfWidth * m_psfHeight * 2, m_complexAperture);
+    // queue.finish();
+
+    // cl::Buffer complexApertureBufferMagnitude(context, CL_MEM_READ_WRITE, sizeof(float) * m_psfWidth * m_psfHeight);
+
+    // for (int i = 0; i < m_psfHeight*m_psfWidth; i++)
+    // {
+    //     float x = m_complexAperture[2*i];
+    //     float y = m_complexAperture[2*i + 1];
+    //     magnitude[i] = std::sqrt(x*x + y*y);
+    // }
+    
+
+    // queue.enqueueWriteBuffer(complexApertureBufferMagnitude, CL_TRUE, 0, sizeof(float) * m_psfWidth * m_psfHeight, magnitude);
+    // queue.finish();
+    
+
+    //STEP: APPLY THE FFT TO GET THE PSF
+    m_profileStage = PROFILE_PSF_FFT;
+
+    // or the transform overwrites the complex aperture
+    cl::Buffer psfBuffer = complexApertureBuffer;
+    if(!inPlace)
+        psfBuffer = m_deviceMemory.buffer(MEMORY_PSF, context, CL_MEM_READ_WRITE, sizeof(float) * m_psfWidth * m_psfHeight * 2);
+
+    // the memory mode may change without a new size, baked again then
+    if (inPlace != m_psfPlanInPlace)
+    {
+        clfftSetResultLocation(m_psfPlan, inPlace ? CLFFT_INPLACE : CLFFT_OUTOFPLACE);
+        clfftBakePlan(m_psfPlan, 1, &queue(), NULL, NULL);
+        m_psfPlanInPlace = inPlace;
+    }
+    enqueueTransform(m_psfPlan, CLFFT_FORWARD, complexApertureBuffer, psfBuffer);
+    clFinish(queue());
+
+    m_profileStage = PROFILE_MAGNITUDE;
+    queue.enqueueReadBuffer(psfBuffer, CL_TRUE, 0, sizeof(float) * m_psfWidth * m_psfHeight * 2, raw, NULL, profileEvent());
+    queue.finish();
+    markStage(m_timings.aperture);
+    
+    //STEP: SPECTRAL BLUR
+    cl::Buffer monochromePSF = m_deviceMemory.buffer(MEMORY_PSF, context, CL_MEM_READ_WRITE, sizeof(float) * m_psfWidth * m_psfHeight);
+
+    // From psfBuffer to monochromePSF
+
+    cl::Image2D fresnelPSF = m_deviceMemory.image(MEMORY_PSF, context,
+                CL_MEM_READ_WRITE, 
+                cl::ImageFormat(CL_RGBA, CL_FLOAT),
+                m_psfWidth,
+                m_psfHeight,
+                NULL);
+
+    computeMagnitudeKernel.setArg(0, psfBuffer);
+    computeMagnitudeKernel.setArg(1, fresnelPSF);
+    computeMagnitudeKernel.setArg(2, monochromePSF); // debug 
+    computeMagnitudeKernel.setArg(3, m_psfWidth);
+    computeMagnitudeKernel.setArg(4, m_psfHeight);
+    computeMagnitudeKernel.setArg(5, m_lambda);
+    computeMagnitudeKernel.setArg(6, m_distance);
+
+    queue.enqueueNDRangeKernel(
+        computeMagnitudeKernel, 
+        cl::NullRange, 
+        cl::NDRange(m_psfWidth, m_psfHeight, 1), 
+        tunedRange("compute_magnitude_kernel", m_psfWidth, m_psfHeight), NULL, profileEvent()
+    );
+
+    queue.finish();
+
+    queue.enqueueReadBuffer(monochromePSF, CL_TRUE, 0, sizeof(float) * m_psfWidth * m_psfHeight, magnitude, NULL, profileEvent());
+    queue.finish();
+
+    if(inPlace)
+    {
+        psfBuffer = cl::Buffer();
+        complexApertureBuffer = cl::Buffer();
+        monochromePSF = cl::Buffer();
+    }
+
+    // the energy of the PSF, whatever its resolution
+    double energy = 0.0;
+    for (int i = 0; i < m_psfHeight*m_psfWidth; i++)
+        energy += magnitude[i];
+    if (energy > 0.0)
+        normFactor = (float)(energy / PSF_ENERGY);
+
+
+    queue.enqueueReadImage(fresnelPSF, CL_TRUE, origin, region, 0, 0 , raw,  NULL, profileEvent());
+    queue.finish();
+
+    if(inPlace)
+        fresnelPSF = cl::Image2D();
+
+    
+    // the channels resulting from the spectral blur  
+    cl::Buffer redChannelPSF = m_deviceMemory.buffer(MEMORY_PSF, context, CL_MEM_READ_WRITE, sizeof(float) * m_psfWidth * m_psfHeight);
+    cl::Buffer greenChannelPSF = m_deviceMemory.buffer(MEMORY_PSF, context, CL_MEM_READ_WRITE, sizeof(float) * m_psfWidth * m_psfHeight);
+    cl::Buffer blueChannelPSF = m_deviceMemory.buffer(MEMORY_PSF, context, CL_MEM_READ_WRITE, sizeof(float) * m_psfWidth * m_psfHeight);
+
+    m_profileStage = PROFILE_SPECTRAL_BLUR;
+    // TODO: adapt it to the spectrum mapping vector
+    cl::Buffer spectrumMapping = m_deviceMemory.buffer(MEMORY_PSF, context, CL_MEM_READ_WRITE, sizeof(float) * SPECTRUM_RESOLUTION * 3);
+    queue.enqueueWriteBuffer(spectrumMapping, CL_TRUE, 0, sizeof(float) * SPECTRUM_RESOLUTION * 3, spectrum, NULL, profileEvent());
+
+    cl::Image2D fresnelPSF2 = m_deviceMemory.image(MEMORY_PSF, context,
+                CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, 
+                cl::ImageFormat(CL_RGBA, CL_FLOAT),
+                m_psfWidth,
+                m_psfHeight,
+                raw);
+
+    spectralBlurKernel.setArg(0, fresnelPSF2);
+    spectralBlurKernel.setArg(1, redChannelPSF);
+    spectralBlurKernel.setArg(2, greenChannelPSF);
+    spectralBlurKernel.setArg(3, blueChannelPSF);
+    spectralBlurKernel.setArg(4, spectrumMapping); // lambda to RGB mapping -> TBD
+    spectralBlurKernel.setArg(5, m_psfWidth);
+    spectralBlurKernel.setArg(6, m_psfHeight);
+    spectralBlurKernel.setArg(7, m_lambda*1000*1000);
+    spectralBlurKernel.setArg(8, m_distance);
+    spectralBlurKernel.setArg(9, normFactor);
+    spectralBlurKernel.setArg(10, m_spectralSamples);
+
+    queue.enqueueNDRangeKernel(
+        spectralBlurKernel, 
+        cl::NullRange, 
+        cl::NDRange(m_psfWidth, m_psfHeight, 1), 
+        tunedRange("spectral_blur", m_psfWidth, m_psfHeight), NULL, profileEvent()
+    );
+
+    queue.finish();
+    markStage(m_timings.spectral);
+
+    psfChannels[0] = redChannelPSF;
+    psfChannels[1] = greenChannelPSF;
+    psfChannels[2] = blueChannelPSF;
+}
+
+void TemporalGlareRenderer::setMemoryBudget(unsigned long long bytes)
+{
+    m_memoryBudget = bytes;
+    if (!m_cpuRenderer)
+        m_deviceMemory.setBudget(getMemoryBudget());
+}
+
+unsigned long long TemporalGlareRenderer::getMemoryBudget()
+{
+    if (m_memoryBudget > 0 || m_cpuRenderer)
+        return m_memoryBudget;
+    return device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>() / 100 * DEVICE_MEMORY_BUDGET_PERCENT;
+}
+
+MemoryMode TemporalGlareRenderer::getMemoryMode() const
+{
+    return m_memoryMode;
+}
+
+bool TemporalGlareRenderer::isTiled() const
+{
+    return m_tiled;
+}
+
+int TemporalGlareRenderer::getPsfWidth() const
+{
+    return m_psfWidth;
+}
+
+int TemporalGlareRenderer::getPsfHeight() const
+{
+    return m_psfHeight;
+}
+
+int TemporalGlareRenderer::getEffectiveToneMapOperator() const
+{
+    return m_tiled ? TM_REINHARD_EXTENDED : m_toneMapOperator;
+}
+
+MemoryUsage TemporalGlareRenderer::getDeviceMemoryUsage() const
+{
+    return m_deviceMemory.getUsage();
+}
+
+void TemporalGlareRenderer::resetDeviceMemoryPeak()
+{
+    m_deviceMemory.resetPeak();
+}
+
+// Peak device footprint of an untiled frame of width x height
+unsigned long long TemporalGlareRenderer::frameDeviceBytes(int width, int height, MemoryMode mode) const
+{
+    bool inPlace = mode >= MEMORY_MODE_IN_PLACE;
+    unsigned long long convolution = inPlace ? FRAME_BYTES_CONVOLUTION_IN_PLACE : FRAME_BYTES_CONVOLUTION;
+    if (m_toneMapOperator == TM_REINHARD_LOCAL)
+        convolution += FRAME_BYTES_LOCAL_TONE_MAP;
+
+    unsigned long long perPixel = FRAME_BYTES_RESIDENT +
+                                  (mode == MEMORY_MODE_FULL ? FRAME_BYTES_KEPT_RESULT : 0) +
+                                  std::max<unsigned long long>(inPlace ? FRAME_BYTES_PSF_IN_PLACE : FRAME_BYTES_PSF,
+                                                               convolution);
+    return perPixel * width * height;
+}
+
+// The first memory mode whose frames fit the budget, for the tiled mode
+// also the PSF size. The largest single buffers are RGBA float images of
+// the PSF, too large for some devices whatever the budget
+MemoryMode TemporalGlareRenderer::planMemory(int width, int height)
+{
+    unsigned long long budget = m_deviceMemory.getBudget();
+    cl_ulong maxAllocation = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+
+    MemoryMode mode = MEMORY_MODE_TILED;
+    if (!m_forceTiling && (cl_ulong)width * height * 4 * sizeof(float) <= maxAllocation)
+    {
+        for (int m = MEMORY_MODE_FULL; m < MEMORY_MODE_TILED; ++m)
+            if (frameDeviceBytes(width, height, (MemoryMode)m) <= budget)
+            {
+                mode = (MemoryMode)m;
+                break;
+            }
+    }
+
+    int psfSize = m_tiledPsfSize;
+    m_tiledPsfSize = TILED_PSF_SIZE;
+    if (mode == MEMORY_MODE_TILED)
+        while (m_tiledPsfSize > TILED_MIN_PSF_SIZE && tileDeviceBytes(2 * m_tiledPsfSize, m_tiledPsfSize) > budget)
+            m_tiledPsfSize /= 2;
+
+    // said once per change, sequences plan every frame
+    if (mode == m_memoryMode && psfSize == m_tiledPsfSize)
+        return mode;
+
+    static const char* modeNames[] = { "full", "no caches", "in place", "tiled" };
+    std::cout << "Device memory: " << modeNames[mode] << " frames";
+    if (mode == MEMORY_MODE_TILED)
+        std::cout << " with a " << m_tiledPsfSize << " px PSF";
+    else
+        std::cout << " of about " << (frameDeviceBytes(width, height, mode) >> 20) << " MB";
+    std::cout << " for a " << (budget >> 20) << " MB budget\n";
+    return mode;
+}
+
+// After an allocation failed: the budget shrinks and the buffers are
+// planned again for the next frame. False once nothing is left to give
+bool TemporalGlareRenderer::reduceMemoryBudget()
+{
+    unsigned long long budget = m_deviceMemory.getBudget() / 100 * MEMORY_BUDGET_RETRY_PERCENT;
+    if (m_memoryMode == MEMORY_MODE_TILED && m_tiledPsfSize == TILED_MIN_PSF_SIZE &&
+        m_tileSize == 2 * TILED_MIN_PSF_SIZE)
+        return false;
+
+    std::cout << "Device memory: reducing the budget to " << (budget >> 20) << " MB\n";
+    printMemoryUsage(std::cout, m_deviceMemory.getUsage());
+    m_deviceMemory.setBudget(budget);
+    releaseScaleLevels();
+
+    m_memoryMode = planMemory(m_imgWidth, m_imgHeight);
+    m_tiled = m_memoryMode == MEMORY_MODE_TILED;
+    initTextures();
+    return true;
+}
+
+// Picks the largest tile the memory budget allows and allocates the slots,
+// the PSF spectra and the plans for it, plus the host side results
+void TemporalGlareRenderer::initTiles()
+{
+    releaseTiles();
+
+    cl_ulong budget = m_deviceMemory.getBudget();
+    cl_ulong maxAllocation = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+
+    // no larger than the image with its PSF margin needs, the pinned
+    // staging planes are the largest single allocation
+    int minSize = 2 * m_tiledPsfSize;
+    m_tileSize = minSize;
+    while (m_tileSize < TILED_MAX_TILE_SIZE && m_tileSize < std::max(m_imgWidth, m_imgHeight) + m_tiledPsfSize)
+        m_tileSize *= 2;
+
+    while (m_tileSize > minSize &&
+           (tileDeviceBytes(m_tileSize, m_tiledPsfSize) > budget ||
+            3 * sizeof(float) * (cl_ulong)m_tileSize * m_tileSize > maxAllocation))
+        m_tileSize /= 2;
+
+    if (tileDeviceBytes(m_tileSize, m_tiledPsfSize) > budget)
+        std::cout << "Warning: the smallest tile needs " << (tileDeviceBytes(m_tileSize, m_tiledPsfSize) >> 20)
+                  << " MB, more than the " << (budget >> 20) << " MB budget\n";
+
+    m_tileStep = m_tileSize - m_tiledPsfSize;
+
+    size_t planeSize = sizeof(float) * m_tileSize * m_tileSize;
+    size_t spectrumSize = sizeof(float) * 2 * (m_tileSize/2 + 1) * m_tileSize;
+
+    for (int c = 0; c < 3; ++c)
+        m_tilePSFSpectra[c] = m_deviceMemory.buffer(MEMORY_TILES, context, CL_MEM_READ_WRITE, spectrumSize);
+    m_tileSpectrum = m_deviceMemory.buffer(MEMORY_TILES, context, CL_MEM_READ_WRITE, spectrumSize);
+    m_tileProduct = m_deviceMemory.buffer(MEMORY_TILES, context, CL_MEM_READ_WRITE, spectrumSize);
+
+    for (int slot = 0; slot < TILE_SLOTS; ++slot)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            m_tileInput[slot][c] = m_deviceMemory.buffer(MEMORY_TILES, context, CL_MEM_READ_WRITE, planeSize);
+            m_tileOutput[slot][c] = m_deviceMemory.buffer(MEMORY_TILES, context, CL_MEM_READ_WRITE, planeSize);
+        }
+        m_tileFrame[slot] = m_deviceMemory.image(MEMORY_TILES, context, 
+                    CL_MEM_READ_WRITE, 
+                    cl::ImageFormat(frameChannelOrder(), CL_UNORM_INT8),
+                    m_tileSize,
+                    m_tileSize,
+                    NULL);
+
+        // the three input planes of a tile are packed here on the host
+        m_tileStaging[slot] = m_deviceMemory.buffer(MEMORY_STAGING, context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, 3 * planeSize);
+        m_tileStagingPtrs[slot] = (float*)queue.enqueueMapBuffer(m_tileStaging[slot], CL_TRUE, 
+                                                                 CL_MAP_READ | CL_MAP_WRITE, 0, 3 * planeSize);
+    }
+
+    m_transferQueue = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+
+    size_t clLengths[2] = {(size_t)m_tileSize, (size_t)m_tileSize};
+    clfftCreateDefaultPlan(&m_tileForwardPlan, context(), CLFFT_2D, clLengths);
+    clfftSetPlanPrecision(m_tileForwardPlan, CLFFT_SINGLE);
+    clfftSetLayout(m_tileForwardPlan, CLFFT_REAL, CLFFT_HERMITIAN_INTERLEAVED);
+    setRealTransformStrides(m_tileForwardPlan, m_tileSize, m_tileSize, true);
+    clfftSetResultLocation(m_tileForwardPlan, CLFFT_OUTOFPLACE);
+    clfftBakePlan(m_tileForwardPlan, 1, &queue(), NULL, NULL);
+
+    clfftCreateDefaultPlan(&m_tileInversePlan, context(), CLFFT_2D, clLengths);
+    clfftSetPlanPrecision(m_tileInversePlan, CLFFT_SINGLE);
+    clfftSetLayout(m_tileInversePlan, CLFFT_HERMITIAN_INTERLEAVED, CLFFT_REAL);
+    setRealTransformStrides(m_tileInversePlan, m_tileSize, m_tileSize, false);
+    clfftSetResultLocation(m_tileInversePlan, CLFFT_OUTOFPLACE);
+    clfftBakePlan(m_tileInversePlan, 1, &queue(), NULL, NULL);
+    m_tilePlansReady = true;
+
+    size_t pixels = (size_t)m_imgWidth * m_imgHeight;
+    for (int c = 0; c < 3; ++c)
+        m_tiledHdr[c].assign(pixels, 0.0f);
+    m_tiledFrame.assign(pixels * 4, 0);
+
+    int tilesX = (m_imgWidth + m_tileStep - 1) / m_tileStep;
+    int tilesY = (m_imgHeight + m_tileStep - 1) / m_tileStep;
+    std::cout << "Tiled convolution: " << tilesX << "x" << tilesY << " tiles of " << m_tileSize << " px, "
+              << (tileDeviceBytes(m_tileSize, m_tiledPsfSize) >> 20) << " MB on the device\n";
+    if (m_toneMapOperator != TM_REINHARD_EXTENDED)
+        std::cout << "Tiles are tone mapped with the extended Reinhard operator\n";
+}
+
+void TemporalGlareRenderer::releaseTiles()
+{
+    for (int slot = 0; slot < TILE_SLOTS; ++slot)
+    {
+        if (m_tileStagingPtrs[slot] != nullptr)
+            queue.enqueueUnmapMemObject(m_tileStaging[slot], m_tileStagingPtrs[slot]);
+        m_tileStagingPtrs[slot] = nullptr;
+        m_tileStaging[slot] = cl::Buffer();
+        m_tileFrame[slot] = cl::Image2D();
+        for (int c = 0; c < 3; ++c)
+        {
+            m_tileInput[slot][c] = cl::Buffer();
+            m_tileOutput[slot][c] = cl::Buffer();
+        }
+    }
+    queue.finish();
+
+    for (int c = 0; c < 3; ++c)
+    {
+        m_tilePSFSpectra[c] = cl::Buffer();
+        std::vector<float>().swap(m_tiledHdr[c]);
+    }
+    m_tileSpectrum = cl::Buffer();
+    m_tileProduct = cl::Buffer();
+    std::vector<unsigned char>().swap(m_tiledFrame);
+
+    if (m_tilePlansReady)
+    {
+        clfftDestroyPlan( &m_tileForwardPlan );
+        clfftDestroyPlan( &m_tileInversePlan );
+    }
+    m_tilePlansReady = false;
+}
+
+// Overlap-save convolution of the host image with the PSF. Every tile
+// reads half a PSF of margin around the pixels it produces, the margin is
+// wrapped around by the circular convolution and dropped. While the
+// device transforms one tile the next is packed and uploaded, and the
+// one before is read back, on the transfer queue
+void TemporalGlareRenderer::renderTiles(cl::Buffer* psfChannels)
+{
+    TRACE_SCOPE("tiles", "render");
+    if (!image->hasHostData())
+        image->reloadHostData();
+
+    int margin = m_tiledPsfSize / 2;
+    int tilesX = (m_imgWidth + m_tileStep - 1) / m_tileStep;
+    int tilesY = (m_imgHeight + m_tileStep - 1) / m_tileStep;
+    int nTiles = tilesX * tilesY;
+
+    size_t tilePixels = (size_t)m_tileSize * m_tileSize;
+    size_t planeSize = sizeof(float) * tilePixels;
+
+    // STEP: PSF SPECTRA AT THE TILE SIZE, centred on the origin
+    m_profileStage = PROFILE_PSF_FORWARD_FFT;
+    cl::Buffer embeddedPSF = m_deviceMemory.buffer(MEMORY_TILES, context, CL_MEM_READ_WRITE, planeSize);
+    for (int c = 0; c < 3; ++c)
+    {
+        tilePSFKernel.setArg(0, psfChannels[c]);
+        tilePSFKernel.setArg(1, embeddedPSF);
+        tilePSFKernel.setArg(2, m_tiledPsfSize);
+        tilePSFKernel.setArg(3, m_tileSize);
+
+        queue.enqueueNDRangeKernel(
+            tilePSFKernel, 
+            cl::NullRange, 
+            cl::NDRange(m_tileSize, m_tileSize, 1), 
+            cl::NullRange, NULL, profileEvent()
+        );
+        enqueueTransform(m_tileForwardPlan, CLFFT_FORWARD, embeddedPSF, m_tilePSFSpectra[c]);
+    }
+
+    float exposure = m_autoExposure ? m_autoExposureValue : m_exposure;
+
+    std::vector<cl::Event> uploaded(nTiles);
+    std::vector<cl::Event> transformed(nTiles);
+    std::vector<cl::Event> downloaded(nTiles);
+
+    // STEP: PACK AND UPLOAD, zero outside the image
+    auto uploadTile = [&](int tile)
+    {
+        int slot = tile % TILE_SLOTS;
+        int x = (tile % tilesX) * m_tileStep - margin;
+        int y = (tile / tilesX) * m_tileStep - margin;
+
+        // the staging slot is free once its last upload went through
+        if (tile >= TILE_SLOTS)
+            uploaded[tile - TILE_SLOTS].wait();
+
+        float* staging = m_tileStagingPtrs[slot];
+        for (int c = 0; c < 3; ++c)
+            image->copyTile(c, x, y, m_tileSize, m_tileSize, staging + c * tilePixels);
+
+        // and the input planes once the tile before has been transformed
+        std::vector<cl::Event> waitFor;
+        if (tile >= TILE_SLOTS)
+            waitFor.push_back(transformed[tile - TILE_SLOTS]);
+
+        for (int c = 0; c < 3; ++c)
+            m_transferQueue.enqueueWriteBuffer(m_tileInput[slot][c], CL_FALSE, 0, planeSize, staging + c * tilePixels,
+                                               waitFor.empty() ? NULL : &waitFor, c == 2 ? &uploaded[tile] : NULL);
+        m_transferQueue.flush();
+    };
+
+    // STEP: CONVOLUTION AND TONE MAPPING of one tile
+    auto transformTile = [&](int tile)
+    {
+        int slot = tile % TILE_SLOTS;
+
+        // the output planes are free once the tile before has been read back
+        cl_event waitFor[2] = {uploaded[tile](), NULL};
+        cl_uint nWaitFor = 1;
+        if (tile >= TILE_SLOTS)
+            waitFor[nWaitFor++] = downloaded[tile - TILE_SLOTS]();
+
+        // the image spectra of a tile count to its products
+        for (int c = 0; c < 3; ++c)
+        {
+            m_profileStage = PROFILE_MULTIPLY;
+            enqueueTransform(m_tileForwardPlan, CLFFT_FORWARD, m_tileInput[slot][c], m_tileSpectrum,
+                             c == 0 ? nWaitFor : 0, c == 0 ? waitFor : NULL);
+
+            convOfFFTsKernel.setArg(0, m_tilePSFSpectra[c]);
+            convOfFFTsKernel.setArg(1, m_tileSpectrum);
+            convOfFFTsKernel.setArg(2, m_tileProduct);
+            convOfFFTsKernel.setArg(3, m_tileSize/2 + 1);
+            convOfFFTsKernel.setArg(4, m_tileSize);
+
+            queue.enqueueNDRangeKernel(
+                convOfFFTsKernel, 
+                cl::NullRange, 
+                roundedRange("conv_of_ffts", m_tileSize/2 + 1, m_tileSize), 
+                tunedRange("conv_of_ffts", m_tileSize/2 + 1, m_tileSize, true), NULL, profileEvent()
+            );
+
+            m_profileStage = PROFILE_INVERSE_FFT;
+            enqueueTransform(m_tileInversePlan, CLFFT_BACKWARD, m_tileProduct, m_tileOutput[slot][c]);
+        }
+
+        toneMapperKernel.setArg(0, m_tileOutput[slot][0]);
+        toneMapperKernel.setArg(1, m_tileOutput[slot][1]);
+        toneMapperKernel.setArg(2, m_tileOutput[slot][2]);
+        toneMapperKernel.setArg(3, m_tileFrame[slot]);
+        toneMapperKernel.setArg(4, exposure);
+        toneMapperKernel.setArg(5, m_gamma);
+        toneMapperKernel.setArg(6, m_Lwhite);
+        toneMapperKernel.setArg(7, m_tileSize);
+
+        queue.enqueueNDRangeKernel(
+            toneMapperKernel, 
+            cl::NullRange, 
+            cl::NDRange(m_tileSize, m_tileSize, 1), 
+            tunedRange("tm_reinhard_extended", m_tileSize, m_tileSize),
+            NULL,
+            &transformed[tile]
+        );
+        recordProfileEvent(PROFILE_TONE_MAP, transformed[tile]);
+        queue.flush();
+    };
+
+    // STEP: READ BACK the pixels inside the margin into the full frame
+    auto downloadTile = [&](int tile)
+    {
+        int slot = tile % TILE_SLOTS;
+        int x = (tile % tilesX) * m_tileStep;
+        int y = (tile / tilesX) * m_tileStep;
+        int width = std::min(m_tileStep, m_imgWidth - x);
+        int height = std::min(m_tileStep, m_imgHeight - y);
+
+        std::vector<cl::Event> waitFor(1, transformed[tile]);
+
+        cl::size_t<3> tileOrigin;
+        tileOrigin[0] = margin * sizeof(float); tileOrigin[1] = margin; tileOrigin[2] = 0;
+        cl::size_t<3> frameOrigin;
+        frameOrigin[0] = x * sizeof(float); frameOrigin[1] = y; frameOrigin[2] = 0;
+        cl::size_t<3> region;
+        region[0] = width * sizeof(float); region[1] = height; region[2] = 1;
+
+        m_profileStage = PROFILE_READBACK;
+        for (int c = 0; c < 3; ++c)
+            m_transferQueue.enqueueReadBufferRect(m_tileOutput[slot][c], CL_FALSE, tileOrigin, frameOrigin, region,
+                                                  sizeof(float) * m_tileSize, 0, sizeof(float) * m_imgWidth, 0,
+                                                  m_tiledHdr[c].data(), &waitFor, profileEvent());
+
+        tileOrigin[0] = margin;
+        region[0] = width;
+        m_transferQueue.enqueueReadImage(m_tileFrame[slot], CL_FALSE, tileOrigin, region, sizeof(cl_uint) * m_imgWidth, 0,
+                                         m_tiledFrame.data() + sizeof(cl_uint) * ((size_t)y * m_imgWidth + x),
+                                         &waitFor, &downloaded[tile]);
+        recordProfileEvent(PROFILE_READBACK, downloaded[tile]);
+        m_transferQueue.flush();
+    };
+
+    uploadTile(0);
+    for (int tile = 0; tile < nTiles; ++tile)
+    {
+        transformTile(tile);
+        if (tile + 1 < nTiles)
+            uploadTile(tile + 1);
+        downloadTile(tile);
+    }
+
+    m_transferQueue.finish();
+    queue.finish();
+
+    m_frameInDisplay = false;
+}
+
+// Host transform matching a baked clFFT plan, nullptr when the plan's
+// layout, strides or scaling have no CpuFFT equivalent
+CpuFFT* TemporalGlareRenderer::hostTransform(clfftPlanHandle plan)
+{
+    clfftDim dim;
+    cl_uint dimSize;
+    if (clfftGetPlanDim(plan, &dim, &dimSize) != CLFFT_SUCCESS || dim != CLFFT_2D)
+        return nullptr;
+
+    size_t lengths[2], inStrides[2], outStrides[2];
+    size_t batch, inDistance, outDistance;
+    clfftLayout inLayout, outLayout;
+    cl_float forwardScale, backwardScale;
+    clfftGetPlanLength(plan, CLFFT_2D, lengths);
+    clfftGetPlanInStride(plan, CLFFT_2D, inStrides);
+    clfftGetPlanOutStride(plan, CLFFT_2D, outStrides);
+    clfftGetPlanBatchSize(plan, &batch);
+    clfftGetPlanDistance(plan, &inDistance, &outDistance);
+    clfftGetLayout(plan, &inLayout, &outLayout);
+    clfftGetPlanScale(plan, CLFFT_FORWARD, &forwardScale);
+    clfftGetPlanScale(plan, CLFFT_BACKWARD, &backwardScale);
+
+    int width = (int)lengths[0];
+    int height = (int)lengths[1];
+    size_t hermitianWidth = width/2 + 1;
+
+    // distances in floats, complex values count twice
+    CpuFFTLayout layout;
+    size_t inRow, outRow, spatialDistance, spectralDistance;
+    if (inLayout == CLFFT_COMPLEX_INTERLEAVED && outLayout == CLFFT_COMPLEX_INTERLEAVED && inDistance == outDistance)
+    {
+        layout = CPU_FFT_COMPLEX;
+        inRow = outRow = width;
+        spatialDistance = spectralDistance = 2 * inDistance;
+    }
+    else if (inLayout == CLFFT_REAL && outLayout == CLFFT_HERMITIAN_INTERLEAVED)
+    {
+        layout = CPU_FFT_REAL;
+        inRow = width;
+        outRow = hermitianWidth;
+        spatialDistance = inDistance;
+        spectralDistance = 2 * outDistance;
+    }
+    else if (inLayout == CLFFT_HERMITIAN_INTERLEAVED && outLayout == CLFFT_REAL)
+    {
+        layout = CPU_FFT_REAL;
+        inRow = hermitianWidth;
+        outRow = width;
+        spatialDistance = outDistance;
+        spectralDistance = 2 * inDistance;
+    }
+    else
+        return nullptr;
+
+    if (inStrides[0] != 1 || outStrides[0] != 1 || inStrides[1] != inRow || outStrides[1] != outRow)
+        return nullptr;
+    if (forwardScale != 1.0f || std::fabs(backwardScale * width * height - 1.0f) > 1e-5f)
+        return nullptr;
+    if (!CpuFFT::supportsLength(width) || !CpuFFT::supportsLength(height))
+        return nullptr;
+
+    // plans are keyed by what they do, handles get reused after clfftDestroyPlan
+    std::unique_ptr<CpuFFT>& transform = m_hostTransforms[std::make_tuple(width, height, (int)layout, batch,
+                                                                          spatialDistance, spectralDistance)];
+    if (!transform)
+    {
+        transform.reset(new CpuFFT(width, height, layout, (int)batch));
+        transform->setDistances(spatialDistance, spectralDistance);
+    }
+    return transform.get();
+}
+
+// clfftEnqueueTransform on the renderer's queue. On CPU devices the
+// transform runs on the host through CpuFFT instead, on the mapped
+// buffers so nothing is copied. It returns once the output is written
+void TemporalGlareRenderer::enqueueTransform(clfftPlanHandle plan, clfftDirection dir, cl::Buffer& in, cl::Buffer& out,
+                                             cl_uint nWaitEvents, const cl_event* waitEvents)
+{
+    CpuFFT* transform = m_hostFFT ? hostTransform(plan) : nullptr;
+    if (transform == nullptr)
+    {
+        cl::Event* event = profileEvent();
+        clfftEnqueueTransform(plan, dir, 1, &queue(), nWaitEvents, waitEvents, event ? &(*event)() : NULL,
+                              &in(), &out(), NULL);
+        return;
+    }
+
+    // cl::Event takes over a reference
+    std::vector<cl::Event> waitFor;
+    for (cl_uint i = 0; i < nWaitEvents; ++i)
+    {
+        clRetainEvent(waitEvents[i]);
+        waitFor.push_back(cl::Event(waitEvents[i]));
+    }
+
+    // in place, one mapping for both sides
+    if (in() == out())
+    {
+        float* data = (float*)queue.enqueueMapBuffer(in, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, in.getInfo<CL_MEM_SIZE>(),
+                                                     waitFor.empty() ? NULL : &waitFor);
+        if (dir == CLFFT_FORWARD)
+            transform->forward(data, data);
+        else
+            transform->backward(data, data);
+        queue.enqueueUnmapMemObject(in, data);
+        return;
+    }
+
+    // the blocking maps wait for the commands producing the input
+    size_t inBytes = in.getInfo<CL_MEM_SIZE>();
+    size_t outBytes = out.getInfo<CL_MEM_SIZE>();
+    float* src = (float*)queue.enqueueMapBuffer(in, CL_TRUE, CL_MAP_READ, 0, inBytes, waitFor.empty() ? NULL : &waitFor);
+    float* dst = (float*)queue.enqueueMapBuffer(out, CL_TRUE, CL_MAP_WRITE, 0, outBytes);
+
+    if (dir == CLFFT_FORWARD)
+        transform->forward(src, dst);
+    else
+        transform->backward(src, dst);
+
+    queue.enqueueUnmapMemObject(in, src);
+    queue.enqueueUnmapMemObject(out, dst);
+}
 
 // Read exr file data
-void TemporalGlareRenderer::readExrFile(const QString& fileName)
+void TemporalGlareRenderer::readExrFile(const std::string& fileName)
+{
+    closeExrSequence();
+
+    if (image != nullptr)
+        std::cout << "Flushed previous image \n";
+
+    setImage(new Image(fileName, PIXEL_LAYOUT_PLANAR,
+                       m_halfPrecisionImages ? PIXEL_PRECISION_HALF : PIXEL_PRECISION_FLOAT), true);
+
+    std::cout << "Image Loaded\n";
+    std::cout << "width: "<<image->getWidth()<<", height: "<<image->getHeight()<<"\n";
+    std::cout << "Glare textures loaded\n";
+    std::cout << "width: "<<m_psfWidth<<", height: "<<m_psfHeight<<"\n";
+}
+
+// Takes ownership of newImage. Textures and buffers are only rebuilt when
+// asked to or when the size changes, otherwise the pixels are re-uploaded
+void TemporalGlareRenderer::setImage(Image* newImage, bool reinitialise)
+{
+    TRACE_SCOPE("set image", "render");
+    // the kept scales of another image size are of no use any more
+    if (newImage->getWidth() != getSourceWidth() || newImage->getHeight() != getSourceHeight())
+        releaseScaleLevels();
+
+    // below scale 1 the pipeline works on a copy and the image is kept
+    // to scale again when the quality changes
+    Image* scaled = m_renderScale < 1.0f ? scaledImage(*newImage) : nullptr;
+    if (scaled)
+    {
+        m_sourceImage.reset(newImage);
+        newImage = scaled;
+    }
+    else
+        m_sourceImage.reset();
+
+    bool resized = image == nullptr || newImage->getWidth() != m_imgWidth || newImage->getHeight() != m_imgHeight;
+
+    delete image;
+    image = newImage;
+
+    m_imgWidth = image->getWidth();
+    m_imgHeight = image->getHeight();
+
+    m_imageChanged = true;
+
+    m_autoExposureValue = image->getAutoKeyValue() / image->getLogAverageLuminance();
+
+    // the OpenCL backend measures the pupil's field on the device, unless
+    // the image is tiled
+    // host memory is all the CPU backend needs, it never tiles
+    int tiledPsfSize = m_tiledPsfSize;
+    MemoryMode memoryMode = m_cpuRenderer ? MEMORY_MODE_FULL : planMemory(m_imgWidth, m_imgHeight);
+    bool tiled = memoryMode == MEMORY_MODE_TILED;
+    if ((m_cpuRenderer || tiled) && image->hasHostData())
+        m_imageFieldLuminance = measureFieldLuminance();
+
+    bool modeChanged = tiled != m_tiled || (tiled && tiledPsfSize != m_tiledPsfSize);
+    m_tiled = tiled;
+    m_memoryMode = memoryMode;
+
+    // tiles are read from the host image every frame, nothing to upload
+    if (reinitialise || resized || modeChanged)
+        initTextures();
+    else if (!m_tiled)
+        uploadImage();
+}
+
+// Area average of source at the render scale, the sizes are snapped down
+// to even lengths the transforms support. nullptr when the scale leaves
+// the image as it is or its pixels cannot be read
+Image* TemporalGlareRenderer::scaledImage(Image& source)
+{
+    auto snap = [](int length) {
+        length = std::max(length - length % 2, 2);
+        while (length > 2 && !CpuFFT::supportsLength(length))
+            length -= 2;
+        return length;
+    };
+
+    const int srcWidth = source.getWidth();
+    const int srcHeight = source.getHeight();
+    const int width = snap((int)(srcWidth * m_renderScale));
+    const int height = snap((int)(srcHeight * m_renderScale));
+    if (width >= srcWidth && height >= srcHeight)
+        return nullptr;
+
+    if (!source.hasHostData() && !source.reloadHostData())
+        return nullptr;
+
+    // source pixels each destination pixel covers along one axis, with
+    // the covered fraction of the first and the last
+    struct Span
+    {
+        int first, last;
+        float firstWeight, lastWeight, norm;
+    };
+    auto spans = [](int srcLength, int length) {
+        std::vector<Span> result(length);
+        float ratio = (float)srcLength / length;
+        for (int i = 0; i < length; ++i)
+        {
+            float begin = i * ratio;
+            float end = std::min((i + 1) * ratio, (float)srcLength);
+            Span& span = result[i];
+            span.first = (int)begin;
+            span.last = std::min((int)std::ceil(end) - 1, srcLength - 1);
+            span.firstWeight = std::min(span.first + 1.0f, end) - begin;
+            span.lastWeight = span.last > span.first ? end - span.last : span.firstWeight;
+            span.norm = 1.0f / (end - begin);
+        }
+        return result;
+    };
+    const std::vector<Span> columns = spans(srcWidth, width);
+    const std::vector<Span> rows = spans(srcHeight, height);
+
+    const size_t planeSize = (size_t)width * height;
+    std::vector<float> planes(3 * planeSize);
+    std::vector<float> channel((size_t)srcWidth * srcHeight);
+    std::vector<float> narrowed((size_t)width * srcHeight);
+
+    auto weight = [](const Span& span, int i) {
+        return i == span.first ? span.firstWeight : (i == span.last ? span.lastWeight : 1.0f);
+    };
+
+    for (int c = 0; c < 3; ++c)
+    {
+        source.copyChannel(c, channel.data());
+
+        // columns, then rows of the narrowed plane
+        ThreadPool::global().parallelFor(0, srcHeight, 16, [&](size_t y0, size_t y1) {
+            for (size_t y = y0; y < y1; ++y)
+            {
+                const float* in = channel.data() + y * srcWidth;
+                float* out = narrowed.data() + y * width;
+                for (int x = 0; x < width; ++x)
+                {
+                    const Span& span = columns[x];
+                    float sum = 0.0f;
+                    for (int i = span.first; i <= span.last; ++i)
+                        sum += weight(span, i) * in[i];
+                    out[x] = sum * span.norm;
+                }
+            }
+        });
+        ThreadPool::global().parallelFor(0, height, 16, [&](size_t y0, size_t y1) {
+            for (size_t y = y0; y < y1; ++y)
+            {
+                const Span& span = rows[y];
+                float* out = planes.data() + c * planeSize + y * width;
+                std::fill(out, out + width, 0.0f);
+                for (int i = span.first; i <= span.last; ++i)
+                {
+                    const float* in = narrowed.data() + (size_t)i * width;
+                    float w = weight(span, i) * span.norm;
+                    for (int x = 0; x < width; ++x)
+                        out[x] += w * in[x];
+                }
+            }
+        });
+    }
+
+    // scaled again on the next change of the render scale
+    if (!m_keepHostImage && !m_dynamicResolution)
+        source.releaseHostData();
+
+    std::cout << "Render scale " << m_renderScale << ": " << width << "x" << height << "\n";
+    return new Image(planes.data(), planes.data() + planeSize, planes.data() + 2 * planeSize, width, height,
+                     PIXEL_LAYOUT_PLANAR, m_halfPrecisionImages ? PIXEL_PRECISION_HALF : PIXEL_PRECISION_FLOAT);
+}
+
+void TemporalGlareRenderer::setRenderQuality(const RenderQuality& quality)
+{
+    m_spectralSamples = std::max(1, std::min(quality.spectralSamples, CPU_RENDER_SPECTRAL_SAMPLES));
+
+    float scale = std::max(0.0625f, std::min(quality.scale, 1.0f));
+    if (scale == m_renderScale)
+        return;
+    m_renderScale = scale;
+
+    if (image == nullptr)
+        return;
+
+    // scale the image as it was set again, setImage deletes the old copy
+    Image* source = m_sourceImage ? m_sourceImage.release() : image;
+    if (source == image)
+        image = nullptr;
+    setImage(source, false);
+}
+
+void TemporalGlareRenderer::setDynamicResolution(bool enabled)
+{
+    m_dynamicResolution = enabled;
+    if (!enabled)
+        releaseScaleLevels();
+}
+
+bool TemporalGlareRenderer::getDynamicResolution() const
+{
+    return m_dynamicResolution;
+}
+
+RenderQuality TemporalGlareRenderer::getRenderQuality() const
+{
+    RenderQuality quality;
+    quality.scale = m_renderScale;
+    quality.spectralSamples = m_spectralSamples;
+    return quality;
+}
+
+const FrameTimings& TemporalGlareRenderer::getFrameTimings() const
+{
+    return m_timings;
+}
+
+bool TemporalGlareRenderer::getLastFrameParams(CpuFrameParams& params) const
+{
+    if (!m_hasCpuFrameParams)
+        return false;
+    params = m_cpuFrameParams;
+    return true;
+}
+
+void TemporalGlareRenderer::setImage(const float* red, const float* green, const float* blue, int width, int height)
+{
+    closeExrSequence();
+
+    setImage(new Image(red, green, blue, width, height, PIXEL_LAYOUT_PLANAR,
+                       m_halfPrecisionImages ? PIXEL_PRECISION_HALF : PIXEL_PRECISION_FLOAT), false);
+}
+
+void TemporalGlareRenderer::setParameters(const GlareParameters& params)
+{
+    focus = params.focus;
+    apertureSize = params.apertureSize;
+    m_fieldLuminance = params.fieldLuminance;
+    m_autoFieldLuminance = params.autoFieldLuminance;
+    m_luminanceScale = params.luminanceScale;
+
+    m_toneMapOperator = params.toneMapOperator;
+    m_gamma = params.gamma;
+    m_Lwhite = params.Lwhite;
+    m_exposure = params.exposure;
+    m_autoExposure = params.autoExposure;
+    m_phi = params.phi;
+    m_epsilon = params.epsilon;
+    m_displayMinLuminance = params.displayMinLuminance;
+    m_displayMaxLuminance = params.displayMaxLuminance;
+}
+
+GlareParameters TemporalGlareRenderer::getParameters() const
+{
+    GlareParameters params;
+    params.focus = focus;
+    params.apertureSize = apertureSize;
+    params.fieldLuminance = m_fieldLuminance;
+    params.autoFieldLuminance = m_autoFieldLuminance;
+    params.luminanceScale = m_luminanceScale;
+
+    params.toneMapOperator = m_toneMapOperator;
+    params.gamma = m_gamma;
+    params.Lwhite = m_Lwhite;
+    params.exposure = m_exposure;
+    params.autoExposure = m_autoExposure;
+    params.phi = m_phi;
+    params.epsilon = m_epsilon;
+    params.displayMinLuminance = m_displayMinLuminance;
+    params.displayMaxLuminance = m_displayMaxLuminance;
+    return params;
+}
+
+cl_mem TemporalGlareRenderer::getDeviceFrame() const
+{
+    if (m_cpuRenderer || m_tiled || m_frameInDisplay)
+        return NULL;
+    return m_frameImage();
+}
+
+cl_context TemporalGlareRenderer::getContext() const
+{
+    return context();
+}
+
+cl_command_queue TemporalGlareRenderer::getQueue() const
+{
+    return queue();
+}
+
+cl_program TemporalGlareRenderer::getProgram() const
 {
-    if (image != nullptr)
+    return program();
+}
+
+cl_device_id TemporalGlareRenderer::getDevice() const
+{
+    return device();
+}
+
+const std::string& TemporalGlareRenderer::getDeviceName() const
+{
+    return m_deviceName;
+}
+
+cl::NDRange TemporalGlareRenderer::tunedRange(const char* kernel, size_t width, size_t height, bool rounded) const
+{
+    WorkGroupSize local;
+    if (!m_tuning.find(m_deviceName, kernel, KernelTuning::sizeClass(width, height), local) ||
+        local.x == 0 || (!rounded && (width % local.x != 0 || height % local.y != 0)))
+        return cl::NullRange;
+    return cl::NDRange(local.x, local.y, 1);
+}
+
+cl::NDRange TemporalGlareRenderer::roundedRange(const char* kernel, size_t width, size_t height) const
+{
+    cl::NDRange local = tunedRange(kernel, width, height, true);
+    if (local.dimensions() == 0)
+        return cl::NDRange(width, height, 1);
+    return cl::NDRange((width + local[0] - 1) / local[0] * local[0], (height + local[1] - 1) / local[1] * local[1], 1);
+}
+
+bool TemporalGlareRenderer::openExrSequence(const std::string& pattern, float fps, int decoders)
+{
+    return startSequence(new ExrSequence(pattern, EXR_SEQUENCE_PREFETCH, decoders,
+                                         m_halfPrecisionImages ? PIXEL_PRECISION_HALF : PIXEL_PRECISION_FLOAT), fps);
+}
+
+bool TemporalGlareRenderer::openExrSequence(const std::vector<std::string>& fileNames, float fps, int decoders)
+{
+    return startSequence(new ExrSequence(fileNames, EXR_SEQUENCE_PREFETCH, decoders,
+                                         m_halfPrecisionImages ? PIXEL_PRECISION_HALF : PIXEL_PRECISION_FLOAT), fps);
+}
+
+bool TemporalGlareRenderer::startSequence(ExrSequence* sequence, float fps)
+{
+    closeExrSequence();
+
+    m_sequence.reset(sequence);
+    if (m_sequence->empty())
     {
-        std::cout << "Flushed previous image \n";
-        delete image;
-        delete[] m_ImgRedFFT;
-        delete[] m_ImgBlueFFT;
-        delete[] m_ImgGreenFFT;
+        m_sequence.reset();
+        return false;
     }
 
-    image = new Image(fileName.toUtf8().constData());
+    m_sequenceFps = fps;
+    m_sequenceFramesShown = 0;
+    m_sequenceStalls = 0;
 
-    m_imgWidth = image->getWidth();
-    m_imgHeight = image->getHeight();
+    // the first frame is waited for so the view has a size straight away
+    std::unique_ptr<Image> frame = m_sequence->nextFrame();
+    if (!frame || frame->getWidth() == 0)
+    {
+        m_sequence.reset();
+        return false;
+    }
 
-    m_imageChanged = true;
+    setImage(frame.release(), true);
+    m_sequenceFrameTime = std::chrono::steady_clock::now();
 
-    m_autoExposureValue = image->getAutoKeyValue() / image->getLogAverageLuminance();
+    std::cout << "Sequence opened: " << m_sequence->size() << " frames at " << m_sequenceFps << " fps, "
+              << m_sequence->getDecoderCount() << " decoders\n";
+    return true;
+}
 
-    std::cout << "Image Loaded\n";
-    std::cout << "width: "<<image->getWidth()<<", height: "<<image->getHeight()<<"\n";
+void TemporalGlareRenderer::closeExrSequence()
+{
+    m_sequence.reset();
+}
 
-    initTextures();
-    std::cout << "Glare textures loaded\n";
-    std::cout << "width: "<<m_slidWidth<<", height: "<<m_slidHeight<<"\n";
+bool TemporalGlareRenderer::hasSequence() const
+{
+    return m_sequence != nullptr;
+}
+
+float TemporalGlareRenderer::getSequenceFps() const
+{
+    return m_sequenceFps;
+}
+
+bool TemporalGlareRenderer::stepSequence()
+{
+    if (!m_sequence)
+        return false;
+
+    std::unique_ptr<Image> frame = m_sequence->nextFrame();
+    if (!frame || frame->getWidth() == 0)
+        return false;
+
+    setImage(frame.release(), false);
+    ++m_sequenceFramesShown;
+    return true;
+}
+
+// Swaps in the next frame once its display time has come. Frames are
+// decoded ahead on the sequence threads, when they fall behind the
+// current frame is shown again instead of waiting
+void TemporalGlareRenderer::advanceSequence()
+{
+    if (!m_sequence || m_sequenceFps <= 0.0f)
+        return;
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> frameTime(1.0 / m_sequenceFps);
+    if (now - m_sequenceFrameTime < frameTime)
+        return;
+
+    std::unique_ptr<Image> frame = m_sequence->tryNextFrame();
+    if (!frame)
+    {
+        ++m_sequenceStalls;
+        return;
+    }
+
+    // keep the cadence, unless we are so far behind that catching up
+    // would mean skipping through frames
+    m_sequenceFrameTime += std::chrono::duration_cast<std::chrono::steady_clock::duration>(frameTime);
+    if (now - m_sequenceFrameTime > frameTime)
+        m_sequenceFrameTime = now;
+
+    if (frame->getWidth() == 0)
+        return;
+
+    setImage(frame.release(), false);
+    ++m_sequenceFramesShown;
+
+    if (m_sequenceFramesShown % SEQUENCE_REPORT_FRAMES == 0)
+    {
+        std::cout << "Sequence: decoding " << m_sequence->getDecodeFps() << " fps, "
+                  << m_sequence->getAverageDecodeMs() << " ms per frame and decoder, "
+                  << m_sequenceStalls << " stalls\n";
+    }
 }
 
 void TemporalGlareRenderer::updateViewSize(int newWidth, int newHeight)
@@ -670,8 +2416,8 @@ void TemporalGlareRenderer::initOpenCL()
 		std::vector<cl::Platform> all_platforms;
 		cl::Platform::get(&all_platforms);
 		if (all_platforms.size() == 0) {
-			std::cout << " No platforms found. Check OpenCL installation!\n";
-			exit(1);
+			m_error = "no OpenCL platforms found, check the OpenCL installation";
+			return;
 		}
 		platform = all_platforms[0];
 		std::cout << "Using platform: " << platform.getInfo<CL_PLATFORM_NAME>() << "\n";
@@ -680,21 +2426,69 @@ void TemporalGlareRenderer::initOpenCL()
 		std::vector<cl::Device> all_devices;
 		platform.getDevices(CL_DEVICE_TYPE_ALL, &all_devices);
 		if (all_devices.size() == 0) {
-			std::cout << " No devices found. Check OpenCL installation!\n";
-			exit(1);
+			m_error = "no OpenCL devices found, check the OpenCL installation";
+			return;
 		}
 		device = all_devices[0];
 		std::cout << "Using device: " << device.getInfo<CL_DEVICE_NAME>() << "\n";
+		m_deviceMemory.setBudget(getMemoryBudget());
+
+		// some drivers pad the name, the tuning file is keyed on it
+		m_deviceName = device.getInfo<CL_DEVICE_NAME>().c_str();
+		m_deviceName.erase(m_deviceName.find_last_not_of(" \t") + 1);
+		if (m_tuning.load(KernelTuning::defaultPath()))
+			std::cout << "Kernel tuning: " << m_tuning.count(m_deviceName) << " work-group sizes for this device\n";
+
+		// clFFT's kernels are slow on CPU devices, the buffers are host
+		// memory there anyway so the transforms run on the host
+		m_hostFFT = device.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU;
+		if (m_hostFFT)
+			std::cout << "Using host FFT: " << CpuFFT::getInstructionSet() << "\n";
 
 		context = cl::Context({ device });
 
+        if (!buildProgram())
+            return;
+
+        clfftInitSetupData(&fftSetup);
+        clfftSetup(&fftSetup);
+
+	}
+	catch(cl::Error err) {
+		m_error = std::string("setting up OpenCL: ") + err.what() + " (" + getOCLErrorString(err.err()) + ")";
+	}
+}
+
+// Builds the kernels and the queue for the current context, false with
+// m_error set when they can't be
+bool TemporalGlareRenderer::buildProgram()
+{
+	try {
 		cl::Program::Sources sources;
 
+        // Random number generator, used by the kernels that follow
+        std::ifstream rngFile("philox.cl");
+		if (rngFile.fail()) {
+			m_error = "can't read the random number generator file";
+			return false;
+		}
+		std::string rngSrc(std::istreambuf_iterator<char>(rngFile), (std::istreambuf_iterator<char>()));
+		sources.push_back(std::make_pair(rngSrc.c_str(), rngSrc.length()));
+
+        // Pupil dynamics, its state is read by the render kernels
+        std::ifstream pupilFile("pupil.cl");
+		if (pupilFile.fail()) {
+			m_error = "can't read the pupil kernel file";
+			return false;
+		}
+		std::string pupilSrc(std::istreambuf_iterator<char>(pupilFile), (std::istreambuf_iterator<char>()));
+		sources.push_back(std::make_pair(pupilSrc.c_str(), pupilSrc.length()));
+
         // Render Kernel ?
 		std::ifstream kernelFile("render.cl");
 		if (kernelFile.fail()) {
-			std::cout << "ERROR: can't read the render kernel file\n";
-			exit(1);
+			m_error = "can't read the render kernel file";
+			return false;
 		}
 		std::string src(std::istreambuf_iterator<char>(kernelFile), (std::istreambuf_iterator<char>()));
 		sources.push_back(std::make_pair(src.c_str(), src.length()));
@@ -702,8 +2496,8 @@ void TemporalGlareRenderer::initOpenCL()
         // Tone Map kernel
         std::ifstream kernelFile2("reinhard_extended.cl");
 		if (kernelFile2.fail()) {
-			std::cout << "ERROR: can't read the tonemap kernel file\n";
-			exit(1);
+			m_error = "can't read the tonemap kernel file";
+			return false;
 		}
 		std::string src2(std::istreambuf_iterator<char>(kernelFile2), (std::istreambuf_iterator<char>()));
 		sources.push_back(std::make_pair(src2.c_str(), src2.length()));
@@ -711,165 +2505,707 @@ void TemporalGlareRenderer::initOpenCL()
         // Fresnel rendering kernel
         std::ifstream kernelFile3("fresnel.cl");
 		if (kernelFile3.fail()) {
-			std::cout << "ERROR: can't read the fresnel kernel file\n";
-			exit(1);
+			m_error = "can't read the fresnel kernel file";
+			return false;
 		}
 		std::string src3(std::istreambuf_iterator<char>(kernelFile3), (std::istreambuf_iterator<char>()));
 		sources.push_back(std::make_pair(src3.c_str(), src3.length()));
 
+        // Local tone map kernel
+        std::ifstream kernelFile4("reinhard_local.cl");
+		if (kernelFile4.fail()) {
+			m_error = "can't read the local tonemap kernel file";
+			return false;
+		}
+		std::string src4(std::istreambuf_iterator<char>(kernelFile4), (std::istreambuf_iterator<char>()));
+		sources.push_back(std::make_pair(src4.c_str(), src4.length()));
+
+        // Histogram adjustment kernel
+        std::ifstream kernelFile5("histogram_adjustment.cl");
+		if (kernelFile5.fail()) {
+			m_error = "can't read the histogram adjustment kernel file";
+			return false;
+		}
+		std::string src5(std::istreambuf_iterator<char>(kernelFile5), (std::istreambuf_iterator<char>()));
+		sources.push_back(std::make_pair(src5.c_str(), src5.length()));
+
 
         program = cl::Program(context, sources);
 	    try {
             program.build({ device });
         } catch(cl::Error err) {
-			std::cout << " Error building: " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << "\n";
-			exit(1);
+			m_error = "building the kernels: " + program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
+			return false;
 		}
 
-        queue = cl::CommandQueue(context, device);
+        // every frame is profiled, see resolveProfileEvents
+        queue = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
 
         std::cout << "Existing context: " << context() << std::endl;
 		
 		// kernel = cl::Kernel(program, "lfrender");
         toneMapperKernel = cl::Kernel(program, "tm_reinhard_extended");
         gratingsKernel   = cl::Kernel(program, "glr_render_gratings");
-        lensDotsKernel   = cl::Kernel(program, "glr_render_lens_points");
+        gratingsBakeKernel = cl::Kernel(program, "glr_bake_gratings");
+        lensCountKernel  = cl::Kernel(program, "glr_count_lens_points");
+        lensScanKernel   = cl::Kernel(program, "glr_scan_lens_tiles");
+        lensBinKernel    = cl::Kernel(program, "glr_bin_lens_points");
+        lensRasteriseKernel = cl::Kernel(program, "glr_rasterise_lens_points");
+        lensGenerateKernel = cl::Kernel(program, "glr_generate_lens_points");
+        lensStepKernel   = cl::Kernel(program, "glr_step_lens_points");
         pupilKernel      = cl::Kernel(program, "glr_render_pupil");
+        pupilUpdateKernel = cl::Kernel(program, "glr_update_pupil");
         compExpKernel    = cl::Kernel(program, "generate_complex_exp");
         compExpMultKernel= cl::Kernel(program, "multiply_with_complex_exp");
         spectralBlurKernel=cl::Kernel(program, "spectral_blur");
         convOfFFTsKernel = cl::Kernel(program, "conv_of_ffts");
         computeMagnitudeKernel = cl::Kernel(program, "compute_magnitude_kernel");
-
-        
-        clfftInitSetupData(&fftSetup);
-        clfftSetup(&fftSetup);
+        localScaleSpectraKernel = cl::Kernel(program, "tm_local_scale_spectra");
+        localToneMapperKernel = cl::Kernel(program, "tm_reinhard_local");
+        histogramClearKernel = cl::Kernel(program, "tm_histogram_clear");
+        histogramRangeKernel = cl::Kernel(program, "tm_log_luminance_range");
+        histogramKernel  = cl::Kernel(program, "tm_log_histogram");
+        histogramCdfKernel = cl::Kernel(program, "tm_histogram_cdf");
+        histogramToneMapperKernel = cl::Kernel(program, "tm_histogram_adjustment");
+        tilePSFKernel    = cl::Kernel(program, "embed_tile_psf");
 
 	}
 	catch(cl::Error err) {
-		// std::cerr << "ERROR: " << err.what() << "(" << getOCLErrorString(err.err()) << ")" << std::endl;
-		exit(1);
+		m_error = std::string("creating the kernels: ") + err.what() + " (" + getOCLErrorString(err.err()) + ")";
+		return false;
 	}
-    
+	return true;
+}
 
+// Allocates the staging ring for the current image size and maps every
+// buffer once, the mapped pointers are reused for the whole session
+void TemporalGlareRenderer::initStagingBuffers()
+{
+    releaseStagingBuffers();
+
+    size_t frameSize = sizeof(cl_uint) * m_imgWidth * m_imgHeight;
+    for (int i = 0; i < FRAME_STAGING_BUFFERS; ++i)
+    {
+        m_stagingBuffers[i] = m_deviceMemory.buffer(MEMORY_STAGING, context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, frameSize);
+        m_stagingPtrs[i] = (unsigned char*)queue.enqueueMapBuffer(m_stagingBuffers[i], CL_TRUE, 
+                                                                  CL_MAP_READ | CL_MAP_WRITE, 0, frameSize);
+    }
+    m_stagingIndex = 0;
 }
 
-void TemporalGlareRenderer::initTextures()
+void TemporalGlareRenderer::releaseStagingBuffers()
+{
+    for (int i = 0; i < FRAME_STAGING_BUFFERS; ++i)
+    {
+        if (m_stagingPtrs[i] != nullptr)
+            queue.enqueueUnmapMemObject(m_stagingBuffers[i], m_stagingPtrs[i]);
+        m_stagingPtrs[i] = nullptr;
+        m_stagingBuffers[i] = cl::Buffer();
+    }
+    queue.finish();
+}
+
+// Recreates the context so that it shares objects with the GL context
+// glProperties describe, see the header. On failure the renderer keeps
+// its own context and frames are read back instead
+bool TemporalGlareRenderer::initGLSharing(const cl_context_properties* glProperties)
 {
-    int n; 
-    m_slidTexture = stbi_load("../textures/grating3.bmp",
-                                &m_slidWidth,
-                                &m_slidHeight, 
-                                &n, 
-                                STBI_rgb_alpha);
+    if (m_cpuRenderer)
+    {
+        std::cout << "CPU backend, frames are uploaded through PBOs\n";
+        return false;
+    }
+
+    std::string extensions = device.getInfo<CL_DEVICE_EXTENSIONS>();
+    if (extensions.find("cl_khr_gl_sharing") == std::string::npos)
+    {
+        std::cout << "cl_khr_gl_sharing not supported, frames are uploaded through PBOs\n";
+        return false;
+    }
 
-    unsigned char* temp;
+    if (glProperties == NULL || glProperties[0] == 0)
+    {
+        std::cout << "GL sharing is not set up on this platform, frames are uploaded through PBOs\n";
+        return false;
+    }
 
-    // resize
-    if(m_imgHeight != m_slidHeight || m_imgWidth != m_slidWidth)
+    // the GL pairs, then the platform
+    std::vector<cl_context_properties> properties;
+    for (const cl_context_properties* p = glProperties; *p != 0; p += 2)
     {
-        std::cout << "resized \n";
-        stbir_resize_uint8(m_slidTexture, m_slidWidth, m_slidHeight, 0,
-                          temp, m_imgWidth, m_imgHeight, 0, 
-                          STBI_rgb_alpha);
-                          
-        m_slidHeight = m_imgHeight;
-        m_slidWidth  = m_imgWidth;
+        properties.push_back(p[0]);
+        properties.push_back(p[1]);
+    }
+    properties.push_back(CL_CONTEXT_PLATFORM);
+    properties.push_back((cl_context_properties)platform());
+    properties.push_back(0);
 
-        delete [] m_slidTexture;
-        m_slidTexture = temp;
+    try {
+        cl::Context sharedContext({ device }, properties.data());
+
+        // the staging buffers are mapped through the old queue
+        releaseStagingBuffers();
+        releaseTiles();
+        releaseFramePlans();
+        releaseScaleLevels();
+        // initTextures creates it again in the new context
+        m_pupilState = cl::Buffer();
+        context = sharedContext;
+    } catch(cl::Error err) {
+        std::cerr << "ERROR: " << err.what() << "(" << getOCLErrorString(err.err()) << ")" << std::endl;
+        std::cout << "Could not share the GL context, frames are uploaded through PBOs\n";
+        return false;
     }
 
-    m_pointCoordinates = new float[m_nPoints * 4];
-    float* p = m_pointCoordinates;
-    for(int i = 0; i < m_nPoints; ++i)
+    if (!buildProgram())
     {
-        // rand x coordinate  (-1 , 1)
-        int sign1 = ( rand()%2 ? 1 : -1);
-        int sign2 = ( rand()%2 ? 1 : -1);
+        std::cout << "ERROR: " << m_error << std::endl;
+        return false;
+    }
+    m_glSharing = true;
 
-        p[0] = rand() % 1000 / 1000.0f;
-        p[2] = rand() % 1000 / 1000.0f;
-        
-        float radius = std::sqrt(p[0] * p[0] + p[1] * p[1]);
-        float dr = deformationCoeff(2*radius/m_imgHeight);
+    // everything created so far belongs to the old context
+    if (image != nullptr)
+        initTextures();
 
-        p[1] = p[0] * dr / radius;
-        p[3] = p[2] * dr / radius;    
+    std::cout << "Sharing context with GL: " << context() << std::endl;
+    return true;
+}
 
-        p[0] *= sign1;
-        p[1] *= sign1;
-        p[2] *= sign2;
-        p[3] *= sign2;
+// Registers the GL texture the tone mapper writes into, with the size
+// of its storage. Only used when GL sharing is enabled
+void TemporalGlareRenderer::setDisplayTexture(unsigned int texture, int width, int height)
+{
+    if (!m_glSharing)
+        return;
 
-        p+=4;
+    try {
+        m_displayImage = cl::ImageGL(context, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, texture);
+        m_displayWidth = width;
+        m_displayHeight = height;
+    } catch(cl::Error err) {
+        std::cerr << "ERROR: " << err.what() << "(" << getOCLErrorString(err.err()) << ")" << std::endl;
+        m_displayImage = cl::ImageGL();
     }
+}
+
+bool TemporalGlareRenderer::hasGLSharing() const
+{
+    return m_glSharing;
+}
+
+bool TemporalGlareRenderer::isFrameInDisplay() const
+{
+    return m_frameInDisplay;
+}
 
-    m_ImgRedFFT = new float[m_imgWidth * m_imgHeight*2];
-    m_ImgGreenFFT = new float[m_imgWidth * m_imgHeight*2];
-    m_ImgBlueFFT = new float[m_imgWidth * m_imgHeight*2];
+void TemporalGlareRenderer::initTextures()
+{
+    // what the last size had waits for the render scale to come back
+    if (m_dynamicResolution && !m_tiled)
+        stashScaleLevel();
 
-    // compute the FFTs 
+    // the tiled path keeps its PSF at a fixed size, whatever the image is
+    m_psfWidth = m_tiled ? m_tiledPsfSize : m_imgWidth;
+    m_psfHeight = m_tiled ? m_tiledPsfSize : m_imgHeight;
 
-    cl::Buffer redChannel(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight);
-    cl::Buffer greenChannel(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight);
-    cl::Buffer blueChannel(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight);
+    // the gratings are baked at the new PSF size with the next frame
+    m_gratingsBaked = false;
+    resizeLensPoints(m_nPoints, 0);
 
-    cl::Buffer redChannelFFT(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight*2);
-    cl::Buffer greenChannelFFT(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight*2);
-    cl::Buffer blueChannelFFT(context, CL_MEM_READ_WRITE, sizeof(float) * m_imgWidth * m_imgHeight*2);
+    // the rasteriser's bins are made again with the next frame
+    m_binTilesX = 0;
+    m_binTilesY = 0;
+    m_binCapacity = 0;
 
-    queue.enqueueWriteBuffer(redChannel, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight, image->get_rChannel());
-    queue.enqueueWriteBuffer(greenChannel, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight, image->get_gChannel());
-    queue.enqueueWriteBuffer(blueChannel, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight, image->get_bChannel());
-    queue.finish();
+    if (m_cpuRenderer)
+    {
+        uploadImage();
+        std::cout<<"Textures updated!\n";
+        return;
+    }
 
-    clfftDestroyPlan( &planHandle );
+    // the pupil state outlives images, a sequence adapts across its frames
+    if (m_pupilState() == NULL)
+    {
+        PupilState reset = PupilState();
+        m_pupilState = m_deviceMemory.buffer(MEMORY_APERTURE, context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(PupilState), &reset);
+    }
 
-    size_t clLengths[2] = {m_imgWidth, m_imgHeight};
-    clfftCreateDefaultPlan(&planHandle, context(), CLFFT_2D, clLengths);
-    clfftSetPlanPrecision(planHandle, CLFFT_SINGLE);
-    clfftSetLayout(planHandle, CLFFT_REAL, CLFFT_COMPLEX_INTERLEAVED);
-    clfftSetResultLocation(planHandle, CLFFT_OUTOFPLACE);
+    if (m_tiled)
+    {
+        // nothing full resolution goes to the device
+        releaseStagingBuffers();
+        m_imgRedFFT = cl::Buffer();
+        m_imgGreenFFT = cl::Buffer();
+        m_imgBlueFFT = cl::Buffer();
+        m_frameImage = cl::Image2D();
+        for (int c = 0; c < 3; ++c)
+        {
+            m_uploadChannels[c] = cl::Buffer();
+            m_hdrChannels[c] = cl::Buffer();
+        }
 
-    clfftBakePlan(planHandle, 1, &queue(), NULL, NULL);
+        // memory is short when tiling
+        releaseScaleLevels();
+        initFramePlans();
+        initTiles();
 
-    // red channel FFT
-    clfftEnqueueTransform(planHandle, CLFFT_FORWARD, 1, &queue(), 0, NULL, NULL, &redChannel(), &redChannelFFT(), NULL);
-    clFinish(queue());
+        std::cout<<"Textures updated!\n";
+        return;
+    }
+    releaseTiles();
 
-    queue.enqueueReadBuffer(redChannelFFT, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight * 2, m_ImgRedFFT);
-    queue.finish();
+    if (restoreScaleLevel())
+    {
+        uploadImage();
+        return;
+    }
 
+    // pinned upload planes and the spectra of the image, the spectra
+    // never leave the device
+    size_t planeSize = sizeof(float) * m_imgWidth * m_imgHeight;
+    for (int c = 0; c < 3; ++c)
+        m_uploadChannels[c] = m_deviceMemory.buffer(MEMORY_STAGING, context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, planeSize);
 
-    // green channel FFT
-    clfftEnqueueTransform(planHandle, CLFFT_FORWARD, 1, &queue(), 0, NULL, NULL, &greenChannel(), &greenChannelFFT(), NULL);
-    clFinish(queue());
+    size_t spectrumSize = sizeof(float) * 2 * (m_imgWidth/2 + 1) * m_imgHeight;
+    m_imgRedFFT = m_deviceMemory.buffer(MEMORY_IMAGE, context, CL_MEM_READ_WRITE, spectrumSize);
+    m_imgGreenFFT = m_deviceMemory.buffer(MEMORY_IMAGE, context, CL_MEM_READ_WRITE, spectrumSize);
+    m_imgBlueFFT = m_deviceMemory.buffer(MEMORY_IMAGE, context, CL_MEM_READ_WRITE, spectrumSize);
 
-    queue.enqueueReadBuffer(greenChannelFFT, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight * 2, m_ImgGreenFFT);
-    queue.finish();
+    initFramePlans();
+    uploadImage();
+
+    initLocalToneMapPlan();
+
+    // tone mapped frame for the read back paths
+    m_frameImage = m_deviceMemory.image(MEMORY_IMAGE, context, 
+                CL_MEM_READ_WRITE, 
+                cl::ImageFormat(frameChannelOrder(), CL_UNORM_INT8),
+                m_imgWidth,
+                m_imgHeight,
+                NULL);
+
+    initStagingBuffers();
+
+    std::cout<<"Textures updated!\n";
+
+}
+
+// Uploads the current image and computes its spectra. Buffers are made
+// by initTextures, sequence frames of the same size only come through here
+void TemporalGlareRenderer::uploadImage()
+{
+    TRACE_SCOPE("upload", "render");
+    size_t planeSize = sizeof(float) * m_imgWidth * m_imgHeight;
+
+    // the image spectra are no part of a frame
+    m_profileStage = PROFILE_STAGES;
+
+    // the host pixels may have been dropped after an earlier upload
+    if (!image->hasHostData())
+        image->reloadHostData();
+
+    // at scale 1 the image is the one scaled for the next level
+    bool keepHostImage = m_keepHostImage || (m_dynamicResolution && !m_sourceImage);
+
+    if (m_cpuRenderer)
+    {
+        m_cpuRenderer->setImage(*image);
+        if (!keepHostImage)
+            image->releaseHostData();
+        return;
+    }
 
+    // widen straight into the mapped buffers, whatever the host storage is
+    for (int c = 0; c < 3; ++c)
+    {
+        float* dest = (float*)queue.enqueueMapBuffer(m_uploadChannels[c], CL_TRUE, CL_MAP_WRITE, 0, planeSize);
+        image->copyChannel(c, dest);
+        queue.enqueueUnmapMemObject(m_uploadChannels[c], dest);
+    }
 
-    // blue channel FFT
-    clfftEnqueueTransform(planHandle, CLFFT_FORWARD, 1, &queue(), 0, NULL, NULL, &blueChannel(), &blueChannelFFT(), NULL);
+    if (!keepHostImage)
+        image->releaseHostData();
+
+    enqueueTransform(m_forwardPlan, CLFFT_FORWARD, m_uploadChannels[0], m_imgRedFFT);
+    enqueueTransform(m_forwardPlan, CLFFT_FORWARD, m_uploadChannels[1], m_imgGreenFFT);
+    enqueueTransform(m_forwardPlan, CLFFT_FORWARD, m_uploadChannels[2], m_imgBlueFFT);
     clFinish(queue());
+}
 
-    queue.enqueueReadBuffer(blueChannelFFT, CL_TRUE, 0, sizeof(float) * m_imgWidth * m_imgHeight * 2, m_ImgBlueFFT);
-    queue.finish();
+// The transform of the PSF and, untiled, the real forward and inverse
+// transforms of the convolution, baked once per size instead of per frame
+void TemporalGlareRenderer::initFramePlans()
+{
+    releaseFramePlans();
+
+    size_t psfLengths[2] = {(size_t)m_psfWidth, (size_t)m_psfHeight};
+    clfftCreateDefaultPlan(&m_psfPlan, context(), CLFFT_2D, psfLengths);
+    clfftSetPlanPrecision(m_psfPlan, CLFFT_SINGLE);
+    clfftSetLayout(m_psfPlan, CLFFT_COMPLEX_INTERLEAVED, CLFFT_COMPLEX_INTERLEAVED);
+    clfftSetResultLocation(m_psfPlan, CLFFT_OUTOFPLACE);
+    clfftBakePlan(m_psfPlan, 1, &queue(), NULL, NULL);
+    m_psfPlanInPlace = false;
+    m_psfPlanReady = true;
+
+    // the tiles have plans of their own
+    if (m_tiled)
+        return;
+
+    size_t clLengths[2] = {(size_t)m_imgWidth, (size_t)m_imgHeight};
+    clfftCreateDefaultPlan(&m_forwardPlan, context(), CLFFT_2D, clLengths);
+    clfftSetPlanPrecision(m_forwardPlan, CLFFT_SINGLE);
+    clfftSetLayout(m_forwardPlan, CLFFT_REAL, CLFFT_HERMITIAN_INTERLEAVED);
+    setRealTransformStrides(m_forwardPlan, m_imgWidth, m_imgHeight, true);
+    clfftSetResultLocation(m_forwardPlan, CLFFT_OUTOFPLACE);
+    clfftBakePlan(m_forwardPlan, 1, &queue(), NULL, NULL);
+
+    clfftCreateDefaultPlan(&m_inversePlan, context(), CLFFT_2D, clLengths);
+    clfftSetPlanPrecision(m_inversePlan, CLFFT_SINGLE);
+    clfftSetLayout(m_inversePlan, CLFFT_HERMITIAN_INTERLEAVED, CLFFT_REAL);
+    setRealTransformStrides(m_inversePlan, m_imgWidth, m_imgHeight, false);
+    clfftSetResultLocation(m_inversePlan, CLFFT_OUTOFPLACE);
+    clfftBakePlan(m_inversePlan, 1, &queue(), NULL, NULL);
+    m_convolutionPlansReady = true;
+}
 
-    // discard the rest
-    clfftDestroyPlan( &planHandle );
+void TemporalGlareRenderer::releaseFramePlans()
+{
+    if (m_psfPlanReady)
+        clfftDestroyPlan( &m_psfPlan );
+    if (m_convolutionPlansReady)
+    {
+        clfftDestroyPlan( &m_forwardPlan );
+        clfftDestroyPlan( &m_inversePlan );
+    }
+    m_psfPlanReady = false;
+    m_convolutionPlansReady = false;
+}
 
-    std::cout<<"Textures updated!\n";
+// Moves the buffers and plans of the untiled size the PSF still has into
+// m_scaleLevels, nothing is released
+void TemporalGlareRenderer::stashScaleLevel()
+{
+    if (m_cpuRenderer || !m_convolutionPlansReady || !m_localScalesPlanReady)
+        return;
+
+    ScaleLevel& level = m_scaleLevels[std::make_pair(m_psfWidth, m_psfHeight)];
+    for (int c = 0; c < 3; ++c)
+    {
+        level.uploadChannels[c] = m_uploadChannels[c];
+        m_uploadChannels[c] = cl::Buffer();
+    }
+    level.spectra[0] = m_imgRedFFT;
+    level.spectra[1] = m_imgGreenFFT;
+    level.spectra[2] = m_imgBlueFFT;
+    m_imgRedFFT = cl::Buffer();
+    m_imgGreenFFT = cl::Buffer();
+    m_imgBlueFFT = cl::Buffer();
+    level.frameImage = m_frameImage;
+    m_frameImage = cl::Image2D();
+
+    // still mapped, the frames of that size are staged through them again
+    for (int i = 0; i < FRAME_STAGING_BUFFERS; ++i)
+    {
+        level.stagingBuffers[i] = m_stagingBuffers[i];
+        level.stagingPtrs[i] = m_stagingPtrs[i];
+        m_stagingBuffers[i] = cl::Buffer();
+        m_stagingPtrs[i] = nullptr;
+    }
+
+    level.psfPlan = m_psfPlan;
+    level.forwardPlan = m_forwardPlan;
+    level.inversePlan = m_inversePlan;
+    level.localScalesPlan = m_localScalesPlan;
+    level.psfPlanInPlace = m_psfPlanInPlace;
+    m_psfPlanReady = false;
+    m_convolutionPlansReady = false;
+    m_localScalesPlanReady = false;
+}
+
+// Takes the kept buffers and plans of the image size back, false when
+// there are none and initTextures makes them
+bool TemporalGlareRenderer::restoreScaleLevel()
+{
+    auto found = m_scaleLevels.find(std::make_pair(m_imgWidth, m_imgHeight));
+    if (found == m_scaleLevels.end())
+        return false;
+
+    releaseFramePlans();
+    if (m_localScalesPlanReady)
+        clfftDestroyPlan( &m_localScalesPlan );
+    releaseStagingBuffers();
+
+    ScaleLevel& level = found->second;
+    for (int c = 0; c < 3; ++c)
+        m_uploadChannels[c] = level.uploadChannels[c];
+    m_imgRedFFT = level.spectra[0];
+    m_imgGreenFFT = level.spectra[1];
+    m_imgBlueFFT = level.spectra[2];
+    m_frameImage = level.frameImage;
+    for (int i = 0; i < FRAME_STAGING_BUFFERS; ++i)
+    {
+        m_stagingBuffers[i] = level.stagingBuffers[i];
+        m_stagingPtrs[i] = level.stagingPtrs[i];
+    }
+    m_stagingIndex = 0;
+
+    m_psfPlan = level.psfPlan;
+    m_forwardPlan = level.forwardPlan;
+    m_inversePlan = level.inversePlan;
+    m_localScalesPlan = level.localScalesPlan;
+    m_psfPlanInPlace = level.psfPlanInPlace;
+    m_psfPlanReady = true;
+    m_convolutionPlansReady = true;
+    m_localScalesPlanReady = true;
+
+    m_scaleLevels.erase(found);
+    return true;
+}
+
+void TemporalGlareRenderer::releaseScaleLevels()
+{
+    for (auto& entry : m_scaleLevels)
+    {
+        ScaleLevel& level = entry.second;
+        for (int i = 0; i < FRAME_STAGING_BUFFERS; ++i)
+            queue.enqueueUnmapMemObject(level.stagingBuffers[i], level.stagingPtrs[i]);
+        clfftDestroyPlan( &level.psfPlan );
+        clfftDestroyPlan( &level.forwardPlan );
+        clfftDestroyPlan( &level.inversePlan );
+        clfftDestroyPlan( &level.localScalesPlan );
+    }
+    if (!m_scaleLevels.empty())
+        queue.finish();
+    m_scaleLevels.clear();
+}
+
+// Batched inverse transform producing every level of the luminance
+// pyramid of the local operator at once, baked once per image size
+void TemporalGlareRenderer::initLocalToneMapPlan()
+{
+    if (m_localScalesPlanReady)
+        clfftDestroyPlan( &m_localScalesPlan );
+
+    size_t clLengths[2] = {(size_t)m_imgWidth, (size_t)m_imgHeight};
+    clfftCreateDefaultPlan(&m_localScalesPlan, context(), CLFFT_2D, clLengths);
+    clfftSetPlanPrecision(m_localScalesPlan, CLFFT_SINGLE);
+    clfftSetLayout(m_localScalesPlan, CLFFT_HERMITIAN_INTERLEAVED, CLFFT_REAL);
+    setRealTransformStrides(m_localScalesPlan, m_imgWidth, m_imgHeight, false);
+    clfftSetPlanBatchSize(m_localScalesPlan, TM_LOCAL_SCALES + 1);
+    clfftSetResultLocation(m_localScalesPlan, CLFFT_OUTOFPLACE);
+
+    clfftBakePlan(m_localScalesPlan, 1, &queue(), NULL, NULL);
+    m_localScalesPlanReady = true;
+}
+
+// Up to 10 %, drawn from the stream's sequence for the frame
+float TemporalGlareRenderer::noise(unsigned int frame, int stream)
+{
+    float u[4];
+    philoxUniform4(m_seed, frame, stream, 0, u);
+
+    return 0.1f * u[0];
+}
+
+// Position and deformation response of a lens particle, x, dx, y, dy as
+// lens_point in render.cl
+void TemporalGlareRenderer::lensPoint(float x, float y, float* p)
+{
+    float radius = std::sqrt(x * x + y * y);
+    float dr = deformationCoeff(2*radius/m_psfHeight);
+    float scale = radius > 0.0f ? dr / radius : 0.0f;
+
+    p[0] = x;
+    p[1] = x * scale;
+    p[2] = y;
+    p[3] = y * scale;
+}
+
+// Resizes the particle state to count particles, the first kept ones are
+// copied over and the rest generated
+void TemporalGlareRenderer::resizeLensPoints(int count, int kept)
+{
+    if (m_cpuRenderer)
+    {
+        m_pointCoordinates.resize(4 * (size_t)count);
+        m_pointVelocities.resize(2 * (size_t)count);
+    }
+    else
+    {
+        size_t n = std::max(count, 1);
+        cl::Buffer points = m_deviceMemory.buffer(MEMORY_APERTURE, context, CL_MEM_READ_WRITE, sizeof(cl_float4) * n);
+        cl::Buffer velocities = m_deviceMemory.buffer(MEMORY_APERTURE, context, CL_MEM_READ_WRITE, sizeof(cl_float2) * n);
+        if (kept > 0)
+        {
+            queue.enqueueCopyBuffer(m_pointsBuffer, points, 0, 0, sizeof(cl_float4) * kept);
+            queue.enqueueCopyBuffer(m_pointVelocitiesBuffer, velocities, 0, 0, sizeof(cl_float2) * kept);
+        }
+        m_pointsBuffer = points;
+        m_pointVelocitiesBuffer = velocities;
+    }
+
+    m_nPoints = count;
+    generateLensPoints(kept);
+}
+
+// Point i is block i of the particle stream, on the device for the OpenCL
+// backend (glr_generate_lens_points) and on the host for the CPU one
+void TemporalGlareRenderer::generateLensPoints(int first)
+{
+    if (first >= m_nPoints)
+        return;
+
+    if (!m_cpuRenderer)
+    {
+        lensGenerateKernel.setArg(0, m_pointsBuffer);
+        lensGenerateKernel.setArg(1, m_pointVelocitiesBuffer);
+        lensGenerateKernel.setArg(2, (cl_uint)m_seed);
+        lensGenerateKernel.setArg(3, first);
+        lensGenerateKernel.setArg(4, m_nPoints);
+        lensGenerateKernel.setArg(5, m_psfHeight);
+        queue.enqueueNDRangeKernel(lensGenerateKernel, cl::NullRange, cl::NDRange(m_nPoints - first), cl::NullRange);
+        return;
+    }
+
+    for(int i = first; i < m_nPoints; ++i)
+    {
+        float u[4];
+        philoxUniform4(m_seed, 0, RANDOM_STREAM_PARTICLES, i, u);
+        float signX = u[0] < 0.5f ? 1.0f : -1.0f;
+        float signY = u[1] < 0.5f ? 1.0f : -1.0f;
+
+        lensPoint(signX * u[2], signY * u[3], &m_pointCoordinates[4 * (size_t)i]);
+        m_pointVelocities[2 * (size_t)i] = 0.0f;
+        m_pointVelocities[2 * (size_t)i + 1] = 0.0f;
+    }
+}
+
+// Bins the particles into LENS_TILE tiles of the aperture and rasterises
+// each tile in local memory, leaving the transmission in m_occlusionMask.
+// The bins are sized for the aperture and grow with the particle count
+void TemporalGlareRenderer::rasteriseLensPoints()
+{
+    int tilesX = (m_psfWidth + LENS_TILE - 1) / LENS_TILE;
+    int tilesY = (m_psfHeight + LENS_TILE - 1) / LENS_TILE;
+    int nTiles = tilesX * tilesY;
+
+    if (tilesX != m_binTilesX || tilesY != m_binTilesY)
+    {
+        // counts start at zero, the scan clears them after every frame
+        std::vector<cl_uint> zeros(nTiles, 0);
+        m_tileCounts = m_deviceMemory.buffer(MEMORY_APERTURE, context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_uint) * nTiles, zeros.data());
+        m_tileOffsets = m_deviceMemory.buffer(MEMORY_APERTURE, context, CL_MEM_READ_WRITE, sizeof(cl_uint) * (nTiles + 1));
+        m_tileCursors = m_deviceMemory.buffer(MEMORY_APERTURE, context, CL_MEM_READ_WRITE, sizeof(cl_uint) * nTiles);
+        m_occlusionMask = m_deviceMemory.buffer(MEMORY_APERTURE, context, CL_MEM_READ_WRITE, sizeof(float) * m_psfWidth * m_psfHeight);
+        m_binTilesX = tilesX;
+        m_binTilesY = tilesY;
+    }
+
+    if (m_nPoints > m_binCapacity || m_binCapacity == 0)
+    {
+        m_binCapacity = std::max(m_nPoints, 1);
+        m_pointScreen = m_deviceMemory.buffer(MEMORY_APERTURE, context, CL_MEM_READ_WRITE, sizeof(cl_float2) * m_binCapacity);
+        m_tileEntries = m_deviceMemory.buffer(MEMORY_APERTURE, context, CL_MEM_READ_WRITE, sizeof(cl_uint) * LENS_TILES_PER_POINT * m_binCapacity);
+    }
+
+    if (m_nPoints > 0)
+    {
+        lensCountKernel.setArg(0, m_pointsBuffer);
+        lensCountKernel.setArg(1, m_pointScreen);
+        lensCountKernel.setArg(2, m_tileCounts);
+        lensCountKernel.setArg(3, m_nPoints);
+        lensCountKernel.setArg(4, m_psfWidth);
+        lensCountKernel.setArg(5, m_psfHeight);
+        lensCountKernel.setArg(6, tilesX);
+        lensCountKernel.setArg(7, tilesY);
+        lensCountKernel.setArg(8, m_distort); // distort coefficient -> how the lens is deformed (pixels)
+        queue.enqueueNDRangeKernel(lensCountKernel, cl::NullRange, cl::NDRange(m_nPoints), cl::NullRange, NULL, profileEvent());
+    }
+
+    lensScanKernel.setArg(0, m_tileCounts);
+    lensScanKernel.setArg(1, m_tileOffsets);
+    lensScanKernel.setArg(2, m_tileCursors);
+    lensScanKernel.setArg(3, nTiles);
+    queue.enqueueNDRangeKernel(lensScanKernel, cl::NullRange, cl::NDRange(LENS_SCAN_GROUP), cl::NDRange(LENS_SCAN_GROUP), NULL, profileEvent());
+
+    if (m_nPoints > 0)
+    {
+        lensBinKernel.setArg(0, m_pointScreen);
+        lensBinKernel.setArg(1, m_tileCursors);
+        lensBinKernel.setArg(2, m_tileEntries);
+        lensBinKernel.setArg(3, m_nPoints);
+        lensBinKernel.setArg(4, m_psfWidth);
+        lensBinKernel.setArg(5, m_psfHeight);
+        lensBinKernel.setArg(6, tilesX);
+        lensBinKernel.setArg(7, tilesY);
+        queue.enqueueNDRangeKernel(lensBinKernel, cl::NullRange, cl::NDRange(m_nPoints), cl::NullRange, NULL, profileEvent());
+    }
 
+    lensRasteriseKernel.setArg(0, m_pointScreen);
+    lensRasteriseKernel.setArg(1, m_tileOffsets);
+    lensRasteriseKernel.setArg(2, m_tileEntries);
+    lensRasteriseKernel.setArg(3, m_occlusionMask);
+    lensRasteriseKernel.setArg(4, m_psfWidth);
+    lensRasteriseKernel.setArg(5, m_psfHeight);
+    queue.enqueueNDRangeKernel(lensRasteriseKernel, cl::NullRange,
+                               cl::NDRange(tilesX * LENS_TILE, tilesY * LENS_TILE), cl::NDRange(LENS_TILE, LENS_TILE), NULL, profileEvent());
 }
 
-float TemporalGlareRenderer::noise()
+// Advances the lens particles by dt seconds, glr_step_lens_points on the
+// device and the same integration on the host for the CPU backend
+void TemporalGlareRenderer::stepLensPoints(unsigned int frame, float dt)
 {
-    float noisePercentage = rand() % 10;
-    noisePercentage = noisePercentage / 100;
+    TRACE_SCOPE("lens particles", "render");
+    if (m_nPoints == 0)
+        return;
+
+    if (!m_cpuRenderer)
+    {
+        cl_float2 drift = {{m_particleDriftX, m_particleDriftY}};
+        lensStepKernel.setArg(0, m_pointsBuffer);
+        lensStepKernel.setArg(1, m_pointVelocitiesBuffer);
+        lensStepKernel.setArg(2, (cl_uint)m_seed);
+        lensStepKernel.setArg(3, (cl_uint)frame);
+        lensStepKernel.setArg(4, dt);
+        lensStepKernel.setArg(5, m_nPoints);
+        lensStepKernel.setArg(6, m_psfHeight);
+        lensStepKernel.setArg(7, drift);
+        lensStepKernel.setArg(8, m_particleDamping);
+        lensStepKernel.setArg(9, m_particleDiffusion);
+        queue.enqueueNDRangeKernel(lensStepKernel, cl::NullRange, cl::NDRange(m_nPoints), cl::NullRange, NULL, profileEvent());
+        return;
+    }
+
+    float relax = std::min(m_particleDamping * dt, 1.0f);
+    float kickScale = m_particleDiffusion * std::sqrt(dt);
 
-    return noisePercentage;
+    ThreadPool::global().parallelFor(0, m_nPoints, LENS_PARTICLES_PER_TASK, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            float u[4];
+            philoxUniform4(m_seed, frame, RANDOM_STREAM_PARTICLE_MOTION, (uint32_t)i, u);
+            float r = std::sqrt(-2.0f * std::log(1.0f - u[0]));
+            float angle = 2.0f * 3.14159265f * u[1];
+
+            float* v = &m_pointVelocities[2 * i];
+            v[0] += (m_particleDriftX - v[0]) * relax + kickScale * r * std::cos(angle);
+            v[1] += (m_particleDriftY - v[1]) * relax + kickScale * r * std::sin(angle);
+
+            float* p = &m_pointCoordinates[4 * i];
+            float pos[2] = {p[0] + v[0] * dt, p[2] + v[1] * dt};
+            for (int c = 0; c < 2; ++c)
+            {
+                // reflect at the border of the lens
+                if (pos[c] > 1.0f)  { pos[c] = 2.0f - pos[c];  v[c] = -v[c]; }
+                if (pos[c] < -1.0f) { pos[c] = -2.0f - pos[c]; v[c] = -v[c]; }
+                pos[c] = std::max(-1.0f, std::min(pos[c], 1.0f));
+            }
+
+            lensPoint(pos[0], pos[1], p);
+        }
+    });
 }
 
 // default Radius is 9 mm, and we play around it
@@ -904,17 +3240,32 @@ int TemporalGlareRenderer::getHeight()
     return m_imgHeight;
 }
 
+int TemporalGlareRenderer::getSourceWidth() const
+{
+    return m_sourceImage ? m_sourceImage->getWidth() : m_imgWidth;
+}
+
+int TemporalGlareRenderer::getSourceHeight() const
+{
+    return m_sourceImage ? m_sourceImage->getHeight() : m_imgHeight;
+}
+
 TemporalGlareRenderer::~TemporalGlareRenderer()
 {
     delete[] m_apertureTexture;
     delete[] m_complexExponential;
-    delete[] m_slidTexture;
-    delete[] m_pointCoordinates;
 
-    delete[] m_ImgRedFFT;
-    delete[] m_ImgGreenFFT;
-    delete[] m_ImgBlueFFT;
+    // nothing of OpenCL or clFFT was set up for the CPU backend, or when
+    // the OpenCL setup failed before the queue
+    if (m_cpuRenderer || queue() == NULL)
+        return;
+
+    releaseStagingBuffers();
+    releaseTiles();
+    releaseFramePlans();
+    releaseScaleLevels();
 
-    clfftDestroyPlan( &planHandle );
+    if (m_localScalesPlanReady)
+        clfftDestroyPlan( &m_localScalesPlan );
     clfftTeardown();
 }
\ No newline at end of file
@@ -1,33 +1,224 @@
 #ifndef TemporalGlareRenderer_H
 #define TemporalGlareRenderer_H
 
-#include <QWidget>
-#include <QVector3D>
-#include <QMatrix4x4>
-#include <QString>
-
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
 
 #include "image.h"
+#include "GlareParameters.h"
+#include "ExrSequence.h"
+#include "CpuFFT.h"
+#include "DeviceMemory.h"
+#include "CpuRenderer.h"
+#include "ToneMapping.h"
+#include "LensParticles.h"
+#include "Gratings.h"
+#include "PupilModel.h"
+#include "FrameScheduler.h"
+#include "KernelTuning.h"
 #include "vector_types.h"
 
 #include <time.h>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
 
 #include <clFFT/clFFT.h>
 
+// Pinned host buffers the frames are read back into, a frame stays valid
+// until the ring wraps around
+#define FRAME_STAGING_BUFFERS 3
+
+// Sequence playback prints the decode throughput every this many frames
+#define SEQUENCE_REPORT_FRAMES 48
+
+// Tiled convolution for images whose full resolution buffers do not fit
+// on the device. The PSF is generated at a fixed size, halved down to the
+// minimum while the smallest tile does not fit, tiles are FFT sized
+// powers of two between twice the PSF and the maximum, as large as the
+// budget allows. Two tile slots are in flight at any time
+#define TILED_PSF_SIZE 1024
+#define TILED_MIN_PSF_SIZE 256
+#define TILED_MAX_TILE_SIZE 8192
+#define TILE_SLOTS 2
+
+// Device memory budget, this share of the device's global memory unless
+// set. The rest is headroom for clFFT's scratch buffers and the driver.
+// After an allocation fails the budget shrinks to the retry share of
+// itself and the buffers are planned again
+#define DEVICE_MEMORY_BUDGET_PERCENT 60
+#define MEMORY_BUDGET_RETRY_PERCENT 75
+
+// Device bytes per image pixel at the peak of an untiled frame, see
+// MemoryMode. Resident: the half spectra of the image, the upload planes,
+// the staging ring, the frame image and the occlusion mask. The linear
+// result of the last frame unless it is dropped. Then the larger of the
+// PSF generation and the convolution, whose buffers only live for the
+// frame, and the scale spectra of the local tone mapper with them
+#define FRAME_BYTES_RESIDENT 44
+#define FRAME_BYTES_KEPT_RESULT 12
+#define FRAME_BYTES_PSF 84
+#define FRAME_BYTES_PSF_IN_PLACE 44
+#define FRAME_BYTES_CONVOLUTION 48
+#define FRAME_BYTES_CONVOLUTION_IN_PLACE 24
+#define FRAME_BYTES_LOCAL_TONE_MAP (8 * (TM_LOCAL_SCALES + 1))
+
+// How lean the device side of a frame is, the first mode whose footprint
+// fits the memory budget. Each keeps the savings of the ones before it
+enum MemoryMode
+{
+    MEMORY_MODE_FULL      = 0,  // the last frame's linear result stays until the next one
+    MEMORY_MODE_NO_CACHES = 1,  // ... and is dropped as the next frame starts
+    MEMORY_MODE_IN_PLACE  = 2,  // in-place PSF transform and products, PSF scratch freed early
+    MEMORY_MODE_TILED     = 3   // tiled convolution, with a smaller PSF if need be
+};
+
+// Where frames are rendered. The CPU backend runs the whole pipeline on
+// the host through CpuRenderer, without any OpenCL platform
+enum RenderBackend
+{
+    RENDER_BACKEND_OPENCL = 0,
+    RENDER_BACKEND_CPU    = 1
+};
+
+// The glare pipeline behind a plain C++ interface, nothing in it depends
+// on Qt. A client sets the parameters and an HDR image, then per frame
+//
+//     renderer.setParameters(params);
+//     if (renderer.renderFrame(elapsed))
+//         draw(renderer.stageFrame());
+//
+// or keeps the frame on the device through getDeviceFrame.
 class TemporalGlareRenderer
 {
 public:
-    TemporalGlareRenderer();
+    // cpuThreads and pinThreads size the CpuRenderer's pool, 0 threads
+    // uses every hardware thread
+    explicit TemporalGlareRenderer(RenderBackend backend = defaultBackend(),
+                                   unsigned int cpuThreads = 0, bool pinThreads = false);
     ~TemporalGlareRenderer();
 
-public:
-    void paint(QPainter *painter, QPaintEvent *event, int elapsed, const QSize &destSize);
-    void readExrFile(const QString& fileName);
+    // RENDER_BACKEND_CPU when GLARE_BACKEND=cpu is set in the environment
+    static RenderBackend defaultBackend();
+    RenderBackend getBackend() const;
+
+    // False when the backend could not be set up: no OpenCL platform or
+    // device, kernel files that can't be read or don't build. getError
+    // says why, nothing else may be called on the renderer then
+    bool isValid() const;
+    const std::string& getError() const;
 
+public:
+    // elapsed is the time within the second in ms, it wraps around
+    bool renderFrame(int elapsed);
+    // Renders the next frame, dt seconds of simulation after the last one
+    bool stepFrame(float dt);
+    void readFrame(unsigned char* dest);
+    unsigned char* stageFrame();
+    void readExrFile(const std::string& fileName);
+    // Copies width x height linear float planes as the current image,
+    // closing any sequence
+    void setImage(const float* red, const float* green, const float* blue, int width, int height);
+
+    // The parameters as they were set. Tiled images do not follow all of
+    // them, see isTiled
+    void setParameters(const GlareParameters& params);
+    GlareParameters getParameters() const;
+
+    // The tone mapped frame left on the device, a BGRA (ARGB on big endian
+    // hosts) UNORM_INT8 image in getContext(). Null when the frame is not
+    // in a device image: CPU backend, tiled images, or GL sharing where
+    // it went to the display texture
+    cl_mem getDeviceFrame() const;
+    cl_context getContext() const;
+    cl_command_queue getQueue() const;
+    // The built kernels and the device they run on, for the kernel
+    // micro-benchmarks. The name is the key of the tuning file
+    cl_program getProgram() const;
+    cl_device_id getDevice() const;
+    const std::string& getDeviceName() const;
+
+    // EXR sequences, a printf/glob pattern or a list of files played back
+    // at fps, fps <= 0 only advances on stepSequence. Loading a single
+    // file closes the sequence. decoders <= 0 decodes on
+    // ExrSequence::defaultDecoders() threads
+    bool openExrSequence(const std::string& pattern, float fps, int decoders = 0);
+    bool openExrSequence(const std::vector<std::string>& fileNames, float fps, int decoders = 0);
+    void closeExrSequence();
+    bool hasSequence() const;
+    float getSequenceFps() const;
+    // Waits for the next frame of the sequence and makes it current
+    bool stepSequence();
+
+    // Linear glare result of the last frame, before tone mapping
+    void readHdrFrame(float* red, float* green, float* blue);
+
+    // Seed of the lens particles and the pupil and deformation noise, the
+    // time of construction by default. Together with the frame index it
+    // fixes the random state of a frame, so any frame can be rendered
+    // again exactly
+    void setSeed(unsigned int seed);
+    unsigned int getSeed() const;
+    // Index of the next frame renderFrame makes, counts up from 0
+    void setFrameIndex(unsigned int frame);
+    unsigned int getFrameIndex() const;
+    // Lens particles, moved every frame by the elapsed time. Resizing keeps
+    // the particles there are, up to LENS_PARTICLES_MAX
+    void setParticleCount(int count);
+    int getParticleCount() const;
+    // Procedural lens gratings, see Gratings.h: fibres around the lens,
+    // 0 for none, and their jitter in [0, 1]. Baked again before the next
+    // frame, like after a new seed
+    void setGratings(int fibres, float jitter);
+    int getGratingsFibres() const;
+    float getGratingsJitter() const;
+    // Adaptation luminance the pupil diameter follows (cd/m^2). Setting it
+    // turns m_autoFieldLuminance off
+    void setFieldLuminance(float luminance);
+
+    // Size of the frames, the image times the render scale
     int getWidth();
     int getHeight();
+    // Size of the image as it was set
+    int getSourceWidth() const;
+    int getSourceHeight() const;
+
+    // Internal resolution. Below scale 1 the pipeline works on an area
+    // averaged copy of the image, snapped to lengths the FFTs support,
+    // and the frames come out that size. Fewer spectral samples make the
+    // blur cheaper and the colour fringes coarser
+    void setRenderQuality(const RenderQuality& quality);
+    RenderQuality getRenderQuality() const;
+    // For a scheduler that changes the render scale from frame to frame:
+    // the image keeps its host pixels and the buffers and plans of every
+    // scale are kept for when the frames come back to it
+    void setDynamicResolution(bool enabled);
+    bool getDynamicResolution() const;
+    // Stage timings of the last frame
+    const FrameTimings& getFrameTimings() const;
+    // What the last frame of the CPU backend was rendered from, false
+    // with the OpenCL backend. The gratings and particles point into the
+    // renderer and stay valid until the next frame
+    bool getLastFrameParams(CpuFrameParams& params) const;
+    // Device profiles of the last FRAME_PROFILE_RING frames of the OpenCL
+    // backend, oldest first. The last one takes in the readbacks of its
+    // frame as they finish
+    std::vector<FrameProfile> getFrameProfiles();
+    bool getLastFrameProfile(FrameProfile& profile);
+
+    // OpenCL/OpenGL interop. glProperties are the zero terminated
+    // CL_GL_CONTEXT_KHR and CL_GLX_DISPLAY_KHR (CL_WGL_HDC_KHR on Windows)
+    // pairs of the current GL context, NULL where sharing is not set up.
+    // The caller owns GL, libglare does not link it
+    bool initGLSharing(const cl_context_properties* glProperties);
+    void setDisplayTexture(unsigned int texture, int width, int height);
+    bool hasGLSharing() const;
+    // False when the last frame has to be read back to reach the texture
+    bool isFrameInDisplay() const;
 
     float focus = 500.0f;
     float apertureSize = 8.0f;
@@ -46,18 +237,130 @@ public:
 
     bool m_autoExposure;
 
+    int m_toneMapOperator;
+
+    // local operator parameters
+    float m_phi;
+    float m_epsilon;
+
+    // histogram adjustment display range (cd/m^2)
+    float m_displayMinLuminance;
+    float m_displayMaxLuminance;
+
+    // Image residency: keep the host pixels after upload and store them
+    // as half floats. Both only matter for the host footprint, the device
+    // copies are float either way
+    bool m_keepHostImage;
+    bool m_halfPrecisionImages;
+
+    // Pupil adaptation: measured every frame over the foveal window of the
+    // image, see PupilModel.h, or m_fieldLuminance. Image values times
+    // m_luminanceScale are cd/m^2
+    bool m_autoFieldLuminance;
+    float m_luminanceScale;
+
+    // Lens particle motion, see LENS_PARTICLE_DRIFT_X and on
+    float m_particleDriftX;
+    float m_particleDriftY;
+    float m_particleDamping;
+    float m_particleDiffusion;
+
+    // Always convolve in tiles, even when the image would fit. Takes
+    // effect with the next image
+    bool m_forceTiling;
+
+    // Device memory budget in bytes, 0 for DEVICE_MEMORY_BUDGET_PERCENT of
+    // the device. Takes effect with the next image
+    void setMemoryBudget(unsigned long long bytes);
+    unsigned long long getMemoryBudget();
+    MemoryMode getMemoryMode() const;
+    // Images too large for the device are convolved in tiles
+    // (MEMORY_MODE_TILED), which renders them differently: the tiles are
+    // tone mapped with the extended Reinhard operator whatever the
+    // parameters ask for, and the PSF is getPsfWidth x getPsfHeight,
+    // TILED_PSF_SIZE or less, instead of the image size. The aperture is
+    // sampled more coarsely then and glare reaching further than half the
+    // PSF from a source is cut off
+    bool isTiled() const;
+    int getPsfWidth() const;
+    int getPsfHeight() const;
+    // The operator the frames are tone mapped with, which differs from
+    // GlareParameters::toneMapOperator for tiled images
+    int getEffectiveToneMapOperator() const;
+    // Device allocations by stage, current and peak
+    MemoryUsage getDeviceMemoryUsage() const;
+    void resetDeviceMemoryPeak();
+
 private:
     void updateViewSize(int newWidth, int newHeight);
-    float noise();
-    void updatePupilDiameter();
+    float noise(unsigned int frame, int stream);
+    void lensPoint(float x, float y, float* p);
+    void resizeLensPoints(int count, int kept);
+    void generateLensPoints(int first);
+    void stepLensPoints(unsigned int frame, float dt);
+    void rasteriseLensPoints();
+    void updatePupilDiameter(unsigned int frame, float dt);
+    void fovealWindow(int& x0, int& y0, int& width, int& height);
+    float measureFieldLuminance();
     void updateApertureTexture();
-    void updateLensDeformation();
+    void bakeGratings();
+    void updateLensDeformation(unsigned int frame);
     void initTextures();
+    void uploadImage();
+    void setImage(Image* newImage, bool reinitialise);
+    Image* scaledImage(Image& source);
+    void markStage(float& stage);
+    bool startSequence(ExrSequence* sequence, float fps);
+    void advanceSequence();
+    void initLocalToneMapPlan();
+    void initFramePlans();
+    void releaseFramePlans();
+    void stashScaleLevel();
+    bool restoreScaleLevel();
+    void releaseScaleLevels();
+    void initStagingBuffers();
+    void releaseStagingBuffers();
+    void generatePSF(cl::Buffer* psfChannels, unsigned int frame, float dt);
+    unsigned long long frameDeviceBytes(int width, int height, MemoryMode mode) const;
+    MemoryMode planMemory(int width, int height);
+    bool reduceMemoryBudget();
+    void initTiles();
+    void releaseTiles();
+    void renderTiles(cl::Buffer* psfChannels);
+    bool renderFrameOnHost(unsigned int frame, float dt);
+    bool renderFrameOnDevice(unsigned int frame, float dt);
+    CpuFFT* hostTransform(clfftPlanHandle plan);
+    void enqueueTransform(clfftPlanHandle plan, clfftDirection dir, cl::Buffer& in, cl::Buffer& out,
+                          cl_uint nWaitEvents = 0, const cl_event* waitEvents = NULL);
+
+    // Profiling: commands pass profileEvent() as their event and are put
+    // to m_profileStage, PROFILE_STAGES between frames. recordProfileEvent
+    // takes events made elsewhere. They are resolved into the ring once
+    // finished
+    cl::Event* profileEvent();
+    void recordProfileEvent(ProfileStage stage, const cl::Event& event);
+    void beginFrameProfile(unsigned int frame);
+    void resolveProfileEvents();
 
     float deformationCoeff(float d);
 
+    // Local size of a width x height launch from the tuning file, the
+    // driver's choice without an entry or when it doesn't divide the launch.
+    // Kernels that check their bounds are rounded up to it instead, with
+    // roundedRange as their global size
+    cl::NDRange tunedRange(const char* kernel, size_t width, size_t height, bool rounded = false) const;
+    cl::NDRange roundedRange(const char* kernel, size_t width, size_t height) const;
+
     // OpenCL stuff 
     void initOpenCL();
+    bool buildProgram();
+    std::string m_error;    // empty while the renderer is valid
+
+    // every buffer and image of the device goes through it, it outlives
+    // the OpenCL objects below
+    DeviceMemory m_deviceMemory;
+    unsigned long long m_memoryBudget;     // as set, 0 for the default share
+    MemoryMode m_memoryMode;
 
     cl::Platform platform;
     cl::Device device;
@@ -70,13 +373,45 @@ private:
     cl::Kernel floatToUintRBGAKernel;
     cl::Kernel mergeKernel;
     cl::Kernel gratingsKernel;
-    cl::Kernel lensDotsKernel;
+    cl::Kernel gratingsBakeKernel;
+    cl::Kernel lensCountKernel;
+    cl::Kernel lensScanKernel;
+    cl::Kernel lensBinKernel;
+    cl::Kernel lensRasteriseKernel;
+    cl::Kernel lensGenerateKernel;
+    cl::Kernel lensStepKernel;
     cl::Kernel pupilKernel;
+    cl::Kernel pupilUpdateKernel;
     cl::Kernel compExpKernel;
     cl::Kernel compExpMultKernel;
     cl::Kernel spectralBlurKernel;
     cl::Kernel convOfFFTsKernel;
     cl::Kernel computeMagnitudeKernel;
+    cl::Kernel localScaleSpectraKernel;
+    cl::Kernel localToneMapperKernel;
+    cl::Kernel histogramClearKernel;
+    cl::Kernel histogramRangeKernel;
+    cl::Kernel histogramKernel;
+    cl::Kernel histogramCdfKernel;
+    cl::Kernel histogramToneMapperKernel;
+    cl::Kernel tilePSFKernel;
+
+    // work-group sizes of this device, see KernelTuning.h
+    std::string m_deviceName;
+    KernelTuning m_tuning;
+
+    // tone mapped output, either a shared GL texture or a device image
+    bool m_glSharing;
+    cl::ImageGL m_displayImage;
+    int m_displayWidth;
+    int m_displayHeight;
+    cl::Image2D m_frameImage;
+    bool m_frameInDisplay;      // last frame went to m_displayImage
+
+    // persistently mapped CL_MEM_ALLOC_HOST_PTR buffers
+    cl::Buffer m_stagingBuffers[FRAME_STAGING_BUFFERS];
+    unsigned char* m_stagingPtrs[FRAME_STAGING_BUFFERS];
+    int m_stagingIndex;
 
     // Image data
     int m_imgWidth;
@@ -89,6 +424,44 @@ private:
     int debug = 0;
 
     Image *image = nullptr;
+    // the image as it was set while the pipeline works on a scaled copy
+    std::unique_ptr<Image> m_sourceImage;
+    float m_renderScale;
+    int m_spectralSamples;
+
+    // buffers and plans of an untiled image size, kept with dynamic
+    // resolution while the frames are another size
+    struct ScaleLevel
+    {
+        cl::Buffer uploadChannels[3];
+        cl::Buffer spectra[3];
+        cl::Image2D frameImage;
+        cl::Buffer stagingBuffers[FRAME_STAGING_BUFFERS];
+        unsigned char* stagingPtrs[FRAME_STAGING_BUFFERS];
+        clfftPlanHandle psfPlan;
+        clfftPlanHandle forwardPlan;
+        clfftPlanHandle inversePlan;
+        clfftPlanHandle localScalesPlan;
+        bool psfPlanInPlace;
+    };
+    bool m_dynamicResolution;
+    std::map<std::pair<int, int>, ScaleLevel> m_scaleLevels;
+
+    FrameTimings m_timings;
+    std::chrono::steady_clock::time_point m_frameStart;
+    std::chrono::steady_clock::time_point m_stageStart;
+
+    // device profile ring, m_profileHead is the frame being recorded.
+    // A deque keeps the events profileEvent hands out in place
+    std::vector<FrameProfile> m_profiles;
+    int m_profileHead;
+    int m_profileCount;
+    ProfileStage m_profileStage;
+    std::deque<std::pair<ProfileStage, cl::Event> > m_profileEvents;
+    // with GLARE_TRACING, the event whose enqueue time on the host maps
+    // the device clock for the trace, -1 for none
+    int m_traceAnchor;
+    unsigned long long m_traceAnchorHost;
 
     //Aperture related stuff
 
@@ -97,22 +470,51 @@ private:
     const float m_maxPupilSize;
     float m_fieldLuminance;
     float m_apperture;
+    // pupil dynamics, on the device or for the CPU backend on the host.
+    // Backends without the image on the device measure it at load
+    cl::Buffer m_pupilState;
+    PupilState m_hostPupil;
+    float m_imageFieldLuminance;
     cl_float2 m_pupilCenter;
 
     //Aperture texture
     float* m_apertureTexture;
 
-    //slid texture -> loaded once
-    unsigned char* m_slidTexture;
-    int m_slidWidth;
-    int m_slidHeight;
+    // procedural gratings at the PSF size, an image on the device or one
+    // grey byte per pixel for the CPU backend
+    cl::Image2D m_gratingsImage;
+    std::vector<unsigned char> m_gratingsTexture;
+    int m_gratingsFibres;
+    float m_gratingsJitter;
+    bool m_gratingsBaked;
     float m_slidRadiusPx;
     float m_slidRadiusDeformedPx;
     float m_distort;
 
     //lens particles
-    float* m_pointCoordinates; //x, alphadx, y, alphady
+    // lens particles, on the device or for the CPU backend on the host
+    std::vector<float> m_pointCoordinates; //x, alphadx, y, alphady
+    std::vector<float> m_pointVelocities;  //vx, vy
+    cl::Buffer m_pointsBuffer;
+    cl::Buffer m_pointVelocitiesBuffer;
     int m_nPoints;
+    int m_lastElapsed;
+
+    // particle rasteriser: screen positions, per tile counts, offsets and
+    // cursors, the binned particle indices and the resulting mask
+    cl::Buffer m_pointScreen;
+    cl::Buffer m_tileCounts;
+    cl::Buffer m_tileOffsets;
+    cl::Buffer m_tileCursors;
+    cl::Buffer m_tileEntries;
+    cl::Buffer m_occlusionMask;
+    int m_binTilesX;
+    int m_binTilesY;
+    int m_binCapacity;      // particles the bins have room for
+
+    // random state, see Philox.h
+    unsigned int m_seed;
+    unsigned int m_frameIndex;
 
     //we neglect the vitreous for a moment
     //we also neglect flinching 
@@ -124,11 +526,72 @@ private:
     float m_distance;
 
     clfftSetupData fftSetup;
-    clfftPlanHandle planHandle;
-
-    float* m_ImgRedFFT;
-    float* m_ImgGreenFFT;
-    float* m_ImgBlueFFT;
+    // transform of the PSF at m_psfWidth x m_psfHeight and the real
+    // transforms of the convolution at image size, baked per size
+    clfftPlanHandle m_psfPlan;
+    bool m_psfPlanInPlace;
+    clfftPlanHandle m_forwardPlan;
+    clfftPlanHandle m_inversePlan;
+    bool m_psfPlanReady;
+    bool m_convolutionPlansReady;
+    clfftPlanHandle m_localScalesPlan;
+    bool m_localScalesPlanReady;
+
+    // sequence playback
+    std::unique_ptr<ExrSequence> m_sequence;
+    float m_sequenceFps;
+    std::chrono::steady_clock::time_point m_sequenceFrameTime;
+    size_t m_sequenceFramesShown;
+    size_t m_sequenceStalls;
+
+    // linear result of the last frame
+    cl::Buffer m_hdrChannels[3];
+
+    // pinned planes the image is uploaded through
+    cl::Buffer m_uploadChannels[3];
+
+    // spectra of the loaded image, resident on the device
+    cl::Buffer m_imgRedFFT;
+    cl::Buffer m_imgGreenFFT;
+    cl::Buffer m_imgBlueFFT;
+
+    // Resolution the PSF is generated at, the image size or m_tiledPsfSize
+    int m_psfWidth;
+    int m_psfHeight;
+    int m_tiledPsfSize;
+
+    // tiled convolution, tiles are m_tileSize squared with the image
+    // advancing m_tileStep pixels between them. Uploads and read backs
+    // go through m_transferQueue while the previous tile is transformed
+    bool m_tiled;
+    int m_tileSize;
+    int m_tileStep;
+    cl::CommandQueue m_transferQueue;
+    cl::Buffer m_tilePSFSpectra[3];
+    cl::Buffer m_tileSpectrum;
+    cl::Buffer m_tileProduct;
+    cl::Buffer m_tileInput[TILE_SLOTS][3];
+    cl::Buffer m_tileOutput[TILE_SLOTS][3];
+    cl::Image2D m_tileFrame[TILE_SLOTS];
+    cl::Buffer m_tileStaging[TILE_SLOTS];     // pinned, persistently mapped
+    float* m_tileStagingPtrs[TILE_SLOTS];
+    clfftPlanHandle m_tileForwardPlan;
+    clfftPlanHandle m_tileInversePlan;
+    bool m_tilePlansReady;
+
+    // full resolution results of the tiled path, on the host
+    std::vector<float> m_tiledHdr[3];
+    std::vector<unsigned char> m_tiledFrame;
+
+    // transforms of CPU devices run on the host, one CpuFFT per distinct
+    // plan (width, height, layout, batch, spatial and spectral distance)
+    bool m_hostFFT;
+    std::map<std::tuple<int, int, int, size_t, size_t, size_t>, std::unique_ptr<CpuFFT> > m_hostTransforms;
+
+    // set for RENDER_BACKEND_CPU, none of the OpenCL objects exist then
+    std::unique_ptr<CpuRenderer> m_cpuRenderer;
+    CpuFrameParams m_cpuFrameParams;
+    bool m_hasCpuFrameParams;
 
 
 };
@@ -0,0 +1,216 @@
+#include "ThreadPool.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// set on threads while they run chunks, nested loops then run inline
+static thread_local bool t_inParallelFor = false;
+
+// Best effort, the scheduler keeps the thread wherever it likes when the
+// CPU is not available to the process
+static void pinThread(std::thread::native_handle_type thread, unsigned int cpu)
+{
+#if defined(__linux__)
+    unsigned int nCpus = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % nCpus, &set);
+    pthread_setaffinity_np(thread, sizeof(set), &set);
+#else
+    (void)thread;
+    (void)cpu;
+#endif
+}
+
+ThreadPool::ThreadPool(unsigned int nThreads, bool pinThreads) :
+    m_job(nullptr), m_begin(0), m_end(0), m_grain(1), m_pending(0),
+    m_generation(0), m_stop(false)
+{
+    if (nThreads == 0)
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    m_shares.reset(new Share[nThreads]);
+    for (unsigned int i = 0; i < nThreads; ++i)
+    {
+        m_shares[i].next = 0;
+        m_shares[i].end = 0;
+    }
+
+    // the caller of parallelFor is the last thread
+    for (unsigned int i = 1; i < nThreads; ++i)
+    {
+        m_workers.emplace_back(&ThreadPool::workerLoop, this, i - 1);
+        if (pinThreads)
+            pinThread(m_workers.back().native_handle(), i);
+    }
+
+#if defined(__linux__)
+    if (pinThreads)
+        pinThread(pthread_self(), 0);
+#endif
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for (std::thread& worker : m_workers)
+        worker.join();
+}
+
+ThreadPool& ThreadPool::global()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::parallelFor(size_t begin, size_t end, size_t grain,
+                             const std::function<void(size_t, size_t)>& fn)
+{
+    if (begin >= end)
+        return;
+    grain = std::max<size_t>(grain, 1);
+
+    if (m_workers.empty() || t_inParallelFor || end - begin <= grain)
+    {
+        for (size_t i = begin; i < end; i += grain)
+            fn(i, std::min(i + grain, end));
+        return;
+    }
+
+    std::lock_guard<std::mutex> submit(m_submitMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_job = &fn;
+        m_begin = begin;
+        m_end = end;
+        m_grain = grain;
+
+        // thread i starts on the i-th contiguous run of chunks, the same
+        // one for every loop of the same length
+        size_t nChunks = (end - begin + grain - 1) / grain;
+        unsigned int nShares = size();
+        for (unsigned int i = 0; i < nShares; ++i)
+        {
+            std::lock_guard<std::mutex> shareLock(m_shares[i].mutex);
+            m_shares[i].next = nChunks * i / nShares;
+            m_shares[i].end = nChunks * (i + 1) / nShares;
+        }
+
+        m_pending = (unsigned int)m_workers.size();
+        ++m_generation;
+    }
+    m_wake.notify_all();
+
+    runChunks((unsigned int)m_workers.size());
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_pending == 0; });
+    m_job = nullptr;
+}
+
+void ThreadPool::parallelForTiles(int width, int height, int tileWidth, int tileHeight,
+                                  const std::function<void(int, int, int, int)>& fn)
+{
+    if (width <= 0 || height <= 0)
+        return;
+    tileWidth = std::max(tileWidth, 1);
+    tileHeight = std::max(tileHeight, 1);
+
+    // row major tile order, neighbouring tiles end up in the same share
+    size_t tilesX = (width + tileWidth - 1) / tileWidth;
+    size_t tilesY = (height + tileHeight - 1) / tileHeight;
+
+    parallelFor(0, tilesX * tilesY, 1, [&](size_t tile, size_t)
+    {
+        int x0 = (int)(tile % tilesX) * tileWidth;
+        int y0 = (int)(tile / tilesX) * tileHeight;
+        fn(x0, y0, std::min(x0 + tileWidth, width), std::min(y0 + tileHeight, height));
+    });
+}
+
+void ThreadPool::runChunks(unsigned int index)
+{
+    t_inParallelFor = true;
+    size_t chunk;
+    while (takeChunk(index, chunk))
+    {
+        size_t chunkBegin = m_begin + chunk * m_grain;
+        (*m_job)(chunkBegin, std::min(chunkBegin + m_grain, m_end));
+    }
+    t_inParallelFor = false;
+}
+
+// Front of the own share first, then the upper half of the first other
+// share with work left. Only one share lock is held at a time
+bool ThreadPool::takeChunk(unsigned int index, size_t& chunk)
+{
+    Share& own = m_shares[index];
+    {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (own.next < own.end)
+        {
+            chunk = own.next++;
+            return true;
+        }
+    }
+
+    unsigned int nShares = size();
+    for (unsigned int i = 1; i < nShares; ++i)
+    {
+        Share& victim = m_shares[(index + i) % nShares];
+        size_t stolenBegin, stolenEnd;
+        {
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            size_t remaining = victim.end - victim.next;
+            if (remaining == 0)
+                continue;
+
+            stolenEnd = victim.end;
+            stolenBegin = victim.next + remaining / 2;
+            victim.end = stolenBegin;
+        }
+
+        // the rest of the stolen run becomes the own share
+        std::lock_guard<std::mutex> lock(own.mutex);
+        own.next = stolenBegin + 1;
+        own.end = stolenEnd;
+        chunk = stolenBegin;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(unsigned int index)
+{
+    TRACE_THREAD_NAME("pool worker");
+    unsigned int seen = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this, seen] { return m_stop || m_generation != seen; });
+            if (m_stop)
+                return;
+            seen = m_generation;
+        }
+
+        {
+            TRACE_SCOPE("parallel for", "cpu");
+            runChunks(index);
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_pending == 0)
+            m_done.notify_all();
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running parallel loops. The calling thread
+// takes part in the loop. Every thread starts on its own contiguous share
+// of the chunks and steals the upper half of another thread's remaining
+// share once its own runs out, so uneven chunks balance out while the
+// same thread keeps touching the same rows from one loop to the next.
+// Loops started from inside a loop run serially.
+class ThreadPool
+{
+public:
+    // nThreads = 0 uses one thread per hardware thread. pinThreads binds
+    // worker i to CPU i + 1 and the constructing thread, which is expected
+    // to call parallelFor, to CPU 0 (Linux only). Pages first touched by a
+    // share then stay on the NUMA node that works on them
+    explicit ThreadPool(unsigned int nThreads = 0, bool pinThreads = false);
+    ~ThreadPool();
+
+    // Pool shared by the image loading and processing code
+    static ThreadPool& global();
+
+    unsigned int size() const { return (unsigned int)m_workers.size() + 1; }
+
+    // Calls fn(chunkBegin, chunkEnd) over [begin, end) in chunks of at most
+    // grain items, chunk k starting at begin + k * grain, and returns once
+    // all of them are done. fn must not throw
+    void parallelFor(size_t begin, size_t end, size_t grain,
+                     const std::function<void(size_t, size_t)>& fn);
+
+    // Calls fn(x0, y0, x1, y1) for the tileWidth x tileHeight tiles that
+    // cover a width x height plane, clipped at its edges
+    void parallelForTiles(int width, int height, int tileWidth, int tileHeight,
+                          const std::function<void(int, int, int, int)>& fn);
+
+private:
+    // chunk indices [next, end) still owned by one thread
+    struct Share
+    {
+        std::mutex mutex;
+        size_t next;
+        size_t end;
+    };
+
+    void workerLoop(unsigned int index);
+    void runChunks(unsigned int index);
+    bool takeChunk(unsigned int index, size_t& chunk);
+
+    std::vector<std::thread> m_workers;
+    std::unique_ptr<Share[]> m_shares;  // one per thread, the caller's last
+
+    std::mutex m_submitMutex;   // one loop at a time
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+
+    const std::function<void(size_t, size_t)>* m_job;
+    size_t m_begin;
+    size_t m_end;
+    size_t m_grain;
+    unsigned int m_pending;
+    unsigned int m_generation;
+    bool m_stop;
+};
+
+#endif // THREADPOOL_H
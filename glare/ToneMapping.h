@@ -0,0 +1,23 @@
+#ifndef TONEMAPPING_H
+#define TONEMAPPING_H
+
+// Tone mapping operators and their constants, shared by the OpenCL and
+// the host renderers
+
+// Number of centre-surround scales of the local Reinhard operator,
+// the Gaussian pyramid holds one more level for the last surround
+#define TM_LOCAL_SCALES 8
+
+// Bins of the log luminance histogram, also the work-group size of the
+// histogram kernels (see histogram_adjustment.cl)
+#define TM_HIST_BINS 256
+#define TM_HIST_MAX_GROUPS 256
+
+enum ToneMapOperator
+{
+    TM_REINHARD_EXTENDED = 0,
+    TM_REINHARD_LOCAL    = 1,
+    TM_HISTOGRAM_ADJUSTMENT = 2
+};
+
+#endif // TONEMAPPING_H
@@ -0,0 +1,250 @@
+#include "Trace.h"
+
+#include <chrono>
+
+#ifdef GLARE_TRACING
+
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+enum TraceEventType
+{
+    TRACE_EVENT_SPAN,
+    TRACE_EVENT_DEVICE_SPAN,
+    TRACE_EVENT_COUNTER
+};
+
+struct TraceEvent
+{
+    const char* name;
+    const char* category;
+    unsigned long long start;
+    unsigned long long end;
+    unsigned long long queued;      // device spans
+    double value;                   // counters
+    int type;
+    int queue;                      // device spans
+};
+
+// Written by its thread only. An event is visible to the exporter once
+// count is past it
+struct TraceThread
+{
+    std::unique_ptr<TraceEvent[]> events;
+    std::atomic<size_t> count;
+    std::atomic<size_t> dropped;
+    std::atomic<const char*> name;
+    std::atomic<unsigned int> capture;
+    int id;
+};
+
+// Buffers are kept until the process ends, threads that finished still
+// have their events in them
+static std::mutex s_threadsMutex;
+static std::vector<std::unique_ptr<TraceThread> > s_threads;
+
+static std::atomic<bool> s_active(false);
+static std::atomic<unsigned int> s_capture(0);
+static unsigned long long s_captureStart = 0;
+
+static TraceThread* threadBuffer()
+{
+    static thread_local TraceThread* buffer = nullptr;
+    if (buffer == nullptr)
+    {
+        std::unique_ptr<TraceThread> created(new TraceThread);
+        created->events.reset(new TraceEvent[TRACE_THREAD_EVENTS]);
+        created->count = 0;
+        created->dropped = 0;
+        created->name = nullptr;
+        created->capture = 0;
+
+        std::lock_guard<std::mutex> lock(s_threadsMutex);
+        created->id = (int)s_threads.size() + 1;
+        buffer = created.get();
+        s_threads.push_back(std::move(created));
+    }
+
+    // the first event of a new capture starts the buffer again
+    unsigned int capture = s_capture.load(std::memory_order_acquire);
+    if (buffer->capture.load(std::memory_order_relaxed) != capture)
+    {
+        buffer->count.store(0, std::memory_order_relaxed);
+        buffer->dropped.store(0, std::memory_order_relaxed);
+        buffer->capture.store(capture, std::memory_order_release);
+    }
+    return buffer;
+}
+
+static void record(const TraceEvent& event)
+{
+    if (!s_active.load(std::memory_order_relaxed))
+        return;
+
+    TraceThread* buffer = threadBuffer();
+    size_t n = buffer->count.load(std::memory_order_relaxed);
+    if (n >= TRACE_THREAD_EVENTS)
+    {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffer->events[n] = event;
+    buffer->count.store(n + 1, std::memory_order_release);
+}
+
+bool traceAvailable()
+{
+    return true;
+}
+
+bool traceStart()
+{
+    s_captureStart = traceNow();
+    s_capture.fetch_add(1, std::memory_order_release);
+    s_active.store(true, std::memory_order_release);
+    return true;
+}
+
+void traceStop()
+{
+    s_active.store(false, std::memory_order_release);
+}
+
+bool traceActive()
+{
+    return s_active.load(std::memory_order_relaxed);
+}
+
+void traceSpan(const char* name, const char* category, unsigned long long start, unsigned long long end)
+{
+    TraceEvent event = { name, category, start, end, 0, 0.0, TRACE_EVENT_SPAN, 0 };
+    record(event);
+}
+
+void traceDeviceSpan(const char* name, int queue, unsigned long long queued, unsigned long long start,
+                     unsigned long long end)
+{
+    TraceEvent event = { name, "device", start, end, queued, 0.0, TRACE_EVENT_DEVICE_SPAN, queue };
+    record(event);
+}
+
+void traceCounter(const char* name, double value)
+{
+    unsigned long long now = traceNow();
+    TraceEvent event = { name, "counter", now, now, 0, value, TRACE_EVENT_COUNTER, 0 };
+    record(event);
+}
+
+void traceThreadName(const char* name)
+{
+    threadBuffer()->name.store(name, std::memory_order_release);
+}
+
+// Chrome wants microseconds from the start of the capture
+static double microseconds(unsigned long long ns)
+{
+    return ns > s_captureStart ? (ns - s_captureStart) / 1000.0 : 0.0;
+}
+
+static void writeMetadata(std::ofstream& file, bool& first, const char* kind, int pid, int tid, const std::string& name)
+{
+    file << (first ? "\n" : ",\n") << "{\"name\": \"" << kind << "\", \"ph\": \"M\", \"pid\": " << pid;
+    if (tid > 0)
+        file << ", \"tid\": " << tid;
+    file << ", \"args\": {\"name\": \"" << name << "\"}}";
+    first = false;
+}
+
+bool traceWriteChrome(const std::string& path)
+{
+    traceStop();
+    unsigned int capture = s_capture.load(std::memory_order_acquire);
+
+    std::ofstream file(path);
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+
+    bool first = true;
+    writeMetadata(file, first, "process_name", TRACE_LANE_HOST, 0, "host");
+    writeMetadata(file, first, "process_name", TRACE_LANE_DEVICE, 0, "OpenCL device");
+
+    std::vector<bool> queues;
+    size_t dropped = 0;
+    std::lock_guard<std::mutex> lock(s_threadsMutex);
+    for (const std::unique_ptr<TraceThread>& thread : s_threads)
+    {
+        if (thread->capture.load(std::memory_order_acquire) != capture)
+            continue;
+
+        size_t count = thread->count.load(std::memory_order_acquire);
+        dropped += thread->dropped.load(std::memory_order_relaxed);
+        const char* name = thread->name.load(std::memory_order_acquire);
+        if (count == 0)
+            continue;
+        writeMetadata(file, first, "thread_name", TRACE_LANE_HOST, thread->id,
+                      name ? std::string(name) : "thread " + std::to_string(thread->id));
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            const TraceEvent& event = thread->events[i];
+            file << (first ? "\n" : ",\n") << "{\"name\": \"" << event.name << "\", \"cat\": \"" << event.category
+                 << "\", \"ts\": " << microseconds(event.start);
+            if (event.type == TRACE_EVENT_COUNTER)
+            {
+                file << ", \"ph\": \"C\", \"pid\": " << TRACE_LANE_DEVICE << ", \"args\": {\"value\": "
+                     << event.value << "}}";
+            }
+            else if (event.type == TRACE_EVENT_DEVICE_SPAN)
+            {
+                // how long the command waited between its enqueue and start
+                file << ", \"dur\": " << (event.end > event.start ? (event.end - event.start) / 1000.0 : 0.0)
+                     << ", \"ph\": \"X\", \"pid\": " << TRACE_LANE_DEVICE << ", \"tid\": " << event.queue
+                     << ", \"args\": {\"wait_us\": " << (event.start > event.queued ? (event.start - event.queued) / 1000.0 : 0.0) << "}}";
+                if ((size_t)event.queue >= queues.size())
+                    queues.resize(event.queue + 1, false);
+                queues[event.queue] = true;
+            }
+            else
+            {
+                file << ", \"dur\": " << (event.end - event.start) / 1000.0 << ", \"ph\": \"X\", \"pid\": "
+                     << TRACE_LANE_HOST << ", \"tid\": " << thread->id << "}";
+            }
+            first = false;
+        }
+    }
+
+    for (size_t queue = 0; queue < queues.size(); ++queue)
+        if (queues[queue])
+            writeMetadata(file, first, "thread_name", TRACE_LANE_DEVICE, (int)queue,
+                          queue == 1 ? "queue" : "queue " + std::to_string(queue));
+    file << "\n]}\n";
+
+    if (dropped > 0)
+        std::cout << "Trace: " << dropped << " events dropped, more than " << TRACE_THREAD_EVENTS << " on a thread\n";
+    return (bool)file;
+}
+
+#else
+
+bool traceAvailable() { return false; }
+bool traceStart() { return false; }
+void traceStop() {}
+bool traceActive() { return false; }
+bool traceWriteChrome(const std::string&) { return false; }
+void traceSpan(const char*, const char*, unsigned long long, unsigned long long) {}
+void traceDeviceSpan(const char*, int, unsigned long long, unsigned long long, unsigned long long) {}
+void traceCounter(const char*, double) {}
+void traceThreadName(const char*) {}
+
+#endif // GLARE_TRACING
+
+unsigned long long traceNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,80 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+
+// Events a thread can record per capture, later ones are counted as dropped
+#define TRACE_THREAD_EVENTS 65536
+
+// Lanes of the exported trace, Perfetto shows each as a process
+enum TraceLane
+{
+    TRACE_LANE_HOST = 1,        // one track per host thread
+    TRACE_LANE_DEVICE = 2       // one track per command queue
+};
+
+// Timeline capture of host and device activity, exported as Chrome
+// trace-event JSON for chrome://tracing or ui.perfetto.dev. Host spans
+// come from TRACE_SCOPE, device spans from the renderer's profiling
+// events mapped to the host clock. Each thread records into a buffer of
+// its own without locks or allocation, the exporter reads what the
+// threads published once the capture is stopped.
+//
+// Built only with GLARE_TRACING defined (cmake -DGLARE_TRACING=ON).
+// Without it the macros expand to nothing and traceStart() fails, so
+// production builds carry no cost.
+bool traceAvailable();
+// Starts a new capture, false when tracing is not built in
+bool traceStart();
+void traceStop();
+bool traceActive();
+// Stops the capture and writes it, false when it could not be written
+bool traceWriteChrome(const std::string& path);
+
+// ns of the steady clock, the time base of every event
+unsigned long long traceNow();
+
+// name and category must outlive the capture, string literals in practice
+void traceSpan(const char* name, const char* category, unsigned long long start, unsigned long long end);
+// a command of queue 1, 2, ... with its times already on the host clock
+void traceDeviceSpan(const char* name, int queue, unsigned long long queued, unsigned long long start,
+                     unsigned long long end);
+// a counter track of the device process, device memory in practice
+void traceCounter(const char* name, double value);
+void traceThreadName(const char* name);
+
+#ifdef GLARE_TRACING
+
+// Span of the enclosing scope on the calling thread
+class TraceScope
+{
+public:
+    TraceScope(const char* name, const char* category) :
+        m_name(name), m_category(category), m_start(traceActive() ? traceNow() : 0) {}
+    ~TraceScope()
+    {
+        if (m_start != 0)
+            traceSpan(m_name, m_category, m_start, traceNow());
+    }
+
+private:
+    const char* m_name;
+    const char* m_category;
+    unsigned long long m_start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name, category) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name, category)
+#define TRACE_COUNTER(name, value) traceCounter(name, value)
+#define TRACE_THREAD_NAME(name) traceThreadName(name)
+
+#else
+
+#define TRACE_SCOPE(name, category)
+#define TRACE_COUNTER(name, value)
+#define TRACE_THREAD_NAME(name)
+
+#endif // GLARE_TRACING
+
+#endif // TRACE_H
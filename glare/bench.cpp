@@ -0,0 +1,1177 @@
+// End to end frame benchmark. Renders synthetic HDR scenes of several
+// sizes through the whole glare pipeline, with a fixed seed so every run
+// renders the same frames, and reports frame time percentiles, the stage
+// breakdown and throughput as JSON. A stored report can be given as the
+// baseline to flag frame times that regressed beyond a threshold.
+//
+// With --kernels it times the 2D kernels on their own instead, across
+// work-group sizes, and stores the best for each size class in the
+// tuning file the renderer reads at startup (see KernelTuning.h).
+//
+// With --accuracy it compares pipeline configurations instead: the first
+// frame of every case is rendered once in double precision by
+// ReferenceRenderer and once by each configuration, which is then timed
+// like a case. The report has the error of each on the linear output
+// next to its frame time and marks the Pareto front, --plot draws it.
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <limits>    // cxxopts.hpp relies on it being included
+
+#include "cxxopts.hpp"
+
+#include "TemporalGlareRenderer.h"
+#include "BenchScenes.h"
+#include "KernelBench.h"
+#include "KernelTuning.h"
+#include "ReferenceRenderer.h"
+#include "Trace.h"
+
+// One scene at one size
+struct BenchCase
+{
+    BenchScene scene;
+    int width;
+    int height;
+};
+
+struct BenchResult
+{
+    BenchCase benchCase;
+    std::vector<double> frameMs;        // measured frames, sorted
+    FrameTimings stages;                // medians of the host stage timings
+    bool hasDeviceStages;
+    double deviceStages[PROFILE_STAGES]; // medians of the device busy times
+    double devicePeakMb;                // device memory at the peak of the case, < 0 on the cpu
+    double baselineMs;                  // median of the baseline, < 0 without one
+};
+
+// Nearest rank percentile of sorted values
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0.0;
+    size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+static double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return percentile(values, 50.0);
+}
+
+static std::vector<std::string> splitList(const std::string& text, char separator = ',')
+{
+    std::vector<std::string> items;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, separator))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+// 512 for 512x512, WxH, or the names of the usual video sizes
+static bool parseSize(const std::string& text, int& width, int& height)
+{
+    if (text == "hd" || text == "1080p") { width = 1920; height = 1080; return true; }
+    if (text == "4k")  { width = 3840; height = 2160; return true; }
+    if (text == "8k")  { width = 7680; height = 4320; return true; }
+
+    char* end = nullptr;
+    width = (int)std::strtol(text.c_str(), &end, 10);
+    height = width;
+    if (*end == 'x')
+        height = (int)std::strtol(end + 1, &end, 10);
+    return *end == '\0' && width > 0 && height > 0;
+}
+
+// A pipeline configuration of --accuracy
+struct AccuracyConfig
+{
+    std::string name;
+    RenderBackend backend;
+    RenderQuality quality;
+    bool halfImages;        // image stored as half floats on the host
+    bool tiled;             // tiled convolution with its smaller PSF, opencl only
+};
+
+struct AccuracyResult
+{
+    BenchCase benchCase;
+    AccuracyConfig config;
+    double medianMs;
+    double psnr;            // dB over the peak of the reference
+    double relativeL2;
+    double maxError;        // largest absolute difference
+    double peak;            // of the reference
+    bool pareto;            // no other configuration of the case is both faster and closer
+};
+
+// backend[:half][:s<samples>][:x<scale>][:tiled], for example cpu:s8:x0.5
+static bool parseConfig(const std::string& text, AccuracyConfig& config)
+{
+    std::vector<std::string> parts = splitList(text, ':');
+    if (parts.empty() || (parts[0] != "cpu" && parts[0] != "opencl"))
+        return false;
+
+    config.name = text;
+    config.backend = parts[0] == "cpu" ? RENDER_BACKEND_CPU : RENDER_BACKEND_OPENCL;
+    config.quality.scale = 1.0f;
+    config.quality.spectralSamples = CPU_RENDER_SPECTRAL_SAMPLES;
+    config.halfImages = false;
+    config.tiled = false;
+
+    for (size_t i = 1; i < parts.size(); ++i)
+    {
+        const std::string& part = parts[i];
+        char* end = nullptr;
+        if (part == "half")
+            config.halfImages = true;
+        else if (part == "tiled")
+            config.tiled = true;
+        else if (part[0] == 's')
+            config.quality.spectralSamples = (int)std::strtol(part.c_str() + 1, &end, 10);
+        else if (part[0] == 'x')
+            config.quality.scale = std::strtof(part.c_str() + 1, &end);
+        else
+            return false;
+        if (end != nullptr && (*end != '\0' || end == part.c_str() + 1))
+            return false;
+    }
+    return config.quality.spectralSamples > 0 && config.quality.scale > 0.0f;
+}
+
+// What --accuracy compares without --configs
+static std::string defaultConfigs(RenderBackend backend)
+{
+    std::string name = backend == RENDER_BACKEND_CPU ? "cpu" : "opencl";
+    std::string configs;
+    for (const char* options : {"", ":half", ":s16", ":s8", ":s4", ":x0.75", ":x0.5", ":s8:x0.5"})
+        configs += (configs.empty() ? "" : ",") + name + options;
+    if (backend == RENDER_BACKEND_OPENCL)
+        configs += ",opencl:tiled,cpu";
+    return configs;
+}
+
+// Just enough of a JSON reader for the reports glare-bench writes
+struct JsonValue
+{
+    enum Type { NONE, NUMBER, STRING, BOOLEAN, ARRAY, OBJECT } type = NONE;
+    double number = 0.0;
+    std::string text;
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue> > members;
+
+    const JsonValue* get(const std::string& key) const
+    {
+        for (const std::pair<std::string, JsonValue>& member : members)
+            if (member.first == key)
+                return &member.second;
+        return nullptr;
+    }
+};
+
+class JsonReader
+{
+public:
+    explicit JsonReader(const std::string& text) : m_text(text), m_pos(0) {}
+
+    bool parse(JsonValue& value)
+    {
+        return parseValue(value) && (skipSpace(), m_pos == m_text.size());
+    }
+
+private:
+    void skipSpace()
+    {
+        while (m_pos < m_text.size() && std::isspace((unsigned char)m_text[m_pos]))
+            ++m_pos;
+    }
+
+    bool parseString(std::string& out)
+    {
+        if (m_text[m_pos] != '"')
+            return false;
+        for (++m_pos; m_pos < m_text.size(); ++m_pos)
+        {
+            char c = m_text[m_pos];
+            if (c == '"')
+            {
+                ++m_pos;
+                return true;
+            }
+            if (c == '\\' && ++m_pos < m_text.size())
+                c = m_text[m_pos] == 'n' ? '\n' : (m_text[m_pos] == 't' ? '\t' : m_text[m_pos]);
+            out += c;
+        }
+        return false;
+    }
+
+    bool parseValue(JsonValue& value)
+    {
+        skipSpace();
+        if (m_pos >= m_text.size())
+            return false;
+
+        char c = m_text[m_pos];
+        if (c == '{' || c == '[')
+        {
+            bool object = c == '{';
+            value.type = object ? JsonValue::OBJECT : JsonValue::ARRAY;
+            ++m_pos;
+            skipSpace();
+            if (m_pos < m_text.size() && m_text[m_pos] == (object ? '}' : ']'))
+            {
+                ++m_pos;
+                return true;
+            }
+            while (true)
+            {
+                JsonValue item;
+                if (object)
+                {
+                    std::string key;
+                    skipSpace();
+                    if (m_pos >= m_text.size() || !parseString(key))
+                        return false;
+                    skipSpace();
+                    if (m_pos >= m_text.size() || m_text[m_pos++] != ':' || !parseValue(item))
+                        return false;
+                    value.members.push_back(std::make_pair(key, item));
+                }
+                else
+                {
+                    if (!parseValue(item))
+                        return false;
+                    value.items.push_back(item);
+                }
+
+                skipSpace();
+                if (m_pos >= m_text.size())
+                    return false;
+                char next = m_text[m_pos++];
+                if (next == (object ? '}' : ']'))
+                    return true;
+                if (next != ',')
+                    return false;
+            }
+        }
+        if (c == '"')
+        {
+            value.type = JsonValue::STRING;
+            return parseString(value.text);
+        }
+        if (m_text.compare(m_pos, 4, "true") == 0 || m_text.compare(m_pos, 5, "false") == 0)
+        {
+            value.type = JsonValue::BOOLEAN;
+            value.number = c == 't' ? 1.0 : 0.0;
+            m_pos += c == 't' ? 4 : 5;
+            return true;
+        }
+        if (m_text.compare(m_pos, 4, "null") == 0)
+        {
+            m_pos += 4;
+            return true;
+        }
+
+        const char* begin = m_text.c_str() + m_pos;
+        char* end = nullptr;
+        value.number = std::strtod(begin, &end);
+        if (end == begin)
+            return false;
+        value.type = JsonValue::NUMBER;
+        m_pos += end - begin;
+        return true;
+    }
+
+    const std::string& m_text;
+    size_t m_pos;
+};
+
+// Median frame time of the baseline for the case, < 0 when it has none
+static double baselineMedian(const JsonValue& baseline, const BenchCase& benchCase)
+{
+    const JsonValue* results = baseline.get("results");
+    if (!results)
+        return -1.0;
+
+    for (const JsonValue& result : results->items)
+    {
+        const JsonValue* scene = result.get("scene");
+        const JsonValue* width = result.get("width");
+        const JsonValue* height = result.get("height");
+        const JsonValue* medianMs = result.get("median_ms");
+        if (scene && width && height && medianMs && scene->text == benchSceneName(benchCase.scene) &&
+            (int)width->number == benchCase.width && (int)height->number == benchCase.height)
+            return medianMs->number;
+    }
+    return -1.0;
+}
+
+static std::string jsonNumber(double value)
+{
+    std::ostringstream out;
+    out.precision(6);
+    out << (std::isfinite(value) ? value : 0.0);
+    return out.str();
+}
+
+static void writeReport(std::ostream& out, const std::vector<BenchResult>& results, const std::string& backend,
+                        unsigned int seed, int warmup, int frames, const RenderQuality& quality,
+                        double threshold, bool hasBaseline, int regressions)
+{
+    out << "{\n";
+    out << "  \"backend\": \"" << backend << "\",\n";
+    out << "  \"seed\": " << seed << ",\n";
+    out << "  \"warmup\": " << warmup << ",\n";
+    out << "  \"frames\": " << frames << ",\n";
+    out << "  \"scale\": " << jsonNumber(quality.scale) << ",\n";
+    out << "  \"spectral_samples\": " << quality.spectralSamples << ",\n";
+    out << "  \"results\": [";
+
+    for (size_t r = 0; r < results.size(); ++r)
+    {
+        const BenchResult& result = results[r];
+        const std::vector<double>& ms = result.frameMs;
+        double medianMs = percentile(ms, 50.0);
+        double megapixels = (double)result.benchCase.width * result.benchCase.height / 1e6;
+
+        out << (r == 0 ? "\n" : ",\n") << "    {\n";
+        out << "      \"scene\": \"" << benchSceneName(result.benchCase.scene) << "\",\n";
+        out << "      \"width\": " << result.benchCase.width << ",\n";
+        out << "      \"height\": " << result.benchCase.height << ",\n";
+        out << "      \"median_ms\": " << jsonNumber(medianMs) << ",\n";
+        out << "      \"p95_ms\": " << jsonNumber(percentile(ms, 95.0)) << ",\n";
+        out << "      \"p99_ms\": " << jsonNumber(percentile(ms, 99.0)) << ",\n";
+        out << "      \"min_ms\": " << jsonNumber(ms.empty() ? 0.0 : ms.front()) << ",\n";
+        out << "      \"max_ms\": " << jsonNumber(ms.empty() ? 0.0 : ms.back()) << ",\n";
+        out << "      \"megapixels_per_s\": " << jsonNumber(medianMs > 0.0 ? megapixels / (medianMs / 1000.0) : 0.0) << ",\n";
+        out << "      \"stages_ms\": {\"aperture\": " << jsonNumber(result.stages.aperture)
+            << ", \"spectral\": " << jsonNumber(result.stages.spectral)
+            << ", \"convolution\": " << jsonNumber(result.stages.convolution)
+            << ", \"tone_map\": " << jsonNumber(result.stages.toneMap)
+            << ", \"total\": " << jsonNumber(result.stages.total) << "}";
+
+        if (result.hasDeviceStages)
+        {
+            out << ",\n      \"device_stages_ms\": {";
+            for (int stage = 0; stage < PROFILE_STAGES; ++stage)
+                out << (stage ? ", " : "") << "\"" << profileStageName(stage) << "\": " << jsonNumber(result.deviceStages[stage]);
+            out << "}";
+        }
+        if (result.devicePeakMb >= 0.0)
+            out << ",\n      \"device_peak_mb\": " << jsonNumber(result.devicePeakMb);
+
+        if (result.baselineMs > 0.0)
+        {
+            double change = (medianMs - result.baselineMs) / result.baselineMs * 100.0;
+            out << ",\n      \"baseline_median_ms\": " << jsonNumber(result.baselineMs);
+            out << ",\n      \"change_percent\": " << jsonNumber(change);
+            out << ",\n      \"regression\": " << (change > threshold ? "true" : "false");
+        }
+        out << "\n    }";
+    }
+
+    out << "\n  ]";
+    if (hasBaseline)
+    {
+        out << ",\n  \"threshold_percent\": " << jsonNumber(threshold);
+        out << ",\n  \"regressions\": " << regressions;
+    }
+    out << "\n}\n";
+}
+
+static void writeKernelReport(std::ostream& out, const std::string& device, const std::string& tuningPath,
+                              int spectralSamples, const std::vector<KernelTiming>& timings,
+                              const KernelTuning& tuning)
+{
+    out << "{\n";
+    out << "  \"device\": \"" << device << "\",\n";
+    out << "  \"tuning_file\": \"" << tuningPath << "\",\n";
+    out << "  \"spectral_samples\": " << spectralSamples << ",\n";
+    out << "  \"kernels\": [";
+    for (size_t i = 0; i < timings.size(); ++i)
+    {
+        const KernelTiming& timing = timings[i];
+        int sizeClass = KernelTuning::sizeClass(timing.width, timing.height);
+        WorkGroupSize best;
+        bool isBest = tuning.find(device, timing.kernel, sizeClass, best) &&
+                      best.x == timing.local.x && best.y == timing.local.y;
+
+        out << (i == 0 ? "\n" : ",\n") << "    {\"kernel\": \"" << timing.kernel << "\""
+            << ", \"width\": " << timing.width << ", \"height\": " << timing.height
+            << ", \"size_class\": " << sizeClass
+            << ", \"local\": [" << timing.local.x << ", " << timing.local.y << "]"
+            << ", \"median_ms\": " << jsonNumber(timing.medianMs)
+            << ", \"gb_per_s\": " << jsonNumber(timing.gbPerS)
+            << ", \"gflop_per_s\": " << jsonNumber(timing.gflopPerS)
+            << ", \"best\": " << (isBest ? "true" : "false") << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+// Times every kernel at every size and local size. The best local size of
+// a kernel and size class is the one with the lowest time relative to the
+// fastest at each size of the class, among those that ran at all of them
+static void benchmarkKernels(TemporalGlareRenderer& renderer, const std::vector<BenchCase>& sizes,
+                             int repetitions, int spectralSamples,
+                             std::vector<KernelTiming>& timings, KernelTuning& tuning)
+{
+    KernelBench bench(renderer.getContext(), renderer.getDevice(), renderer.getProgram(), spectralSamples);
+    const std::string& device = renderer.getDeviceName();
+
+    for (const std::string& kernel : KernelBench::kernelNames())
+    {
+        std::map<int, std::vector<std::vector<KernelTiming> > > classes;
+        for (const BenchCase& size : sizes)
+        {
+            std::vector<KernelTiming> runs = bench.run(kernel, size.width, size.height, repetitions);
+            if (runs.empty())
+                continue;
+            double fastest = runs[0].medianMs;
+            for (const KernelTiming& run : runs)
+                fastest = std::min(fastest, run.medianMs);
+            std::cerr << kernel << " " << size.width << "x" << size.height << ": " << fastest << " ms at best" << std::endl;
+
+            // the class of the launch, which is what tunedRange looks up
+            classes[KernelTuning::sizeClass(runs[0].width, runs[0].height)].push_back(runs);
+            timings.insert(timings.end(), runs.begin(), runs.end());
+        }
+
+        for (const auto& sizeClass : classes)
+        {
+            std::map<std::pair<int, int>, std::pair<int, double> > scores;
+            for (const std::vector<KernelTiming>& runs : sizeClass.second)
+            {
+                double fastest = runs[0].medianMs;
+                for (const KernelTiming& run : runs)
+                    fastest = std::min(fastest, run.medianMs);
+                for (const KernelTiming& run : runs)
+                {
+                    std::pair<int, double>& score = scores[std::make_pair(run.local.x, run.local.y)];
+                    score.first += 1;
+                    score.second += fastest > 0.0 ? run.medianMs / fastest : 1.0;
+                }
+            }
+
+            bool found = false;
+            std::pair<int, int> best;
+            double bestScore = 0.0;
+            for (const auto& score : scores)
+                if (score.second.first == (int)sizeClass.second.size() && (!found || score.second.second < bestScore))
+                {
+                    found = true;
+                    best = score.first;
+                    bestScore = score.second.second;
+                }
+            if (found)
+            {
+                WorkGroupSize local = { best.first, best.second };
+                tuning.set(device, kernel, sizeClass.first, local);
+            }
+        }
+    }
+}
+
+// Error of a frame against the reference on the linear output. Frames
+// rendered below scale 1 are upsampled bilinearly to the reference size,
+// as they are shown. A value that is not finite, half floats overflowing
+// for instance, is an infinite error
+static void compareWithReference(const ReferenceRenderer& reference, const std::vector<float> planes[3],
+                                 int width, int height, AccuracyResult& result)
+{
+    const int referenceWidth = reference.getWidth();
+    const int referenceHeight = reference.getHeight();
+    double squared = 0.0, referenceSquared = 0.0, maxError = 0.0, peak = 0.0;
+
+    for (int c = 0; c < 3; ++c)
+    {
+        const float* plane = planes[c].data();
+        const double* expected = reference.getHdr(c);
+        for (int y = 0; y < referenceHeight; ++y)
+        {
+            double sy = std::max(0.0, std::min((y + 0.5) * height / referenceHeight - 0.5, height - 1.0));
+            int y0 = (int)sy;
+            int y1 = std::min(y0 + 1, height - 1);
+            double fy = sy - y0;
+            for (int x = 0; x < referenceWidth; ++x)
+            {
+                double sx = std::max(0.0, std::min((x + 0.5) * width / referenceWidth - 0.5, width - 1.0));
+                int x0 = (int)sx;
+                int x1 = std::min(x0 + 1, width - 1);
+                double fx = sx - x0;
+                double value = (1 - fy) * ((1 - fx) * plane[(size_t)y0 * width + x0] + fx * plane[(size_t)y0 * width + x1]) +
+                               fy * ((1 - fx) * plane[(size_t)y1 * width + x0] + fx * plane[(size_t)y1 * width + x1]);
+
+                double r = expected[(size_t)y * referenceWidth + x];
+                double error = std::isfinite(value) ? value - r : std::numeric_limits<double>::infinity();
+                squared += error * error;
+                referenceSquared += r * r;
+                maxError = std::max(maxError, std::abs(error));
+                peak = std::max(peak, std::abs(r));
+            }
+        }
+    }
+
+    double mse = squared / (3.0 * referenceWidth * referenceHeight);
+    result.relativeL2 = referenceSquared > 0.0 ? std::sqrt(squared / referenceSquared) : 0.0;
+    result.psnr = mse > 0.0 ? 10.0 * std::log10(peak * peak / mse) : std::numeric_limits<double>::infinity();
+    result.maxError = maxError;
+    result.peak = peak;
+}
+
+static bool sameCase(const BenchCase& a, const BenchCase& b)
+{
+    return a.scene == b.scene && a.width == b.width && a.height == b.height;
+}
+
+// A configuration is on the front when no other one of its case is at
+// least as fast and as close to the reference, and better in one of them
+static void markParetoFront(std::vector<AccuracyResult>& results)
+{
+    for (AccuracyResult& result : results)
+    {
+        result.pareto = true;
+        for (const AccuracyResult& other : results)
+            if (&other != &result && sameCase(other.benchCase, result.benchCase) &&
+                other.medianMs <= result.medianMs && other.relativeL2 <= result.relativeL2 &&
+                (other.medianMs < result.medianMs || other.relativeL2 < result.relativeL2))
+            {
+                result.pareto = false;
+                break;
+            }
+    }
+}
+
+// The first frame of the case in double precision, with the aperture the
+// CPU backend renders it from at full quality
+static bool renderReference(const BenchCase& benchCase, const std::vector<float>& red, const std::vector<float>& green,
+                            const std::vector<float>& blue, unsigned int seed, unsigned int threads, bool pinThreads,
+                            ReferenceRenderer& reference)
+{
+    TemporalGlareRenderer renderer(RENDER_BACKEND_CPU, threads, pinThreads);
+    RenderQuality quality = { 1.0f, CPU_RENDER_SPECTRAL_SAMPLES };
+    renderer.setRenderQuality(quality);
+    renderer.setImage(red.data(), green.data(), blue.data(), benchCase.width, benchCase.height);
+    renderer.setSeed(seed);
+    renderer.setFrameIndex(0);
+
+    CpuFrameParams params;
+    if (!renderer.stepFrame(1.0f / 60.0f) || !renderer.getLastFrameParams(params))
+        return false;
+    reference.render(red.data(), green.data(), blue.data(), benchCase.width, benchCase.height, params);
+    return true;
+}
+
+// Renders the first frame of the case with the configuration, compares it
+// with the reference and times warmup + frames more. Every configuration
+// gets a renderer of its own, so its pupil and particles start out where
+// the reference's did
+static bool measureConfig(const AccuracyConfig& config, const BenchCase& benchCase, const std::vector<float>& red,
+                          const std::vector<float>& green, const std::vector<float>& blue, unsigned int seed,
+                          int warmup, int frames, unsigned int threads, bool pinThreads, unsigned int memoryBudget,
+                          const ReferenceRenderer& reference, AccuracyResult& result)
+{
+    TemporalGlareRenderer renderer(config.backend, threads, pinThreads);
+    if (!renderer.isValid())
+    {
+        std::cerr << "Error: " << renderer.getError() << std::endl;
+        return false;
+    }
+    renderer.m_halfPrecisionImages = config.halfImages;
+    renderer.m_forceTiling = config.tiled;
+    renderer.setMemoryBudget((unsigned long long)memoryBudget << 20);
+    renderer.setRenderQuality(config.quality);
+    renderer.setImage(red.data(), green.data(), blue.data(), benchCase.width, benchCase.height);
+    renderer.setSeed(seed);
+    renderer.setFrameIndex(0);
+    if (!renderer.stepFrame(1.0f / 60.0f))
+        return false;
+
+    int width = renderer.getWidth();
+    int height = renderer.getHeight();
+    std::vector<float> planes[3];
+    for (int c = 0; c < 3; ++c)
+        planes[c].resize((size_t)width * height);
+    renderer.readHdrFrame(planes[0].data(), planes[1].data(), planes[2].data());
+
+    result.benchCase = benchCase;
+    result.config = config;
+    result.config.quality = renderer.getRenderQuality();
+    compareWithReference(reference, planes, width, height, result);
+
+    std::vector<double> frameMs;
+    for (int frame = 0; frame < warmup + frames; ++frame)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (!renderer.stepFrame(1.0f / 60.0f))
+            return false;
+        renderer.stageFrame();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (frame >= warmup)
+            frameMs.push_back(ms);
+    }
+    result.medianMs = median(frameMs);
+    return true;
+}
+
+static bool benchmarkAccuracy(const std::vector<BenchCase>& cases, const std::vector<AccuracyConfig>& configs,
+                              unsigned int seed, int warmup, int frames, unsigned int threads, bool pinThreads,
+                              unsigned int memoryBudget, std::vector<AccuracyResult>& results)
+{
+    std::vector<float> red, green, blue;
+    ReferenceRenderer reference(threads);
+
+    for (const BenchCase& benchCase : cases)
+    {
+        makeBenchScene(benchCase.scene, benchCase.width, benchCase.height, seed, red, green, blue);
+        std::string caseName = std::string(benchSceneName(benchCase.scene)) + " " +
+                               std::to_string(benchCase.width) + "x" + std::to_string(benchCase.height);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (!renderReference(benchCase, red, green, blue, seed, threads, pinThreads, reference))
+        {
+            std::cerr << "Error: Could not render the reference of " << caseName << std::endl;
+            return false;
+        }
+        std::cerr << caseName << ": reference in "
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+
+        for (const AccuracyConfig& config : configs)
+        {
+            AccuracyResult result;
+            if (!measureConfig(config, benchCase, red, green, blue, seed, warmup, frames, threads, pinThreads,
+                               memoryBudget, reference, result))
+            {
+                std::cerr << "Error: Could not render " << caseName << " with " << config.name << std::endl;
+                return false;
+            }
+            std::cerr << caseName << " " << config.name << ": median " << result.medianMs << " ms, PSNR "
+                      << result.psnr << " dB, relative L2 " << result.relativeL2 << ", max error "
+                      << result.maxError << std::endl;
+            results.push_back(result);
+        }
+    }
+
+    markParetoFront(results);
+    return true;
+}
+
+// null for the errors of a frame that is not finite and the PSNR of an
+// exact match
+static std::string jsonMetric(double value)
+{
+    return std::isfinite(value) ? jsonNumber(value) : "null";
+}
+
+static void writeAccuracyReport(std::ostream& out, const std::vector<AccuracyResult>& results, unsigned int seed,
+                                int warmup, int frames)
+{
+    out << "{\n";
+    out << "  \"reference\": {\"precision\": \"double\", \"spectral_samples\": " << REFERENCE_SPECTRAL_SAMPLES << "},\n";
+    out << "  \"seed\": " << seed << ",\n";
+    out << "  \"warmup\": " << warmup << ",\n";
+    out << "  \"frames\": " << frames << ",\n";
+    out << "  \"results\": [";
+
+    for (size_t r = 0; r < results.size(); ++r)
+    {
+        const AccuracyResult& result = results[r];
+        const AccuracyConfig& config = result.config;
+        out << (r == 0 ? "\n" : ",\n") << "    {\n";
+        out << "      \"scene\": \"" << benchSceneName(result.benchCase.scene) << "\",\n";
+        out << "      \"width\": " << result.benchCase.width << ",\n";
+        out << "      \"height\": " << result.benchCase.height << ",\n";
+        out << "      \"config\": \"" << config.name << "\",\n";
+        out << "      \"backend\": \"" << (config.backend == RENDER_BACKEND_CPU ? "cpu" : "opencl") << "\",\n";
+        out << "      \"scale\": " << jsonNumber(config.quality.scale) << ",\n";
+        out << "      \"spectral_samples\": " << config.quality.spectralSamples << ",\n";
+        out << "      \"half_images\": " << (config.halfImages ? "true" : "false") << ",\n";
+        out << "      \"tiled\": " << (config.tiled ? "true" : "false") << ",\n";
+        out << "      \"median_ms\": " << jsonNumber(result.medianMs) << ",\n";
+        out << "      \"psnr_db\": " << jsonMetric(result.psnr) << ",\n";
+        out << "      \"relative_l2\": " << jsonMetric(result.relativeL2) << ",\n";
+        out << "      \"max_abs_error\": " << jsonMetric(result.maxError) << ",\n";
+        out << "      \"reference_peak\": " << jsonNumber(result.peak) << ",\n";
+        out << "      \"pareto\": " << (result.pareto ? "true" : "false") << "\n";
+        out << "    }";
+    }
+    out << "\n  ]\n}\n";
+}
+
+// Relative L2 error over the median frame time as an SVG scatter, one
+// panel per case. The error axis is logarithmic, the Pareto front is
+// drawn in red and joined up. Configurations without a finite error are
+// listed under the title instead
+static void writeAccuracyPlot(std::ostream& out, const std::vector<AccuracyResult>& results)
+{
+    const int panelWidth = 720, panelHeight = 400;
+    const int left = 80, right = 160, top = 40, bottom = 50;
+    const double plotWidth = panelWidth - left - right;
+    const double plotHeight = panelHeight - top - bottom;
+
+    std::vector<BenchCase> cases;
+    for (const AccuracyResult& result : results)
+    {
+        bool seen = false;
+        for (const BenchCase& benchCase : cases)
+            seen = seen || sameCase(benchCase, result.benchCase);
+        if (!seen)
+            cases.push_back(result.benchCase);
+    }
+
+    out << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << panelWidth << "\" height=\""
+        << panelHeight * cases.size() << "\" font-family=\"sans-serif\" font-size=\"12\">\n";
+    out << "<rect width=\"100%\" height=\"100%\" fill=\"white\"/>\n";
+
+    for (size_t p = 0; p < cases.size(); ++p)
+    {
+        std::vector<const AccuracyResult*> points;
+        std::string notFinite;
+        double maxMs = 0.0, minError = 1.0, maxError = 1e-12;
+        for (const AccuracyResult& result : results)
+            if (sameCase(result.benchCase, cases[p]) && !std::isfinite(result.relativeL2))
+                notFinite += (notFinite.empty() ? "not finite: " : ", ") + result.config.name;
+            else if (sameCase(result.benchCase, cases[p]))
+            {
+                points.push_back(&result);
+                maxMs = std::max(maxMs, result.medianMs);
+                minError = std::min(minError, std::max(result.relativeL2, 1e-12));
+                maxError = std::max(maxError, result.relativeL2);
+            }
+        maxMs = maxMs > 0.0 ? maxMs * 1.1 : 1.0;
+        int lowDecade = (int)std::floor(std::log10(minError));
+        int highDecade = std::max((int)std::ceil(std::log10(maxError)), lowDecade + 1);
+
+        double y0 = (double)panelHeight * p;
+        auto px = [&](double ms) { return left + ms / maxMs * plotWidth; };
+        auto py = [&](double error) {
+            double decade = std::log10(std::max(error, 1e-12));
+            return y0 + top + (highDecade - decade) / (highDecade - lowDecade) * plotHeight;
+        };
+
+        out << "<text x=\"" << left << "\" y=\"" << y0 + top - 15 << "\" font-size=\"14\">"
+            << benchSceneName(cases[p].scene) << " " << cases[p].width << "x" << cases[p].height << "</text>\n";
+        if (!notFinite.empty())
+            out << "<text x=\"" << left + plotWidth << "\" y=\"" << y0 + top - 15 << "\" text-anchor=\"end\">"
+                << notFinite << "</text>\n";
+        out << "<rect x=\"" << left << "\" y=\"" << y0 + top << "\" width=\"" << plotWidth << "\" height=\""
+            << plotHeight << "\" fill=\"none\" stroke=\"black\"/>\n";
+        for (int tick = 0; tick <= 5; ++tick)
+        {
+            double ms = maxMs * tick / 5;
+            out << "<text x=\"" << px(ms) << "\" y=\"" << y0 + top + plotHeight + 18
+                << "\" text-anchor=\"middle\">" << jsonNumber(std::round(ms * 10) / 10) << "</text>\n";
+        }
+        for (int decade = lowDecade; decade <= highDecade; ++decade)
+        {
+            double y = py(std::pow(10.0, decade));
+            out << "<line x1=\"" << left << "\" y1=\"" << y << "\" x2=\"" << left + plotWidth << "\" y2=\"" << y
+                << "\" stroke=\"#ddd\"/>\n";
+            out << "<text x=\"" << left - 8 << "\" y=\"" << y + 4 << "\" text-anchor=\"end\">1e" << decade << "</text>\n";
+        }
+        out << "<text x=\"" << left + plotWidth / 2 << "\" y=\"" << y0 + panelHeight - 10
+            << "\" text-anchor=\"middle\">median frame time (ms)</text>\n";
+        out << "<text transform=\"translate(20," << y0 + top + plotHeight / 2
+            << ") rotate(-90)\" text-anchor=\"middle\">relative L2 error</text>\n";
+
+        std::vector<const AccuracyResult*> front;
+        for (const AccuracyResult* point : points)
+            if (point->pareto)
+                front.push_back(point);
+        std::sort(front.begin(), front.end(), [](const AccuracyResult* a, const AccuracyResult* b) {
+            return a->medianMs < b->medianMs;
+        });
+        out << "<polyline fill=\"none\" stroke=\"#c00\" points=\"";
+        for (const AccuracyResult* point : front)
+            out << px(point->medianMs) << "," << py(point->relativeL2) << " ";
+        out << "\"/>\n";
+
+        for (const AccuracyResult* point : points)
+        {
+            double x = px(point->medianMs), y = py(point->relativeL2);
+            out << "<circle cx=\"" << x << "\" cy=\"" << y << "\" r=\"4\" fill=\""
+                << (point->pareto ? "#c00" : "#888") << "\"/>\n";
+            out << "<text x=\"" << x + 7 << "\" y=\"" << y + 4 << "\">" << point->config.name << "</text>\n";
+        }
+    }
+    out << "</svg>\n";
+}
+
+int main(int argc, char *argv[])
+{
+    cxxopts::Options options("glare-bench", "Temporal Glare frame benchmark");
+    options.add_options()
+        ("scenes", "Synthetic scenes: points, area, noise", cxxopts::value<std::string>()->default_value("points,area,noise"))
+        ("sizes", "Frame sizes: 512 for 512x512, WxH, hd, 4k or 8k", cxxopts::value<std::string>()->default_value("512,1024,2048"))
+        ("warmup", "Frames rendered before measuring", cxxopts::value<int>()->default_value("3"))
+        ("n,frames", "Measured frames per scene and size, launches per work-group size with --kernels", cxxopts::value<int>()->default_value("20"))
+        ("seed", "Seed of the scenes and the renderer", cxxopts::value<unsigned int>()->default_value("1"))
+        ("scale", "Render scale of the image axes", cxxopts::value<float>()->default_value("1.0"))
+        ("spectral-samples", "Wavelengths of the spectral blur, 1 to 32", cxxopts::value<int>()->default_value("32"))
+        ("tiled", "Convolve in tiles streamed from the host")
+        ("memory-budget", "Device memory budget in MB, 0 for 60% of the device", cxxopts::value<unsigned int>()->default_value("0"))
+        ("trace", "Chrome trace of every case, warm up included, needs a GLARE_TRACING build", cxxopts::value<std::string>())
+        ("backend", "Render backend: opencl or cpu, GLARE_BACKEND when not given", cxxopts::value<std::string>())
+        ("threads", "Threads of the cpu backend, 0 uses every hardware thread", cxxopts::value<unsigned int>()->default_value("0"))
+        ("pin-threads", "Bind the threads of the cpu backend to one CPU each")
+        ("o,output", "JSON report file, standard output when not given", cxxopts::value<std::string>())
+        ("baseline", "Earlier report to compare the median frame times with", cxxopts::value<std::string>())
+        ("threshold", "Slowdown in percent over the baseline that counts as a regression", cxxopts::value<double>()->default_value("10"))
+        ("kernels", "Time the kernels across work-group sizes and store the best ones, opencl only")
+        ("tuning-file", "Work-group sizes written by --kernels, GLARE_TUNING_FILE or " KERNEL_TUNING_FILE " when not given",
+            cxxopts::value<std::string>())
+        ("accuracy", "Compare pipeline configurations with a double precision reference of the first frame")
+        ("configs", "Configurations of --accuracy: backend[:half][:s<samples>][:x<scale>][:tiled], ...; "
+            "variants of --backend when not given", cxxopts::value<std::string>())
+        ("plot", "SVG plot of error over frame time of --accuracy", cxxopts::value<std::string>())
+        ("h,help", "Print help");
+
+    std::vector<BenchCase> cases;
+    int warmup = 0, frames = 0;
+    unsigned int seed = 0;
+    double threshold = 0.0;
+    RenderQuality quality;
+    std::string output, baselinePath, tracePath, configList, plotPath;
+    RenderBackend backend = TemporalGlareRenderer::defaultBackend();
+    unsigned int threads = 0, memoryBudget = 0;
+    bool pinThreads = false, tiled = false, kernels = false, accuracy = false;
+    std::vector<BenchCase> sizes;
+    std::string tuningPath = KernelTuning::defaultPath();
+
+    try {
+        cxxopts::ParseResult result = options.parse(argc, argv);
+        if (result.count("help"))
+        {
+            std::cout << options.help() << std::endl;
+            return 0;
+        }
+
+        std::vector<BenchScene> scenes;
+        for (const std::string& name : splitList(result["scenes"].as<std::string>()))
+        {
+            BenchScene scene;
+            if (!benchSceneFromName(name, scene))
+            {
+                std::cerr << "Error: Unknown scene " << name << std::endl;
+                return 1;
+            }
+            scenes.push_back(scene);
+        }
+        for (const std::string& size : splitList(result["sizes"].as<std::string>()))
+        {
+            BenchCase benchCase;
+            if (!parseSize(size, benchCase.width, benchCase.height))
+            {
+                std::cerr << "Error: Invalid size " << size << std::endl;
+                return 1;
+            }
+            sizes.push_back(benchCase);
+            for (BenchScene scene : scenes)
+            {
+                benchCase.scene = scene;
+                cases.push_back(benchCase);
+            }
+        }
+
+        warmup = std::max(0, result["warmup"].as<int>());
+        frames = std::max(1, result["frames"].as<int>());
+        seed = result["seed"].as<unsigned int>();
+        quality.scale = result["scale"].as<float>();
+        quality.spectralSamples = result["spectral-samples"].as<int>();
+        tiled = result.count("tiled") > 0;
+        memoryBudget = result["memory-budget"].as<unsigned int>();
+        if (result.count("backend"))
+            backend = result["backend"].as<std::string>() == "cpu" ? RENDER_BACKEND_CPU : RENDER_BACKEND_OPENCL;
+        threads = result["threads"].as<unsigned int>();
+        pinThreads = result.count("pin-threads") > 0;
+        if (result.count("output"))
+            output = result["output"].as<std::string>();
+        if (result.count("baseline"))
+            baselinePath = result["baseline"].as<std::string>();
+        if (result.count("trace"))
+            tracePath = result["trace"].as<std::string>();
+        threshold = result["threshold"].as<double>();
+        kernels = result.count("kernels") > 0;
+        if (result.count("tuning-file"))
+            tuningPath = result["tuning-file"].as<std::string>();
+        accuracy = result.count("accuracy") > 0;
+        if (result.count("configs"))
+            configList = result["configs"].as<std::string>();
+        if (result.count("plot"))
+            plotPath = result["plot"].as<std::string>();
+    } catch (const cxxopts::OptionException& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        std::cerr << options.help() << std::endl;
+        return 1;
+    }
+
+    if (kernels)
+    {
+        if (backend != RENDER_BACKEND_OPENCL)
+        {
+            std::cerr << "Error: --kernels needs the opencl backend" << std::endl;
+            return 1;
+        }
+
+        std::streambuf* stdoutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+        TemporalGlareRenderer renderer(backend);
+        if (!renderer.isValid())
+        {
+            std::cerr << "Error: " << renderer.getError() << std::endl;
+            return 1;
+        }
+        quality.spectralSamples = std::max(1, std::min(quality.spectralSamples, (int)CPU_RENDER_SPECTRAL_SAMPLES));
+
+        // entries of other devices and size classes are kept
+        KernelTuning tuning;
+        tuning.load(tuningPath);
+        std::vector<KernelTiming> timings;
+        benchmarkKernels(renderer, sizes, frames, quality.spectralSamples, timings, tuning);
+        std::cout.rdbuf(stdoutBuffer);
+
+        if (!tuning.save(tuningPath))
+        {
+            std::cerr << "Error: Could not write " << tuningPath << std::endl;
+            return 1;
+        }
+        std::cerr << tuning.count(renderer.getDeviceName()) << " work-group sizes for " << renderer.getDeviceName()
+                  << " in " << tuningPath << std::endl;
+
+        if (output.empty())
+            writeKernelReport(std::cout, renderer.getDeviceName(), tuningPath, quality.spectralSamples, timings, tuning);
+        else
+        {
+            std::ofstream file(output);
+            writeKernelReport(file, renderer.getDeviceName(), tuningPath, quality.spectralSamples, timings, tuning);
+            if (!file)
+            {
+                std::cerr << "Error: Could not write " << output << std::endl;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    if (accuracy)
+    {
+        std::vector<AccuracyConfig> configs;
+        for (const std::string& name : splitList(configList.empty() ? defaultConfigs(backend) : configList))
+        {
+            AccuracyConfig config;
+            if (!parseConfig(name, config))
+            {
+                std::cerr << "Error: Invalid configuration " << name << std::endl;
+                return 1;
+            }
+            if (config.tiled && config.backend != RENDER_BACKEND_OPENCL)
+            {
+                std::cerr << "Error: " << name << ": tiled needs the opencl backend" << std::endl;
+                return 1;
+            }
+            configs.push_back(config);
+        }
+
+        std::streambuf* stdoutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+        std::vector<AccuracyResult> results;
+        bool measured = benchmarkAccuracy(cases, configs, seed, warmup, frames, threads, pinThreads, memoryBudget, results);
+        std::cout.rdbuf(stdoutBuffer);
+        if (!measured)
+            return 1;
+
+        if (output.empty())
+            writeAccuracyReport(std::cout, results, seed, warmup, frames);
+        else
+        {
+            std::ofstream file(output);
+            writeAccuracyReport(file, results, seed, warmup, frames);
+            if (!file)
+            {
+                std::cerr << "Error: Could not write " << output << std::endl;
+                return 1;
+            }
+        }
+        if (!plotPath.empty())
+        {
+            std::ofstream file(plotPath);
+            writeAccuracyPlot(file, results);
+            if (!file)
+            {
+                std::cerr << "Error: Could not write " << plotPath << std::endl;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    if (!tracePath.empty() && !traceStart())
+    {
+        std::cerr << "Error: --trace needs a build with GLARE_TRACING" << std::endl;
+        return 1;
+    }
+    TRACE_THREAD_NAME("main");
+
+    JsonValue baseline;
+    if (!baselinePath.empty())
+    {
+        std::ifstream file(baselinePath);
+        std::stringstream text;
+        text << file.rdbuf();
+        std::string contents = text.str();
+        if (!file || !JsonReader(contents).parse(baseline) || !baseline.get("results"))
+        {
+            std::cerr << "Error: Could not read the baseline " << baselinePath << std::endl;
+            return 1;
+        }
+    }
+
+    // the renderer logs to standard output, which is kept for the report
+    std::streambuf* stdoutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+
+    TemporalGlareRenderer renderer(backend, threads, pinThreads);
+    if (!renderer.isValid())
+    {
+        std::cerr << "Error: " << renderer.getError() << std::endl;
+        return 1;
+    }
+    renderer.m_forceTiling = tiled;
+    renderer.setMemoryBudget((unsigned long long)memoryBudget << 20);
+    renderer.setRenderQuality(quality);
+    quality = renderer.getRenderQuality();
+
+    std::vector<BenchResult> results;
+    std::vector<float> red, green, blue;
+    int regressions = 0;
+
+    for (const BenchCase& benchCase : cases)
+    {
+        makeBenchScene(benchCase.scene, benchCase.width, benchCase.height, seed, red, green, blue);
+        renderer.setImage(red.data(), green.data(), blue.data(), benchCase.width, benchCase.height);
+        renderer.setSeed(seed);
+        renderer.setFrameIndex(0);
+        renderer.resetDeviceMemoryPeak();
+
+        std::vector<double> frameMs;
+        std::vector<double> stageMs[4];
+        std::vector<double> deviceMs[PROFILE_STAGES];
+        bool hasDeviceStages = false;
+
+        for (int frame = 0; frame < warmup + frames; ++frame)
+        {
+            // a frame is done once its pixels are on the host
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            bool rendered = renderer.stepFrame(1.0f / 60.0f);
+            if (rendered)
+                renderer.stageFrame();
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            if (!rendered)
+            {
+                std::cout.rdbuf(stdoutBuffer);
+                std::cerr << "Error: Could not render " << benchSceneName(benchCase.scene) << " at "
+                          << benchCase.width << "x" << benchCase.height << std::endl;
+                return 1;
+            }
+            if (frame < warmup)
+                continue;
+
+            frameMs.push_back(ms);
+            const FrameTimings& timings = renderer.getFrameTimings();
+            stageMs[0].push_back(timings.aperture);
+            stageMs[1].push_back(timings.spectral);
+            stageMs[2].push_back(timings.convolution);
+            stageMs[3].push_back(timings.toneMap);
+
+            FrameProfile profile;
+            if (renderer.getLastFrameProfile(profile))
+            {
+                hasDeviceStages = true;
+                for (int stage = 0; stage < PROFILE_STAGES; ++stage)
+                    deviceMs[stage].push_back(profile.stages[stage].busyMs());
+            }
+        }
+
+        BenchResult result;
+        result.benchCase = benchCase;
+        result.frameMs = frameMs;
+        std::sort(result.frameMs.begin(), result.frameMs.end());
+        result.stages.aperture = (float)median(stageMs[0]);
+        result.stages.spectral = (float)median(stageMs[1]);
+        result.stages.convolution = (float)median(stageMs[2]);
+        result.stages.toneMap = (float)median(stageMs[3]);
+        result.stages.total = (float)percentile(result.frameMs, 50.0);
+        result.hasDeviceStages = hasDeviceStages;
+        for (int stage = 0; stage < PROFILE_STAGES; ++stage)
+            result.deviceStages[stage] = hasDeviceStages ? median(deviceMs[stage]) : 0.0;
+        result.baselineMs = baselinePath.empty() ? -1.0 : baselineMedian(baseline, benchCase);
+        result.devicePeakMb = renderer.getBackend() == RENDER_BACKEND_CPU ? -1.0 :
+                              renderer.getDeviceMemoryUsage().peakTotal / (1024.0 * 1024.0);
+
+        double medianMs = result.stages.total;
+        std::cerr << benchSceneName(benchCase.scene) << " " << benchCase.width << "x" << benchCase.height
+                  << ": median " << medianMs << " ms, p95 " << percentile(result.frameMs, 95.0) << " ms";
+        if (result.baselineMs > 0.0)
+        {
+            double change = (medianMs - result.baselineMs) / result.baselineMs * 100.0;
+            std::cerr << ", " << (change >= 0.0 ? "+" : "") << change << "% over the baseline";
+            if (change > threshold)
+            {
+                std::cerr << " REGRESSION";
+                ++regressions;
+            }
+        }
+        std::cerr << std::endl;
+
+        results.push_back(result);
+    }
+
+    if (!tracePath.empty())
+    {
+        // the device spans of the last frame are still pending
+        renderer.getFrameProfiles();
+        if (!traceWriteChrome(tracePath))
+        {
+            std::cout.rdbuf(stdoutBuffer);
+            std::cerr << "Error: Could not write " << tracePath << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout.rdbuf(stdoutBuffer);
+
+    std::string backendName = renderer.getBackend() == RENDER_BACKEND_CPU ? "cpu" : "opencl";
+    if (output.empty())
+    {
+        writeReport(std::cout, results, backendName, seed, warmup, frames, quality, threshold,
+                    !baselinePath.empty(), regressions);
+    }
+    else
+    {
+        std::ofstream file(output);
+        writeReport(file, results, backendName, seed, warmup, frames, quality, threshold,
+                    !baselinePath.empty(), regressions);
+        if (!file)
+        {
+            std::cerr << "Error: Could not write " << output << std::endl;
+            return 1;
+        }
+    }
+
+    if (regressions > 0)
+    {
+        std::cerr << regressions << " regressions beyond " << threshold << "%" << std::endl;
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,252 @@
+// Headless batch renderer. Renders temporal glare frames for an EXR image
+// or sequence without any widget or GL context, one OpenCL context is
+// kept for the whole job. --backend cpu renders on the host instead, for
+// nodes without a GPU.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <limits>    // cxxopts.hpp relies on it being included
+
+#include "cxxopts.hpp"
+
+#include "TemporalGlareRenderer.h"
+#include "ExrSequence.h"
+#include "FrameWriter.h"
+#include "Trace.h"
+
+static int toneMapOperatorFromName(const std::string& name)
+{
+    if (name == "local")
+        return TM_REINHARD_LOCAL;
+    if (name == "histogram")
+        return TM_HISTOGRAM_ADJUSTMENT;
+    return TM_REINHARD_EXTENDED;
+}
+
+static bool endsWith(const std::string& text, const std::string& suffix)
+{
+    return text.size() >= suffix.size() &&
+           text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    cxxopts::Options options("glare-cli", "Temporal Glare batch renderer");
+    options.add_options()
+        ("i,input", "EXR file, printf pattern (shot.%04d.exr) or glob", cxxopts::value<std::string>())
+        ("o,output", "Output pattern, .png for tone mapped or .exr for linear frames", cxxopts::value<std::string>()->default_value("glare.%04d.png"))
+        ("n,frames", "Number of frames, 0 renders each frame of a sequence once", cxxopts::value<int>()->default_value("0"))
+        ("decoders", "Threads decoding a sequence, 0 for one per hardware thread but one", cxxopts::value<int>()->default_value("0"))
+        ("seed", "Seed of the lens particles and pupil noise, the same seed renders the same frames", cxxopts::value<unsigned int>()->default_value("0"))
+        ("operator", "Tone mapping operator: extended, local or histogram", cxxopts::value<std::string>()->default_value("extended"))
+        ("gamma", "Gamma", cxxopts::value<float>()->default_value("5.0"))
+        ("lwhite", "Lwhite of the extended operator", cxxopts::value<float>()->default_value("5.0"))
+        ("alpha", "Manual exposure, 2^((alpha - 0.5) * 20); auto exposure when not given", cxxopts::value<float>())
+        ("phi", "Sharpening of the local operator", cxxopts::value<float>()->default_value("8.0"))
+        ("epsilon", "Scale selection threshold of the local operator", cxxopts::value<float>()->default_value("0.05"))
+        ("display-min", "Display minimum luminance of histogram adjustment (cd/m^2)", cxxopts::value<float>()->default_value("1.0"))
+        ("display-max", "Display maximum luminance of histogram adjustment (cd/m^2)", cxxopts::value<float>()->default_value("100.0"))
+        ("particles", "Number of lens particles", cxxopts::value<int>()->default_value("2000"))
+        ("fibres", "Radial fibres of the procedural lens gratings, 0 for none", cxxopts::value<int>()->default_value("180"))
+        ("fibre-jitter", "Angular jitter and bend of the fibres, 0 to 1", cxxopts::value<float>()->default_value("0.5"))
+        ("field-luminance", "Fixed adaptation luminance of the pupil (cd/m^2); measured over the image centre when not given", cxxopts::value<float>())
+        ("luminance-scale", "cd/m^2 per unit of the image for the measured adaptation luminance", cxxopts::value<float>()->default_value("1.0"))
+        ("focus", "Focus distance", cxxopts::value<float>()->default_value("500.0"))
+        ("aperture", "Aperture size", cxxopts::value<float>()->default_value("8.0"))
+        ("half", "Keep the input frames as half floats on the host")
+        ("scale", "Render scale of the image axes, frames are written at the scaled size", cxxopts::value<float>()->default_value("1.0"))
+        ("spectral-samples", "Wavelengths of the spectral blur, 1 to 32", cxxopts::value<int>()->default_value("32"))
+        ("tiled", "Convolve in tiles streamed from the host, automatic for images too large for the device")
+        ("memory-budget", "Device memory budget in MB, 0 for 60% of the device", cxxopts::value<unsigned int>()->default_value("0"))
+        ("trace", "Chrome trace of the host and device activity, needs a GLARE_TRACING build", cxxopts::value<std::string>())
+        ("backend", "Render backend: opencl or cpu, GLARE_BACKEND when not given", cxxopts::value<std::string>())
+        ("threads", "Threads of the cpu backend, 0 uses every hardware thread", cxxopts::value<unsigned int>()->default_value("0"))
+        ("pin-threads", "Bind the threads of the cpu backend to one CPU each")
+        ("h,help", "Print help");
+
+    int frames = 0, decoders = 0;
+    std::string input, output, tracePath;
+    TemporalGlareRenderer* renderer = nullptr;
+
+    try {
+        cxxopts::ParseResult result = options.parse(argc, argv);
+
+        if (result.count("help") || !result.count("input"))
+        {
+            std::cout << options.help() << std::endl;
+            return result.count("help") ? 0 : 1;
+        }
+
+        input = result["input"].as<std::string>();
+        output = result["output"].as<std::string>();
+        frames = result["frames"].as<int>();
+        decoders = result["decoders"].as<int>();
+        if (result.count("trace"))
+        {
+            tracePath = result["trace"].as<std::string>();
+            if (!traceStart())
+            {
+                std::cerr << "Error: --trace needs a build with GLARE_TRACING" << std::endl;
+                return 1;
+            }
+            TRACE_THREAD_NAME("main");
+        }
+
+        RenderBackend backend = TemporalGlareRenderer::defaultBackend();
+        if (result.count("backend"))
+            backend = result["backend"].as<std::string>() == "cpu" ? RENDER_BACKEND_CPU : RENDER_BACKEND_OPENCL;
+
+        renderer = new TemporalGlareRenderer(backend, result["threads"].as<unsigned int>(),
+                                             result.count("pin-threads") > 0);
+        if (!renderer->isValid())
+        {
+            std::cerr << "Error: " << renderer->getError() << std::endl;
+            delete renderer;
+            return 1;
+        }
+        renderer->setSeed(result["seed"].as<unsigned int>());
+        renderer->setParticleCount(result["particles"].as<int>());
+        renderer->setGratings(result["fibres"].as<int>(), result["fibre-jitter"].as<float>());
+
+        GlareParameters params = renderer->getParameters();
+        params.toneMapOperator = toneMapOperatorFromName(result["operator"].as<std::string>());
+        params.gamma = result["gamma"].as<float>();
+        params.Lwhite = result["lwhite"].as<float>();
+        params.phi = result["phi"].as<float>();
+        params.epsilon = result["epsilon"].as<float>();
+        params.displayMinLuminance = result["display-min"].as<float>();
+        params.displayMaxLuminance = result["display-max"].as<float>();
+        params.focus = result["focus"].as<float>();
+        params.apertureSize = result["aperture"].as<float>();
+        params.luminanceScale = result["luminance-scale"].as<float>();
+        if (result.count("field-luminance"))
+        {
+            params.fieldLuminance = result["field-luminance"].as<float>();
+            params.autoFieldLuminance = false;
+        }
+        if (result.count("alpha"))
+        {
+            params.exposure = std::pow(2.f, (result["alpha"].as<float>() - 0.5f) * 20.f);
+            params.autoExposure = false;
+        }
+        renderer->setParameters(params);
+
+        renderer->m_halfPrecisionImages = result.count("half") > 0;
+        renderer->m_forceTiling = result.count("tiled") > 0;
+        renderer->setMemoryBudget((unsigned long long)result["memory-budget"].as<unsigned int>() << 20);
+
+        RenderQuality quality;
+        quality.scale = result["scale"].as<float>();
+        quality.spectralSamples = result["spectral-samples"].as<int>();
+        renderer->setRenderQuality(quality);
+    } catch (const cxxopts::OptionException& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        std::cerr << options.help() << std::endl;
+        delete renderer;
+        return 1;
+    }
+
+    // a single existing file is a still, anything else a sequence
+    std::vector<std::string> paths = ExrSequence::expandPattern(input);
+    if (paths.empty())
+    {
+        std::cerr << "Error: No EXR frames match " << input << std::endl;
+        delete renderer;
+        return 1;
+    }
+
+    bool sequence = paths.size() > 1 || paths[0] != input;
+    if (sequence)
+    {
+        if (!renderer->openExrSequence(input, 0.0f, decoders))
+        {
+            delete renderer;
+            return 1;
+        }
+        if (frames <= 0)
+            frames = (int)paths.size();
+    }
+    else
+    {
+        renderer->readExrFile(input);
+        if (frames <= 0)
+            frames = 1;
+    }
+
+    bool writeExr = endsWith(output, ".exr");
+    int width = renderer->getWidth();
+    int height = renderer->getHeight();
+
+    // encoding and disk writes overlap with rendering the next frames
+    FrameWriter writer;
+
+    int status = 0;
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        if (sequence && frame > 0 && !renderer->stepSequence())
+        {
+            std::cerr << "Error: Could not read frame " << frame << std::endl;
+            status = 1;
+            break;
+        }
+
+        // sequences may change size between frames
+        width = renderer->getWidth();
+        height = renderer->getHeight();
+        size_t pixels = (size_t)width * height;
+
+        // the view time advances by one 24 fps frame
+        if (!renderer->stepFrame(frame > 0 ? 1.0f / 24.0f : 0.0f))
+        {
+            std::cerr << "Error: Could not render frame " << frame << std::endl;
+            status = 1;
+            break;
+        }
+
+        std::string path = ExrSequence::formatPattern(output, frame);
+        if (writeExr)
+        {
+            std::vector<float> red(pixels), green(pixels), blue(pixels);
+            renderer->readHdrFrame(red.data(), green.data(), blue.data());
+            writer.writeExr(path, width, height, std::move(red), std::move(green), std::move(blue));
+        }
+        else
+        {
+            std::vector<unsigned char> bgra(pixels * 4);
+            renderer->readFrame(bgra.data());
+            writer.writePng(path, width, height, std::move(bgra));
+        }
+    }
+
+    writer.flush();
+    std::cout << "Wrote " << writer.getWrittenFrames() << " frames" << std::endl;
+    if (writer.getFailedFrames() > 0)
+    {
+        std::cerr << "Error: Could not write " << writer.getFailedFrames() << " frames" << std::endl;
+        status = 1;
+    }
+
+    if (!tracePath.empty())
+    {
+        // the device spans of the last frame are still pending
+        renderer->getFrameProfiles();
+        if (traceWriteChrome(tracePath))
+            std::cout << "Trace written to " << tracePath << std::endl;
+        else
+        {
+            std::cerr << "Error: Could not write " << tracePath << std::endl;
+            status = 1;
+        }
+    }
+
+    if (renderer->getBackend() == RENDER_BACKEND_OPENCL)
+    {
+        std::cout << "Device memory:\n";
+        printMemoryUsage(std::cout, renderer->getDeviceMemoryUsage());
+    }
+
+    delete renderer;
+    return status;
+}
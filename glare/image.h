@@ -6,22 +6,52 @@
 #define IMAGE_H
 
 #include "vector_types.h"
+#include "PixelStorage.h"
 
+#include <functional>
+#include <string>
+#include <vector>
 #include <iostream>
 #include <algorithm>
 
 class Image {
 public:
-    explicit Image(const std::string &filename);
+    explicit Image(const std::string &filename,
+                   PixelLayout layout = PIXEL_LAYOUT_PLANAR,
+                   PixelPrecision precision = PIXEL_PRECISION_FLOAT);
+    // Copies width x height float planes, the statistics are computed as
+    // for a file. There is nothing to reload such an image from, so its
+    // host pixels are kept by releaseHostData
+    Image(const float* red, const float* green, const float* blue, int width, int height,
+          PixelLayout layout = PIXEL_LAYOUT_PLANAR,
+          PixelPrecision precision = PIXEL_PRECISION_FLOAT);
     ~Image();
 
+    Image(const Image&) = delete;
+    Image& operator=(const Image&) = delete;
+
     // float* get_rChannelFFT()  { return m_redFFT;}
     // float* get_gChannelFFT()  { return m_greenFFT;}
     // float* get_bChannelFFT()  { return m_blueFFT;}
 
-    float* get_rChannel()  { return m_red;}
-    float* get_gChannel()  { return m_green;}
-    float* get_bChannel()  { return m_blue;}
+    // Channel c (0 red, 1 green, 2 blue) as a width x height float plane
+    void copyChannel(int c, float* dest) const;
+    // The same plane in place, only for planar float storage
+    const float* getChannel(int c) const;
+    // width x height window of channel c with its top left corner at x, y,
+    // parts outside the image are zero
+    void copyTile(int c, int x, int y, int width, int height, float* dest) const;
+
+    // 2*width x 2*height zero padded plane of channel c, built on first use
+    const float* getPaddedChannel(int c);
+    void releasePaddedChannels();
+
+    // Frees the pixels once they are resident on the device, the
+    // statistics are kept. reloadHostData reads them from the file again
+    void releaseHostData();
+    bool reloadHostData();
+    bool hasHostData() const { return !m_pixels.empty(); }
+    size_t getHostBytes() const;
 
     // cv::Mat get_imgData() {return channels;}
 
@@ -49,17 +79,40 @@ public:
     inline int getWidth() const { return m_width; }
     inline int getHeight() const { return m_height; }
 
-    // TODO: build PNG saving function 
+    // 8 bit RGBA to PNG
+    static bool savePng(const std::string& filename, const unsigned char* rgba, int width, int height);
+
+    // Float planes to an EXR file, stored as half or float
+    static bool saveExr(const std::string& filename,
+                        const float* red,
+                        const float* green,
+                        const float* blue,
+                        int width,
+                        int height,
+                        bool halfPrecision = true);
+
+    // The same encodings into memory, for writing the file elsewhere
+    static bool encodePng(std::vector<unsigned char>& encoded, const unsigned char* rgba, int width, int height);
+    static bool encodeExr(std::vector<unsigned char>& encoded,
+                          const float* red,
+                          const float* green,
+                          const float* blue,
+                          int width,
+                          int height,
+                          bool halfPrecision = true);
+
+    static bool writeFile(const std::string& filename, const std::vector<unsigned char>& data);
 
 private:
+    bool load();
+    void storePixels(const std::function<void(size_t row, float* r, float* g, float* b)>& readRow);
 
-    float* m_red;
-    float* m_green;
-    float* m_blue;
+    std::string m_filename;
+    PixelLayout m_layout;
+    PixelPrecision m_precision;
 
-    float* m_redPadded;
-    float* m_greenPadded;
-    float* m_bluePadded;
+    PixelStorage m_pixels;
+    float* m_padded[3];
 
     int m_width;
     int m_height;
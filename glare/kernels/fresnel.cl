@@ -119,7 +119,8 @@ __kernel void spectral_blur(__read_only image2d_t inputImage,
 							int height,
 							float lambda, 
 							float distance,
-							float normFactor
+							float normFactor,
+							int samples
 							)
 {
 	// global id0 -> width, global id1 -> height
@@ -129,7 +130,6 @@ __kernel void spectral_blur(__read_only image2d_t inputImage,
 
 	int indexOutput = pos.x + pos.y * width; 
 	
-	int samples = 32; 
 	float3 color = (float3)(0, 0, 0);
 
 	for (size_t i = 0; i < samples; ++i)
@@ -149,7 +149,6 @@ __kernel void spectral_blur(__read_only image2d_t inputImage,
 		float intensity;
 		
 		intensity = read_imagef(inputImage, fsampler, (float2)(xi, yi)).x;
-	 	// intensity = intensity / normFactor;
 
 		float fidx =  wavelength - 390;
 		int idx = (int)fidx;
@@ -172,9 +171,10 @@ __kernel void spectral_blur(__read_only image2d_t inputImage,
 		color += xyz * intensity;
 	}
 
-	// norm it 
+	// norm it, normFactor takes the PSF to PSF_ENERGY (GlareConstants.h)
 	color = color / samples;
 	color = color / 21;
+	color = color / normFactor;
 
 	// XYZ to sRGB
 	float R =  3.2404542*color.x - 1.5371385*color.y - 0.4985314*color.z;
@@ -222,13 +222,18 @@ __kernel void spectral_blur(__read_only image2d_t inputImage,
 }
 
 
+// width x height complex values, the launch may be rounded up to whole
+// work-groups
 __kernel void conv_of_ffts(	__global const float* input2,
 							__global const float* input3, 
 							__global float* output1, 
-							int width)
+							int width,
+							int height)
 {
 	int xp = get_global_id(0);
 	int yp = get_global_id(1);
+	if (xp >= width || yp >= height)
+		return;
 
 	int index = (xp + yp*width)*2;
 
@@ -238,12 +243,36 @@ __kernel void conv_of_ffts(	__global const float* input2,
 	// y1 = x2*y3 + y2*x3
 	// where x1 = output[index], y1 = output[index+1] etc. 
 
-	// x1 		   =     x2        *     x3        -     y2          *     y3
-	output1[index] = input2[index] * input3[index] - input2[index+1] * input3[index+1];
+	// read before writing, output1 may be input2 or input3
+	float x2 = input2[index];
+	float y2 = input2[index+1];
+	float x3 = input3[index];
+	float y3 = input3[index+1];
 
-	// y1            =     x2        *     y3          +     y2          *     x3 
-	output1[index+1] = input2[index] * input3[index+1] + input2[index+1] * input3[index];
-	// output1[index+1] = 0;
+	output1[index] = x2 * x3 - y2 * y3;
+	output1[index+1] = x2 * y3 + y2 * x3;
 
 }
 
+
+// Moves the centred psfSize x psfSize PSF into the corners of a zero
+// padded tileSize x tileSize plane with its centre at the origin, so that
+// convolving a tile with it does not shift the tile
+__kernel void embed_tile_psf(	__global const float* psf,
+								__global float* output,
+								int psfSize,
+								int tileSize)
+{
+	int xp = get_global_id(0);
+	int yp = get_global_id(1);
+
+	// offsets from the origin, wrapped around the tile
+	int dx = xp < tileSize / 2 ? xp : xp - tileSize;
+	int dy = yp < tileSize / 2 ? yp : yp - tileSize;
+
+	float value = 0.0f;
+	if (dx >= -psfSize / 2 && dx < psfSize / 2 && dy >= -psfSize / 2 && dy < psfSize / 2)
+		value = psf[(dx + psfSize / 2) + (dy + psfSize / 2) * psfSize];
+
+	output[xp + yp * tileSize] = value;
+}
@@ -0,0 +1,250 @@
+// Ward, Rushmeier, Piatko "A Visibility Matching Tone Reproduction Operator
+// for High Dynamic Range Scenes" - naive histogram adjustment with a
+// ceiling on the bin counts. Everything stays on the device: the log
+// luminance range and histogram are reduced with local atomics, the
+// ceiling-clamped CDF is built by a single work-group and the tone map
+// looks it up.
+
+float4 gammaCorrect(float4 color, float gamma);
+float getLuminance(float4 color);
+
+// must match TM_HIST_BINS in ToneMapping.h, which is also the
+// local size of every kernel in this file
+#define TM_HIST_BINS 256
+
+__constant const float TM_HIST_DELTA      = 1e-4f;   // same as the image statistics
+__constant const float TM_HIST_TOLERANCE  = 0.025f;  // stop once trimmings are below 2.5%
+__constant const int   TM_HIST_ITERATIONS = 32;
+
+// order preserving mapping of floats to uints so that atomic_min and
+// atomic_max can be used on negative log luminances
+uint tm_float_to_ordered(float f)
+{
+    uint bits = as_uint(f);
+    return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+float tm_ordered_to_float(uint u)
+{
+    uint bits = (u & 0x80000000u) ? (u & 0x7fffffffu) : ~u;
+    return as_float(bits);
+}
+
+float tm_log_luminance(__global const float* red_channel,
+                       __global const float* green_channel,
+                       __global const float* blue_channel,
+                       int index)
+{
+    float4 color = {red_channel[index], green_channel[index], blue_channel[index], 1.0f};
+    return log(TM_HIST_DELTA + fmax(getLuminance(color), 0.0f));
+}
+
+// sum of a local array of TM_HIST_BINS values, the result is in values[0]
+void tm_local_sum(__local float* values, int lid)
+{
+    for (int offset = TM_HIST_BINS / 2; offset > 0; offset >>= 1)
+    {
+        if (lid < offset)
+            values[lid] += values[lid + offset];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
+
+// log_range[0] = min, log_range[1] = max, in the ordered representation
+__kernel void tm_histogram_clear(__global uint* histogram,
+                                 __global uint* log_range)
+{
+    int i = get_global_id(0);
+    histogram[i] = 0;
+
+    if (i == 0)
+    {
+        log_range[0] = 0xffffffffu;
+        log_range[1] = 0u;
+    }
+}
+
+__kernel void tm_log_luminance_range(__global const float* red_channel,
+                                     __global const float* green_channel,
+                                     __global const float* blue_channel,
+                                     __global uint* log_range,
+                                     int nPixels)
+{
+    __local float localMin[TM_HIST_BINS];
+    __local float localMax[TM_HIST_BINS];
+
+    int lid = get_local_id(0);
+
+    float lmin = MAXFLOAT;
+    float lmax = -MAXFLOAT;
+    for (int i = get_global_id(0); i < nPixels; i += get_global_size(0))
+    {
+        float l = tm_log_luminance(red_channel, green_channel, blue_channel, i);
+        lmin = fmin(lmin, l);
+        lmax = fmax(lmax, l);
+    }
+
+    localMin[lid] = lmin;
+    localMax[lid] = lmax;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int offset = TM_HIST_BINS / 2; offset > 0; offset >>= 1)
+    {
+        if (lid < offset)
+        {
+            localMin[lid] = fmin(localMin[lid], localMin[lid + offset]);
+            localMax[lid] = fmax(localMax[lid], localMax[lid + offset]);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (lid == 0)
+    {
+        atomic_min(&log_range[0], tm_float_to_ordered(localMin[0]));
+        atomic_max(&log_range[1], tm_float_to_ordered(localMax[0]));
+    }
+}
+
+__kernel void tm_log_histogram(__global const float* red_channel,
+                               __global const float* green_channel,
+                               __global const float* blue_channel,
+                               __global const uint* log_range,
+                               __global uint* histogram,
+                               int nPixels)
+{
+    __local uint localHist[TM_HIST_BINS];
+
+    int lid = get_local_id(0);
+    localHist[lid] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    float logMin = tm_ordered_to_float(log_range[0]);
+    float logMax = tm_ordered_to_float(log_range[1]);
+    float scale = TM_HIST_BINS / fmax(logMax - logMin, 1e-6f);
+
+    for (int i = get_global_id(0); i < nPixels; i += get_global_size(0))
+    {
+        float l = tm_log_luminance(red_channel, green_channel, blue_channel, i);
+        int bin = clamp((int)((l - logMin) * scale), 0, TM_HIST_BINS - 1);
+        atomic_inc(&localHist[bin]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // merge the work-group histogram into the global one
+    if (localHist[lid] > 0)
+        atomic_add(&histogram[lid], localHist[lid]);
+}
+
+// launched as a single work-group of TM_HIST_BINS work-items
+__kernel void tm_histogram_cdf(__global const uint* histogram,
+                               __global const uint* log_range,
+                               __global float* cdf,
+                               float logDisplayMin,
+                               float logDisplayMax)
+{
+    __local float counts[TM_HIST_BINS];
+    __local float scratch[TM_HIST_BINS];
+
+    int lid = get_local_id(0);
+    counts[lid] = (float)histogram[lid];
+
+    float logMin = tm_ordered_to_float(log_range[0]);
+    float logMax = tm_ordered_to_float(log_range[1]);
+    float binWidth = (logMax - logMin) / TM_HIST_BINS;
+    float displayRange = logDisplayMax - logDisplayMin;
+
+    // no bin may map to a larger contrast than the linear operator would
+    for (int iteration = 0; iteration < TM_HIST_ITERATIONS; ++iteration)
+    {
+        scratch[lid] = counts[lid];
+        barrier(CLK_LOCAL_MEM_FENCE);
+        tm_local_sum(scratch, lid);
+        float total = scratch[0];
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        float ceiling = total * binWidth / displayRange;
+        float excess = fmax(counts[lid] - ceiling, 0.0f);
+
+        scratch[lid] = excess;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        tm_local_sum(scratch, lid);
+        float trimmings = scratch[0];
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // uniform across the work-group, every item read the same sums
+        if (trimmings <= TM_HIST_TOLERANCE * total)
+            break;
+
+        counts[lid] -= excess;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // inclusive scan, cdf[i] is the fraction of pixels up to the end of bin i
+    scratch[lid] = counts[lid];
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int offset = 1; offset < TM_HIST_BINS; offset <<= 1)
+    {
+        float value = lid >= offset ? scratch[lid - offset] : 0.0f;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        scratch[lid] += value;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    float total = scratch[TM_HIST_BINS - 1];
+    cdf[lid] = total > 0.0f ? scratch[lid] / total : (float)(lid + 1) / TM_HIST_BINS;
+}
+
+__kernel void tm_histogram_adjustment(__global const float* red_channel,
+                                      __global const float* green_channel,
+                                      __global const float* blue_channel,
+                                      __global const uint* log_range,
+                                      __global const float* cdf,
+                                      __write_only image2d_t outputImage,
+                                      float logDisplayMin,
+                                      float logDisplayMax,
+                                      float gamma,
+                                      int width)
+{
+    const int2 pos = {get_global_id(0), get_global_id(1)};
+    int index = pos.x + width * pos.y;
+
+    float4 color = {red_channel[index], green_channel[index], blue_channel[index], 1.0f};
+    float Lw = getLuminance(color);
+
+    float logMin = tm_ordered_to_float(log_range[0]);
+    float logMax = tm_ordered_to_float(log_range[1]);
+    float logWorldRange = fmax(logMax - logMin, 1e-6f);
+    float displayRange = logDisplayMax - logDisplayMin;
+
+    float l = log(TM_HIST_DELTA + fmax(Lw, 0.0f));
+    float Bde;
+
+    if (logWorldRange <= displayRange)
+    {
+        // the scene fits on the display, a linear operator is enough
+        Bde = logDisplayMax - (logMax - l);
+    }
+    else
+    {
+        // interpolate the cdf between the bin edges
+        float t = clamp((l - logMin) / logWorldRange * TM_HIST_BINS, 0.0f, (float)TM_HIST_BINS);
+        int bin = min((int)t, TM_HIST_BINS - 1);
+        float lower = bin > 0 ? cdf[bin - 1] : 0.0f;
+        float P = lower + (cdf[bin] - lower) * (t - bin);
+
+        Bde = logDisplayMin + displayRange * P;
+    }
+
+    // display luminance relative to the display white
+    float Ld = exp(Bde - logDisplayMax);
+    color = Lw > 0.0f ? color * (Ld / Lw) : (float4)(0.0f);
+    color = clamp(color, 0.0f, 1.0f);
+    color = gammaCorrect(color, gamma);
+
+    // correct alpha
+    color.w = 1.0f;
+
+    // write back, the output is normalised so it can be a shared GL texture
+    write_imagef(outputImage, pos, color);
+}
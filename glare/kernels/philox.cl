@@ -0,0 +1,39 @@
+// Philox4x32-10 counter based generator, the device side of Philox.h.
+// Built ahead of the other kernel files so every kernel can draw from it,
+// blocks are keyed the same way: counter (index, frame, stream, 0) and
+// key (seed, 0), so host and device produce the same values
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+// must match RandomStream in Philox.h
+#define RANDOM_STREAM_PUPIL       0
+#define RANDOM_STREAM_DEFORMATION 1
+#define RANDOM_STREAM_PARTICLES   2
+#define RANDOM_STREAM_PARTICLE_MOTION 3
+#define RANDOM_STREAM_GRATINGS    4
+
+uint4 philox4x32(uint4 ctr, uint2 key)
+{
+    for (int round = 0; round < PHILOX_ROUNDS; ++round)
+    {
+        uint hi0 = mul_hi(PHILOX_M0, ctr.x);
+        uint lo0 = PHILOX_M0 * ctr.x;
+        uint hi1 = mul_hi(PHILOX_M1, ctr.z);
+        uint lo1 = PHILOX_M1 * ctr.z;
+
+        ctr = (uint4)(hi1 ^ ctr.y ^ key.x, lo1, hi0 ^ ctr.w ^ key.y, lo0);
+        key += (uint2)(PHILOX_W0, PHILOX_W1);
+    }
+    return ctr;
+}
+
+// Block index of the (seed, frame, stream) sequence as four floats in [0, 1)
+float4 philox_uniform4(uint seed, uint frame, uint stream, uint index)
+{
+    uint4 bits = philox4x32((uint4)(index, frame, stream, 0), (uint2)(seed, 0));
+    return convert_float4(bits >> 8) * (1.0f / 16777216.0f);
+}
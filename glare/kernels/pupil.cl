@@ -0,0 +1,124 @@
+// Pupil dynamics on the device, see PupilModel.h. One work-group averages
+// the luminance of the foveal window and its first work-item advances the
+// pupil state, which glr_render_pupil reads in the same queue, so the
+// host never waits on the measurement
+
+// must match PupilModel.h
+#define PUPIL_LATENCY 0.25f
+#define PUPIL_TAU_CONSTRICT 0.15f
+#define PUPIL_TAU_DILATE 1.5f
+#define PUPIL_HIPPUS_TAU 1.0f
+#define PUPIL_HIPPUS_SIGMA 0.05f
+#define PUPIL_MIN_DIAMETER 1.5f
+#define PUPIL_HISTORY 64
+#define PUPIL_GROUP 256
+
+typedef struct
+{
+    float time;
+    float diameter;
+    float hippus;
+    float aperture;
+    float radiusPx;
+    float luminance;
+    uint count;
+    uint pad;
+    float sampleTime[PUPIL_HISTORY];
+    float sampleLuminance[PUPIL_HISTORY];
+} PupilState;
+
+float pupil_steady_diameter(float luminance)
+{
+    return 4.9f - 3.0f * tanh(0.4f * (log(fmax(luminance, 1e-6f)) + 1.0f));
+}
+
+// Averages the window (x0, y0, windowWidth, windowHeight) of the image
+// planes in cd/m^2, or takes fieldLuminance when it is not negative, and
+// advances the state by dt seconds. Launched as a single work-group
+__kernel __attribute__((reqd_work_group_size(PUPIL_GROUP, 1, 1)))
+void glr_update_pupil(__global const float* red,
+                      __global const float* green,
+                      __global const float* blue,
+                      int width,
+                      int x0,
+                      int y0,
+                      int windowWidth,
+                      int windowHeight,
+                      float fieldLuminance,
+                      float luminanceScale,
+                      __global PupilState* state,
+                      float dt,
+                      uint seed,
+                      uint frame,
+                      float maxDiameter,
+                      int psfHeight)
+{
+    __local float sums[PUPIL_GROUP];
+
+    int lid = get_local_id(0);
+    int nPixels = fieldLuminance < 0.0f ? windowWidth * windowHeight : 0;
+
+    float sum = 0.0f;
+    for (int i = lid; i < nPixels; i += PUPIL_GROUP)
+    {
+        int index = (y0 + i / windowWidth) * width + x0 + i % windowWidth;
+        sum += fmax(0.212671f * red[index] + 0.71516f * green[index] + 0.072169f * blue[index], 0.0f);
+    }
+    sums[lid] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int offset = PUPIL_GROUP / 2; offset > 0; offset >>= 1)
+    {
+        if (lid < offset)
+            sums[lid] += sums[lid + offset];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (lid != 0)
+        return;
+
+    float luminance = nPixels > 0 ? sums[0] / nPixels * luminanceScale : fieldLuminance;
+
+    // hippus kick from the pupil stream of the frame, Box-Muller
+    float4 u = philox_uniform4(seed, frame, RANDOM_STREAM_PUPIL, 0);
+    float gauss = sqrt(-2.0f * log(1.0f - u.x)) * cos(2.0f * M_PI_F * u.y);
+
+    if (state->count == 0)
+    {
+        state->time = 0.0f;
+        state->diameter = pupil_steady_diameter(luminance);
+        state->hippus = 0.0f;
+    }
+    else
+    {
+        state->time += dt;
+    }
+
+    state->sampleTime[state->count % PUPIL_HISTORY] = state->time;
+    state->sampleLuminance[state->count % PUPIL_HISTORY] = luminance;
+    state->count++;
+
+    // the newest sample at least the latency old, or the oldest one kept
+    uint kept = min(state->count, (uint)PUPIL_HISTORY);
+    float delayed = luminance;
+    for (uint k = 0; k < kept; ++k)
+    {
+        uint slot = (state->count - 1 - k) % PUPIL_HISTORY;
+        delayed = state->sampleLuminance[slot];
+        if (state->time - state->sampleTime[slot] >= PUPIL_LATENCY)
+            break;
+    }
+
+    float target = pupil_steady_diameter(delayed);
+    float tau = target < state->diameter ? PUPIL_TAU_CONSTRICT : PUPIL_TAU_DILATE;
+    state->diameter += (target - state->diameter) * (1.0f - exp(-dt / tau));
+
+    float decay = exp(-dt / PUPIL_HIPPUS_TAU);
+    state->hippus = state->hippus * decay + sqrt(1.0f - decay * decay) * gauss;
+
+    float p = fmin(state->diameter, maxDiameter);
+    float aperture = p + PUPIL_HIPPUS_SIGMA * state->hippus * maxDiameter / p * sqrt(1.0f - p / maxDiameter);
+    state->aperture = clamp(aperture, PUPIL_MIN_DIAMETER, maxDiameter);
+    state->radiusPx = (float)psfHeight / maxDiameter * state->aperture / 2.0f;
+    state->luminance = luminance;
+}
@@ -38,10 +38,8 @@ __kernel void tm_reinhard_extended( __global const float* red_channel,
     // correct alpha
     color.w = 1.0f;
 
-    color = color * 255.0f;
-
-    // write back
-    write_imageui(outputImage, pos, convert_uint4_sat(color));
+    // write back, the output is normalised so it can be a shared GL texture
+    write_imagef(outputImage, pos, color);
 }
 
 float4 gammaCorrect(float4 color, float gamma)
@@ -0,0 +1,113 @@
+// Reinhard et al. "Photographic Tone Reproduction for Digital Images"
+// dodging-and-burning operator. The luminance is blurred at every scale in
+// the frequency domain: the spectra of the convolved channels are already
+// available, so the luminance spectrum is a linear combination of them and
+// each blur is a multiplication with the analytic transfer function of the
+// Gaussian centre-surround kernel.
+
+float4 gammaCorrect(float4 color, float gamma);
+float getLuminance(float4 color);
+
+__constant const float TM_LOCAL_PI      = 3.14159265f;
+__constant const float TM_LOCAL_ALPHA1  = 0.35355339f;    // 1 / (2 * sqrt(2))
+__constant const float TM_LOCAL_RATIO   = 1.6f;           // s_{i+1} / s_i
+
+// Spectra are in clFFT hermitian interleaved layout: (width/2 + 1) x height
+// complex values per scale. Launched over (width/2 + 1, height).
+__kernel void tm_local_scale_spectra(__global const float* red_spectrum,
+                                     __global const float* green_spectrum,
+                                     __global const float* blue_spectrum,
+                                     __global float* scale_spectra,
+                                     int width,
+                                     int height,
+                                     int nScales)
+{
+    int xp = get_global_id(0);
+    int yp = get_global_id(1);
+
+    int specWidth = width / 2 + 1;
+    int index = (xp + yp * specWidth) * 2;
+
+    // the FFT is linear, so the luminance spectrum is the weighted sum
+    float re = 0.212671f * red_spectrum[index]
+             + 0.71516f  * green_spectrum[index]
+             + 0.072169f * blue_spectrum[index];
+    float im = 0.212671f * red_spectrum[index+1]
+             + 0.71516f  * green_spectrum[index+1]
+             + 0.072169f * blue_spectrum[index+1];
+
+    // frequencies in cycles per pixel, negative half of y wraps around
+    float fx = (float)xp / width;
+    float fy = (float)(yp <= height / 2 ? yp : yp - height) / height;
+    float f2 = fx * fx + fy * fy;
+
+    int scaleStride = specWidth * height * 2;
+
+    // R(x, y, s) = exp(-(x^2 + y^2) / (alpha s)^2) / (pi (alpha s)^2)
+    // has the transfer function exp(-pi^2 (alpha s)^2 |f|^2)
+    float s = 1.0f;
+    for (int i = 0; i <= nScales; ++i)
+    {
+        float as = TM_LOCAL_ALPHA1 * s;
+        float g = exp(-TM_LOCAL_PI * TM_LOCAL_PI * as * as * f2);
+
+        scale_spectra[i * scaleStride + index]   = re * g;
+        scale_spectra[i * scaleStride + index+1] = im * g;
+
+        s *= TM_LOCAL_RATIO;
+    }
+}
+
+// blurred holds nScales + 1 planes of width x height luminance, plane i
+// blurred at scale 1.6^i. V2 at scale s is V1 at scale 1.6 s.
+__kernel void tm_reinhard_local(__global const float* red_channel,
+                                __global const float* green_channel,
+                                __global const float* blue_channel,
+                                __global const float* blurred,
+                                __write_only image2d_t outputImage,
+                                float exposure,
+                                float key,
+                                float phi,
+                                float epsilon,
+                                float gamma,
+                                int width,
+                                int height,
+                                int nScales)
+{
+    const int2 pos = {get_global_id(0), get_global_id(1)};
+    int index = pos.x + width * pos.y;
+    int planeSize = width * height;
+
+    float4 color = {red_channel[index], green_channel[index], blue_channel[index], 1.0f};
+
+    float Lw = getLuminance(color);
+    float L = exposure * Lw;
+
+    // pick the largest scale around which no large contrast is found
+    float adaptation = exposure * blurred[index];
+    float s = 1.0f;
+    float sharpening = native_powr(2.0f, phi) * key;
+    for (int i = 0; i < nScales; ++i)
+    {
+        float v1 = exposure * blurred[i * planeSize + index];
+        float v2 = exposure * blurred[(i+1) * planeSize + index];
+        float v = (v1 - v2) / (sharpening / (s * s) + v1);
+
+        if (fabs(v) >= epsilon)
+            break;
+
+        adaptation = v1;
+        s *= TM_LOCAL_RATIO;
+    }
+
+    float Ld = L / (1.0f + adaptation);
+    color = Lw > 0.0f ? color * (Ld / Lw) : (float4)(0.0f);
+    color = clamp(color, 0.0f, 1.0f);
+    color = gammaCorrect(color, gamma);
+
+    // correct alpha
+    color.w = 1.0f;
+
+    // write back, the output is normalised so it can be a shared GL texture
+    write_imagef(outputImage, pos, color);
+}
@@ -4,14 +4,17 @@ const sampler_t sampler = CLK_ADDRESS_CLAMP | CLK_NORMALIZED_COORDS_FALSE |
 constant uint4 blackColor = {0, 0, 0, 255};
 constant uint4 whiteColor = {255, 255, 255, 255};
 
+// The radius comes from the pupil state glr_update_pupil left earlier in
+// the queue
 __kernel void glr_render_pupil(__write_only image2d_t outputImage,
-                               float radius, 
+                               __global const PupilState* pupil,
                                int width, 
                                int height,
                                float2 ctr)
 
 {
     const int2 pos = {get_global_id(0), get_global_id(1)}; 
+    const float radius = pupil->radiusPx;
     // if(distance(ctr, convert_float2(pos)) > radius)
     if(pown(ctr.x - pos.x, 2) + pown(ctr.y - pos.y, 2) > pown(radius,2) )
         write_imageui(outputImage, pos, blackColor);
@@ -20,6 +23,50 @@ __kernel void glr_render_pupil(__write_only image2d_t outputImage,
 }
 
 
+// must match Gratings.h
+#define GRATINGS_WIDTH 0.0025f
+#define GRATINGS_CONTRAST 0.55f
+#define GRATINGS_REACH 2
+
+// Bakes the procedural lens gratings of Gratings.h, the radial fibres
+// drawn from the RANDOM_STREAM_GRATINGS blocks of the seed. Run once per
+// PSF size, seed or fibre setting
+__kernel void glr_bake_gratings(__write_only image2d_t outputImage,
+                                int width,
+                                int height,
+                                int fibres,
+                                float jitter,
+                                uint seed)
+{
+    const int2 pos = {get_global_id(0), get_global_id(1)};
+    if (pos.x >= width || pos.y >= height)
+        return;
+
+    float transmission = 1.0f;
+    if (fibres > 0)
+    {
+        float spacing = 2.0f * M_PI_F / fibres;
+        float2 d = (float2)(pos.x + 0.5f - width / 2.0f, pos.y + 0.5f - height / 2.0f);
+        float r = length(d);
+        float theta = atan2(d.y, d.x);
+        int slot = (int)floor((theta + M_PI_F) / spacing);
+
+        for (int k = slot - GRATINGS_REACH; k <= slot + GRATINGS_REACH; ++k)
+        {
+            int fibre = ((k % fibres) + fibres) % fibres;
+            float4 u = philox_uniform4(seed, 0, RANDOM_STREAM_GRATINGS, fibre);
+            float angle = -M_PI_F + (fibre + 0.5f + jitter * (u.x - 0.5f)) * spacing
+                        + jitter * (u.y - 0.5f) * spacing * r / height;
+            float halfWidth = 0.5f * GRATINGS_WIDTH * (0.5f + u.z) * height;
+            float coverage = clamp(halfWidth + 0.5f - r * fabs(remainder(theta - angle, 2.0f * M_PI_F)), 0.0f, 1.0f);
+            transmission *= 1.0f - GRATINGS_CONTRAST * (0.75f + 0.5f * u.w) * coverage;
+        }
+    }
+
+    uint v = convert_uint_sat_rte(transmission * 255.0f);
+    write_imageui(outputImage, pos, (uint4)(v, v, v, 255));
+}
+
 // this kernel puts a white spot in the middle of a grating texture
 __kernel void glr_render_gratings(__read_only image2d_t inputImage,
                                   __write_only image2d_t outputImage,
@@ -41,57 +88,266 @@ __kernel void glr_render_gratings(__read_only image2d_t inputImage,
 }
 
 
-// we distort the original points coordinates based on 
-// the variation of the lens size
-__kernel void glr_render_lens_points(__global const float* points, 
-                                     __global unsigned char* outputImage, 
-                                     int width, 
-                                     int height, 
-                                     float distort )
+// Position and deformation response of a lens particle at pos: x, dx,
+// y, dy, the displacement grows with the distance from the lens centre
+// like TemporalGlareRenderer::deformationCoeff
+float4 lens_point(float2 pos, int height)
+{
+    float radius = length(pos);
+    float dr = (exp(2.0f * radius / height) - 1.0f) / (M_E_F - 1.0f);
+    float scale = radius > 0.0f ? dr / radius : 0.0f;
+    return (float4)(pos.x, pos.x * scale, pos.y, pos.y * scale);
+}
+
+// Lens particles from first on, at rest. Point i is block i of the
+// particle stream so the host generates the same ones
+// (TemporalGlareRenderer::generateLensPoints)
+__kernel void glr_generate_lens_points(__global float4* points,
+                                       __global float2* velocities,
+                                       uint seed,
+                                       int first,
+                                       int nPoints,
+                                       int height)
+{
+    int i = first + get_global_id(0);
+    if (i >= nPoints)
+        return;
+
+    float4 u = philox_uniform4(seed, 0, RANDOM_STREAM_PARTICLES, i);
+    float2 sign = (float2)(u.x < 0.5f ? 1.0f : -1.0f, u.y < 0.5f ? 1.0f : -1.0f);
+
+    points[i] = lens_point(sign * u.zw, height);
+    velocities[i] = (float2)(0.0f, 0.0f);
+}
+
+// Moves the lens particles over dt seconds. Velocities relax towards the
+// drift at the damping rate and get a Brownian kick from the frame's
+// motion stream, positions reflect at the border of the lens
+__kernel void glr_step_lens_points(__global float4* points,
+                                   __global float2* velocities,
+                                   uint seed,
+                                   uint frame,
+                                   float dt,
+                                   int nPoints,
+                                   int height,
+                                   float2 drift,
+                                   float damping,
+                                   float diffusion)
 {
-    int index = get_global_id(0);
-    index = index * 4;
+    int i = get_global_id(0);
+    if (i >= nPoints)
+        return;
 
-    float xnew = points[index] + distort * points[index+1];
-    xnew = xnew * width/2.0f + width/2.0f;
+    // two normal deviates, Box-Muller
+    float4 u = philox_uniform4(seed, frame, RANDOM_STREAM_PARTICLE_MOTION, i);
+    float r = sqrt(-2.0f * log(1.0f - u.x));
+    float2 kick = r * (float2)(cos(2.0f * M_PI_F * u.y), sin(2.0f * M_PI_F * u.y));
+
+    float2 v = velocities[i];
+    v += (drift - v) * min(damping * dt, 1.0f) + diffusion * sqrt(dt) * kick;
+
+    float4 p = points[i];
+    float2 pos = (float2)(p.x, p.z) + v * dt;
+    if (pos.x > 1.0f)  { pos.x = 2.0f - pos.x;  v.x = -v.x; }
+    if (pos.x < -1.0f) { pos.x = -2.0f - pos.x; v.x = -v.x; }
+    if (pos.y > 1.0f)  { pos.y = 2.0f - pos.y;  v.y = -v.y; }
+    if (pos.y < -1.0f) { pos.y = -2.0f - pos.y; v.y = -v.y; }
+    pos = clamp(pos, -1.0f, 1.0f);
+
+    points[i] = lens_point(pos, height);
+    velocities[i] = v;
+}
+
+// Particle rasteriser, the same constants as LensParticles.h
+#define LENS_PARTICLE_RADIUS 1.5f
+#define LENS_TILE 16
+#define LENS_TILES_PER_POINT 4
+#define LENS_DEPTH_SCALE 4096.0f
+#define LENS_DEPTH_OPAQUE 49152u
+#define LENS_SCAN_GROUP 256
+
+// Tiles a particle at pos overlaps, false when it is off the aperture
+bool lens_point_tiles(float2 pos, int width, int height, int tilesX, int tilesY, int4* tiles)
+{
+    float extent = LENS_PARTICLE_RADIUS + 0.5f;
+    if (pos.x + extent < 0.0f || pos.y + extent < 0.0f || pos.x - extent >= width || pos.y - extent >= height)
+        return false;
+
+    *tiles = (int4)(clamp((int)floor((pos.x - extent) / LENS_TILE), 0, tilesX - 1),
+                    clamp((int)floor((pos.y - extent) / LENS_TILE), 0, tilesY - 1),
+                    clamp((int)floor((pos.x + extent) / LENS_TILE), 0, tilesX - 1),
+                    clamp((int)floor((pos.y + extent) / LENS_TILE), 0, tilesY - 1));
+    return true;
+}
+
+// Pass 1: places the particles on the aperture, distorted with the lens,
+// and counts them per tile
+__kernel void glr_count_lens_points(__global const float4* points,
+                                    __global float2* screen,
+                                    __global uint* tileCounts,
+                                    int nPoints,
+                                    int width,
+                                    int height,
+                                    int tilesX,
+                                    int tilesY,
+                                    float distort)
+{
+    int i = get_global_id(0);
+    if (i >= nPoints)
+        return;
 
-    float ynew = points[index+2] + distort * points[index+3];
-    ynew = ynew * height/2.0f + height/2.0f;
+    float4 p = points[i];
+    float2 pos = (float2)((p.x + distort * p.y) * width / 2.0f + width / 2.0f,
+                          (p.z + distort * p.w) * height / 2.0f + height / 2.0f);
+    screen[i] = pos;
 
-    int pos; 
+    int4 tiles;
+    if (!lens_point_tiles(pos, width, height, tilesX, tilesY, &tiles))
+        return;
 
-    int i, j;
-    for(i = -1; i <=1; i++)
-        for(j = -1; j<=1; j++)
+    for (int ty = tiles.y; ty <= tiles.w; ++ty)
+        for (int tx = tiles.x; tx <= tiles.z; ++tx)
+            atomic_inc(&tileCounts[ty * tilesX + tx]);
+}
+
+// Exclusive prefix sum of the tile counts into offsets, nTiles + 1 of
+// them, in a single work-group. The cursors of the binning pass start at
+// the offsets and the counts are cleared for the next frame
+__kernel __attribute__((reqd_work_group_size(LENS_SCAN_GROUP, 1, 1)))
+void glr_scan_lens_tiles(__global uint* tileCounts,
+                         __global uint* tileOffsets,
+                         __global uint* tileCursors,
+                         int nTiles)
+{
+    __local uint partials[LENS_SCAN_GROUP];
+
+    int lid = get_local_id(0);
+    int size = LENS_SCAN_GROUP;
+    int chunk = (nTiles + size - 1) / size;
+    int begin = min(lid * chunk, nTiles);
+    int end = min(begin + chunk, nTiles);
+
+    uint sum = 0;
+    for (int t = begin; t < end; ++t)
+        sum += tileCounts[t];
+    partials[lid] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (lid == 0)
+    {
+        uint running = 0;
+        for (int k = 0; k < size; ++k)
         {
-            pos = (int)(xnew+i) * width + (int)(ynew+j);
-            if(pos < width*height)
+            uint count = partials[k];
+            partials[k] = running;
+            running += count;
+        }
+        tileOffsets[nTiles] = running;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    uint offset = partials[lid];
+    for (int t = begin; t < end; ++t)
+    {
+        tileOffsets[t] = offset;
+        tileCursors[t] = offset;
+        offset += tileCounts[t];
+        tileCounts[t] = 0;
+    }
+}
+
+// Pass 2: writes every particle into the bins of the tiles it overlaps
+__kernel void glr_bin_lens_points(__global const float2* screen,
+                                  __global uint* tileCursors,
+                                  __global uint* tileEntries,
+                                  int nPoints,
+                                  int width,
+                                  int height,
+                                  int tilesX,
+                                  int tilesY)
+{
+    int i = get_global_id(0);
+    if (i >= nPoints)
+        return;
+
+    int4 tiles;
+    if (!lens_point_tiles(screen[i], width, height, tilesX, tilesY, &tiles))
+        return;
+
+    for (int ty = tiles.y; ty <= tiles.w; ++ty)
+        for (int tx = tiles.x; tx <= tiles.z; ++tx)
+            tileEntries[atomic_inc(&tileCursors[ty * tilesX + tx])] = i;
+}
+
+// One work-group per tile: the particles of the tile's bin are spread
+// over the work-items and each splats the analytic coverage of its disc
+// into the tile's optical depth in local memory. The mask is the
+// transmission, 1 where nothing covers the pixel
+__kernel __attribute__((reqd_work_group_size(LENS_TILE, LENS_TILE, 1)))
+void glr_rasterise_lens_points(__global const float2* screen,
+                               __global const uint* tileOffsets,
+                               __global const uint* tileEntries,
+                               __global float* mask,
+                               int width,
+                               int height)
+{
+    __local uint depth[LENS_TILE * LENS_TILE];
+
+    int lid = get_local_id(1) * LENS_TILE + get_local_id(0);
+    int tile = get_group_id(1) * get_num_groups(0) + get_group_id(0);
+    int ox = get_group_id(0) * LENS_TILE;
+    int oy = get_group_id(1) * LENS_TILE;
+
+    depth[lid] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    float extent = LENS_PARTICLE_RADIUS + 0.5f;
+    uint end = tileOffsets[tile + 1];
+    for (uint e = tileOffsets[tile] + lid; e < end; e += LENS_TILE * LENS_TILE)
+    {
+        float2 pos = screen[tileEntries[e]];
+        int x0 = max((int)floor(pos.x - extent), ox);
+        int x1 = min((int)ceil(pos.x + extent), ox + LENS_TILE);
+        int y0 = max((int)floor(pos.y - extent), oy);
+        int y1 = min((int)ceil(pos.y + extent), oy + LENS_TILE);
+
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x)
             {
-                pos*=4;
-                
-                outputImage[pos] = 0;
-                outputImage[pos+1] = 0;
-                outputImage[pos+2] = 0;
-                outputImage[pos+3] = 255;
+                float coverage = LENS_PARTICLE_RADIUS + 0.5f - distance((float2)(x + 0.5f, y + 0.5f), pos);
+                if (coverage <= 0.0f)
+                    continue;
+                uint d = coverage >= 1.0f ? LENS_DEPTH_OPAQUE
+                                          : (uint)(-log(1.0f - coverage) * LENS_DEPTH_SCALE + 0.5f);
+                atomic_add(&depth[(y - oy) * LENS_TILE + (x - ox)], d);
             }
-            
-        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int x = ox + get_local_id(0);
+    int y = oy + get_local_id(1);
+    if (x < width && y < height)
+        mask[y * width + x] = exp(-(float)depth[lid] / LENS_DEPTH_SCALE);
 }
 
 // merge images -> better implement alpha blending
+// The gratings, black outside the pupil and attenuated by the particle
+// occlusion mask
 __kernel void glr_merge_images(__read_only image2d_t inputImage1,
                                 __read_only image2d_t inputImage2,
-                                __read_only image2d_t inputImage3,
-                                __write_only image2d_t outputImage)
+                                __global const float* occlusion,
+                                __write_only image2d_t outputImage,
+                                int width)
 {
     const int2 pos = {get_global_id(0), get_global_id(1)}; 
     uint4 color1 = read_imageui(inputImage1, sampler, pos);
     uint4 color2 = read_imageui(inputImage2, sampler, pos);
-    uint4 color3 = read_imageui(inputImage3, sampler, pos);
     uint4 color  = color1; // by default, we get the slids
 
-    if(color3.x == 0 || color2.x == 0)
+    if(color2.x == 0)
         color = blackColor;
+    else
+        color.xyz = convert_uint3_sat_rte(convert_float3(color.xyz) * occlusion[pos.y * width + pos.x]);
     
     write_imageui(outputImage, pos, color);
 
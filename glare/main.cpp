@@ -8,6 +8,7 @@
 #include <QCommandLineParser>
 
 #include "TGViewerWindow.h"
+#include "Trace.h"
 
 int main(int argc, char *argv[])
 {
@@ -16,9 +17,21 @@ int main(int argc, char *argv[])
     QCommandLineParser parser;
     parser.setApplicationDescription("Temporal Glare Viewer");
     parser.addHelpOption();
+    QCommandLineOption traceOption("trace", "Chrome trace of the session, needs a GLARE_TRACING build", "file");
+    parser.addOption(traceOption);
+    QCommandLineOption decodersOption("decoders", "Threads decoding EXR sequences, 0 for one per hardware thread but one", "count", "0");
+    parser.addOption(decodersOption);
 
     parser.process(app);
 
+    QString tracePath = parser.value(traceOption);
+    if (!tracePath.isEmpty() && !traceStart())
+    {
+        std::cerr << "Error: --trace needs a build with GLARE_TRACING" << std::endl;
+        return 1;
+    }
+    TRACE_THREAD_NAME("main");
+
 
     QSurfaceFormat fmt;
     fmt.setSamples(4);
@@ -30,7 +43,17 @@ int main(int argc, char *argv[])
     //     lf_dir=args[0];
 
     TGViewerWindow window;
+    if (!window.getRenderer().isValid())
+    {
+        std::cerr << "Error: " << window.getRenderer().getError() << std::endl;
+        return 1;
+    }
+    window.setSequenceDecoders(parser.value(decodersOption).toInt());
     window.show();
-    return app.exec();
+    int status = app.exec();
+
+    if (!tracePath.isEmpty() && !traceWriteChrome(tracePath.toStdString()))
+        std::cerr << "Error: Could not write " << tracePath.toStdString() << std::endl;
+    return status;
 
 }
@@ -0,0 +1,188 @@
+// CpuFFT against a naive double precision DFT: complex and real planes
+// with every supported prime factor, odd real widths, batches with tight
+// and padded distances, and the scaled backward transform back to the
+// input.
+
+#include "CpuFFT.h"
+
+#include <cmath>
+#include <complex>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+typedef std::complex<double> Complex;
+
+// relative L2 error CpuFFT may have over the double precision DFT
+#define CPUFFT_TEST_TOLERANCE 1e-5
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what)
+{
+    if (!ok)
+    {
+        std::cout << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+// Unscaled forward 2D DFT of a width x height plane, row major
+static std::vector<Complex> dft2D(const std::vector<Complex>& in, int width, int height)
+{
+    const double pi = std::acos(-1.0);
+    std::vector<Complex> rows(in.size()), out(in.size());
+    for (int y = 0; y < height; ++y)
+        for (int k = 0; k < width; ++k)
+        {
+            Complex sum = 0.0;
+            for (int x = 0; x < width; ++x)
+                sum += in[(size_t)y * width + x] * std::polar(1.0, -2.0 * pi * ((size_t)k * x % width) / width);
+            rows[(size_t)y * width + k] = sum;
+        }
+    for (int x = 0; x < width; ++x)
+        for (int k = 0; k < height; ++k)
+        {
+            Complex sum = 0.0;
+            for (int y = 0; y < height; ++y)
+                sum += rows[(size_t)y * width + x] * std::polar(1.0, -2.0 * pi * ((size_t)k * y % height) / height);
+            out[(size_t)k * width + x] = sum;
+        }
+    return out;
+}
+
+static double relativeError(double error, double norm)
+{
+    return norm > 0.0 ? std::sqrt(error / norm) : std::sqrt(error);
+}
+
+static std::vector<float> randomPlanes(size_t count)
+{
+    std::vector<float> values(count);
+    for (size_t i = 0; i < count; ++i)
+        values[i] = (float)std::rand() / RAND_MAX * 2.0f - 1.0f;
+    return values;
+}
+
+// Batched complex transform, spatialDistance and spectralDistance in floats
+static void testComplex(int width, int height, int batch, size_t padding)
+{
+    const size_t plane = 2 * (size_t)width * height;
+    const size_t distance = plane + padding;
+    std::vector<float> input = randomPlanes(distance * batch);
+    std::vector<float> spectrum(distance * batch, 0.0f), output(distance * batch, 0.0f);
+
+    CpuFFT fft(width, height, CPU_FFT_COMPLEX, batch);
+    fft.setDistances(distance, distance);
+    fft.forward(input.data(), spectrum.data());
+    fft.backward(spectrum.data(), output.data());
+
+    double error = 0.0, norm = 0.0, roundTrip = 0.0, inputNorm = 0.0;
+    for (int b = 0; b < batch; ++b)
+    {
+        const float* in = input.data() + b * distance;
+        std::vector<Complex> values((size_t)width * height);
+        for (size_t i = 0; i < values.size(); ++i)
+            values[i] = Complex(in[2 * i], in[2 * i + 1]);
+        std::vector<Complex> expected = dft2D(values, width, height);
+
+        const float* out = spectrum.data() + b * distance;
+        const float* back = output.data() + b * distance;
+        for (size_t i = 0; i < expected.size(); ++i)
+        {
+            error += std::norm(Complex(out[2 * i], out[2 * i + 1]) - expected[i]);
+            norm += std::norm(expected[i]);
+            roundTrip += std::norm(Complex(back[2 * i], back[2 * i + 1]) - values[i]);
+            inputNorm += std::norm(values[i]);
+        }
+    }
+
+    std::string name = "complex " + std::to_string(width) + "x" + std::to_string(height) +
+                       " batch " + std::to_string(batch) + " padding " + std::to_string(padding);
+    check(relativeError(error, norm) < CPUFFT_TEST_TOLERANCE, name + " forward");
+    check(relativeError(roundTrip, inputNorm) < CPUFFT_TEST_TOLERANCE, name + " backward");
+}
+
+// Batched real transform, hermitian rows of width/2 + 1 values
+static void testReal(int width, int height, int batch, size_t padding)
+{
+    const int hermitianWidth = width / 2 + 1;
+    const size_t spatialDistance = (size_t)width * height + padding;
+    const size_t spectralDistance = 2 * (size_t)hermitianWidth * height + 2 * padding;
+    std::vector<float> input = randomPlanes(spatialDistance * batch);
+    std::vector<float> spectrum(spectralDistance * batch, 0.0f), output(spatialDistance * batch, 0.0f);
+
+    CpuFFT fft(width, height, CPU_FFT_REAL, batch);
+    fft.setDistances(spatialDistance, spectralDistance);
+    fft.forward(input.data(), spectrum.data());
+    fft.backward(spectrum.data(), output.data());
+
+    double error = 0.0, norm = 0.0, roundTrip = 0.0, inputNorm = 0.0;
+    for (int b = 0; b < batch; ++b)
+    {
+        const float* in = input.data() + b * spatialDistance;
+        std::vector<Complex> values((size_t)width * height);
+        for (size_t i = 0; i < values.size(); ++i)
+            values[i] = in[i];
+        std::vector<Complex> expected = dft2D(values, width, height);
+
+        const float* out = spectrum.data() + b * spectralDistance;
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < hermitianWidth; ++x)
+            {
+                size_t i = (size_t)y * hermitianWidth + x;
+                Complex e = expected[(size_t)y * width + x];
+                error += std::norm(Complex(out[2 * i], out[2 * i + 1]) - e);
+                norm += std::norm(e);
+            }
+
+        const float* back = output.data() + b * spatialDistance;
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+            roundTrip += (back[i] - in[i]) * (back[i] - in[i]);
+            inputNorm += in[i] * in[i];
+        }
+    }
+
+    std::string name = "real " + std::to_string(width) + "x" + std::to_string(height) +
+                       " batch " + std::to_string(batch) + " padding " + std::to_string(padding);
+    check(relativeError(error, norm) < CPUFFT_TEST_TOLERANCE, name + " forward");
+    check(relativeError(roundTrip, inputNorm) < CPUFFT_TEST_TOLERANCE, name + " backward");
+}
+
+int main()
+{
+    std::srand(1);
+    std::cout << "CpuFFT with " << CpuFFT::getInstructionSet() << " butterflies\n";
+
+    // every prime factor, powers of two and mixed radices
+    const int sizes[][2] = {
+        {64, 32}, {12, 10}, {30, 14}, {22, 26}, {105, 8}, {48, 60}, {2, 2}
+    };
+    for (const auto& size : sizes)
+    {
+        testComplex(size[0], size[1], 1, 0);
+        testReal(size[0], size[1], 1, 0);
+    }
+
+    // odd widths of real planes have no half length rows
+    testReal(15, 9, 1, 0);
+    testReal(33, 12, 1, 0);
+
+    // batches, tight and with room between the planes
+    testComplex(20, 18, 3, 0);
+    testComplex(20, 18, 3, 6);
+    testReal(28, 24, 4, 0);
+    testReal(28, 24, 4, 10);
+
+    check(CpuFFT::supportsLength(2 * 3 * 5 * 7 * 11 * 13), "supportsLength of the supported primes");
+    check(!CpuFFT::supportsLength(2 * 17), "supportsLength of 17");
+
+    if (failures > 0)
+    {
+        std::cout << failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "All CpuFFT checks passed\n";
+    return 0;
+}
@@ -0,0 +1,129 @@
+// FrameWriter's ordering guarantee: a large EXR is submitted ahead of
+// small PNGs, which the other workers encode long before it, while a
+// second thread watches the directory and checks that a file never shows
+// up before the ones submitted ahead of it. A frame that can't be written
+// is counted as failed without holding the later ones back.
+
+#include "FrameWriter.h"
+
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define FRAMEWRITER_TEST_THREADS 4
+#define FRAMEWRITER_TEST_FRAMES 24
+// side of the EXR frames, large enough to still be encoding when the PNGs are done
+#define FRAMEWRITER_TEST_EXR_SIZE 1024
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what)
+{
+    if (!ok)
+    {
+        std::cout << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+static bool fileExists(const std::string& filename)
+{
+    FILE* file = std::fopen(filename.c_str(), "rb");
+    if (!file)
+        return false;
+    std::fclose(file);
+    return true;
+}
+
+static std::string frameName(int frame)
+{
+    char name[64];
+    std::snprintf(name, sizeof(name), "framewriter_test.%02d.%s", frame, frame % 8 == 0 ? "exr" : "png");
+    return name;
+}
+
+int main()
+{
+    for (int frame = 0; frame < FRAMEWRITER_TEST_FRAMES; ++frame)
+        std::remove(frameName(frame).c_str());
+
+    // the highest frame on disk first, then every frame before it: a frame
+    // turning up between the two looks is later than all of them
+    std::atomic<bool> done(false);
+    std::atomic<int> outOfOrder(0);
+    std::thread watcher([&] {
+        while (!done)
+        {
+            int last = -1;
+            for (int frame = FRAMEWRITER_TEST_FRAMES - 1; frame >= 0 && last < 0; --frame)
+                if (fileExists(frameName(frame)))
+                    last = frame;
+            for (int frame = 0; frame < last; ++frame)
+                if (!fileExists(frameName(frame)))
+                {
+                    std::cout << "frame " << last << " is on disk before frame " << frame << "\n";
+                    ++outOfOrder;
+                }
+        }
+    });
+
+    const int exrSize = FRAMEWRITER_TEST_EXR_SIZE;
+    const int pngSize = 16;
+    {
+        FrameWriter writer(FRAMEWRITER_TEST_THREADS);
+        unsigned int state = 1;
+        for (int frame = 0; frame < FRAMEWRITER_TEST_FRAMES; ++frame)
+        {
+            if (frame % 8 == 0)
+            {
+                // noise, so the compression has work to do
+                std::vector<float> planes[3];
+                for (auto& plane : planes)
+                {
+                    plane.resize((size_t)exrSize * exrSize);
+                    for (float& value : plane)
+                    {
+                        state = state * 1664525u + 1013904223u;
+                        value = (float)(state >> 8) * (1.0f / 16777216.0f) * 1000.0f;
+                    }
+                }
+                writer.writeExr(frameName(frame), exrSize, exrSize,
+                                std::move(planes[0]), std::move(planes[1]), std::move(planes[2]));
+            }
+            else
+            {
+                std::vector<unsigned char> bgra((size_t)pngSize * pngSize * 4, (unsigned char)(frame * 10));
+                writer.writePng(frameName(frame), pngSize, pngSize, std::move(bgra));
+            }
+
+            // a frame in the middle that can't be written
+            if (frame == FRAMEWRITER_TEST_FRAMES / 2)
+                writer.writePng("framewriter_test_no_such_directory/frame.png", pngSize, pngSize,
+                                std::vector<unsigned char>((size_t)pngSize * pngSize * 4, 0));
+        }
+
+        writer.flush();
+        check(writer.getWrittenFrames() == FRAMEWRITER_TEST_FRAMES, "written frames after flush");
+        check(writer.getFailedFrames() == 1, "failed frames after flush");
+        for (int frame = 0; frame < FRAMEWRITER_TEST_FRAMES; ++frame)
+            check(fileExists(frameName(frame)), frameName(frame) + " after flush");
+    }
+
+    done = true;
+    watcher.join();
+    check(outOfOrder == 0, "frames written in submission order");
+
+    for (int frame = 0; frame < FRAMEWRITER_TEST_FRAMES; ++frame)
+        std::remove(frameName(frame).c_str());
+
+    if (failures > 0)
+    {
+        std::cout << failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "All FrameWriter checks passed\n";
+    return 0;
+}
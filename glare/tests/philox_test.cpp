@@ -0,0 +1,197 @@
+// Philox.h against the Random123 known answers, then kernels/philox.cl
+// against Philox.h on the first OpenCL device: the host and device
+// generators have to give the same bits and the same floats for every
+// (seed, frame, stream, index). Exits with 77, skipped, when there is no
+// device to run the kernel on.
+//
+// philox_test <path to philox.cl>
+
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include "Philox.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// blocks drawn on the device per stream
+#define PHILOX_TEST_BLOCKS 4096
+
+#define PHILOX_TEST_SKIPPED 77
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what)
+{
+    if (!ok)
+    {
+        std::cout << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+// philox4x32-10 known answer tests of Random123
+static void testKnownAnswers()
+{
+    const uint32_t counters[3][4] = {
+        {0x00000000u, 0x00000000u, 0x00000000u, 0x00000000u},
+        {0xffffffffu, 0xffffffffu, 0xffffffffu, 0xffffffffu},
+        {0x243f6a88u, 0x85a308d3u, 0x13198a2eu, 0x03707344u}
+    };
+    const uint32_t keys[3][2] = {
+        {0x00000000u, 0x00000000u},
+        {0xffffffffu, 0xffffffffu},
+        {0xa4093822u, 0x299f31d0u}
+    };
+    const uint32_t expected[3][4] = {
+        {0x6627e8d5u, 0xe169c58du, 0xbc57ac4cu, 0x9b00dbd8u},
+        {0x408f276du, 0x41c83b0eu, 0xa20bc7c6u, 0x6d5451fdu},
+        {0xd16cfe09u, 0x94fdccebu, 0x5001e420u, 0x24126ea1u}
+    };
+
+    for (int t = 0; t < 3; ++t)
+    {
+        uint32_t out[4];
+        philox4x32(counters[t], keys[t], out);
+        for (int i = 0; i < 4; ++i)
+            check(out[i] == expected[t][i], "known answer " + std::to_string(t) + " word " + std::to_string(i));
+    }
+}
+
+static const char* parityKernel =
+    "__kernel void philox_parity(uint seed, uint frame, uint stream,\n"
+    "                            __global uint4* bits, __global float4* uniforms)\n"
+    "{\n"
+    "    uint index = get_global_id(0);\n"
+    "    bits[index] = philox4x32((uint4)(index, frame, stream, 0), (uint2)(seed, 0));\n"
+    "    uniforms[index] = philox_uniform4(seed, frame, stream, index);\n"
+    "}\n";
+
+// Returns false when there is no device
+static bool testDeviceParity(const char* philoxPath)
+{
+    std::ifstream rngFile(philoxPath);
+    if (rngFile.fail())
+    {
+        std::cout << "ERROR: can't read " << philoxPath << "\n";
+        ++failures;
+        return true;
+    }
+    std::string rngSrc(std::istreambuf_iterator<char>(rngFile), (std::istreambuf_iterator<char>()));
+
+    cl::Device device;
+    try {
+        std::vector<cl::Platform> platforms;
+        cl::Platform::get(&platforms);
+        std::vector<cl::Device> devices;
+        for (auto& platform : platforms)
+        {
+            try {
+                platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+            }
+            catch (cl::Error err) {
+                devices.clear();
+            }
+            if (!devices.empty())
+                break;
+        }
+        if (devices.empty())
+            return false;
+        device = devices[0];
+    }
+    catch (cl::Error err) {
+        return false;
+    }
+    std::cout << "Using device: " << device.getInfo<CL_DEVICE_NAME>() << "\n";
+
+    cl::Context context({ device });
+    cl::Program::Sources sources;
+    sources.push_back(std::make_pair(rngSrc.c_str(), rngSrc.length()));
+    sources.push_back(std::make_pair(parityKernel, std::string(parityKernel).length()));
+    cl::Program program(context, sources);
+    try {
+        program.build({ device });
+    }
+    catch (cl::Error err) {
+        std::cout << "ERROR: building philox.cl\n" << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << "\n";
+        ++failures;
+        return true;
+    }
+
+    cl::CommandQueue queue(context, device);
+    cl::Buffer bitsBuffer(context, CL_MEM_WRITE_ONLY, sizeof(cl_uint4) * PHILOX_TEST_BLOCKS);
+    cl::Buffer uniformBuffer(context, CL_MEM_WRITE_ONLY, sizeof(cl_float4) * PHILOX_TEST_BLOCKS);
+    cl::Kernel kernel(program, "philox_parity");
+
+    const uint32_t seeds[] = {0u, 1u, 0xdeadbeefu};
+    const uint32_t frames[] = {0u, 7u, 100000u};
+    std::vector<uint32_t> bits(4 * PHILOX_TEST_BLOCKS);
+    std::vector<float> uniforms(4 * PHILOX_TEST_BLOCKS);
+
+    for (uint32_t seed : seeds)
+        for (uint32_t frame : frames)
+            for (uint32_t stream = RANDOM_STREAM_PUPIL; stream <= RANDOM_STREAM_GRATINGS; ++stream)
+            {
+                kernel.setArg(0, seed);
+                kernel.setArg(1, frame);
+                kernel.setArg(2, stream);
+                kernel.setArg(3, bitsBuffer);
+                kernel.setArg(4, uniformBuffer);
+                queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(PHILOX_TEST_BLOCKS), cl::NullRange);
+                queue.enqueueReadBuffer(bitsBuffer, CL_FALSE, 0, sizeof(uint32_t) * bits.size(), bits.data());
+                queue.enqueueReadBuffer(uniformBuffer, CL_TRUE, 0, sizeof(float) * uniforms.size(), uniforms.data());
+
+                int mismatches = 0;
+                for (uint32_t index = 0; index < PHILOX_TEST_BLOCKS; ++index)
+                {
+                    uint32_t counter[4] = {index, frame, stream, 0};
+                    uint32_t key[2] = {seed, 0};
+                    uint32_t hostBits[4];
+                    float hostUniforms[4];
+                    philox4x32(counter, key, hostBits);
+                    philoxUniform4(seed, frame, stream, index, hostUniforms);
+                    for (int i = 0; i < 4; ++i)
+                        if (bits[4 * index + i] != hostBits[i] || uniforms[4 * index + i] != hostUniforms[i])
+                            ++mismatches;
+                }
+                check(mismatches == 0, "device blocks of seed " + std::to_string(seed) + " frame " +
+                                       std::to_string(frame) + " stream " + std::to_string(stream));
+            }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cout << "usage: philox_test <path to philox.cl>\n";
+        return 1;
+    }
+
+    testKnownAnswers();
+
+    bool ranOnDevice = true;
+    try {
+        ranOnDevice = testDeviceParity(argv[1]);
+    }
+    catch (cl::Error err) {
+        std::cout << "ERROR: " << err.what() << " (" << err.err() << ")\n";
+        ++failures;
+    }
+
+    if (failures > 0)
+    {
+        std::cout << failures << " checks failed\n";
+        return 1;
+    }
+    if (!ranOnDevice)
+    {
+        std::cout << "Philox.h matches the known answers, no OpenCL device to check philox.cl on\n";
+        return PHILOX_TEST_SKIPPED;
+    }
+    std::cout << "All Philox checks passed\n";
+    return 0;
+}
@@ -0,0 +1,169 @@
+// floatToHalf and halfToFloat: the F16C runs and the scalar tails give the
+// same bits, values past the half range saturate to +-HALF_MAX instead of
+// becoming infinities, and a bright light stored in half precision
+// PixelStorage comes back finite.
+
+#include "PixelStorage.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what)
+{
+    if (!ok)
+    {
+        std::cout << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+static float bitsToFloat(uint32_t bits)
+{
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static std::string hex(uint32_t value)
+{
+    char text[16];
+    std::snprintf(text, sizeof(text), "0x%08x", value);
+    return text;
+}
+
+// floatToHalf of one value on its own, which is the scalar tail
+static uint16_t toHalf(float f)
+{
+    uint16_t h;
+    floatToHalf(&f, &h, 1);
+    return h;
+}
+
+// Runs of eight go through F16C when the CPU has it, the remainder through
+// the scalar conversion: every value converted both ways has to agree
+static void testSameBits()
+{
+    std::vector<float> values;
+    for (uint32_t bits = 0; bits < 0x80000000u; bits += 0x1f3d)
+    {
+        values.push_back(bitsToFloat(bits));
+        values.push_back(bitsToFloat(bits | 0x80000000u));
+    }
+    // rounding ties, denormals and the edge of the range
+    const float edges[] = {0.0f, 1.0f, 1.0f + 1.0f / 2048.0f, 1.0f + 3.0f / 2048.0f, 5.96e-8f, 2.98e-8f,
+                           6.1e-5f, 65504.0f, 65519.0f, 65520.0f, 65535.0f, 1.0e5f, 3.0e38f};
+    for (float edge : edges)
+    {
+        values.push_back(edge);
+        values.push_back(-edge);
+    }
+    values.resize(values.size() / 8 * 8);
+
+    std::vector<uint16_t> bulk(values.size());
+    floatToHalf(values.data(), bulk.data(), values.size());
+
+    int mismatches = 0;
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        uint16_t single = toHalf(values[i]);
+        if (single != bulk[i] && mismatches++ < 4)
+        {
+            uint32_t bits;
+            std::memcpy(&bits, &values[i], sizeof(bits));
+            std::cout << hex(bits) << ": run " << hex(bulk[i]) << ", single " << hex(single) << "\n";
+        }
+    }
+    check(mismatches == 0, "runs and single values convert to the same bits");
+
+    // and back, every half widens to the same float both ways
+    std::vector<uint16_t> halves(0x10000);
+    for (size_t i = 0; i < halves.size(); ++i)
+        halves[i] = (uint16_t)i;
+    std::vector<float> widened(halves.size());
+    halfToFloat(halves.data(), widened.data(), halves.size());
+    mismatches = 0;
+    for (size_t i = 0; i < halves.size(); ++i)
+    {
+        float single;
+        halfToFloat(&halves[i], &single, 1);
+        if (std::memcmp(&single, &widened[i], sizeof(float)) != 0)
+            ++mismatches;
+    }
+    check(mismatches == 0, "runs and single values widen to the same floats");
+}
+
+static void testSaturation()
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    const float large[] = {65504.0f, 65520.0f, 70000.0f, 1.0e5f, 3.0e38f, inf, 1.0f, 1.0f};
+
+    uint16_t bulk[8];
+    floatToHalf(large, bulk, 8);
+    for (int i = 0; i < 6; ++i)
+    {
+        check(bulk[i] == HALF_MAX_BITS, "run of " + std::to_string(large[i]) + " saturates");
+        check(toHalf(large[i]) == HALF_MAX_BITS, std::to_string(large[i]) + " saturates");
+        check(toHalf(-large[i]) == (0x8000 | HALF_MAX_BITS), std::to_string(-large[i]) + " saturates");
+    }
+
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    float nans[8] = {nan, nan, nan, nan, nan, nan, nan, nan};
+    uint16_t nanBits[8];
+    floatToHalf(nans, nanBits, 8);
+    check((nanBits[0] & 0x7c00) == 0x7c00 && (nanBits[0] & 0x3ff) != 0, "NaN run stays NaN");
+    uint16_t single = toHalf(nan);
+    check((single & 0x7c00) == 0x7c00 && (single & 0x3ff) != 0, "NaN stays NaN");
+}
+
+// A sun of 1e5 among ordinary pixels, as the points bench scene has
+static void testBrightStorage()
+{
+    const int width = 13, height = 3;
+    std::vector<float> red(width, 0.5f), green(width, 2.0f), blue(width, 1.0e5f);
+    red[5] = 1.0e6f;
+
+    const PixelLayout layouts[] = {PIXEL_LAYOUT_PLANAR, PIXEL_LAYOUT_RGBA};
+    for (PixelLayout layout : layouts)
+    {
+        PixelStorage storage;
+        storage.allocate(width, height, layout, PIXEL_PRECISION_HALF);
+        for (int y = 0; y < height; ++y)
+            storage.storeRow(y, red.data(), green.data(), blue.data());
+
+        std::vector<float> plane((size_t)width * height);
+        for (int c = 0; c < 3; ++c)
+        {
+            storage.loadChannel(c, plane.data());
+            bool finite = true;
+            for (float value : plane)
+                finite = finite && std::isfinite(value);
+            check(finite, "half storage of channel " + std::to_string(c) + " is finite");
+        }
+        storage.loadChannel(2, plane.data());
+        check(plane[0] == HALF_MAX, "1e5 is stored as HALF_MAX");
+        storage.loadChannel(1, plane.data());
+        check(plane[0] == 2.0f, "2 is stored exactly");
+    }
+}
+
+int main()
+{
+    testSameBits();
+    testSaturation();
+    testBrightStorage();
+
+    if (failures > 0)
+    {
+        std::cout << failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "All PixelStorage checks passed\n";
+    return 0;
+}